@@ -29,16 +29,88 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
-#include <fstream>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <istream>
+#include <limits>
+#include <list>
 #include <memory>
-#include <sstream>
+#include <ostream>
+#include <streambuf>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+/* By default this is a header-only library. In large projects, define
+ * MONET_LIBRARY everywhere and link the `ziotom78_monet` library built
+ * with `-DMONET_CompiledLibrary=ON` (or define MONET_IMPLEMENTATION in
+ * exactly one source file before including this header): the code of
+ * the canvases is then compiled only once, and every other source file
+ * only reads their declarations. */
+#if defined(MONET_IMPLEMENTATION) || !defined(MONET_LIBRARY)
+#define MONET_DEFINITIONS
+#endif
+
+#ifdef MONET_IMPLEMENTATION
+#define MONET_INLINE
+#else
+#define MONET_INLINE inline
+#endif
+
+/* Virtual functions defined outside their class are declared with
+ * MONET_VIRTUAL. Were they not inline in the declaration, the first of
+ * them would be the "key function" of the class, and every source file
+ * including this header would compile the whole class, used or not */
+#if defined(MONET_DEFINITIONS) && !defined(MONET_IMPLEMENTATION)
+#define MONET_VIRTUAL inline
+#else
+#define MONET_VIRTUAL
+#endif
+
+#ifdef MONET_DEFINITIONS
+#include <fstream>
+#include <sstream>
+#endif
+
+/* Some parts of the library are compiled only if a macro is defined,
+ * so that programs that do not use them do not pay for them. Define
+ * each macro in every source file, or in none:
+ *
+ * - MONET_WITH_PDF: PDFCanvas;
+ * - MONET_WITH_SCENES: SceneWriter and SceneFile;
+ * - MONET_WITH_SVGREADER: SVGReader and `SVGCanvas::includesvg`;
+ * - MONET_WITH_DENSITY: DensityGrid;
+ * - MONET_WITH_SVGFILLS: gradients, patterns and images in SVGCanvas,
+ *   which otherwise draws them with the defaults of BaseCanvas;
+ * - MONET_WITH_THREADS: the classes that start threads (CanvasWorker
+ *   and AsyncCanvas, and the threaded children of TeeCanvas). Programs
+ *   using them must be linked with the threading library of the
+ *   system (e.g., `-pthread`). */
+#ifdef MONET_WITH_THREADS
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MONET_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace monet {
 
-const char *version = "0.1.0";
+const char *const version = "0.1.0";
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -118,17 +190,36 @@ inline std::ostream &operator<<(std::ostream &out, Point p) {
  * Color d{gray(0.5)};           // Gray shade (50%)
  * \endcode
  */
+struct Color;
+
+/// Write `col` as `#rrggbb` into `dest`, which must have room for 7
+/// characters (no terminator is added), and return 7
+inline size_t formathexcolor(char *dest, Color col);
+
 struct Color {
   double r, g, b;
 
   std::string toHTML() const {
-    char buf[8];
-    snprintf(buf, sizeof(buf) / sizeof(buf[0]), "#%02x%02x%02x", int(r * 255),
-             int(g * 255), int(b * 255));
-    return std::string(buf);
+    char buf[7];
+    return std::string(buf, formathexcolor(buf, *this));
   }
 };
 
+inline size_t formathexcolor(char *dest, Color col) {
+  static const char digits[]{"0123456789abcdef"};
+  const double channels[]{col.r, col.g, col.b};
+
+  dest[0] = '#';
+  for (int i{}; i < 3; ++i) {
+    // Truncate like printf("%02x", int(x * 255)) does
+    const double scaled{channels[i] * 255};
+    const int level{scaled >= 255 ? 255 : (scaled > 0 ? int(scaled) : 0)};
+    dest[1 + 2 * i] = digits[level >> 4];
+    dest[2 + 2 * i] = digits[level & 15];
+  }
+  return 7;
+}
+
 inline std::ostream &operator<<(std::ostream &out, Color col) {
   out << "rgb[" << col.r << ", " << col.g << ", " << col.b << ']';
   return out;
@@ -137,12 +228,26 @@ inline std::ostream &operator<<(std::ostream &out, Color col) {
 // All the three values r, g, and b must be in the range [0, 1]
 inline Color rgb(double r, double g, double b) { return Color{r, g, b}; }
 
+// The gray level must be in the range [0, 1]
+inline Color gray(double level) { return Color{level, level, level}; }
+
 // All the three values h, s, and l must be in the range [0, 1]
 inline Color hsl(double h, double s, double l) {
-  h = std::fmod(h, 1.0);
+  if (s == 0)
+    return gray(l);
+
+  if (h < 0 || h >= 1)
+    h = std::fmod(h, 1.0);
   double chroma{(1 - std::fabs(2 * l - 1)) * s};
   double sh{6 * h};
-  double x{chroma * (1 - std::fabs(std::fmod(sh, 2) - 1))};
+
+  // The same as std::fmod(sh, 2), which is slow, if 0 <= sh < 6
+  double rem{sh < 0 ? std::fmod(sh, 2)
+                    : (sh < 2 ? sh
+                              : (sh < 4 ? sh - 2
+                                        : (sh < 6 ? sh - 4
+                                                  : std::fmod(sh, 2))))};
+  double x{chroma * (1 - std::fabs(rem - 1))};
 
   Color scaled;
   if (sh <= 1)
@@ -162,8 +267,31 @@ inline Color hsl(double h, double s, double l) {
   return Color{scaled.r + m, scaled.g + m, scaled.b + m};
 }
 
-// The gray level must be in the range [0, 1]
-inline Color gray(double level) { return hsl(0.0, 0.0, level); }
+/// Convert `col` into hue, saturation, and luminosity (the inverse of
+/// `hsl`). The hue of a gray is zero
+inline void tohsl(Color col, double &h, double &s, double &l) {
+  const double maxval{std::max(std::max(col.r, col.g), col.b)};
+  const double minval{std::min(std::min(col.r, col.g), col.b)};
+  const double chroma{maxval - minval};
+
+  l = (maxval + minval) / 2;
+  if (chroma == 0) {
+    h = s = 0;
+    return;
+  }
+
+  s = chroma / (1 - std::fabs(2 * l - 1));
+  if (maxval == col.r)
+    h = (col.g - col.b) / chroma;
+  else if (maxval == col.g)
+    h = (col.b - col.r) / chroma + 2;
+  else
+    h = (col.r - col.g) / chroma + 4;
+
+  h /= 6;
+  if (h < 0)
+    h += 1;
+}
 
 const Color black{0.0, 0.0, 0.0};
 const Color darkred{0.5, 0.0, 0.0};
@@ -186,10 +314,71 @@ const Color lightpurple{1.0, 0.5, 1.0};
 const Color lightcyan{0.5, 1.0, 1.0};
 const Color white{1.0, 1.0, 1.0};
 
+/** A color with an alpha channel, packed in 32 bits
+ *
+ * Each channel is an integer in the range [0, 255]; an alpha of 255
+ * means that the color is opaque. Converting a Color8 into a Color and
+ * back gives the same Color8; the opposite is true only for colors
+ * whose components are multiples of 1/255 (e.g., 0 and 1).
+ *
+ * Passing a Color8 to `BaseCanvas::setstrokecolor` or
+ * `BaseCanvas::setfillcolor` sets the opacity of strokes or fills as
+ * well, which is combined with the transparency of the canvas.
+ */
+struct Color8 {
+  uint8_t r, g, b, a;
+
+  Color8() : r{0}, g{0}, b{0}, a{255} {}
+  Color8(uint8_t ar, uint8_t ag, uint8_t ab, uint8_t aa = 255)
+      : r{ar}, g{ag}, b{ab}, a{aa} {}
+
+  /// Round the components of `col` and `alpha` (which must be in the
+  /// range [0, 1]) to the nearest 8-bit values
+  explicit Color8(Color col, double alpha = 1.0)
+      : r{quantize(col.r)}, g{quantize(col.g)}, b{quantize(col.b)},
+        a{quantize(alpha)} {}
+
+  static uint8_t quantize(double value) {
+    return value <= 0 ? 0 : (value >= 1 ? 255 : uint8_t(value * 255 + 0.5));
+  }
+
+  /// Return the color, ignoring the alpha channel
+  Color tocolor() const { return Color{r / 255.0, g / 255.0, b / 255.0}; }
+
+  /// Return the alpha channel as a number in the range [0, 1]
+  double alpha() const { return a / 255.0; }
+
+  /// Return the color as the integer 0xRRGGBBAA
+  uint32_t packed() const {
+    return (uint32_t(r) << 24) | (uint32_t(g) << 16) | (uint32_t(b) << 8) | a;
+  }
+
+  /// Create a color from an integer returned by `packed`
+  static Color8 frompacked(uint32_t value) {
+    return Color8{uint8_t(value >> 24), uint8_t(value >> 16),
+                  uint8_t(value >> 8), uint8_t(value)};
+  }
+};
+
+inline bool operator==(Color8 a, Color8 b) { return a.packed() == b.packed(); }
+inline bool operator!=(Color8 a, Color8 b) { return !(a == b); }
+
+/// Return true if `col` and `alpha` can be converted into a Color8 and
+/// back without any change
+inline bool isexactcolor8(Color col, double alpha = 1.0) {
+  const Color8 col8{col, alpha};
+  const Color back{col8.tocolor()};
+  return back.r == col.r && back.g == col.g && back.b == col.b &&
+         col8.alpha() == alpha;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 enum class Action { Stroke, Fill, FillAndStroke };
 
+enum class LineJoin { Miter, Round, Bevel };
+enum class LineCap { Butt, Round, Square };
+
 ////////////////////////////////////////////////////////////////////////////////
 
 enum class FontFamily { Serif, SansSerif, Monospaced };
@@ -344,646 +533,9439 @@ inline TransformSequence operator|(Transform tr1, Transform tr2) {
 }
 
 inline TransformSequence operator|(TransformSequence seq, Transform tr) {
-  size_t input_size{seq.size()};
-  TransformSequence result(input_size + 1);
-  result[0] = tr;
-  std::copy(seq.begin(), seq.end(), result.begin() + 1);
-
-  return result;
+  // Reuse the storage of `seq`, which is often a temporary
+  seq.insert(seq.begin(), tr);
+  return seq;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-class BaseCanvas {
-private:
-  Color strokecolor;
-  Color fillcolor;
-  double strokewidth;
-  FontFamily fontfamily;
-  double fontsize;
-  double transparency;
+/** An affine transformation, stored as a 2×3 matrix
+ *
+ * The six coefficients follow the SVG convention: a point (x, y) is
+ * mapped to (a·x + c·y + e, b·x + d·y + f). Use `tomatrix` to convert
+ * a Transform or a TransformSequence into a Matrix.
+ */
+struct Matrix {
+  double a, b, c, d, e, f;
 
-protected:
-  virtual void movetoxy(double x, double y) = 0;
-  virtual void linetoxy(double x, double y) = 0;
-  virtual void quadratictoxy(double xdir, double ydir, double xend,
-                             double yend) = 0;
-  virtual void cubictoxy(double xc1, double yc1, double xc2, double yc2,
-                         double xend, double yend) = 0;
-  virtual void linexy(double x1, double y1, double x2, double y2) = 0;
-  virtual void circlexy(double x, double y, double radius, Action act) = 0;
-  virtual void rectanglexy(double x1, double y1, double x2, double y2,
-                           Action act) = 0;
-  virtual void textxy(double x, double y, const char *text,
-                      HorizontalAlignment halign, VerticalAlignment valign) = 0;
+  Matrix() : a(1), b(0), c(0), d(1), e(0), f(0) {}
+  Matrix(double aa, double ab, double ac, double ad, double ae, double af)
+      : a(aa), b(ab), c(ac), d(ad), e(ae), f(af) {}
 
-public:
-  BaseCanvas()
-      : strokecolor{black}, fillcolor{white}, strokewidth{1.0},
-        fontfamily{FontFamily::SansSerif}, fontsize{12.0}, transparency{0.0} {}
-  void setstrokecolor(Color col) { strokecolor = col; }
-  void setfillcolor(Color col) { fillcolor = col; }
+  /// Apply the transformation to a point
+  Point apply(Point p) const {
+    return Point(a * p.x + c * p.y + e, b * p.x + d * p.y + f);
+  }
 
-  Color getstrokecolor() const { return strokecolor; }
-  Color getfillcolor() const { return fillcolor; }
+  /// Return the factor by which areas are scaled by the transformation
+  double determinant() const { return a * d - b * c; }
+};
 
-  void setstrokewidth(double width) { strokewidth = width; };
-  double getstrokewidth() const { return strokewidth; }
+/// Return the transformation that applies `m2` first and then `m1`
+inline Matrix operator*(const Matrix &m1, const Matrix &m2) {
+  return Matrix(m1.a * m2.a + m1.c * m2.b, m1.b * m2.a + m1.d * m2.b,
+                m1.a * m2.c + m1.c * m2.d, m1.b * m2.c + m1.d * m2.d,
+                m1.a * m2.e + m1.c * m2.f + m1.e,
+                m1.b * m2.e + m1.d * m2.f + m1.f);
+}
 
-  virtual void setfontfamily(FontFamily fam) { fontfamily = fam; }
-  virtual void setfontsize(double size) { fontsize = size; }
+inline Matrix tomatrix(const Transform &transf) {
+  switch (transf.type) {
+  case TransformType::Identity:
+    return Matrix();
+
+  case TransformType::Translation:
+    return Matrix(1, 0, 0, 1, transf.translation.x, transf.translation.y);
+
+  case TransformType::Rotation: {
+    const double pi{3.14159265358979323846};
+    double angle{transf.rotation.angle * pi / 180.0};
+    double cosa{std::cos(angle)}, sina{std::sin(angle)};
+    Point pivot{transf.rotation.pivot};
+
+    // Same as SVG's rotate(angle x y): move the pivot to the origin,
+    // rotate, and move it back
+    return Matrix(cosa, sina, -sina, cosa,
+                  pivot.x - cosa * pivot.x + sina * pivot.y,
+                  pivot.y - sina * pivot.x - cosa * pivot.y);
+  }
 
-  virtual FontFamily getfontfamily() const { return fontfamily; }
-  virtual double getfontsize() const { return fontsize; }
+  case TransformType::Scale:
+    return Matrix(transf.scale_factor.x, 0, 0, transf.scale_factor.y, 0, 0);
 
-  virtual double getwidth() const = 0;
-  virtual double getheight() const = 0;
+  default:
+    abort();
+  }
+}
 
-  void settransparency(double tr) { transparency = tr; }
-  double gettransparency() const { return transparency; }
+/// Convert a sequence into a matrix. As in SVG, the last element of the
+/// sequence is the first to be applied.
+inline Matrix tomatrix(const TransformSequence &transforms) {
+  Matrix result;
+  for (const auto &transf : transforms)
+    result = result * tomatrix(transf);
 
-  /// Move the current point on the image plane
-  void moveto(Point p) { movetoxy(p.x, p.y); }
+  return result;
+}
 
-  /// Append to the current path a line from the current point to `p` on the
-  /// image plane
-  void lineto(Point p) { linetoxy(p.x, p.y); }
+inline bool isidentity(const TransformSequence &transforms) {
+  for (const auto &transf : transforms) {
+    if (transf.type != TransformType::Identity)
+      return false;
+  }
 
-  /// Draw a line that joins a vector of 2D points on the image plane
-  void drawpath(const std::vector<Point> pts) {
-    for (size_t i{}; i < pts.size(); ++i) {
-      if (i == 0)
-        moveto(pts[i]);
-      else
-        lineto(pts[i]);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** Bézier curves
+ *
+ * The following functions compute points, tight bounding boxes, and
+ * lengths of quadratic and cubic Bézier curves, and tell how many
+ * straight segments are needed to approximate a curve within a given
+ * tolerance. They are the building blocks for `flatten` and `length`,
+ * which work on Path objects.
+ */
+
+inline Point quadraticpoint(Point p0, Point p1, Point p2, double t) {
+  double u{1 - t};
+  return u * u * p0 + 2 * u * t * p1 + t * t * p2;
+}
+
+inline Point cubicpoint(Point p0, Point p1, Point p2, Point p3, double t) {
+  double u{1 - t};
+  return u * u * u * p0 + 3 * u * u * t * p1 + 3 * u * t * t * p2 +
+         t * t * t * p3;
+}
+
+inline void extendbox(Point p, Point &min, Point &max) {
+  min.x = std::min(min.x, p.x);
+  min.y = std::min(min.y, p.y);
+  max.x = std::max(max.x, p.x);
+  max.y = std::max(max.y, p.y);
+}
+
+/// Enlarge the box (min, max) so that it includes the quadratic curve
+inline void quadraticbounds(Point p0, Point p1, Point p2, Point &min,
+                            Point &max) {
+  extendbox(p0, min, max);
+  extendbox(p2, min, max);
+
+  // The derivative vanishes where t = (p0 - p1) / (p0 - 2 p1 + p2)
+  const double num[]{p0.x - p1.x, p0.y - p1.y};
+  const double den[]{p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y};
+  for (int axis{}; axis < 2; ++axis) {
+    if (den[axis] == 0)
+      continue;
+
+    double t{num[axis] / den[axis]};
+    if (t > 0 && t < 1)
+      extendbox(quadraticpoint(p0, p1, p2, t), min, max);
+  }
+}
+
+/// Enlarge the box (min, max) so that it includes the cubic curve
+inline void cubicbounds(Point p0, Point p1, Point p2, Point p3, Point &min,
+                        Point &max) {
+  extendbox(p0, min, max);
+  extendbox(p3, min, max);
+
+  // The derivative is a quadratic polynomial a t² + b t + c
+  const Point a{3 * (p3 - p0) + 9 * (p1 - p2)};
+  const Point b{6 * (p0 - 2 * p1 + p2)};
+  const Point c{3 * (p1 - p0)};
+  const double coeffs[2][3]{{a.x, b.x, c.x}, {a.y, b.y, c.y}};
+
+  for (int axis{}; axis < 2; ++axis) {
+    double qa{coeffs[axis][0]}, qb{coeffs[axis][1]}, qc{coeffs[axis][2]};
+    double roots[2];
+    int numofroots{};
+
+    if (std::fabs(qa) < 1e-12 * (std::fabs(qb) + std::fabs(qc))) {
+      if (qb != 0)
+        roots[numofroots++] = -qc / qb;
+    } else {
+      double delta{qb * qb - 4 * qa * qc};
+      if (delta >= 0) {
+        double sq{std::sqrt(delta)};
+        roots[numofroots++] = (-qb + sq) / (2 * qa);
+        roots[numofroots++] = (-qb - sq) / (2 * qa);
+      }
+    }
+
+    for (int i{}; i < numofroots; ++i) {
+      if (roots[i] > 0 && roots[i] < 1)
+        extendbox(cubicpoint(p0, p1, p2, p3, roots[i]), min, max);
     }
   }
+}
 
-  /// Append a quadratic curved line to the current path
-  void quadraticto(Point dir, Point end) {
-    quadratictoxy(dir.x, dir.y, end.x, end.y);
+inline double norm(Point p) { return std::sqrt(p.x * p.x + p.y * p.y); }
+
+/// Smaller tolerances (including zero, negative and NaN ones) are
+/// raised to this value by the functions that flatten or measure curves
+const double mintolerance = 1e-9;
+
+inline double clamptolerance(double tolerance) {
+  return tolerance > mintolerance ? tolerance : mintolerance;
+}
+
+/// Largest number of segments used to flatten a single curve or arc
+const int maxsegments = 1 << 20;
+
+// Turn an estimate of the number of segments into a count between 1 and
+// `maxsegments`; infinities and NaNs from degenerate input are clamped too
+inline int clampsegments(double n) {
+  return n >= 1 ? int(std::ceil(std::min(n, double(maxsegments)))) : 1;
+}
+
+/** Number of segments needed to flatten a quadratic curve
+ *
+ * If the curve is sampled at `n` evenly-spaced values of the parameter
+ * and the points are joined by straight lines, the distance between the
+ * polyline and the curve is at most |p0 - 2 p1 + p2| / (4 n²): this
+ * function returns the smallest `n` that keeps it below `tolerance`.
+ */
+inline int quadraticsegments(Point p0, Point p1, Point p2, double tolerance) {
+  double dd{norm(p0 - 2 * p1 + p2)};
+  return clampsegments(std::sqrt(dd / (4 * clamptolerance(tolerance))));
+}
+
+/// Number of segments needed to flatten a cubic curve (Wang's formula)
+inline int cubicsegments(Point p0, Point p1, Point p2, Point p3,
+                         double tolerance) {
+  double dd{std::max(norm(p0 - 2 * p1 + p2), norm(p1 - 2 * p2 + p3))};
+  return clampsegments(std::sqrt(3 * dd / (4 * clamptolerance(tolerance))));
+}
+
+/// Return the length of a cubic curve, with an absolute error
+/// smaller than `tolerance`
+inline double cubiclength(Point p0, Point p1, Point p2, Point p3,
+                          double tolerance, int depth = 0) {
+  if (depth == 0)
+    tolerance = clamptolerance(tolerance);
+
+  double chord{norm(p3 - p0)};
+  double polygon{norm(p1 - p0) + norm(p2 - p1) + norm(p3 - p2)};
+
+  // The arc is longer than the chord and shorter than the control
+  // polygon, so if they are close enough, we are done
+  if (polygon - chord <= tolerance || depth >= 24)
+    return (2 * chord + polygon) / 3;
+
+  // Split the curve in two halves using De Casteljau's algorithm
+  Point p01{(p0 + p1) / 2}, p12{(p1 + p2) / 2}, p23{(p2 + p3) / 2};
+  Point p012{(p01 + p12) / 2}, p123{(p12 + p23) / 2};
+  Point mid{(p012 + p123) / 2};
+
+  return cubiclength(p0, p01, p012, mid, tolerance / 2, depth + 1) +
+         cubiclength(mid, p123, p23, p3, tolerance / 2, depth + 1);
+}
+
+/// Return the length of a quadratic curve, with an absolute error
+/// smaller than `tolerance`
+inline double quadraticlength(Point p0, Point p1, Point p2,
+                              double tolerance) {
+  // Degree elevation turns a quadratic curve into an equivalent cubic
+  return cubiclength(p0, p0 + 2.0 / 3.0 * (p1 - p0),
+                     p2 + 2.0 / 3.0 * (p1 - p2), p2, tolerance);
+}
+
+/** A collection of cubic curves stored as a structure of arrays
+ *
+ * Evaluating many curves at once with `evaluate` runs a plain loop
+ * over contiguous arrays, which compilers turn into SIMD code.
+ */
+class CubicArray {
+private:
+  std::vector<double> x0, y0, x1, y1, x2, y2, x3, y3;
+
+public:
+  void push_back(Point p0, Point p1, Point p2, Point p3) {
+    x0.push_back(p0.x);
+    y0.push_back(p0.y);
+    x1.push_back(p1.x);
+    y1.push_back(p1.y);
+    x2.push_back(p2.x);
+    y2.push_back(p2.y);
+    x3.push_back(p3.x);
+    y3.push_back(p3.y);
   }
 
-  /// Append a cubic curved line to the current path
-  void cubicto(Point control1, Point control2, Point end) {
-    cubictoxy(control1.x, control1.y, control2.x, control2.y, end.x, end.y);
+  /// Add a quadratic curve, converting it into a cubic one
+  void push_back(Point p0, Point p1, Point p2) {
+    push_back(p0, p0 + 2.0 / 3.0 * (p1 - p0), p2 + 2.0 / 3.0 * (p1 - p2), p2);
   }
 
-  void line(Point p1, Point p2) { linexy(p1.x, p1.y, p2.x, p2.y); }
+  size_t size() const { return x0.size(); }
 
-  /// Draw a circle
-  void circle(Point pt, double radius, Action act = Action::Stroke) {
-    circlexy(pt.x, pt.y, radius, act);
+  void clear() {
+    for (auto vec : {&x0, &y0, &x1, &y1, &x2, &y2, &x3, &y3})
+      vec->clear();
   }
 
-  /// Paint a rectangle
-  void rectangle(Point p1, Point p2, Action act = Action::Stroke) {
-    rectanglexy(p1.x, p1.y, p2.x, p2.y, act);
+  /// Evaluate all the curves at the same parameter `t`, saving the
+  /// coordinates in `x` and `y` (which must have `size()` elements)
+  void evaluate(double t, double *x, double *y) const {
+    const double u{1 - t};
+    const double w0{u * u * u}, w1{3 * u * u * t}, w2{3 * u * t * t},
+        w3{t * t * t};
+    const size_t n{size()};
+
+    for (size_t i{}; i < n; ++i) {
+      x[i] = w0 * x0[i] + w1 * x1[i] + w2 * x2[i] + w3 * x3[i];
+      y[i] = w0 * y0[i] + w1 * y1[i] + w2 * y2[i] + w3 * y3[i];
+    }
   }
 
-  /// Draw a line of text
-  void text(Point p, const std::string &str,
-            HorizontalAlignment halign = HorizontalAlignment::Right,
-            VerticalAlignment valign = VerticalAlignment::Top);
+  /// Evaluate the i-th curve at the parameter `t[i]`
+  void evaluate(const double *t, double *x, double *y) const {
+    const size_t n{size()};
 
-  virtual void closepath() = 0;
-  virtual void strokepath() = 0;
-  virtual void fillpath() = 0;
-  virtual void fillandstrokepath() {
-    fillpath();
-    strokepath();
+    for (size_t i{}; i < n; ++i) {
+      const double u{1 - t[i]};
+      const double w0{u * u * u}, w1{3 * u * u * t[i]}, w2{3 * u * t[i] * t[i]},
+          w3{t[i] * t[i] * t[i]};
+      x[i] = w0 * x0[i] + w1 * x1[i] + w2 * x2[i] + w3 * x3[i];
+      y[i] = w0 * y0[i] + w1 * y1[i] + w2 * y2[i] + w3 * y3[i];
+    }
   }
-  virtual void clearpath() = 0;
-
-  virtual void begingroup(const TransformSequence &transforms = identity,
-                          const std::string &name = "") = 0;
-  virtual void endgroup() = 0;
-  virtual int grouplevel() const = 0;
+};
 
-  virtual void defineclip() = 0;
-  virtual void endclip() = 0;
+////////////////////////////////////////////////////////////////////////////////
 
-  virtual void useclip() = 0;
-  virtual void removeclip() = 0;
+enum class PathVerb : unsigned char {
+  MoveTo,
+  LineTo,
+  QuadraticTo,
+  CubicTo,
+  Close
 };
 
-inline void BaseCanvas::text(Point p, const std::string &str,
-                             HorizontalAlignment halign,
-                             VerticalAlignment valign) {
-  textxy(p.x, p.y, str.c_str(), halign, valign);
+/// Return the number of coordinates (not points!) used by a verb
+inline size_t numofcoords(PathVerb verb) {
+  switch (verb) {
+  case PathVerb::MoveTo:
+  case PathVerb::LineTo:
+    return 2;
+  case PathVerb::QuadraticTo:
+    return 4;
+  case PathVerb::CubicTo:
+    return 6;
+  case PathVerb::Close:
+    return 0;
+  default:
+    abort();
+  }
 }
 
-////////////////////////////////////////////////////////////////////////////////
+/// The output formats for which a Path can cache its serialized form
+enum class PathFormat { SVG, PDF, NumOfFormats };
 
-/** A SVG canvas
+/** A path that can be built once and drawn many times
  *
- * This object represents a write-only SVG file where painting
- * operations can be issued and saved.
+ * Unlike the path built by `BaseCanvas::moveto`, `BaseCanvas::lineto`,
+ * etc., which lives inside the canvas and is lost once it has been
+ * drawn, a Path is a value: it stores its verbs and coordinates in two
+ * compact arrays, and it can be copied, moved, and passed to
+ * `BaseCanvas::draw` as many times as needed:
  *
  * \code{cpp}
- * #include "monet.h"
- *
- * using namespace monet;
- *
- * int main() {
- *   SVGCanvas canv{"simple.svg", 100, 100};
+ * Path marker;
+ * marker.moveto(Point{-1, -1}).lineto(Point{1, -1}).lineto(Point{0, 1})
+ *       .closepath();
  *
- *   // Create a closed path
- *   canv.moveto(Point(0.0, 0.0));
- *   canv.lineto(Point(100.0, 0.0));
- *   canv.lineto(Point(100.0, 100.0));
- *   canv.closepath();
- *   canv.strokepath();
- * }
+ * for (const auto &pt : points)
+ *   canv.draw(marker, TransformSequence{translate(pt)}, Action::Fill);
  * \endcode
+ *
+ * The bounding box and the text that each backend produces for the
+ * path are computed the first time they are needed and then cached,
+ * until the path is modified again.
  */
-class SVGCanvas : public BaseCanvas {
+class Path {
 private:
-  const int tabwidth{2};
+  std::vector<PathVerb> verbs;
+  std::vector<double> coords;
 
-  std::unique_ptr<std::ostream> stream;
-  int indentlevel;
-  double width, height;
-  std::string pathspec;
-  int m_grouplevel;
-  bool clipping;
+  mutable bool bboxvalid;
+  mutable Point bboxmin, bboxmax;
 
-  void indent() {
-    for (int i{}; i < tabwidth * indentlevel; ++i) {
-      *stream << ' ';
-    }
-  }
+  mutable bool cachevalid[size_t(PathFormat::NumOfFormats)];
+  mutable std::string cache[size_t(PathFormat::NumOfFormats)];
 
-  std::string indentstr(int level) {
-    return std::string(tabwidth * level, ' ');
+  void invalidate() {
+    bboxvalid = false;
+    for (auto &valid : cachevalid)
+      valid = false;
   }
 
-  std::string fontfamilyname() const;
-
-protected:
-  void movetoxy(double x, double y) override;
-  void linetoxy(double x, double y) override;
-  void quadratictoxy(double xdir, double ydir, double xend,
-                     double yend) override;
-  void cubictoxy(double xc1, double yc1, double xc2, double yc2, double xend,
-                 double yend) override;
-  void linexy(double x1, double y1, double x2, double y2) override;
-  void circlexy(double x, double y, double radius,
-                Action act = Action::Stroke) override;
-  void rectanglexy(double x1, double y1, double x2, double y2,
-                   Action act = Action::Stroke) override;
-  void textxy(double x, double y, const char *text, HorizontalAlignment halign,
-              VerticalAlignment valign) override;
+  void append(PathVerb verb, std::initializer_list<double> values) {
+    verbs.push_back(verb);
+    coords.insert(coords.end(), values);
+    invalidate();
+  }
 
 public:
-  /// Create a new SVG file with the specified width and height (in points)
-  SVGCanvas(const std::string &filename, double awidth, double aheight);
-  void operator=(const SVGCanvas &canvas) = delete;
-  virtual ~SVGCanvas();
-
-  /// Returns true if the SVG file was created successfully
-  bool isok() const { return stream->good(); }
+  Path() : bboxvalid{false}, cachevalid{} {}
 
-  /// Terminate a path that was started by a call to Transform::moveto or
-  /// Transform::lineto
-  void closepath() override { pathspec += " z"; }
+  Path &moveto(Point p) {
+    append(PathVerb::MoveTo, {p.x, p.y});
+    return *this;
+  }
 
-  /// Draw the profile of the current path
-  void strokepath() override;
+  Path &lineto(Point p) {
+    append(PathVerb::LineTo, {p.x, p.y});
+    return *this;
+  }
 
-  /// Fill the interior of the current path
-  void fillpath() override;
+  Path &quadraticto(Point dir, Point end) {
+    append(PathVerb::QuadraticTo, {dir.x, dir.y, end.x, end.y});
+    return *this;
+  }
 
-  /// Draw the profile of the current path and fill its interior
-  void fillandstrokepath() override;
+  Path &cubicto(Point control1, Point control2, Point end) {
+    append(PathVerb::CubicTo, {control1.x, control1.y, control2.x, control2.y,
+                               end.x, end.y});
+    return *this;
+  }
 
-  /// Remove the path that has been drawn so far from memory
-  void clearpath() override { pathspec = ""; }
+  Path &closepath() {
+    append(PathVerb::Close, {});
+    return *this;
+  }
 
-  /// Start a new group of paint operations, possibly associated with a
-  /// transformation
-  void begingroup(const TransformSequence &transforms = identity,
-                  const std::string &name = "") override;
+  /// Replace the content of the path with a copy of the arrays
+  void assign(const PathVerb *newverbs, size_t numofverbs,
+              const double *newcoords, size_t numofcoords) {
+    verbs.assign(newverbs, newverbs + numofverbs);
+    coords.assign(newcoords, newcoords + numofcoords);
+    invalidate();
+  }
 
-  /// Close the group that was started by the last call to Transform::begingroup
-  void endgroup() override;
+  /// Remove all the elements from the path, keeping the memory
+  void clear() {
+    verbs.clear();
+    coords.clear();
+    invalidate();
+  }
 
-  /// Return the group nest level, i.e., the number of unclosed calls to
-  /// Transform::begingroup
-  int grouplevel() const override { return m_grouplevel; }
+  bool empty() const { return verbs.empty(); }
 
-  /// Return the width of the SVG picture (in points)
-  double getwidth() const override { return width; }
+  /// Return the number of verbs (moveto, lineto, etc.) in the path
+  size_t size() const { return verbs.size(); }
 
-  /// Return the height of the SVG picture (in points)
-  double getheight() const override { return height; }
+  const std::vector<PathVerb> &getverbs() const { return verbs; }
+  const std::vector<double> &getcoords() const { return coords; }
 
-  /// Start recording painting commands and use them to clip
-  void defineclip() override;
+  /// Compute the smallest rectangle enclosing the path. Curves are
+  /// bounded using their extrema, not their control points
+  void boundingbox(Point &min, Point &max) const;
 
-  /// Terminate recording painting commands for clipping
-  void endclip() override;
+  /// Apply a transformation to every point in the path
+  Path &transform(const Matrix &matrix);
+  Path &transform(const TransformSequence &transforms) {
+    return transform(tomatrix(transforms));
+  }
 
-  /// Apply the clipping
-  void useclip() override;
+  /// Return the text representing the path in the given format; the
+  /// first call runs `serialize(path, result)`, the next ones return
+  /// the cached result
+  template <typename Fn>
+  const std::string &serialized(PathFormat format, Fn serialize) const {
+    size_t idx{size_t(format)};
+    if (!cachevalid[idx]) {
+      cache[idx].clear();
+      serialize(*this, cache[idx]);
+      cachevalid[idx] = true;
+    }
 
-  /// Stop clipping
-  void removeclip() override;
+    return cache[idx];
+  }
 };
 
-inline std::string SVGCanvas::fontfamilyname() const {
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void Path::boundingbox(Point &min, Point &max) const {
+  if (!bboxvalid) {
+    const double *pt{coords.data()};
+    Point current, start;
+    bool first{true};
+
+    // Like `flatten`, segments before the first MoveTo start at the
+    // origin, and Close goes back to the start of the subpath
+    bboxmin = bboxmax = Point{};
+    for (PathVerb verb : verbs) {
+      if (verb != PathVerb::Close && first) {
+        bboxmin = bboxmax =
+            verb == PathVerb::MoveTo ? Point{pt[0], pt[1]} : current;
+        first = false;
+      }
+
+      switch (verb) {
+      case PathVerb::MoveTo:
+        start = current = Point{pt[0], pt[1]};
+        extendbox(current, bboxmin, bboxmax);
+        break;
+
+      case PathVerb::LineTo:
+        current = Point{pt[0], pt[1]};
+        extendbox(current, bboxmin, bboxmax);
+        break;
+
+      case PathVerb::QuadraticTo:
+        quadraticbounds(current, Point{pt[0], pt[1]}, Point{pt[2], pt[3]},
+                        bboxmin, bboxmax);
+        current = Point{pt[2], pt[3]};
+        break;
+
+      case PathVerb::CubicTo:
+        cubicbounds(current, Point{pt[0], pt[1]}, Point{pt[2], pt[3]},
+                    Point{pt[4], pt[5]}, bboxmin, bboxmax);
+        current = Point{pt[4], pt[5]};
+        break;
+
+      case PathVerb::Close:
+        current = start;
+        break;
+      }
+
+      pt += numofcoords(verb);
+    }
+
+    bboxvalid = true;
+  }
+
+  min = bboxmin;
+  max = bboxmax;
+}
+
+MONET_INLINE Path &Path::transform(const Matrix &matrix) {
+  for (size_t i{}; i + 1 < coords.size(); i += 2) {
+    Point p{matrix.apply(Point{coords[i], coords[i + 1]})};
+    coords[i] = p.x;
+    coords[i + 1] = p.y;
+  }
+
+  invalidate();
+  return *this;
+}
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** Turn a path into a sequence of straight lines
+ *
+ * Curves are replaced by polylines that never depart from the curve by
+ * more than `tolerance`. For every point of the flattened path,
+ * `emit(verb, point)` is called, where `verb` is either
+ * `PathVerb::MoveTo`, `PathVerb::LineTo`, or `PathVerb::Close` (in the
+ * latter case, `point` is the first point of the subpath being closed).
+ * No memory is allocated, so this can be used to stream very long paths.
+ */
+template <typename Fn>
+void flatten(const Path &path, double tolerance, Fn emit) {
+  const double *pt{path.getcoords().data()};
+  Point current, start;
+
+  for (PathVerb verb : path.getverbs()) {
+    switch (verb) {
+    case PathVerb::MoveTo:
+      current = start = Point{pt[0], pt[1]};
+      emit(PathVerb::MoveTo, current);
+      break;
+
+    case PathVerb::LineTo:
+      current = Point{pt[0], pt[1]};
+      emit(PathVerb::LineTo, current);
+      break;
+
+    case PathVerb::QuadraticTo: {
+      Point p1{pt[0], pt[1]}, p2{pt[2], pt[3]};
+      int n{quadraticsegments(current, p1, p2, tolerance)};
+      for (int i{1}; i < n; ++i)
+        emit(PathVerb::LineTo, quadraticpoint(current, p1, p2, double(i) / n));
+
+      current = p2;
+      emit(PathVerb::LineTo, current);
+      break;
+    }
+
+    case PathVerb::CubicTo: {
+      Point p1{pt[0], pt[1]}, p2{pt[2], pt[3]}, p3{pt[4], pt[5]};
+      int n{cubicsegments(current, p1, p2, p3, tolerance)};
+      for (int i{1}; i < n; ++i)
+        emit(PathVerb::LineTo,
+             cubicpoint(current, p1, p2, p3, double(i) / n));
+
+      current = p3;
+      emit(PathVerb::LineTo, current);
+      break;
+    }
+
+    case PathVerb::Close:
+      current = start;
+      emit(PathVerb::Close, start);
+      break;
+
+    default:
+      abort();
+    }
+
+    pt += numofcoords(verb);
+  }
+}
+
+/// Return a copy of the path where curves have been replaced by
+/// polylines, within the tolerance `tolerance`
+inline Path flatten(const Path &path, double tolerance) {
+  Path result;
+  flatten(path, tolerance, [&result](PathVerb verb, Point p) {
+    if (verb == PathVerb::MoveTo)
+      result.moveto(p);
+    else if (verb == PathVerb::LineTo)
+      result.lineto(p);
+    else
+      result.closepath();
+  });
+
+  return result;
+}
+
+/// Return the length of the path; the error on curved segments is
+/// smaller than `tolerance`
+inline double length(const Path &path, double tolerance = 1e-6) {
+  const double *pt{path.getcoords().data()};
+  Point current, start;
+  double result{};
+
+  for (PathVerb verb : path.getverbs()) {
+    switch (verb) {
+    case PathVerb::MoveTo:
+      current = start = Point{pt[0], pt[1]};
+      break;
+
+    case PathVerb::LineTo:
+      result += norm(Point{pt[0], pt[1]} - current);
+      current = Point{pt[0], pt[1]};
+      break;
+
+    case PathVerb::QuadraticTo:
+      result += quadraticlength(current, Point{pt[0], pt[1]},
+                                Point{pt[2], pt[3]}, tolerance);
+      current = Point{pt[2], pt[3]};
+      break;
+
+    case PathVerb::CubicTo:
+      result += cubiclength(current, Point{pt[0], pt[1]}, Point{pt[2], pt[3]},
+                            Point{pt[4], pt[5]}, tolerance);
+      current = Point{pt[4], pt[5]};
+      break;
+
+    case PathVerb::Close:
+      result += norm(start - current);
+      current = start;
+      break;
+
+    default:
+      abort();
+    }
+
+    pt += numofcoords(verb);
+  }
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** How a stroke is drawn
+ *
+ * Besides the width, a stroke is characterized by the shape of the
+ * corners (`join`), the shape of the ends of open subpaths (`cap`), and
+ * an optional dash pattern: `dashes` lists the lengths of the dashes
+ * and of the gaps between them, starting from a dash, and it is
+ * repeated along the path. As in SVG, the pattern restarts at every
+ * subpath, shifted by `dashoffset`.
+ */
+struct StrokeStyle {
+  double width;
+  LineJoin join;
+  LineCap cap;
+  double miterlimit;
+  std::vector<double> dashes;
+  double dashoffset;
+
+  StrokeStyle()
+      : width{1.0}, join{LineJoin::Miter}, cap{LineCap::Butt},
+        miterlimit{4.0}, dashes{}, dashoffset{0.0} {}
+};
+
+/** Convert a stroke into a set of polygons to be filled
+ *
+ * Backends that cannot stroke lines natively can feed the points of a
+ * path to a StrokeExpander via `moveto`, `lineto`, and `closepath`
+ * (curves must be flattened first, see `flatten`), and fill the
+ * polygons passed to the callback using the non-zero winding rule.
+ * Each segment, join, and cap produces its own polygon, always in
+ * counterclockwise order, as soon as it is known: the memory used by
+ * the expander does not depend on the length of the path.
+ *
+ * Call `finish()` after the last point, to add the caps to the last
+ * subpath.
+ */
+class StrokeExpander {
+public:
+  typedef std::function<void(const Point *pts, size_t numofpts)> Callback;
+
+private:
+  StrokeStyle style;
+  double halfwidth;
+  double tolerance;
+  Callback emit;
+  std::vector<Point> scratch;
+
+  // State of the subpath being stroked
+  Point start, last, firstdir, lastdir;
+  size_t numofsegments;
+  bool open;
+
+  // State of the dash pattern
+  bool dashed;
+  size_t dashidx;
+  double dashleft;
+  bool penup;
+
+  static Point normal(Point dir) { return Point{-dir.y, dir.x}; }
+  static double cross(Point a, Point b) { return a.x * b.y - a.y * b.x; }
+  static double dot(Point a, Point b) { return a.x * b.x + a.y * b.y; }
+
+  void polygon(const Point *pts, size_t num) {
+    double area{};
+    for (size_t i{}; i < num; ++i)
+      area += cross(pts[i], pts[(i + 1) % num]);
+
+    if (area >= 0) {
+      emit(pts, num);
+      return;
+    }
+
+    if (pts != scratch.data())
+      scratch.assign(pts, pts + num);
+    std::reverse(scratch.begin(), scratch.end());
+    emit(scratch.data(), scratch.size());
+  }
+
+  // Add to `scratch` the points of the arc of radius `halfwidth` around
+  // `center`, starting from direction `from` and turning by `angle`
+  // radians (counterclockwise if positive)
+  void arc(Point center, Point from, double angle) {
+    double step{2 * std::acos(std::max(-1.0, 1 - tolerance / halfwidth))};
+    int n{clampsegments(std::fabs(angle) / step)};
+    double start_angle{std::atan2(from.y, from.x)};
+    for (int i{}; i <= n; ++i) {
+      double theta{start_angle + angle * i / n};
+      scratch.push_back(center + halfwidth * Point{std::cos(theta),
+                                                   std::sin(theta)});
+    }
+  }
+
+  void join(Point center, Point dir0, Point dir1) {
+    double turn{cross(dir0, dir1)};
+    double cosine{dot(dir0, dir1)};
+    if (std::fabs(turn) < 1e-12 && cosine > 0)
+      return; // The two segments are aligned
+
+    // Joins are drawn on the outer side of the corner
+    double side{turn > 0 ? -1.0 : 1.0};
+    Point outer0{center + side * halfwidth * normal(dir0)};
+    Point outer1{center + side * halfwidth * normal(dir1)};
+
+    switch (style.join) {
+    case LineJoin::Round: {
+      // Turn in the same direction as the segments; this also picks
+      // the right half-turn when the path reverses on itself
+      double angle{std::fabs(std::atan2(turn, cosine))};
+      if (side > 0)
+        angle = -angle;
+
+      scratch.clear();
+      scratch.push_back(center);
+      arc(center, outer0 - center, angle);
+      polygon(scratch.data(), scratch.size());
+      return;
+    }
+
+    case LineJoin::Miter: {
+      // The ratio between the miter length and the stroke width is
+      // 1/sin(θ/2), where θ is the angle between the two segments,
+      // i.e., 1/cos(φ/2), where φ is the angle between the directions
+      double halfcos{std::sqrt(std::max(0.0, (1 + cosine) / 2))};
+      if (halfcos > 0 && 1 / halfcos <= style.miterlimit) {
+        Point bisector{normal(dir0) + normal(dir1)};
+        bisector /= norm(bisector);
+        Point tip{center + side * (halfwidth / halfcos) * bisector};
+        const Point pts[]{center, outer0, tip, outer1};
+        polygon(pts, 4);
+        return;
+      }
+      // Beyond the miter limit, fall back to a bevel
+    }
+    // fall through
+
+    case LineJoin::Bevel: {
+      const Point pts[]{center, outer0, outer1};
+      polygon(pts, 3);
+      return;
+    }
+
+    default:
+      abort();
+    }
+  }
+
+  // Draw a cap at `pt`; `dir` points outside the segment
+  void cap(Point pt, Point dir) {
+    Point n{halfwidth * normal(dir)};
+
+    switch (style.cap) {
+    case LineCap::Butt:
+      return;
+
+    case LineCap::Square: {
+      Point ext{halfwidth * dir};
+      const Point pts[]{pt - n, pt - n + ext, pt + n + ext, pt + n};
+      polygon(pts, 4);
+      return;
+    }
+
+    case LineCap::Round: {
+      const double pi{3.14159265358979323846};
+      scratch.clear();
+      arc(pt, Point{0, 0} - n, pi);
+      polygon(scratch.data(), scratch.size());
+      return;
+    }
+
+    default:
+      abort();
+    }
+  }
+
+  // These three methods stroke a solid line
+  void solidmoveto(Point p) {
+    solidfinish();
+    start = last = p;
+    numofsegments = 0;
+    open = true;
+  }
+
+  void solidlineto(Point p) {
+    Point delta{p - last};
+    double len{norm(delta)};
+    if (len == 0)
+      return;
+
+    Point dir{delta / len};
+    Point n{halfwidth * normal(dir)};
+    const Point pts[]{last - n, p - n, p + n, last + n};
+    polygon(pts, 4);
+
+    if (numofsegments == 0)
+      firstdir = dir;
+    else
+      join(last, lastdir, dir);
+
+    lastdir = dir;
+    last = p;
+    ++numofsegments;
+  }
+
+  void solidfinish() {
+    if (open && numofsegments > 0) {
+      cap(start, Point{0, 0} - firstdir);
+      cap(last, lastdir);
+    }
+
+    open = false;
+    numofsegments = 0;
+  }
+
+  void resetdashes() {
+    dashidx = 0;
+    dashleft = style.dashes[0];
+    penup = true;
+
+    double total{};
+    for (double len : style.dashes)
+      total += len;
+
+    double offset{std::fmod(style.dashoffset, total)};
+    if (offset < 0)
+      offset += total;
+
+    while (offset > 0) {
+      double take{std::min(offset, dashleft)};
+      offset -= take;
+      dashleft -= take;
+      if (dashleft <= 0)
+        nextdash();
+    }
+  }
+
+  void nextdash() {
+    dashidx = (dashidx + 1) % style.dashes.size();
+    dashleft = style.dashes[dashidx];
+  }
+
+  // Dashes are "on" for even indexes and "off" for odd ones
+  bool dashon() const { return dashidx % 2 == 0; }
+
+public:
+  StrokeExpander(const StrokeStyle &astyle, double atolerance, Callback fn)
+      : style{astyle}, halfwidth{astyle.width / 2},
+        tolerance{clamptolerance(atolerance)},
+        emit{fn}, scratch{}, start{}, last{}, firstdir{}, lastdir{},
+        numofsegments{0}, open{false}, dashed{false}, dashidx{0},
+        dashleft{0}, penup{true} {
+    // As in SVG, an odd number of values is repeated to make it even
+    if (style.dashes.size() % 2 == 1)
+      style.dashes.insert(style.dashes.end(), style.dashes.begin(),
+                          style.dashes.end());
+
+    double total{};
+    for (double len : style.dashes)
+      total += len;
+    dashed = total > 0;
+  }
+
+  void moveto(Point p) {
+    if (!dashed) {
+      solidmoveto(p);
+      return;
+    }
+
+    solidfinish();
+    start = last = p;
+    resetdashes();
+  }
+
+  void lineto(Point p) {
+    if (!dashed) {
+      solidlineto(p);
+      return;
+    }
+
+    // Split the segment into dashes, and stroke each of them
+    Point delta{p - last};
+    double len{norm(delta)};
+    if (len == 0)
+      return;
+
+    Point dir{delta / len};
+    Point pos{last};
+    double remaining{len};
+    while (remaining > 0) {
+      double take{std::min(remaining, dashleft)};
+      Point end{remaining <= dashleft ? p : pos + take * dir};
+
+      if (dashon()) {
+        if (penup) {
+          solidmoveto(pos);
+          penup = false;
+        }
+        solidlineto(end);
+      }
+
+      pos = end;
+      remaining -= take;
+      dashleft -= take;
+      if (dashleft <= 0) {
+        if (dashon()) {
+          solidfinish();
+          penup = true;
+        }
+        nextdash();
+      }
+    }
+
+    last = p;
+  }
+
+  void closepath() {
+    if (dashed) {
+      // Dashes are not joined at the closing point: go back to the
+      // beginning of the subpath and stop there
+      Point first{start};
+      lineto(first);
+      solidfinish();
+      start = last = first;
+      resetdashes();
+      return;
+    }
+
+    if (!open)
+      return;
+
+    if (last.x != start.x || last.y != start.y)
+      solidlineto(start);
+
+    if (numofsegments > 1)
+      join(start, lastdir, firstdir);
+
+    // A closed subpath has no caps
+    open = false;
+    numofsegments = 0;
+    solidmoveto(start);
+  }
+
+  void finish() { solidfinish(); }
+};
+
+/// Stroke a path (flattening its curves within `tolerance`) and pass
+/// the polygons to `fn`, see StrokeExpander
+inline void strokeoutline(const Path &path, const StrokeStyle &style,
+                          double tolerance, StrokeExpander::Callback fn) {
+  StrokeExpander expander{style, tolerance, fn};
+  flatten(path, tolerance, [&expander](PathVerb verb, Point p) {
+    if (verb == PathVerb::MoveTo)
+      expander.moveto(p);
+    else if (verb == PathVerb::LineTo)
+      expander.lineto(p);
+    else
+      expander.closepath();
+  });
+  expander.finish();
+}
+
+/// Return a path that, once filled with the non-zero winding rule,
+/// covers the same area as the stroke of `path`
+inline Path strokeoutline(const Path &path, const StrokeStyle &style,
+                          double tolerance) {
+  Path result;
+  strokeoutline(path, style, tolerance,
+                [&result](const Point *pts, size_t num) {
+                  result.moveto(pts[0]);
+                  for (size_t i{1}; i < num; ++i)
+                    result.lineto(pts[i]);
+                  result.closepath();
+                });
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/// The parameters that define how primitives are painted, see
+/// `BaseCanvas::getstate`
+struct DrawingState {
+  Color strokecolor, fillcolor;
+  double strokealpha, fillalpha;
+  StrokeStyle strokestyle;
+  FontFamily fontfamily;
+  double fontsize;
+  double transparency;
+};
+
+/** One of several alternative ways to draw the same content
+ *
+ * See `BaseCanvas::detailgroup`: `draw` is called if the effective
+ * scale of the canvas is at least `minscale`, and no other level with a
+ * larger `minscale` qualifies.
+ */
+struct DetailLevel {
+  double minscale;
+  std::function<void()> draw;
+};
+
+/// A clipping region returned by `BaseCanvas::defineclip`. Ids are
+/// assigned by each canvas, starting from zero
+struct ClipRegion {
+  int id;
+};
+
+enum class GradientType { Linear, Radial };
+
+/// The color space where the colors of a Gradient are interpolated
+enum class ColorSpace { RGB, HSL };
+
+struct GradientStop {
+  double offset;
+  Color color;
+};
+
+/** A smooth transition between colors, used to fill shapes
+ *
+ * Coordinates are relative to the bounding box of the shape being
+ * filled: (0, 0) is its corner with the smallest coordinates, and (1,
+ * 1) the opposite one. Thus, the same gradient can fill shapes of any
+ * size, and canvases write it only once. A linear gradient goes from
+ * `start` to `end`; a radial gradient goes from its center `start` to
+ * the circle with radius `radius`. Colors are specified by stops
+ * (see `addstop`), and they do not change before the first stop and
+ * after the last one.
+ *
+ * \code{cpp}
+ * canv.rectangle(Point{0, 0}, Point{10, 100},
+ *                lineargradient(Point{0, 0}, Point{0, 1}, ColorSpace::HSL)
+ *                    .addstop(0, blue)
+ *                    .addstop(1, red));
+ * \endcode
+ */
+struct Gradient {
+  GradientType type;
+  Point start, end;
+  double radius;
+  ColorSpace space;
+  std::vector<GradientStop> stops;
+
+  /// Add a stop at `offset`, which is a number in the range [0, 1] not
+  /// smaller than the one of the previous stop
+  Gradient &addstop(double offset, Color col) {
+    assert(stops.empty() || offset >= stops.back().offset);
+    stops.push_back(GradientStop{offset, col});
+    return *this;
+  }
+
+  /// Return the color at `offset`
+  Color colorat(double offset) const;
+
+  /// Fill `result` with stops that give the same colors when they are
+  /// interpolated in RGB, as SVG and PDF do. Gradients in HSL get
+  /// `samples` stops between each pair of their own stops
+  void rgbstops(std::vector<GradientStop> &result, int samples = 8) const;
+};
+
+inline bool operator==(const Gradient &a, const Gradient &b) {
+  if (a.type != b.type || a.space != b.space || a.start.x != b.start.x ||
+      a.start.y != b.start.y || a.end.x != b.end.x || a.end.y != b.end.y ||
+      a.radius != b.radius || a.stops.size() != b.stops.size())
+    return false;
+
+  for (size_t i{}; i < a.stops.size(); ++i) {
+    const GradientStop &x{a.stops[i]}, &y{b.stops[i]};
+    if (x.offset != y.offset || x.color.r != y.color.r ||
+        x.color.g != y.color.g || x.color.b != y.color.b)
+      return false;
+  }
+  return true;
+}
+
+inline bool operator!=(const Gradient &a, const Gradient &b) {
+  return !(a == b);
+}
+
+/// Return a gradient along the segment from `start` to `end`
+inline Gradient lineargradient(Point start, Point end,
+                               ColorSpace space = ColorSpace::RGB) {
+  return Gradient{GradientType::Linear, start, end, 0.0, space, {}};
+}
+
+/// Return a gradient from `center` to the circle with radius `radius`
+inline Gradient radialgradient(Point center, double radius,
+                               ColorSpace space = ColorSpace::RGB) {
+  return Gradient{GradientType::Radial, center, center, radius, space, {}};
+}
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE Color Gradient::colorat(double offset) const {
+  assert(!stops.empty());
+  if (offset <= stops.front().offset)
+    return stops.front().color;
+  if (offset >= stops.back().offset)
+    return stops.back().color;
+
+  size_t i{1};
+  while (stops[i].offset < offset)
+    ++i;
+
+  const GradientStop &a{stops[i - 1]}, &b{stops[i]};
+  const double t{(offset - a.offset) / (b.offset - a.offset)};
+  if (space == ColorSpace::RGB)
+    return Color{a.color.r + t * (b.color.r - a.color.r),
+                 a.color.g + t * (b.color.g - a.color.g),
+                 a.color.b + t * (b.color.b - a.color.b)};
+
+  double h1, s1, l1, h2, s2, l2;
+  tohsl(a.color, h1, s1, l1);
+  tohsl(b.color, h2, s2, l2);
+
+  // Grays have no hue, and the hue goes around the shortest way
+  if (s1 == 0)
+    h1 = h2;
+  else if (s2 == 0)
+    h2 = h1;
+  if (h2 - h1 > 0.5)
+    h1 += 1;
+  else if (h1 - h2 > 0.5)
+    h2 += 1;
+
+  const double h{h1 + t * (h2 - h1)};
+  return hsl(h >= 1 ? h - 1 : h, s1 + t * (s2 - s1), l1 + t * (l2 - l1));
+}
+
+MONET_INLINE void Gradient::rgbstops(std::vector<GradientStop> &result,
+                                     int samples) const {
+  result.clear();
+  for (size_t i{}; i < stops.size(); ++i) {
+    if (i > 0 && space == ColorSpace::HSL) {
+      const double first{stops[i - 1].offset}, last{stops[i].offset};
+      for (int k{1}; k <= samples && last > first; ++k) {
+        const double offset{first + (last - first) * k / (samples + 1)};
+        result.push_back(GradientStop{offset, colorat(offset)});
+      }
+    }
+    result.push_back(stops[i]);
+  }
+}
+#endif // MONET_DEFINITIONS
+
+// A tile used to fill shapes, defined after RecordingCanvas
+class Pattern;
+
+/** An argument of the bulk primitives (e.g., `BaseCanvas::circles`)
+ *
+ * A column is either an array with one value per item, or one value
+ * that is used for all the items. The array is not copied, so it must
+ * outlive the column.
+ */
+template <typename T> class Column {
+private:
+  const T *data;
+  T value;
+
+public:
+  Column(const T &avalue) : data{nullptr}, value(avalue) {}
+  Column(const T *adata) : data{adata}, value() { assert(adata); }
+  Column(const std::vector<T> &vec) : data{vec.data()}, value() {}
+
+  const T &operator[](size_t idx) const { return data ? data[idx] : value; }
+
+  /// Return true if the same value is used for all the items
+  bool isscalar() const { return data == nullptr; }
+};
+
+/** Sort items according to their color
+ *
+ * `build` sorts the indexes of `n` items so that the ones whose colors
+ * are the same once quantized to 8 bits per channel (as in `#rrggbb`)
+ * are consecutive. Groups are sorted by the first item that uses them,
+ * and the items of a group keep their order. Group `i` includes the
+ * items `order[start[i]]` … `order[start[i + 1] - 1]`.
+ */
+class ColorGroups {
+private:
+  std::unordered_map<uint32_t, uint32_t> groupof;
+  std::vector<uint32_t> itemgroup;
+
+  static uint32_t quantize(Color col) {
+    uint32_t key{};
+    for (double channel : {col.r, col.g, col.b}) {
+      const double scaled{channel * 255};
+      key = (key << 8) |
+            uint32_t(scaled >= 255 ? 255 : (scaled > 0 ? int(scaled) : 0));
+    }
+    return key;
+  }
+
+public:
+  std::vector<size_t> order;
+  std::vector<size_t> start;
+
+  size_t numofgroups() const { return start.size() - 1; }
+
+  void build(const Column<Color> &colors, size_t n) {
+    order.resize(n);
+    start.assign(1, 0);
+    if (colors.isscalar()) {
+      for (size_t i{}; i < n; ++i)
+        order[i] = i;
+      start.push_back(n);
+      return;
+    }
+
+    // Counting sort: first number the groups, then place the items.
+    // Palettes are small, so a direct-mapped cache in front of the hash
+    // table avoids most lookups
+    const uint32_t none{0xffffffff};
+    uint32_t cachedkey[64], cachedgroup[64];
+    std::fill(cachedkey, cachedkey + 64, none);
+    groupof.clear();
+    itemgroup.resize(n);
+    for (size_t i{}; i < n; ++i) {
+      const uint32_t key{quantize(colors[i])};
+      const uint32_t slot{(key * 0x9E3779B1u) >> 26};
+      if (cachedkey[slot] != key) {
+        auto it = groupof.emplace(key, uint32_t(groupof.size()));
+        cachedkey[slot] = key;
+        cachedgroup[slot] = it.first->second;
+      }
+      itemgroup[i] = cachedgroup[slot];
+    }
+
+    start.assign(groupof.size() + 1, 0);
+    for (size_t i{}; i < n; ++i)
+      ++start[itemgroup[i] + 1];
+    for (size_t g{1}; g < start.size(); ++g)
+      start[g] += start[g - 1];
+
+    std::vector<size_t> next(start.begin(), start.end() - 1);
+    for (size_t i{}; i < n; ++i)
+      order[next[itemgroup[i]]++] = i;
+  }
+};
+
+class BaseCanvas {
+  friend class CommandPlayer;
+
+private:
+  Color strokecolor;
+  Color fillcolor;
+  double strokealpha, fillalpha;
+  StrokeStyle strokestyle;
+  FontFamily fontfamily;
+  double fontsize;
+  double transparency;
+
+  // Current transformation matrix, and the ones of the enclosing groups
+  Matrix ctm;
+  std::vector<Matrix> ctmstack;
+  double devicescale;
+
+protected:
+  virtual void movetoxy(double x, double y) = 0;
+  virtual void linetoxy(double x, double y) = 0;
+  virtual void quadratictoxy(double xdir, double ydir, double xend,
+                             double yend) = 0;
+  virtual void cubictoxy(double xc1, double yc1, double xc2, double yc2,
+                         double xend, double yend) = 0;
+  virtual void linexy(double x1, double y1, double x2, double y2) = 0;
+  virtual void circlexy(double x, double y, double radius, Action act) = 0;
+  virtual void rectanglexy(double x1, double y1, double x2, double y2,
+                           Action act) = 0;
+  virtual void textxy(double x, double y, const char *text,
+                      HorizontalAlignment halign, VerticalAlignment valign) = 0;
+  MONET_VIRTUAL virtual void pathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        Action act);
+
+  /// Implementations of the bulk primitives. The default ones call
+  /// `circlexy` and `rectanglexy` for each item, in order
+  MONET_VIRTUAL virtual void circlearray(const Column<double> &xs,
+                                         const Column<double> &ys,
+                                         const Column<double> &radii,
+                                         const Column<Color> &colors, size_t n,
+                                         Action act);
+  MONET_VIRTUAL virtual void rectanglearray(const Column<double> &xs,
+                                            const Column<double> &ys,
+                                            const Column<double> &widths,
+                                            const Column<double> &heights,
+                                            const Column<Color> &colors,
+                                            size_t n, Action act);
+
+  /// Implementation of `texts`. The default one calls `textxy` for
+  /// each label
+  MONET_VIRTUAL virtual void textarray(const Column<double> &xs,
+                                       const Column<double> &ys,
+                                       const Column<std::string> &strings,
+                                       size_t n, HorizontalAlignment halign,
+                                       VerticalAlignment valign);
+
+  /// Implementations of the primitives filled with a gradient. The
+  /// coordinates of the gradient are relative to the bounding box of
+  /// the shape, before `transforms` are applied. The default ones fill
+  /// the shape with the color of the first stop
+  MONET_VIRTUAL virtual void gradientcirclexy(double x, double y,
+                                              double radius,
+                                              const Gradient &gradient);
+  MONET_VIRTUAL virtual void gradientrectanglexy(double x1, double y1,
+                                                 double x2, double y2,
+                                                 const Gradient &gradient);
+  MONET_VIRTUAL virtual void
+  gradientpathobject(const Path &path, const TransformSequence &transforms,
+                     const Gradient &gradient);
+
+  /// Implementations of the primitives filled with a pattern. Tiles
+  /// are aligned to the origin of the coordinate system of the shape.
+  /// The default ones fill the shape with the fill color
+  MONET_VIRTUAL virtual void patterncirclexy(double x, double y,
+                                             double radius,
+                                             const Pattern &pattern);
+  MONET_VIRTUAL virtual void patternrectanglexy(double x1, double y1,
+                                                double x2, double y2,
+                                                const Pattern &pattern);
+  MONET_VIRTUAL virtual void
+  patternpathobject(const Path &path, const TransformSequence &transforms,
+                    const Pattern &pattern);
+
+  /// Implementation of `image`. The default one fills a rectangle for
+  /// each pixel that is not fully transparent
+  MONET_VIRTUAL virtual void imagexy(double x1, double y1, double x2,
+                                     double y2, size_t cols, size_t rows,
+                                     const Color8 *pixels);
+
+  /// Implementation of `cliprectangle`. The default one draws a filled
+  /// rectangle between `defineclip` and `endclip`
+  virtual ClipRegion cliprectanglexy(double x1, double y1, double x2,
+                                     double y2) {
+    const ClipRegion region{defineclip()};
+    rectanglexy(x1, y1, x2, y2, Action::Fill);
+    endclip();
+    return region;
+  }
+
+  /// Set the color used by `act` (the fill color, unless `act` is
+  /// Action::Stroke) to the one of item `idx`
+  void setitemcolor(const Column<Color> &colors, size_t idx, Action act) {
+    if (act == Action::Stroke)
+      strokecolor = colors[idx];
+    else
+      fillcolor = colors[idx];
+  }
+
+  /// Implementations of `begingroup` and `endgroup` must call these, so
+  /// that the canvas knows the current transformation
+  void pushtransform(const TransformSequence &transforms) {
+    ctmstack.push_back(ctm);
+    if (!isidentity(transforms))
+      ctm = ctm * tomatrix(transforms);
+  }
+
+  void poptransform() {
+    assert(!ctmstack.empty());
+    ctm = ctmstack.back();
+    ctmstack.pop_back();
+  }
+
+public:
+  BaseCanvas()
+      : strokecolor{black}, fillcolor{white}, strokealpha{1.0},
+        fillalpha{1.0}, strokestyle{},
+        fontfamily{FontFamily::SansSerif}, fontsize{12.0}, transparency{0.0},
+        ctm{}, ctmstack{}, devicescale{1.0} {}
+  virtual ~BaseCanvas() {}
+
+  void setstrokecolor(Color col) { strokecolor = col; }
+  void setfillcolor(Color col) { fillcolor = col; }
+
+  Color getstrokecolor() const { return strokecolor; }
+  Color getfillcolor() const { return fillcolor; }
+
+  /// Set the color and the opacity of strokes
+  void setstrokecolor(Color8 col) {
+    strokecolor = col.tocolor();
+    strokealpha = col.alpha();
+  }
+
+  /// Set the color and the opacity of fills
+  void setfillcolor(Color8 col) {
+    fillcolor = col.tocolor();
+    fillalpha = col.alpha();
+  }
+
+  /// Set the opacity of strokes and fills, in the range [0, 1]. Unlike
+  /// `settransparency`, they apply to one kind of paint only; colors of
+  /// type Color do not change them.
+  void setstrokealpha(double alpha) { strokealpha = alpha; }
+  void setfillalpha(double alpha) { fillalpha = alpha; }
+  double getstrokealpha() const { return strokealpha; }
+  double getfillalpha() const { return fillalpha; }
+
+  void setstrokewidth(double width) { strokestyle.width = width; };
+  double getstrokewidth() const { return strokestyle.width; }
+
+  void setlinejoin(LineJoin join) { strokestyle.join = join; }
+  LineJoin getlinejoin() const { return strokestyle.join; }
+
+  void setlinecap(LineCap cap) { strokestyle.cap = cap; }
+  LineCap getlinecap() const { return strokestyle.cap; }
+
+  /// Set the maximum ratio between the length of a miter join and the
+  /// stroke width; sharper corners are drawn using bevel joins
+  void setmiterlimit(double limit) { strokestyle.miterlimit = limit; }
+  double getmiterlimit() const { return strokestyle.miterlimit; }
+
+  /// Set the dash pattern: `dashes` contains the lengths of dashes and
+  /// gaps, alternatively. Pass an empty vector to draw solid lines.
+  void setdash(const std::vector<double> &dashes, double offset = 0.0) {
+    strokestyle.dashes = dashes;
+    strokestyle.dashoffset = offset;
+  }
+  const std::vector<double> &getdash() const { return strokestyle.dashes; }
+  double getdashoffset() const { return strokestyle.dashoffset; }
+
+  /// Return all the parameters that define how lines are stroked
+  const StrokeStyle &getstrokestyle() const { return strokestyle; }
+
+  virtual void setfontfamily(FontFamily fam) { fontfamily = fam; }
+  virtual void setfontsize(double size) { fontsize = size; }
+
+  virtual FontFamily getfontfamily() const { return fontfamily; }
+  virtual double getfontsize() const { return fontsize; }
+
+  virtual double getwidth() const = 0;
+  virtual double getheight() const = 0;
+
+  void settransparency(double tr) { transparency = tr; }
+  double gettransparency() const { return transparency; }
+
+  /// Return the colors, the stroke style, the font, and the
+  /// transparency currently used to paint primitives
+  DrawingState getstate() const {
+    return DrawingState{strokecolor, fillcolor,       strokealpha,
+                        fillalpha,   strokestyle,     getfontfamily(),
+                        getfontsize(), transparency};
+  }
+
+  /// Restore the parameters returned by `getstate`
+  void setstate(const DrawingState &state) {
+    strokecolor = state.strokecolor;
+    fillcolor = state.fillcolor;
+    strokealpha = state.strokealpha;
+    fillalpha = state.fillalpha;
+    strokestyle = state.strokestyle;
+    setfontfamily(state.fontfamily);
+    setfontsize(state.fontsize);
+    transparency = state.transparency;
+  }
+
+  /// Return the transformation from the coordinates of the current
+  /// group to the ones of the canvas
+  const Matrix &getctm() const { return ctm; }
+
+  /// Set the resolution of the device that will show the image, in
+  /// units per millimeter (e.g., pixels/mm); the default is 1
+  void setdevicescale(double scale) { devicescale = scale; }
+  double getdevicescale() const { return devicescale; }
+
+  /// Return how many device units correspond to one unit in the
+  /// current group. Non-uniform scalings are averaged geometrically
+  double geteffectivescale() const {
+    return devicescale * std::sqrt(std::fabs(ctm.determinant()));
+  }
+
+  /// Move the current point on the image plane
+  void moveto(Point p) { movetoxy(p.x, p.y); }
+
+  /// Append to the current path a line from the current point to `p` on the
+  /// image plane
+  void lineto(Point p) { linetoxy(p.x, p.y); }
+
+  /// Draw a line that joins a vector of 2D points on the image plane
+  void drawpath(const std::vector<Point> pts) {
+    for (size_t i{}; i < pts.size(); ++i) {
+      if (i == 0)
+        moveto(pts[i]);
+      else
+        lineto(pts[i]);
+    }
+  }
+
+  /// Append a quadratic curved line to the current path
+  void quadraticto(Point dir, Point end) {
+    quadratictoxy(dir.x, dir.y, end.x, end.y);
+  }
+
+  /// Append a cubic curved line to the current path
+  void cubicto(Point control1, Point control2, Point end) {
+    cubictoxy(control1.x, control1.y, control2.x, control2.y, end.x, end.y);
+  }
+
+  void line(Point p1, Point p2) { linexy(p1.x, p1.y, p2.x, p2.y); }
+
+  /// Draw a circle
+  void circle(Point pt, double radius, Action act = Action::Stroke) {
+    circlexy(pt.x, pt.y, radius, act);
+  }
+
+  /// Paint a rectangle
+  void rectangle(Point p1, Point p2, Action act = Action::Stroke) {
+    rectanglexy(p1.x, p1.y, p2.x, p2.y, act);
+  }
+
+  /// Fill a circle with a gradient. The fill color is not used, but
+  /// the transparency is
+  void circle(Point pt, double radius, const Gradient &gradient) {
+    gradientcirclexy(pt.x, pt.y, radius, gradient);
+  }
+
+  /// Fill a rectangle with a gradient, like `circle`
+  void rectangle(Point p1, Point p2, const Gradient &gradient) {
+    gradientrectanglexy(p1.x, p1.y, p2.x, p2.y, gradient);
+  }
+
+  /// Fill a circle with a pattern. The fill color is not used: the
+  /// tile keeps the parameters it was drawn with
+  void circle(Point pt, double radius, const Pattern &pattern) {
+    patterncirclexy(pt.x, pt.y, radius, pattern);
+  }
+
+  /// Fill a rectangle with a pattern, like `circle`
+  void rectangle(Point p1, Point p2, const Pattern &pattern) {
+    patternrectanglexy(p1.x, p1.y, p2.x, p2.y, pattern);
+  }
+
+  /** Draw an image with `cols` × `rows` pixels, stored by rows, that
+   * fills the rectangle from `p1` to `p2`
+   *
+   * The first pixel is in the corner `p1`, and the first row goes from
+   * `p1.x` to `p2.x`. The alpha channel of the pixels is combined with
+   * the transparency of the canvas. The pixels are copied, so they can
+   * be changed once the method returns.
+   */
+  void image(Point p1, Point p2, size_t cols, size_t rows,
+             const Color8 *pixels) {
+    imagexy(p1.x, p1.y, p2.x, p2.y, cols, rows, pixels);
+  }
+
+  /** Draw `n` circles
+   *
+   * Each argument but `n` and `act` can be either an array with `n`
+   * elements or a single value. The colors replace the fill color, or
+   * the stroke color if `act` is Action::Stroke; the current colors are
+   * not changed. Canvases can draw items with the same color together,
+   * so overlapping items with different colors might not be stacked in
+   * the order of the arrays.
+   */
+  void circles(const Column<double> &xs, const Column<double> &ys,
+               const Column<double> &radii, const Column<Color> &colors,
+               size_t n, Action act = Action::Fill) {
+    circlearray(xs, ys, radii, colors, n, act);
+  }
+
+  /// Draw `n` rectangles from (x, y) to (x + width, y + height); see
+  /// `circles` for the meaning of the arguments
+  void rectangles(const Column<double> &xs, const Column<double> &ys,
+                  const Column<double> &widths, const Column<double> &heights,
+                  const Column<Color> &colors, size_t n,
+                  Action act = Action::Fill) {
+    rectanglearray(xs, ys, widths, heights, colors, n, act);
+  }
+
+  /// Draw `n` labels, each at the point (x, y), with the same font,
+  /// fill color, and alignment; see `circles` for the meaning of the
+  /// arguments. This is useful for tick labels and annotations
+  void texts(const Column<double> &xs, const Column<double> &ys,
+             const Column<std::string> &strings, size_t n,
+             HorizontalAlignment halign = HorizontalAlignment::Right,
+             VerticalAlignment valign = VerticalAlignment::Top) {
+    textarray(xs, ys, strings, n, halign, valign);
+  }
+
+  /// Draw a Path object. Any path built with moveto, lineto, etc. that
+  /// has not been drawn yet is discarded
+  void draw(const Path &path, Action act = Action::Stroke) {
+    pathobject(path, identity, act);
+  }
+
+  /// Draw a Path object, applying a sequence of transformations to it
+  void draw(const Path &path, const TransformSequence &transforms,
+            Action act = Action::Stroke) {
+    pathobject(path, transforms, act);
+  }
+
+  /// Fill a Path object with a gradient, like `circle`
+  void draw(const Path &path, const Gradient &gradient) {
+    gradientpathobject(path, identity, gradient);
+  }
+
+  void draw(const Path &path, const TransformSequence &transforms,
+            const Gradient &gradient) {
+    gradientpathobject(path, transforms, gradient);
+  }
+
+  /// Fill a Path object with a pattern, like `circle`
+  void draw(const Path &path, const Pattern &pattern) {
+    patternpathobject(path, identity, pattern);
+  }
+
+  void draw(const Path &path, const TransformSequence &transforms,
+            const Pattern &pattern) {
+    patternpathobject(path, transforms, pattern);
+  }
+
+  /// Draw a line of text
+  void text(Point p, const std::string &str,
+            HorizontalAlignment halign = HorizontalAlignment::Right,
+            VerticalAlignment valign = VerticalAlignment::Top);
+
+  virtual void closepath() = 0;
+  virtual void strokepath() = 0;
+  virtual void fillpath() = 0;
+  virtual void fillandstrokepath() {
+    fillpath();
+    strokepath();
+  }
+  virtual void clearpath() = 0;
+
+  virtual void begingroup(const TransformSequence &transforms = identity,
+                          const std::string &name = "") = 0;
+  virtual void endgroup() = 0;
+  virtual int grouplevel() const = 0;
+
+  /// Start a group and draw only one of the alternatives in `levels`:
+  /// the one with the largest `minscale` that does not exceed the
+  /// effective scale within the group. If the scale is smaller than
+  /// every `minscale`, the group is left empty.
+  void detailgroup(const TransformSequence &transforms,
+                   std::initializer_list<DetailLevel> levels,
+                   const std::string &name = "");
+
+  /// Start the definition of a new clipping region: what is drawn
+  /// until `endclip` makes its shape. The region can be used any
+  /// number of times, through the value returned by this function
+  virtual ClipRegion defineclip() = 0;
+  virtual void endclip() = 0;
+
+  /// Define a clipping region made by the rectangle from `p1` to `p2`.
+  /// Some canvases apply rectangular regions faster than other shapes
+  ClipRegion cliprectangle(Point p1, Point p2) {
+    return cliprectanglexy(p1.x, p1.y, p2.x, p2.y);
+  }
+
+  /// Clip to the last region that was defined
+  virtual void useclip() = 0;
+
+  /// Clip what is drawn until the next call to `removeclip` to
+  /// `region`. Calls can be nested, and the regions are intersected
+  virtual void useclip(ClipRegion region) = 0;
+
+  /// Stop using the region passed to the last call to `useclip`
+  virtual void removeclip() = 0;
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void BaseCanvas::text(Point p, const std::string &str,
+                                   HorizontalAlignment halign,
+                                   VerticalAlignment valign) {
+  textxy(p.x, p.y, str.c_str(), halign, valign);
+}
+
+MONET_INLINE void
+BaseCanvas::detailgroup(const TransformSequence &transforms,
+                        std::initializer_list<DetailLevel> levels,
+                        const std::string &name) {
+  begingroup(transforms, name);
+
+  const double scale{geteffectivescale()};
+  const DetailLevel *chosen{};
+  for (const auto &level : levels) {
+    if (level.minscale <= scale &&
+        (!chosen || level.minscale > chosen->minscale))
+      chosen = &level;
+  }
+
+  if (chosen && chosen->draw)
+    chosen->draw();
+
+  endgroup();
+}
+
+// This implementation works with any backend, as it replays the path
+// using the path-building methods; backends can do better by overriding it
+MONET_INLINE void BaseCanvas::pathobject(const Path &path,
+                                         const TransformSequence &transforms,
+                                         Action act) {
+  bool transformed{!isidentity(transforms)};
+  if (transformed)
+    begingroup(transforms);
+
+  clearpath();
+
+  const double *pt{path.getcoords().data()};
+  for (PathVerb verb : path.getverbs()) {
+    switch (verb) {
+    case PathVerb::MoveTo:
+      movetoxy(pt[0], pt[1]);
+      break;
+    case PathVerb::LineTo:
+      linetoxy(pt[0], pt[1]);
+      break;
+    case PathVerb::QuadraticTo:
+      quadratictoxy(pt[0], pt[1], pt[2], pt[3]);
+      break;
+    case PathVerb::CubicTo:
+      cubictoxy(pt[0], pt[1], pt[2], pt[3], pt[4], pt[5]);
+      break;
+    case PathVerb::Close:
+      closepath();
+      break;
+    default:
+      abort();
+    }
+
+    pt += numofcoords(verb);
+  }
+
+  switch (act) {
+  case Action::Stroke:
+    strokepath();
+    break;
+  case Action::Fill:
+    fillpath();
+    break;
+  case Action::FillAndStroke:
+    fillandstrokepath();
+    break;
+  default:
+    abort();
+  }
+
+  clearpath();
+
+  if (transformed)
+    endgroup();
+}
+
+MONET_INLINE void BaseCanvas::circlearray(const Column<double> &xs,
+                                          const Column<double> &ys,
+                                          const Column<double> &radii,
+                                          const Column<Color> &colors, size_t n,
+                                          Action act) {
+  const Color oldstroke{strokecolor}, oldfill{fillcolor};
+  for (size_t i{}; i < n; ++i) {
+    setitemcolor(colors, i, act);
+    circlexy(xs[i], ys[i], radii[i], act);
+  }
+  strokecolor = oldstroke;
+  fillcolor = oldfill;
+}
+
+MONET_INLINE void BaseCanvas::rectanglearray(const Column<double> &xs,
+                                             const Column<double> &ys,
+                                             const Column<double> &widths,
+                                             const Column<double> &heights,
+                                             const Column<Color> &colors,
+                                             size_t n, Action act) {
+  const Color oldstroke{strokecolor}, oldfill{fillcolor};
+  for (size_t i{}; i < n; ++i) {
+    setitemcolor(colors, i, act);
+    rectanglexy(xs[i], ys[i], xs[i] + widths[i], ys[i] + heights[i], act);
+  }
+  strokecolor = oldstroke;
+  fillcolor = oldfill;
+}
+
+MONET_INLINE void BaseCanvas::textarray(const Column<double> &xs,
+                                        const Column<double> &ys,
+                                        const Column<std::string> &strings,
+                                        size_t n, HorizontalAlignment halign,
+                                        VerticalAlignment valign) {
+  for (size_t i{}; i < n; ++i)
+    textxy(xs[i], ys[i], strings[i].c_str(), halign, valign);
+}
+
+MONET_INLINE void BaseCanvas::gradientcirclexy(double x, double y,
+                                               double radius,
+                                               const Gradient &gradient) {
+  const Color oldfill{fillcolor};
+  if (!gradient.stops.empty())
+    fillcolor = gradient.stops.front().color;
+  circlexy(x, y, radius, Action::Fill);
+  fillcolor = oldfill;
+}
+
+MONET_INLINE void BaseCanvas::gradientrectanglexy(double x1, double y1,
+                                                  double x2, double y2,
+                                                  const Gradient &gradient) {
+  const Color oldfill{fillcolor};
+  if (!gradient.stops.empty())
+    fillcolor = gradient.stops.front().color;
+  rectanglexy(x1, y1, x2, y2, Action::Fill);
+  fillcolor = oldfill;
+}
+
+MONET_INLINE void
+BaseCanvas::gradientpathobject(const Path &path,
+                               const TransformSequence &transforms,
+                               const Gradient &gradient) {
+  const Color oldfill{fillcolor};
+  if (!gradient.stops.empty())
+    fillcolor = gradient.stops.front().color;
+  pathobject(path, transforms, Action::Fill);
+  fillcolor = oldfill;
+}
+
+MONET_INLINE void BaseCanvas::patterncirclexy(double x, double y,
+                                              double radius,
+                                              const Pattern &) {
+  circlexy(x, y, radius, Action::Fill);
+}
+
+MONET_INLINE void BaseCanvas::patternrectanglexy(double x1, double y1,
+                                                 double x2, double y2,
+                                                 const Pattern &) {
+  rectanglexy(x1, y1, x2, y2, Action::Fill);
+}
+
+MONET_INLINE void
+BaseCanvas::patternpathobject(const Path &path,
+                              const TransformSequence &transforms,
+                              const Pattern &) {
+  pathobject(path, transforms, Action::Fill);
+}
+
+MONET_INLINE void BaseCanvas::imagexy(double x1, double y1, double x2,
+                                      double y2, size_t cols, size_t rows,
+                                      const Color8 *pixels) {
+  const Color oldfill{fillcolor};
+  const double oldalpha{fillalpha};
+  const double dx{(x2 - x1) / cols}, dy{(y2 - y1) / rows};
+  for (size_t r{}; r < rows; ++r)
+    for (size_t c{}; c < cols; ++c) {
+      const Color8 &pixel{pixels[r * cols + c]};
+      if (pixel.a == 0)
+        continue;
+      fillcolor = pixel.tocolor();
+      fillalpha = pixel.a / 255.0;
+      rectanglexy(x1 + c * dx, y1 + r * dy, x1 + (c + 1) * dx,
+                  y1 + (r + 1) * dy, Action::Fill);
+    }
+  fillcolor = oldfill;
+  fillalpha = oldalpha;
+}
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef MONET_WITH_DENSITY
+
+/// How `DensityGrid::shade` maps the values of the bins to colors
+enum class TransferFunction {
+  Linear,   ///< Proportionally to the value
+  Log,      ///< Proportionally to the logarithm of the value
+  Equalize, ///< According to the rank of the value among all the bins
+};
+
+/** Aggregate a point cloud into a grid of bins, to be drawn as an image
+ *
+ * When there are many more points than pixels, drawing each of them is
+ * slow and the result is unreadable. A DensityGrid divides the
+ * rectangle from `amin` to `amax` into `acols` × `arows` bins (usually
+ * one per pixel of the output) and sums the weight of the points in
+ * each of them: with the default weight of 1, each bin counts its
+ * points. The time needed by `add` is proportional to the number of
+ * points, while the size of the image drawn by `draw` only depends on
+ * the number of bins:
+ *
+ *     DensityGrid grid{800, 600, Point{-5, -5}, Point{5, 5}};
+ *     grid.add(xs, ys, xs.size());
+ *     grid.draw(canvas, lineargradient(Point{0, 0}, Point{1, 0})
+ *                           .addstop(0, lightblue)
+ *                           .addstop(1, darkblue));
+ *
+ * Bins are stored by rows; the first one contains `amin`, and its
+ * row goes towards increasing X coordinates.
+ */
+class DensityGrid {
+private:
+  size_t cols, rows;
+  Point minpt, maxpt;
+  std::vector<double> bins;
+
+  // Add the points from `first` to `last` (excluded) to `grid`
+  void addrange(const Column<double> &xs, const Column<double> &ys,
+                const Column<double> &weights, size_t first, size_t last,
+                double *grid) const {
+    const double scalex{double(cols) / (maxpt.x - minpt.x)};
+    const double scaley{double(rows) / (maxpt.y - minpt.y)};
+    for (size_t i{first}; i < last; ++i) {
+      const double fx{(xs[i] - minpt.x) * scalex};
+      const double fy{(ys[i] - minpt.y) * scaley};
+
+      // This is false for NaNs as well
+      if (fx >= 0 && fx < double(cols) && fy >= 0 && fy < double(rows))
+        grid[size_t(fy) * cols + size_t(fx)] += weights[i];
+    }
+  }
+
+public:
+  DensityGrid(size_t acols, size_t arows, Point amin, Point amax)
+      : cols{acols}, rows{arows}, minpt{amin}, maxpt{amax},
+        bins(acols * arows) {
+    assert(amin.x < amax.x && amin.y < amax.y);
+  }
+
+  size_t getcols() const { return cols; }
+  size_t getrows() const { return rows; }
+
+  /// Return the value of the bin in column `col` and row `row`
+  double at(size_t col, size_t row) const { return bins[row * cols + col]; }
+
+  /// Return all the bins, stored by rows
+  const std::vector<double> &getbins() const { return bins; }
+
+  /// Set all the bins to zero
+  void clear() { std::fill(bins.begin(), bins.end(), 0.0); }
+
+  /** Add the weights of `n` points to the bins that contain them
+   *
+   * Points outside the grid, or with a NaN coordinate, are ignored.
+   * If MONET_WITH_THREADS is defined, the points are divided among
+   * `numofthreads` threads (by default, as many as the processor
+   * supports), each with a grid of its own; the grids are then summed.
+   * Large point clouds can be added in several calls.
+   */
+  void add(const Column<double> &xs, const Column<double> &ys, size_t n,
+           const Column<double> &weights = 1.0, unsigned numofthreads = 0);
+
+  /// Map the value of each bin to a color of `colormap` (in the range
+  /// from 0 to 1) using `tf`. Empty bins are transparent
+  void shade(std::vector<Color8> &pixels, const Gradient &colormap,
+             TransferFunction tf = TransferFunction::Equalize) const;
+
+  /// Draw the grid as an image on `canvas`, shaded as in `shade`
+  void draw(BaseCanvas &canvas, const Gradient &colormap,
+            TransferFunction tf = TransferFunction::Equalize) const {
+    std::vector<Color8> pixels;
+    shade(pixels, colormap, tf);
+    canvas.image(minpt, maxpt, cols, rows, pixels.data());
+  }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void DensityGrid::add(const Column<double> &xs,
+                                   const Column<double> &ys, size_t n,
+                                   const Column<double> &weights,
+                                   unsigned numofthreads) {
+#ifndef MONET_WITH_THREADS
+  (void)numofthreads;
+  addrange(xs, ys, weights, 0, n, bins.data());
+#else
+  if (numofthreads == 0)
+    numofthreads = std::max(1U, std::thread::hardware_concurrency());
+
+  // Every thread but the first needs a grid of its own, which is worth
+  // it only if the thread has enough points
+  const size_t minpoints{size_t(1) << 16};
+  const size_t numofchunks{std::min(size_t(numofthreads), n / minpoints + 1)};
+  if (numofchunks <= 1) {
+    addrange(xs, ys, weights, 0, n, bins.data());
+    return;
+  }
+
+  std::vector<std::vector<double>> partial(numofchunks - 1,
+                                           std::vector<double>(bins.size()));
+  std::vector<std::thread> threads;
+  for (size_t chunk{1}; chunk < numofchunks; ++chunk)
+    threads.emplace_back([&, chunk] {
+      addrange(xs, ys, weights, n * chunk / numofchunks,
+               n * (chunk + 1) / numofchunks, partial[chunk - 1].data());
+    });
+  addrange(xs, ys, weights, 0, n / numofchunks, bins.data());
+  for (std::thread &thread : threads)
+    thread.join();
+
+  // Each thread sums a range of bins of all the grids
+  auto reduce = [&](size_t first, size_t last) {
+    for (const std::vector<double> &grid : partial)
+      for (size_t i{first}; i < last; ++i)
+        bins[i] += grid[i];
+  };
+  threads.clear();
+  for (size_t chunk{1}; chunk < numofchunks; ++chunk)
+    threads.emplace_back(reduce, bins.size() * chunk / numofchunks,
+                         bins.size() * (chunk + 1) / numofchunks);
+  reduce(0, bins.size() / numofchunks);
+  for (std::thread &thread : threads)
+    thread.join();
+#endif // MONET_WITH_THREADS
+}
+
+MONET_INLINE void DensityGrid::shade(std::vector<Color8> &pixels,
+                                     const Gradient &colormap,
+                                     TransferFunction tf) const {
+  pixels.assign(bins.size(), Color8{0, 0, 0, 0});
+
+  double lowest{std::numeric_limits<double>::infinity()};
+  double highest{-lowest};
+  for (double value : bins) {
+    if (value != 0) {
+      lowest = std::min(lowest, value);
+      highest = std::max(highest, value);
+    }
+  }
+  if (lowest > highest)
+    return;
+
+  // Pixels have 8 bits per channel, so 256 colors are enough
+  Color8 palette[256];
+  for (int i{}; i < 256; ++i)
+    palette[i] = Color8{colormap.colorat(i / 255.0)};
+
+  // Histogram equalization uses the rank of each value among the
+  // values of the other bins that are not empty
+  std::vector<double> sorted;
+  size_t highestrank{};
+  if (tf == TransferFunction::Equalize) {
+    for (double value : bins)
+      if (value != 0)
+        sorted.push_back(value);
+    std::sort(sorted.begin(), sorted.end());
+    highestrank = size_t(
+        std::lower_bound(sorted.begin(), sorted.end(), highest) -
+        sorted.begin());
+  }
+
+  const double span{highest - lowest};
+  for (size_t i{}; i < bins.size(); ++i) {
+    const double value{bins[i]};
+    if (value == 0)
+      continue;
+
+    double level{1};
+    switch (tf) {
+    case TransferFunction::Linear:
+      if (span > 0)
+        level = (value - lowest) / span;
+      break;
+    case TransferFunction::Log:
+      if (span > 0)
+        level = std::log1p(value - lowest) / std::log1p(span);
+      break;
+    case TransferFunction::Equalize:
+      if (highestrank > 0)
+        level = double(std::lower_bound(sorted.begin(), sorted.end(), value) -
+                       sorted.begin()) /
+                double(highestrank);
+      break;
+    default:
+      abort();
+    }
+
+    pixels[i] = palette[int(level * 255 + 0.5)];
+  }
+}
+#endif // MONET_DEFINITIONS
+#endif // MONET_WITH_DENSITY
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef MONET_HAVE_MMAP
+
+/** A stream buffer writing into a memory-mapped file
+ *
+ * The put area of this buffer is the mapping itself, so anything
+ * formatted by a `std::ostream` lands directly in the page cache
+ * without passing through an intermediate buffer. When the mapping is
+ * full, the file is enlarged by a factor `growthfactor` and mapped
+ * again. Once the buffer is destroyed, the file is truncated to the
+ * number of bytes that were actually written.
+ *
+ * This is only available on POSIX systems.
+ */
+class MMapStreamBuf : public std::streambuf {
+private:
+  int fd;
+  char *base;
+  size_t capacity;
+  size_t growthfactor;
+  // Number of bytes in the file once a remap has failed
+  size_t written;
+  bool broken;
+
+  size_t used() const { return size_t(pptr() - pbase()); }
+
+  // The put area is emptied, so that the stream sets its badbit and
+  // nothing is written in the region that is no longer mapped
+  bool fail(size_t pos) {
+    setp(nullptr, nullptr);
+    base = nullptr;
+    capacity = 0;
+    written = pos;
+    broken = true;
+    return false;
+  }
+
+  bool grow(size_t minsize) {
+    if (broken)
+      return false;
+
+    size_t newcapacity{std::max(capacity, size_t(4096))};
+    while (newcapacity < minsize)
+      newcapacity *= growthfactor;
+
+    size_t pos{base ? used() : 0};
+    if (base) {
+      munmap(base, capacity);
+      base = nullptr;
+    }
+
+    if (ftruncate(fd, off_t(newcapacity)) != 0)
+      return fail(pos);
+
+    void *addr{mmap(nullptr, newcapacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0)};
+    if (addr == MAP_FAILED)
+      return fail(pos);
+
+    base = static_cast<char *>(addr);
+    capacity = newcapacity;
+    setp(base, base + capacity);
+    advance(pos);
+
+    return true;
+  }
+
+  // pbump takes an int, so move in steps to support files larger than 2 GB
+  void advance(size_t count) {
+    while (count > 0) {
+      size_t step{std::min(count, size_t(1) << 30)};
+      pbump(int(step));
+      count -= step;
+    }
+  }
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+      return traits_type::not_eof(ch);
+
+    if (!grow(capacity + 1))
+      return traits_type::eof();
+
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize count) override {
+    size_t n{size_t(count)};
+    if (size_t(epptr() - pptr()) < n && !grow(used() + n))
+      return 0;
+
+    std::memcpy(pptr(), s, n);
+    advance(n);
+    return count;
+  }
+
+public:
+  /// Create (or overwrite) the file and map the first `initialsize` bytes
+  MMapStreamBuf(const std::string &filename,
+                size_t initialsize = size_t(64) << 20, size_t factor = 2)
+      : fd{-1}, base{nullptr}, capacity{std::max(initialsize, size_t(4096))},
+        growthfactor{std::max(factor, size_t(2))}, written{0}, broken{false} {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return;
+
+    size_t initial{capacity};
+    capacity = 0;
+    if (!grow(initial)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  MMapStreamBuf(const MMapStreamBuf &) = delete;
+  void operator=(const MMapStreamBuf &) = delete;
+
+  ~MMapStreamBuf() override {
+    if (fd < 0)
+      return;
+
+    // After a failure, keep only what reached the file before the
+    // mapping was released
+    size_t size{written};
+    if (!broken) {
+      size = used();
+      munmap(base, capacity);
+    }
+    if (ftruncate(fd, off_t(size)) != 0)
+      std::perror("Unable to truncate memory-mapped file");
+    close(fd);
+  }
+
+  /// Return true if the file was created and mapped successfully
+  bool isopen() const { return fd >= 0; }
+
+  /// Return true if the file could not be enlarged or mapped again
+  bool isbroken() const { return broken; }
+
+  /// Return the number of bytes written so far
+  size_t size() const { return broken ? written : used(); }
+};
+
+/** An output stream that writes into a memory-mapped file
+ *
+ * Pass it to the `SVGCanvas` constructor that accepts a stream to
+ * produce very large documents (several GB) without going through
+ * `std::ofstream`:
+ *
+ * \code{cpp}
+ * SVGCanvas canv{mmapstream("skymap.svg"), 500, 500};
+ * \endcode
+ */
+class MMapOStream : public std::ostream {
+private:
+  MMapStreamBuf buf;
+
+public:
+  MMapOStream(const std::string &filename,
+              size_t initialsize = size_t(64) << 20, size_t factor = 2)
+      : std::ostream{nullptr}, buf{filename, initialsize, factor} {
+    rdbuf(&buf);
+    if (!buf.isopen())
+      setstate(std::ios_base::failbit);
+  }
+};
+
+#endif // MONET_HAVE_MMAP
+
+/** Open a file for writing through a memory mapping
+ *
+ * On POSIX systems, this returns a stream writing into a memory-mapped
+ * file (see MMapOStream); elsewhere it falls back to `std::ofstream`.
+ * The mapping saves the copy into the buffer of `std::ofstream`, but
+ * it is not the fastest way to write a file: a `write(2)` loop with a
+ * large buffer is quicker.
+ */
+std::unique_ptr<std::ostream> mmapstream(const std::string &filename);
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE std::unique_ptr<std::ostream>
+mmapstream(const std::string &filename) {
+#ifdef MONET_HAVE_MMAP
+  return std::unique_ptr<std::ostream>{new MMapOStream(filename)};
+#else
+  return std::unique_ptr<std::ostream>{new std::ofstream(filename.c_str())};
+#endif
+}
+#endif // MONET_DEFINITIONS
+
+/** A file mapped in memory for reading
+ *
+ * On POSIX systems the file is mapped with `mmap`, so that its pages
+ * are read only when they are used; elsewhere it is read in memory at
+ * once. In both cases the data is aligned to 8 bytes.
+ */
+class MappedFile {
+private:
+  const char *m_data;
+  size_t m_size;
+  void *mapping;
+  std::vector<uint64_t> words;
+
+public:
+  MappedFile() : m_data{nullptr}, m_size{0}, mapping{nullptr}, words{} {}
+
+  MappedFile(const MappedFile &) = delete;
+  void operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { close(); }
+
+  /// Open the file; return false if it cannot be read
+  bool open(const std::string &filename);
+
+  /// Release the file
+  void close();
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE bool MappedFile::open(const std::string &filename) {
+  close();
+
+#ifdef MONET_HAVE_MMAP
+  int fd{::open(filename.c_str(), O_RDONLY)};
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  bool ok{fstat(fd, &info) == 0};
+  if (ok && info.st_size > 0) {
+    void *addr{
+        mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0)};
+    ok = (addr != MAP_FAILED);
+    if (ok) {
+      mapping = addr;
+      m_size = size_t(info.st_size);
+      madvise(mapping, m_size, MADV_SEQUENTIAL);
+    }
+  }
+  ::close(fd);
+  if (!ok)
+    return false;
+
+  m_data = mapping ? static_cast<const char *>(mapping) : "";
+#else
+  std::ifstream in{filename, std::ios::binary | std::ios::ate};
+  if (!in)
+    return false;
+
+  const size_t size{size_t(in.tellg())};
+  words.resize((size + 7) / sizeof(uint64_t));
+  if (!in.seekg(0) || !in.read(reinterpret_cast<char *>(words.data()),
+                               std::streamsize(size))) {
+    words.clear();
+    return false;
+  }
+
+  m_data = size > 0 ? reinterpret_cast<const char *>(words.data()) : "";
+  m_size = size;
+#endif
+
+  return true;
+}
+
+MONET_INLINE void MappedFile::close() {
+#ifdef MONET_HAVE_MMAP
+  if (mapping)
+    munmap(mapping, m_size);
+#endif
+  mapping = nullptr;
+  words.clear();
+  m_data = nullptr;
+  m_size = 0;
+}
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** A monotonic memory arena
+ *
+ * Memory is handed out by bumping a pointer inside large blocks and is
+ * never released piece by piece: a call to `reset()` makes the whole
+ * arena available again. If more than one block was needed since the
+ * last reset, `reset()` merges them into one block, so that after a
+ * few rounds the arena satisfies every request without touching the
+ * global heap.
+ *
+ * SVGCanvas uses an arena to hold the text of the element being
+ * formatted, and resets it once the element has been written.
+ */
+class Arena {
+private:
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::vector<size_t> blocksizes;
+  size_t offset;
+
+  void addblock(size_t size) {
+    blocks.emplace_back(new char[size]);
+    blocksizes.push_back(size);
+    offset = 0;
+  }
+
+public:
+  explicit Arena(size_t initialsize = 4096) : offset{0} {
+    addblock(initialsize);
+  }
+
+  Arena(const Arena &) = delete;
+  void operator=(const Arena &) = delete;
+
+  /// Return a pointer to `size` bytes aligned to `align`, which must be
+  /// a power of two
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    size_t start{(offset + align - 1) & ~(align - 1)};
+    if (start + size > blocksizes.back()) {
+      addblock(std::max(size + align, 2 * blocksizes.back()));
+      start = 0;
+    }
+
+    offset = start + size;
+    return blocks.back().get() + start;
+  }
+
+  /// Make all the memory available again, invalidating every pointer
+  /// returned by `allocate`
+  void reset() {
+    if (blocks.size() > 1) {
+      size_t total{capacity()};
+      blocks.clear();
+      blocksizes.clear();
+      addblock(total);
+    }
+
+    offset = 0;
+  }
+
+  /// Return the total number of bytes owned by the arena
+  size_t capacity() const {
+    size_t total{};
+    for (size_t size : blocksizes)
+      total += size;
+
+    return total;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** A streaming zlib (RFC 1950/1951) compressor
+ *
+ * This is a small DEFLATE encoder that uses LZ77 with hash chains and
+ * the fixed Huffman codes. It does not compress as well as zlib, but
+ * it has no dependencies, and it is good enough for the repetitive
+ * text of PDF content streams. Data passed to `write` is compressed
+ * in blocks of 32 kB and sent to the sink; `finish` flushes the last
+ * block and the checksum.
+ */
+class ZlibWriter {
+public:
+  typedef std::function<void(const char *data, size_t len)> Sink;
+
+private:
+  enum {
+    blocksize = 32768,
+    maxdistance = 32768,
+    maxmatch = 258,
+    maxchain = 16,
+    nicematch = 32,
+    maxinsert = 8
+  };
+
+  Sink sink;
+  std::vector<unsigned char> window;
+  size_t histlen;
+  std::vector<int> head, prev;
+  std::string out;
+  unsigned long bitbuf;
+  int bitcount;
+  unsigned long adler_a, adler_b;
+  bool finished;
+
+  void putbits(unsigned long value, int count) {
+    bitbuf |= value << bitcount;
+    bitcount += count;
+    while (bitcount >= 8) {
+      out += char(bitbuf & 0xFF);
+      bitbuf >>= 8;
+      bitcount -= 8;
+    }
+  }
+
+  // Huffman codes are stored starting from the most significant bit
+  void puthuffman(unsigned code, int len) {
+    unsigned rev{};
+    for (int i{}; i < len; ++i)
+      rev |= ((code >> i) & 1) << (len - 1 - i);
+    putbits(rev, len);
+  }
+
+  void putsymbol(unsigned sym) {
+    if (sym < 144)
+      puthuffman(0x30 + sym, 8);
+    else if (sym < 256)
+      puthuffman(0x190 + sym - 144, 9);
+    else if (sym < 280)
+      puthuffman(sym - 256, 7);
+    else
+      puthuffman(0xC0 + sym - 280, 8);
+  }
+
+  void putmatch(size_t len, size_t dist) {
+    static const unsigned short lenbase[]{
+        3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const unsigned char lenextra[]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                          1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                          4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const unsigned short distbase[]{
+        1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+    static const unsigned char distextra[]{0, 0, 0,  0,  1,  1,  2,  2,
+                                           3, 3, 4,  4,  5,  5,  6,  6,
+                                           7, 7, 8,  8,  9,  9,  10, 10,
+                                           11, 11, 12, 12, 13, 13};
+
+    int code{28};
+    while (lenbase[code] > len)
+      --code;
+    putsymbol(unsigned(257 + code));
+    putbits(len - lenbase[code], lenextra[code]);
+
+    code = 29;
+    while (distbase[code] > dist)
+      --code;
+    puthuffman(unsigned(code), 5);
+    putbits(dist - distbase[code], distextra[code]);
+  }
+
+  unsigned hash(size_t pos) const {
+    return ((unsigned(window[pos]) << 10) ^ (unsigned(window[pos + 1]) << 5) ^
+            unsigned(window[pos + 2])) &
+           0x7FFF;
+  }
+
+  void insert(size_t pos) {
+    unsigned h{hash(pos)};
+    prev[pos] = head[h];
+    head[h] = int(pos);
+  }
+
+  // Compress everything after the history as one block
+  void compressblock(bool final) {
+    const size_t end{window.size()};
+
+    putbits(final ? 1 : 0, 1);
+    putbits(1, 2); // Fixed Huffman codes
+
+    std::fill(head.begin(), head.end(), -1);
+    prev.resize(end);
+    for (size_t i{}; i + 2 < histlen; ++i)
+      insert(i);
+
+    size_t pos{histlen};
+    while (pos < end) {
+      size_t bestlen{}, bestdist{};
+      if (pos + 2 < end) {
+        const size_t limit{std::min(size_t(maxmatch), end - pos)};
+        int candidate{head[hash(pos)]};
+        for (int steps{}; candidate >= 0 && steps < maxchain; ++steps) {
+          size_t dist{pos - size_t(candidate)};
+          if (dist > maxdistance)
+            break;
+
+          // A candidate can only be better if it matches one more byte
+          size_t len{};
+          if (bestlen == 0 ||
+              (bestlen < limit && window[size_t(candidate) + bestlen] ==
+                                      window[pos + bestlen])) {
+            while (len < limit &&
+                   window[size_t(candidate) + len] == window[pos + len])
+              ++len;
+          }
+
+          if (len > bestlen) {
+            bestlen = len;
+            bestdist = dist;
+
+            // Long matches are good enough, don't look any further
+            if (len >= std::min(limit, size_t(nicematch)))
+              break;
+          }
+          candidate = prev[size_t(candidate)];
+        }
+      }
+
+      if (bestlen >= 3) {
+        putmatch(bestlen, bestdist);
+
+        // Indexing every byte of a long match is slow and hardly useful
+        const size_t numofinserts{bestlen <= maxinsert ? bestlen : 1};
+        for (size_t k{}; k < numofinserts; ++k) {
+          if (pos + k + 2 < end)
+            insert(pos + k);
+        }
+        pos += bestlen;
+      } else {
+        putsymbol(window[pos]);
+        if (pos + 2 < end)
+          insert(pos);
+        ++pos;
+      }
+    }
+
+    putsymbol(256); // End of block
+
+    // Keep the last 32 kB as the history for the next block
+    if (end > maxdistance)
+      window.erase(window.begin(), window.end() - maxdistance);
+    histlen = window.size();
+
+    flushoutput();
+  }
+
+  void flushoutput() {
+    if (!out.empty()) {
+      sink(out.data(), out.size());
+      out.clear();
+    }
+  }
+
+public:
+  explicit ZlibWriter(Sink asink)
+      : sink{asink}, window{}, histlen{0}, head(1 << 15, -1), prev{}, out{},
+        bitbuf{0}, bitcount{0}, adler_a{1}, adler_b{0}, finished{false} {
+    // CMF = deflate with a 32 kB window, FLG = no dictionary, fastest
+    out += char(0x78);
+    out += char(0x01);
+  }
+
+  ZlibWriter(const ZlibWriter &) = delete;
+  void operator=(const ZlibWriter &) = delete;
+
+  void write(const char *data, size_t len) {
+    assert(!finished);
+    const unsigned char *bytes{reinterpret_cast<const unsigned char *>(data)};
+    // The sums cannot overflow 32 bits in 5552 steps (see RFC 1950)
+    for (size_t start{}; start < len; start += 5552) {
+      const size_t stop{std::min(len, start + 5552)};
+      for (size_t i{start}; i < stop; ++i) {
+        adler_a += bytes[i];
+        adler_b += adler_a;
+      }
+      adler_a %= 65521;
+      adler_b %= 65521;
+    }
+
+    while (len > 0) {
+      // Compress a full block only when more data is coming, so that
+      // the last one can be marked as final
+      if (window.size() == histlen + blocksize)
+        compressblock(false);
+
+      size_t take{std::min(len, histlen + blocksize - window.size())};
+      window.insert(window.end(), bytes, bytes + take);
+      bytes += take;
+      len -= take;
+    }
+  }
+
+  void finish() {
+    if (finished)
+      return;
+
+    compressblock(true);
+    if (bitcount > 0)
+      putbits(0, 8 - bitcount);
+
+    unsigned long checksum{(adler_b << 16) | adler_a};
+    for (int shift{24}; shift >= 0; shift -= 8)
+      out += char((checksum >> shift) & 0xFF);
+
+    flushoutput();
+    finished = true;
+  }
+};
+
+/// Return the CRC-32 of `len` bytes, as used by PNG files, continuing
+/// the one of the bytes before them (`crc`)
+inline uint32_t crc32(const unsigned char *data, size_t len,
+                      uint32_t crc = 0) {
+  struct Table {
+    uint32_t values[256];
+
+    Table() : values{} {
+      for (uint32_t i{}; i < 256; ++i) {
+        uint32_t value{i};
+        for (int bit{}; bit < 8; ++bit)
+          value = (value & 1) ? 0xEDB88320U ^ (value >> 1) : value >> 1;
+        values[i] = value;
+      }
+    }
+  };
+  static const Table table;
+
+  crc = ~crc;
+  for (size_t i{}; i < len; ++i)
+    crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+/** Append a PNG file to `result`, containing an image with `cols` ×
+ * `rows` pixels stored by rows, from the top one
+ *
+ * The image has 8 bits per channel and an alpha channel. Rows are not
+ * filtered, and they are compressed with ZlibWriter: images of data
+ * with large uniform areas, like density maps, compress well anyway.
+ */
+inline void encodepng(std::string &result, size_t cols, size_t rows,
+                      const Color8 *pixels) {
+  static_assert(sizeof(Color8) == 4, "Color8 must be packed as RGBA");
+
+  auto put32 = [](std::string &dest, uint32_t value) {
+    for (int shift{24}; shift >= 0; shift -= 8)
+      dest += char((value >> shift) & 0xFF);
+  };
+  auto chunk = [&](const char *type, const std::string &data) {
+    put32(result, uint32_t(data.size()));
+    const size_t start{result.size()};
+    result.append(type, 4);
+    result += data;
+    put32(result, crc32(reinterpret_cast<const unsigned char *>(
+                            result.data() + start),
+                        result.size() - start));
+  };
+
+  result.append("\x89PNG\r\n\x1a\n", 8);
+
+  std::string header;
+  put32(header, uint32_t(cols));
+  put32(header, uint32_t(rows));
+  header.append("\x08\x06\x00\x00\x00", 5); // RGBA, 8 bits per channel
+  chunk("IHDR", header);
+
+  std::string compressed;
+  ZlibWriter writer{[&compressed](const char *data, size_t len) {
+    compressed.append(data, len);
+  }};
+  const char nofilter{0};
+  for (size_t row{}; row < rows; ++row) {
+    writer.write(&nofilter, 1);
+    writer.write(reinterpret_cast<const char *>(pixels + row * cols),
+                 cols * sizeof(Color8));
+  }
+  writer.finish();
+  chunk("IDAT", compressed);
+  chunk("IEND", std::string{});
+}
+
+/// Append `len` bytes starting from `data` to `result`, encoded in
+/// Base64 (RFC 4648)
+inline void encodebase64(std::string &result, const char *data, size_t len) {
+  static const char digits[]{
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+  const unsigned char *bytes{reinterpret_cast<const unsigned char *>(data)};
+
+  result.reserve(result.size() + (len + 2) / 3 * 4);
+  size_t i{};
+  for (; i + 3 <= len; i += 3) {
+    const uint32_t group{(uint32_t(bytes[i]) << 16) |
+                         (uint32_t(bytes[i + 1]) << 8) | bytes[i + 2]};
+    for (int shift{18}; shift >= 0; shift -= 6)
+      result += digits[(group >> shift) & 63];
+  }
+
+  if (i < len) {
+    uint32_t group{uint32_t(bytes[i]) << 16};
+    if (i + 1 < len)
+      group |= uint32_t(bytes[i + 1]) << 8;
+    result += digits[(group >> 18) & 63];
+    result += digits[(group >> 12) & 63];
+    result += i + 1 < len ? digits[(group >> 6) & 63] : '=';
+    result += '=';
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** A streaming implementation of the 64-bit xxHash function
+ *
+ * Data can be passed to `update` in pieces of any size; `digest`
+ * returns the hash of everything passed so far, and it does not change
+ * the state, so that more data can be added afterwards. The result is
+ * the same as the reference implementation (XXH64), on every platform.
+ */
+class XXHash64 {
+private:
+  static constexpr uint64_t prime1{0x9E3779B185EBCA87ULL};
+  static constexpr uint64_t prime2{0xC2B2AE3D27D4EB4FULL};
+  static constexpr uint64_t prime3{0x165667B19E3779F9ULL};
+  static constexpr uint64_t prime4{0x85EBCA77C2B2AE63ULL};
+  static constexpr uint64_t prime5{0x27D4EB2F165667C5ULL};
+
+  uint64_t acc[4];
+  unsigned char buffer[32];
+  size_t buffered;
+  uint64_t total;
+  uint64_t seed;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  // The input is little-endian, whatever the platform
+  static uint64_t read64(const unsigned char *p) {
+    uint64_t result{};
+    for (int i{7}; i >= 0; --i)
+      result = (result << 8) | p[i];
+    return result;
+  }
+
+  static uint64_t read32(const unsigned char *p) {
+    return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) |
+           (uint64_t(p[3]) << 24);
+  }
+
+  static uint64_t round(uint64_t accumulator, uint64_t input) {
+    return rotl(accumulator + input * prime2, 31) * prime1;
+  }
+
+  static uint64_t merge(uint64_t hash, uint64_t accumulator) {
+    return (hash ^ round(0, accumulator)) * prime1 + prime4;
+  }
+
+  void stripe(const unsigned char *p) {
+    for (int i{}; i < 4; ++i)
+      acc[i] = round(acc[i], read64(p + 8 * i));
+  }
+
+public:
+  explicit XXHash64(uint64_t aseed = 0) { reset(aseed); }
+
+  /// Forget all the data, and start again with a new seed
+  void reset(uint64_t aseed = 0) {
+    seed = aseed;
+    acc[0] = seed + prime1 + prime2;
+    acc[1] = seed + prime2;
+    acc[2] = seed;
+    acc[3] = seed - prime1;
+    buffered = 0;
+    total = 0;
+  }
+
+  /// Add `len` bytes to the data being hashed
+  void update(const void *data, size_t len) {
+    const unsigned char *p{static_cast<const unsigned char *>(data)};
+    total += len;
+
+    if (buffered > 0) {
+      size_t take{std::min(len, sizeof(buffer) - buffered)};
+      std::memcpy(buffer + buffered, p, take);
+      buffered += take;
+      p += take;
+      len -= take;
+      if (buffered < sizeof(buffer))
+        return;
+
+      stripe(buffer);
+      buffered = 0;
+    }
+
+    for (; len >= sizeof(buffer); p += sizeof(buffer), len -= sizeof(buffer))
+      stripe(p);
+
+    std::memcpy(buffer, p, len);
+    buffered = len;
+  }
+
+  /// Return the hash of the data passed so far
+  uint64_t digest() const;
+
+  /// Return the number of bytes passed so far
+  uint64_t size() const { return total; }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE uint64_t XXHash64::digest() const {
+  uint64_t hash;
+  if (total >= sizeof(buffer)) {
+    hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) +
+           rotl(acc[3], 18);
+    for (uint64_t accumulator : acc)
+      hash = merge(hash, accumulator);
+  } else {
+    hash = seed + prime5;
+  }
+  hash += total;
+
+  const unsigned char *p{buffer}, *end{buffer + buffered};
+  for (; p + 8 <= end; p += 8)
+    hash = rotl(hash ^ round(0, read64(p)), 27) * prime1 + prime4;
+  if (p + 4 <= end) {
+    hash = rotl(hash ^ (read32(p) * prime1), 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    hash = rotl(hash ^ (*p * prime5), 11) * prime1;
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+#endif // MONET_DEFINITIONS
+
+/// Return a hash of the content of `gradient`, so that canvases can
+/// write equal gradients only once
+inline uint64_t hashgradient(const Gradient &gradient) {
+  const double header[]{double(gradient.type), double(gradient.space),
+                        gradient.start.x,      gradient.start.y,
+                        gradient.end.x,        gradient.end.y,
+                        gradient.radius};
+  XXHash64 hash;
+  hash.update(header, sizeof(header));
+  for (const GradientStop &stop : gradient.stops) {
+    const double values[]{stop.offset, stop.color.r, stop.color.g,
+                          stop.color.b};
+    hash.update(values, sizeof(values));
+  }
+  return hash.digest();
+}
+
+/** A stream buffer that hashes the data passing through it
+ *
+ * Everything written is added to `hash` and forwarded to `next`, which
+ * can be null: in this case, the data is only hashed. This is useful to
+ * check if a document would be the same as one written before, without
+ * writing it.
+ */
+class HashingStreamBuf : public std::streambuf {
+private:
+  std::unique_ptr<std::ostream> next;
+  std::shared_ptr<XXHash64> hash;
+  char buf[4096];
+
+  bool forward() {
+    size_t len{size_t(pptr() - pbase())};
+    hash->update(pbase(), len);
+    if (next)
+      next->write(pbase(), std::streamsize(len));
+
+    setp(buf, buf + sizeof(buf));
+    return !next || next->good();
+  }
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (!forward())
+      return traits_type::eof();
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize count) override {
+    if (count > std::streamsize(sizeof(buf))) {
+      // Long strings skip the buffer
+      if (!forward())
+        return 0;
+      hash->update(s, size_t(count));
+      if (next)
+        next->write(s, count);
+      return count;
+    }
+
+    return std::streambuf::xsputn(s, count);
+  }
+
+  int sync() override {
+    if (!forward())
+      return -1;
+    if (next)
+      next->flush();
+    return 0;
+  }
+
+public:
+  HashingStreamBuf(std::unique_ptr<std::ostream> anext,
+                   std::shared_ptr<XXHash64> ahash)
+      : next{std::move(anext)}, hash{std::move(ahash)} {
+    assert(hash);
+    setp(buf, buf + sizeof(buf));
+  }
+
+  ~HashingStreamBuf() { sync(); }
+};
+
+/// A `std::ostream` that owns a HashingStreamBuf
+class HashingOStream : public std::ostream {
+private:
+  HashingStreamBuf hashbuf;
+
+public:
+  HashingOStream(std::unique_ptr<std::ostream> next,
+                 std::shared_ptr<XXHash64> hash)
+      : std::ostream{nullptr}, hashbuf{std::move(next), std::move(hash)} {
+    rdbuf(&hashbuf);
+  }
+
+  ~HashingOStream() { flush(); }
+};
+
+/** Return a stream that adds everything written to `hash` before
+ * passing it to `next` (which can be null, to discard the data)
+ *
+ * As canvases own their stream, `hash` is shared, so that it can be
+ * read after the canvas has been destroyed:
+ *
+ * \code{cpp}
+ * auto hash = std::make_shared<XXHash64>();
+ * {
+ *   SVGCanvas canv{hashstream(mmapstream("plot.svg"), hash), 100, 100};
+ *   // ...
+ * }
+ * std::cout << std::hex << hash->digest() << '\n';
+ * \endcode
+ */
+inline std::unique_ptr<std::ostream>
+hashstream(std::unique_ptr<std::ostream> next,
+           std::shared_ptr<XXHash64> hash) {
+  return std::unique_ptr<std::ostream>{
+      new HashingOStream{std::move(next), std::move(hash)}};
+}
+
+////////////////
+
+/** Format a number like `printf("%g")`, without depending on the locale
+ *
+ * The result has six significant digits, and it uses the exponential
+ * notation only for very large or small numbers. Unlike `printf`, the
+ * decimal separator is always a dot, and the digits are computed with
+ * one IEEE 754 operation followed by integer arithmetic, so they are
+ * the same on every platform. Digits are correctly rounded (as with
+ * glibc's `printf`) for numbers between 1e-17 and 1e27. Returns the
+ * length of the string written in `dest`, which must be at least 16
+ * bytes long.
+ */
+inline size_t formatgeneral(char *dest, size_t size, double value) {
+  static const double powersof10[]{1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                   1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                   1e18, 1e19, 1e20, 1e21, 1e22};
+  const int maxpower{22};
+
+  // Return round(value·10^power) as an integer
+  auto scaled = [&](double value, int power) -> long long {
+    if (power > maxpower || power < -maxpower) {
+      // Extremely large or small numbers: just be deterministic
+      for (; power > maxpower; power -= maxpower)
+        value *= powersof10[maxpower];
+      for (; power < -maxpower; power += maxpower)
+        value /= powersof10[maxpower];
+      return std::llround(power >= 0 ? value * powersof10[power]
+                                     : value / powersof10[-power]);
+    }
+
+    const double factor{powersof10[std::abs(power)]};
+    const double result{power >= 0 ? value * factor : value / factor};
+    const double lower{std::floor(result)};
+    if (result - lower != 0.5)
+      return std::llround(result);
+
+    // The result is halfway between two integers, but it has been
+    // rounded: the sign of the rounding error (computed exactly using
+    // fma, as `factor` is exact) tells which way to go
+    const double error{power >= 0 ? std::fma(value, factor, -result)
+                                   : -std::fma(result, factor, -value)};
+    const long long integer{static_cast<long long>(lower)};
+    if (error != 0)
+      return error > 0 ? integer + 1 : integer;
+
+    // A true tie: round half to even, like printf
+    return integer + integer % 2;
+  };
+
+  assert(size >= 16);
+  (void)size;
+
+  char *cur{dest};
+  if (std::isnan(value)) {
+    std::memcpy(dest, "nan", 4);
+    return 3;
+  }
+  if (std::signbit(value)) {
+    *cur++ = '-';
+    value = -value;
+  }
+  if (std::isinf(value)) {
+    std::memcpy(cur, "inf", 4);
+    return size_t(cur - dest) + 3;
+  }
+  if (value == 0) {
+    *cur++ = '0';
+    *cur = '\0';
+    return size_t(cur - dest);
+  }
+
+  // Find the exponent so that there are exactly six digits, correcting
+  // the estimate given by log10, which might be off by one
+  int exponent{int(std::floor(std::log10(value)))};
+  long long mantissa{scaled(value, 5 - exponent)};
+  if (mantissa >= 1000000)
+    mantissa = scaled(value, 5 - ++exponent);
+  else if (mantissa < 100000)
+    mantissa = scaled(value, 5 - --exponent);
+  if (mantissa >= 1000000) {
+    mantissa /= 10;
+    ++exponent;
+  }
+
+  char digits[6];
+  for (int i{5}; i >= 0; --i) {
+    digits[i] = char('0' + mantissa % 10);
+    mantissa /= 10;
+  }
+
+  int numofdigits{6};
+  while (numofdigits > 1 && digits[numofdigits - 1] == '0')
+    --numofdigits;
+
+  if (exponent >= -4 && exponent < 6) {
+    if (exponent >= 0) {
+      for (int i{}; i <= exponent; ++i)
+        *cur++ = digits[i];
+      if (numofdigits > exponent + 1) {
+        *cur++ = '.';
+        for (int i{exponent + 1}; i < numofdigits; ++i)
+          *cur++ = digits[i];
+      }
+    } else {
+      *cur++ = '0';
+      *cur++ = '.';
+      for (int i{-1}; i > exponent; --i)
+        *cur++ = '0';
+      for (int i{}; i < numofdigits; ++i)
+        *cur++ = digits[i];
+    }
+  } else {
+    *cur++ = digits[0];
+    if (numofdigits > 1) {
+      *cur++ = '.';
+      for (int i{1}; i < numofdigits; ++i)
+        *cur++ = digits[i];
+    }
+
+    *cur++ = 'e';
+    *cur++ = exponent < 0 ? '-' : '+';
+    int absexp{std::abs(exponent)};
+    if (absexp >= 100)
+      *cur++ = char('0' + absexp / 100);
+    *cur++ = char('0' + absexp / 10 % 10);
+    *cur++ = char('0' + absexp % 10);
+  }
+
+  *cur = '\0';
+  return size_t(cur - dest);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** A least-recently-used cache of formatted groups
+ *
+ * See `SVGCanvas::cachedgroup`. Entries are kept in memory until their
+ * total size exceeds `budget` bytes; then the ones that have not been
+ * used for the longest time are dropped. If `directory` is not empty,
+ * every entry is also saved there in a file, so that it can be found
+ * again after it has been dropped, or by another process; the
+ * directory must exist.
+ *
+ * A cache can be shared by several canvases, but not by several
+ * threads at the same time.
+ */
+class RenderCache {
+private:
+  struct Entry {
+    uint64_t key;
+    int level;
+    std::string bytes;
+  };
+
+  // The most recently used entry is the first one
+  std::list<Entry> entries;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> lookup;
+  size_t budget, used;
+  std::string directory;
+  uint64_t m_hits, m_misses, m_bytessaved;
+
+  // A function, as a static array would need one definition outside
+  // of the header
+  static const char *magic() { return "MONETRC1"; }
+  enum { magiclength = 8 };
+
+  std::string filename(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.mrc",
+                  static_cast<unsigned long long>(key));
+    return directory + name;
+  }
+
+  bool load(uint64_t key, int &level, std::string &bytes) const;
+  void save(uint64_t key, int level, const std::string &bytes) const;
+
+  void evict() {
+    while (used > budget && !entries.empty()) {
+      used -= entries.back().bytes.size();
+      lookup.erase(entries.back().key);
+      entries.pop_back();
+    }
+  }
+
+  void keep(uint64_t key, int level, std::string bytes) {
+    auto old = lookup.find(key);
+    if (old != lookup.end()) {
+      used -= old->second->bytes.size();
+      entries.erase(old->second);
+    }
+
+    used += bytes.size();
+    entries.push_front(Entry{key, level, std::move(bytes)});
+    lookup[key] = entries.begin();
+    evict();
+  }
+
+public:
+  explicit RenderCache(size_t abudget = size_t(64) << 20,
+                       const std::string &adirectory = "")
+      : entries{}, lookup{}, budget{abudget}, used{0}, directory{adirectory},
+        m_hits{0}, m_misses{0}, m_bytessaved{0} {}
+
+  /// Return the entry associated with `key`, or null if there is none.
+  /// `level` is set to the indentation level of its first line
+  const std::string *find(uint64_t key, int &level);
+
+  /// Add an entry, replacing any other one with the same key
+  void insert(uint64_t key, int level, std::string bytes) {
+    if (!directory.empty())
+      save(key, level, bytes);
+    keep(key, level, std::move(bytes));
+  }
+
+  /// Drop every entry kept in memory (files are not removed)
+  void clear() {
+    entries.clear();
+    lookup.clear();
+    used = 0;
+  }
+
+  /// Change the maximum number of bytes kept in memory
+  void setbudget(size_t abudget) {
+    budget = abudget;
+    evict();
+  }
+
+  /// Return the number of bytes kept in memory
+  size_t memoryused() const { return used; }
+
+  /// Return the number of entries kept in memory
+  size_t size() const { return entries.size(); }
+
+  /// Return how many times `find` has found an entry
+  uint64_t hits() const { return m_hits; }
+
+  /// Return how many times `find` has returned null
+  uint64_t misses() const { return m_misses; }
+
+  /// Return the fraction of calls to `find` that found an entry
+  double hitrate() const {
+    return m_hits + m_misses > 0 ? double(m_hits) / double(m_hits + m_misses)
+                                 : 0.0;
+  }
+
+  /// Return the number of bytes that have been copied from the cache
+  /// instead of being formatted
+  uint64_t bytessaved() const { return m_bytessaved; }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE const std::string *RenderCache::find(uint64_t key, int &level) {
+  auto it = lookup.find(key);
+  if (it != lookup.end()) {
+    // Move the entry to the front of the list
+    entries.splice(entries.begin(), entries, it->second);
+  } else {
+    std::string bytes;
+    if (directory.empty() || !load(key, level, bytes)) {
+      ++m_misses;
+      return nullptr;
+    }
+
+    keep(key, level, std::move(bytes));
+    it = lookup.find(key);
+    if (it == lookup.end()) {
+      // The entry is larger than the budget, so it was dropped at once
+      ++m_misses;
+      return nullptr;
+    }
+  }
+
+  ++m_hits;
+  m_bytessaved += it->second->bytes.size();
+  level = it->second->level;
+  return &it->second->bytes;
+}
+
+MONET_INLINE bool RenderCache::load(uint64_t key, int &level,
+                                    std::string &bytes) const {
+  std::ifstream in{filename(key), std::ios::binary};
+  char header[magiclength];
+  int32_t storedlevel;
+  uint64_t storedkey, length;
+  if (!in.read(header, sizeof(header)) ||
+      std::memcmp(header, magic(), sizeof(header)) != 0 ||
+      !in.read(reinterpret_cast<char *>(&storedkey), sizeof(storedkey)) ||
+      !in.read(reinterpret_cast<char *>(&storedlevel), sizeof(storedlevel)) ||
+      !in.read(reinterpret_cast<char *>(&length), sizeof(length)) ||
+      storedkey != key || storedlevel < 0)
+    return false;
+
+  // A damaged entry must not make us allocate more than the file holds
+  const std::streamoff start{in.tellg()};
+  if (start < 0 || !in.seekg(0, std::ios::end))
+    return false;
+  const std::streamoff end{in.tellg()};
+  if (end < start || length != uint64_t(end - start) || !in.seekg(start))
+    return false;
+
+  bytes.resize(size_t(length));
+  if (length > 0 && !in.read(&bytes[0], std::streamsize(length)))
+    return false;
+
+  level = storedlevel;
+  return true;
+}
+
+MONET_INLINE void RenderCache::save(uint64_t key, int level,
+                                    const std::string &bytes) const {
+  // Write a temporary file and rename it, so that other processes
+  // never see an incomplete entry
+  const std::string name{filename(key)};
+  const std::string tmpname{name + ".tmp"};
+  bool ok;
+  {
+    std::ofstream out{tmpname, std::ios::binary};
+    const int32_t storedlevel{level};
+    const uint64_t length{bytes.size()};
+    out.write(magic(), magiclength);
+    out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+    out.write(reinterpret_cast<const char *>(&storedlevel),
+              sizeof(storedlevel));
+    out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.write(bytes.data(), std::streamsize(bytes.size()));
+    out.close();
+    ok = bool(out);
+  }
+  if (!ok || std::rename(tmpname.c_str(), name.c_str()) != 0)
+    std::remove(tmpname.c_str());
+}
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef MONET_WITH_SVGREADER
+
+/** A streaming reader for SVG files
+ *
+ * `parse` scans a document once, and it calls `startelement`,
+ * `endelement`, and `characters` for what it finds, as a SAX parser
+ * does. Nothing is copied: names, attribute values, and text are
+ * passed as slices of the document, with their entities unchanged.
+ * Only the subset of XML used by SVG files (and by SVGCanvas in
+ * particular) is supported: DTDs are skipped, and namespaces are not
+ * resolved.
+ */
+class SVGReader {
+public:
+  /// A range of characters in the document
+  struct Slice {
+    const char *begin, *end;
+
+    size_t size() const { return size_t(end - begin); }
+    bool operator==(const Slice &other) const {
+      return size() == other.size() &&
+             std::memcmp(begin, other.begin, size()) == 0;
+    }
+    bool operator==(const char *str) const {
+      return std::strlen(str) == size() && std::memcmp(begin, str, size()) == 0;
+    }
+    std::string str() const { return std::string{begin, end}; }
+  };
+
+  struct Attribute {
+    Slice name;
+    Slice value; // Without the quotes
+  };
+
+private:
+  std::vector<Attribute> attributes;
+  std::vector<Slice> elements; // The names of the open elements
+
+  static bool isspace(char ch) {
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+  }
+
+  // Return the first occurrence of `what` in the range, or `nullptr`
+  static const char *find(const char *begin, const char *end,
+                          const char *what) {
+    const char *result{
+        std::search(begin, end, what, what + std::strlen(what))};
+    return result == end ? nullptr : result;
+  }
+
+protected:
+  /// Called for every start tag, with the name of the element, its
+  /// attributes, and the whole tag from `<` to `>`. Empty elements
+  /// (e.g., `<circle .../>`) are followed by a call to `endelement`
+  /// with an empty tag
+  virtual void startelement(const Slice &, const std::vector<Attribute> &,
+                            const Slice &) {}
+
+  /// Called for every end tag, with the name of the element and the
+  /// whole tag
+  virtual void endelement(const Slice &, const Slice &) {}
+
+  /// Called for the text between two tags, including whitespace, and
+  /// for the content of CDATA sections
+  virtual void characters(const Slice &) {}
+
+public:
+  SVGReader() : attributes{}, elements{} {}
+  virtual ~SVGReader() {}
+
+  /// Scan `size` bytes starting from `data`; return false if they are
+  /// not a well-formed document
+  bool parse(const char *data, size_t size);
+
+  /// Look for the attribute `name`; return false if it is not present
+  static bool findattribute(const std::vector<Attribute> &attributes,
+                            const char *name, Slice &value) {
+    for (const Attribute &attr : attributes) {
+      if (attr.name == name) {
+        value = attr.value;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE bool SVGReader::parse(const char *data, size_t size) {
+  const char *cur{data}, *end{data + size};
+  bool root{false};
+  elements.clear();
+
+  while (cur < end) {
+    const char *tag{
+        static_cast<const char *>(std::memchr(cur, '<', size_t(end - cur)))};
+    if (!tag)
+      tag = end;
+
+    if (tag > cur) {
+      if (!elements.empty())
+        characters(Slice{cur, tag});
+      else if (!std::all_of(cur, tag, isspace))
+        return false;
+    }
+    if (tag == end)
+      break;
+
+    // Comments, CDATA sections, processing instructions, and DTDs
+    cur = tag + 1;
+    if (cur < end && (*cur == '!' || *cur == '?')) {
+      const char *terminator{">"};
+      const bool cdata{size_t(end - cur) >= 8 &&
+                       std::memcmp(cur, "![CDATA[", 8) == 0};
+      if (cdata)
+        terminator = "]]>";
+      else if (size_t(end - cur) >= 3 && std::memcmp(cur, "!--", 3) == 0)
+        terminator = "-->";
+      else if (*cur == '?')
+        terminator = "?>";
+
+      const char *close{find(cur + 1, end, terminator)};
+      if (!close || (cdata && elements.empty()))
+        return false;
+      if (cdata)
+        characters(Slice{cur + 8, close});
+
+      cur = close + std::strlen(terminator);
+      continue;
+    }
+
+    if (cur < end && *cur == '/') {
+      const char *p{cur + 1};
+      while (p < end && !isspace(*p) && *p != '>')
+        ++p;
+      const Slice name{cur + 1, p};
+      while (p < end && isspace(*p))
+        ++p;
+      if (p == end || *p != '>' || elements.empty() ||
+          !(elements.back() == name))
+        return false;
+
+      elements.pop_back();
+      cur = p + 1;
+      endelement(name, Slice{tag, cur});
+      continue;
+    }
+
+    const char *p{cur};
+    while (p < end && !isspace(*p) && *p != '>' && *p != '/')
+      ++p;
+    const Slice name{cur, p};
+    if (name.size() == 0 || (root && elements.empty()))
+      return false;
+
+    attributes.clear();
+    bool empty{false};
+    for (;;) {
+      while (p < end && isspace(*p))
+        ++p;
+      if (p == end)
+        return false;
+      if (*p == '>') {
+        ++p;
+        break;
+      }
+      if (*p == '/') {
+        if (end - p < 2 || p[1] != '>')
+          return false;
+        empty = true;
+        p += 2;
+        break;
+      }
+
+      const char *attrname{p};
+      while (p < end && !isspace(*p) && *p != '=' && *p != '>' && *p != '/')
+        ++p;
+      const Slice attr{attrname, p};
+      while (p < end && isspace(*p))
+        ++p;
+      if (attr.size() == 0 || p == end || *p != '=')
+        return false;
+      ++p;
+      while (p < end && isspace(*p))
+        ++p;
+      if (p == end || (*p != '"' && *p != '\''))
+        return false;
+
+      const char *value{p + 1};
+      const char *close{static_cast<const char *>(
+          std::memchr(value, *p, size_t(end - value)))};
+      if (!close)
+        return false;
+      attributes.push_back(Attribute{attr, Slice{value, close}});
+      p = close + 1;
+    }
+
+    root = true;
+    cur = p;
+    startelement(name, attributes, Slice{tag, cur});
+    if (empty)
+      endelement(name, Slice{cur, cur});
+    else
+      elements.push_back(name);
+  }
+
+  return root && elements.empty();
+}
+#endif // MONET_DEFINITIONS
+#endif // MONET_WITH_SVGREADER
+
+////////////////
+
+/// How SVGCanvas lays out the text of the document
+enum class SVGLayout {
+  /// Indent nested elements, and put long lists of attributes on
+  /// several lines
+  Indented,
+  /// Write every element on one line, without indentation
+  Compact,
+};
+
+/** A SVG canvas
+ *
+ * This object represents a write-only SVG file where painting
+ * operations can be issued and saved.
+ *
+ * \code{cpp}
+ * #include "monet.h"
+ *
+ * using namespace monet;
+ *
+ * int main() {
+ *   SVGCanvas canv{"simple.svg", 100, 100};
+ *
+ *   // Create a closed path
+ *   canv.moveto(Point(0.0, 0.0));
+ *   canv.lineto(Point(100.0, 0.0));
+ *   canv.lineto(Point(100.0, 100.0));
+ *   canv.closepath();
+ *   canv.strokepath();
+ * }
+ * \endcode
+ */
+class SVGCanvas : public BaseCanvas {
+private:
+  const int tabwidth{2};
+
+  std::unique_ptr<std::ostream> stream;
+  bool compact;
+  int indentlevel;
+  double width, height;
+  std::string pathspec;
+  int m_grouplevel;
+
+  // Rectangular clipping regions, sorted by id. They are written in
+  // the <defs> only when they are needed (see `setclipgeometry`)
+  struct ClipShape {
+    int id;
+    bool written;
+    double xmin, ymin, xmax, ymax;
+  };
+
+  // A region in use: `shape` is its index in `clipshapes`, or -1. Its
+  // <g> element is written by `openclip`, which is not called while
+  // the canvas can clip the geometry itself
+  struct ActiveClip {
+    int id, shape;
+    bool open;
+    Matrix ctm;
+  };
+
+  enum class ClipTest { Inside, Outside, Partial };
+
+  int numofclipregions;
+  std::vector<ClipShape> clipshapes;
+  std::vector<ActiveClip> clips;
+  bool definingclip;
+  bool clipgeometry;
+
+  // Number of regions defined or used, and of files included, so far:
+  // their ids depend on what was drawn before (see `drawcached`)
+  size_t clipcalls;
+  int numofimports;
+
+  // While `capturing` is positive, the output is also appended to
+  // `captured`, so that it can be saved in `cache`
+  std::shared_ptr<RenderCache> cache;
+  std::string captured;
+  int capturing;
+
+  // Opaque strokes with the same style are merged into the path data
+  // in `batch`, which is written by `flushbatch` (see `setmergestrokes`)
+  bool merging;
+  std::string batch;
+  Color batchcolor;
+  StrokeStyle batchstyle;
+
+  // Used by the bulk primitives to write each color once, and to skip
+  // the items that are clipped away (see `cullitems`)
+  ColorGroups colorgroups;
+  std::vector<size_t> keptitems;
+  std::vector<Color> keptcolors;
+
+  // Hashes of the gradients and the patterns written in the <defs> so
+  // far. While `fillpaint` is not null, shapes are filled with the
+  // paint whose id is `fillpaint` followed by `fillkey`
+  std::unordered_set<uint64_t> gradients;
+  std::unordered_set<uint64_t> patterns;
+  std::vector<GradientStop> gradientstops;
+  const char *fillpaint;
+  uint64_t fillkey;
+
+  // The text of the element being written is accumulated in `buf`,
+  // which lives in `arena`, and is sent to `stream` by `endelement`
+  Arena arena;
+  char *buf;
+  size_t buflen, bufsize;
+
+  void growbuffer(size_t minsize) {
+    size_t newsize{std::max(std::max(minsize, 2 * bufsize), size_t(256))};
+    char *newbuf{static_cast<char *>(arena.allocate(newsize, 1))};
+    if (buflen > 0)
+      std::memcpy(newbuf, buf, buflen);
+
+    buf = newbuf;
+    bufsize = newsize;
+  }
+
+  void write(const char *str, size_t len) {
+    if (buflen + len > bufsize)
+      growbuffer(buflen + len);
+
+    std::memcpy(buf + buflen, str, len);
+    buflen += len;
+  }
+
+  void write(const char *str) { write(str, std::strlen(str)); }
+
+  // Write a string literal without scanning it for the terminating
+  // '\0': its length is known at compile time
+  template <size_t N> void writelit(const char (&str)[N]) { write(str, N - 1); }
+
+  void writenum(double value) {
+    char num[32];
+    write(num, formatnumber(num, sizeof(num), value));
+  }
+
+  void writecolor(Color col) {
+    char hex[8];
+    write(hex, formatcolor(hex, sizeof(hex), col));
+  }
+
+  void writepaintid(const char *prefix, uint64_t key) {
+    static const char digits[]{"0123456789abcdef"};
+    char hex[16];
+    for (int i{15}; i >= 0; --i, key >>= 4)
+      hex[i] = digits[key & 15];
+    write(prefix);
+    write(hex, sizeof(hex));
+  }
+
+  // Write the fill color, or a reference to the paint being drawn
+  void writefill() {
+    if (fillpaint) {
+      writelit("url(#");
+      writepaintid(fillpaint, fillkey);
+      writelit(")");
+    } else
+      writecolor(getfillcolor());
+  }
+
+#ifdef MONET_WITH_SVGFILLS
+  // Write `gradient` in the <defs>, if needed, and fill the next shapes
+  // with it until `endgradient` is called
+  void begingradient(const Gradient &gradient);
+  void endgradient() { fillpaint = nullptr; }
+
+  // The same for patterns, whose tile is replayed into the <defs>
+  void beginpattern(const Pattern &pattern);
+  void endpattern() { fillpaint = nullptr; }
+#endif // MONET_WITH_SVGFILLS
+
+  // Cut a filled rectangle to the region returned by `cullingshape`;
+  // return false if nothing is left
+  bool cutrectangle(double &x1, double &y1, double &x2, double &y2);
+
+  void writeopacity() {
+    if (gettransparency() > 0) {
+      writelit(" opacity=\"");
+      writenum(1 - gettransparency());
+      writelit("\"");
+    }
+  }
+
+  // Write the opacity of the colors used by `act`
+  void writealpha(Action act) {
+    if (act != Action::Fill && getstrokealpha() < 1) {
+      writelit(" stroke-opacity=\"");
+      writenum(getstrokealpha());
+      writelit("\"");
+    }
+    if (act != Action::Stroke && getfillalpha() < 1) {
+      writelit(" fill-opacity=\"");
+      writenum(getfillalpha());
+      writelit("\"");
+    }
+  }
+
+  // Write the attributes of the stroke that differ from SVG's defaults
+  void writestrokestyle() {
+    const StrokeStyle &style{getstrokestyle()};
+
+    if (style.join != LineJoin::Miter) {
+      writelit(" stroke-linejoin=\"");
+      write(style.join == LineJoin::Round ? "round" : "bevel");
+      writelit("\"");
+    }
+
+    if (style.cap != LineCap::Butt) {
+      writelit(" stroke-linecap=\"");
+      write(style.cap == LineCap::Round ? "round" : "square");
+      writelit("\"");
+    }
+
+    if (style.miterlimit != 4.0) {
+      writelit(" stroke-miterlimit=\"");
+      writenum(style.miterlimit);
+      writelit("\"");
+    }
+
+    if (!style.dashes.empty()) {
+      writelit(" stroke-dasharray=\"");
+      for (size_t i{}; i < style.dashes.size(); ++i) {
+        if (i > 0)
+          writelit(" ");
+        writenum(style.dashes[i]);
+      }
+      writelit("\"");
+
+      if (style.dashoffset != 0) {
+        writelit(" stroke-dashoffset=\"");
+        writenum(style.dashoffset);
+        writelit("\"");
+      }
+    }
+  }
+
+  void indent() { indent(indentlevel); }
+
+  // Write the colors and the stroke style used by `act`
+  void writepaint(Action act) {
+    if (act == Action::Stroke)
+      writelit(" fill=\"none\"");
+    else {
+      writelit(" fill=\"");
+      writecolor(getfillcolor());
+      writelit("\"");
+    }
+
+    if (act == Action::Fill)
+      writelit(" stroke=\"none\"");
+    else {
+      writelit(" stroke=\"");
+      writecolor(getstrokecolor());
+      writelit("\" stroke-width=\"");
+      writenum(getstrokewidth());
+      writelit("\"");
+      writestrokestyle();
+    }
+
+    writealpha(act);
+  }
+
+  void writeclipid(int id) {
+    writelit("monet_clip_path");
+    if (id > 0) {
+      writelit("_");
+      writenum(id);
+    }
+  }
+
+  void beginclipdefs(int id);
+  void endclipdefs();
+
+  // Write the <g> element of the innermost clipping region in use, if
+  // it was not written yet
+  void openclip();
+
+  // Return the innermost region in use if the canvas must clip the
+  // geometry itself, otherwise null
+  const ClipShape *cullingshape() const {
+    if (clips.empty() || !clipgeometry || definingclip || capturing > 0)
+      return nullptr;
+
+    const ActiveClip &clip{clips.back()};
+    const Matrix &ctm{getctm()};
+    if (clip.shape < 0 || ctm.a != clip.ctm.a || ctm.b != clip.ctm.b ||
+        ctm.c != clip.ctm.c || ctm.d != clip.ctm.d || ctm.e != clip.ctm.e ||
+        ctm.f != clip.ctm.f)
+      return nullptr;
+    return &clipshapes[size_t(clip.shape)];
+  }
+
+  // How far strokes can extend beyond their geometry: half their
+  // width, times `factor` to account for square caps and miter joins
+  double strokemargin(Action act, double factor) const {
+    return act == Action::Fill ? 0 : 0.5 * getstrokewidth() * factor;
+  }
+
+  // Compare the box with corners (x1, y1) and (x2, y2), enlarged by
+  // `margin`, with a rectangular clipping region
+  static ClipTest cliptest(const ClipShape &shape, double x1, double y1,
+                           double x2, double y2, double margin) {
+    const double xmin{std::min(x1, x2) - margin};
+    const double xmax{std::max(x1, x2) + margin};
+    const double ymin{std::min(y1, y2) - margin};
+    const double ymax{std::max(y1, y2) + margin};
+    if (xmax < shape.xmin || xmin > shape.xmax || ymax < shape.ymin ||
+        ymin > shape.ymax)
+      return ClipTest::Outside;
+    if (xmin < shape.xmin || xmax > shape.xmax || ymin < shape.ymin ||
+        ymax > shape.ymax)
+      return ClipTest::Partial;
+    return ClipTest::Inside;
+  }
+
+  // Return false if the box is hidden by the region returned by
+  // `cullingshape`; if the box crosses its border, let the viewer clip
+  bool clipbox(double x1, double y1, double x2, double y2, double margin) {
+    const ClipShape *shape{cullingshape()};
+    if (!shape)
+      return true;
+
+    switch (cliptest(*shape, x1, y1, x2, y2, margin)) {
+    case ClipTest::Outside:
+      return false;
+    case ClipTest::Partial:
+      openclip();
+      return true;
+    default:
+      return true;
+    }
+  }
+
+  // Clip a segment to a box (Liang-Barsky); return false if nothing is
+  // left
+  static bool clipsegment(double &x1, double &y1, double &x2, double &y2,
+                          double xmin, double ymin, double xmax,
+                          double ymax);
+
+  // Fill `keptitems` and `keptcolors` with the items of a bulk
+  // primitive that are not hidden by the region returned by
+  // `cullingshape`, whose boxes are computed by `box`. Return false if
+  // the canvas does not clip the geometry
+  template <typename ItemBox>
+  bool cullitems(const Column<Color> &colors, size_t n, double margin,
+                 ItemBox box);
+
+  // Write the items of a bulk primitive: each color group becomes a
+  // <g> element carrying the style, and `item` writes its children
+  template <typename WriteItem>
+  void writearray(const Column<Color> &colors, size_t n, Action act,
+                  WriteItem item);
+
+  // Separate two attributes of the element being written
+  void nextattribute() {
+    if (compact) {
+      writelit(" ");
+    } else {
+      writelit("\n");
+      indent(indentlevel + 1);
+    }
+  }
+
+  void indent(int level) {
+    if (compact)
+      return;
+
+    static const char spaces[] = "                                ";
+    const int chunk{int(sizeof(spaces)) - 1};
+    for (int count{tabwidth * level}; count > 0; count -= chunk) {
+      write(spaces, size_t(std::min(count, chunk)));
+    }
+  }
+
+  void output(const char *data, size_t len) {
+    stream->write(data, std::streamsize(len));
+    if (capturing > 0)
+      captured.append(data, len);
+  }
+
+  // Send the element in `buf` to the output stream and recycle the arena
+  void endelement() {
+    output(buf, buflen);
+    arena.reset();
+    buf = nullptr;
+    buflen = bufsize = 0;
+  }
+
+  // Format a number like `std::ostream` does with its default settings
+  static size_t formatnumber(char *dest, size_t size, double value) {
+    return formatgeneral(dest, size, value);
+  }
+
+  static size_t formatcolor(char *dest, size_t size, Color col) {
+    assert(size >= 7);
+    return formathexcolor(dest, col);
+  }
+
+  static void appendverb(std::string &d, PathVerb verb, const double *pt);
+  static void formatpath(const Path &path, std::string &d);
+
+  // Return the attributes that align a text element
+  static const char *textanchor(HorizontalAlignment halign) {
+    switch (halign) {
+    case HorizontalAlignment::Left:
+      return "text-anchor=\"end\"";
+    case HorizontalAlignment::Center:
+      return "text-anchor=\"middle\"";
+    case HorizontalAlignment::Right:
+      return "text-anchor=\"start\"";
+    default:
+      abort();
+    }
+  }
+
+  static const char *textbaseline(VerticalAlignment valign) {
+    switch (valign) {
+    case VerticalAlignment::Top:
+      return "dominant-baseline=\"text-top\"";
+    case VerticalAlignment::Center:
+      return "dominant-baseline=\"central\"";
+    case VerticalAlignment::Middle:
+      return "dominant-baseline=\"middle\"";
+    case VerticalAlignment::Bottom:
+      return "dominant-baseline=\"text-bottom\"";
+    default:
+      abort();
+    }
+  }
+
+  void writetransforms(const TransformSequence &transforms);
+
+  // These are the specialized writers used by circlexy, rectanglexy,
+  // and the *path() methods: the branches on `act` are resolved at
+  // compile time, so every element is written as a sequence of
+  // constant strings and formatted numbers.
+  template <Action act> void emitcircle(double x, double y, double radius);
+  template <Action act>
+  void emitrectangle(double x1, double y1, double x2, double y2);
+  template <Action act>
+  void emitpath(const std::string &d, const TransformSequence &transforms);
+
+  const char *fontfamilyname() const;
+
+  // Return true if the stroke about to be drawn can be added to
+  // `batch`; otherwise, write the batch, so that the primitive can be
+  // written as a separate element
+  bool canmerge();
+  void flushbatch();
+
+  // Add a subpath joining up to four points to `batch`
+  void batchpolyline(const double *pt, int numofpoints, bool closed) {
+    assert(numofpoints <= 4);
+    char text[256];
+    size_t len{};
+    for (int i{}; i < numofpoints; ++i) {
+      if (i == 0) {
+        if (!batch.empty())
+          text[len++] = ' ';
+        text[len++] = 'M';
+      }
+      text[len++] = ' ';
+      len += formatnumber(text + len, 32, pt[2 * i]);
+      text[len++] = ',';
+      len += formatnumber(text + len, 32, pt[2 * i + 1]);
+    }
+    if (closed) {
+      text[len++] = ' ';
+      text[len++] = 'z';
+    }
+    batch.append(text, len);
+  }
+
+  // Write the content of a cache entry that was formatted at
+  // indentation level `level`
+  void splice(const std::string &bytes, int level);
+
+  // Copy the entry associated with `key` from the cache, or call
+  // `draw` and save what it writes
+  void drawcached(uint64_t key, const std::function<void()> &draw);
+
+protected:
+  MONET_VIRTUAL void movetoxy(double x, double y) override;
+  MONET_VIRTUAL void linetoxy(double x, double y) override;
+  MONET_VIRTUAL void quadratictoxy(double xdir, double ydir, double xend,
+                                   double yend) override;
+  MONET_VIRTUAL void cubictoxy(double xc1, double yc1, double xc2, double yc2,
+                               double xend, double yend) override;
+  MONET_VIRTUAL void linexy(double x1, double y1, double x2,
+                            double y2) override;
+  MONET_VIRTUAL void circlexy(double x, double y, double radius,
+                              Action act = Action::Stroke) override;
+  MONET_VIRTUAL void rectanglexy(double x1, double y1, double x2, double y2,
+                                 Action act = Action::Stroke) override;
+  MONET_VIRTUAL void textxy(double x, double y, const char *text,
+                            HorizontalAlignment halign,
+                            VerticalAlignment valign) override;
+  MONET_VIRTUAL void pathobject(const Path &path,
+                                const TransformSequence &transforms,
+                                Action act) override;
+  MONET_VIRTUAL void circlearray(const Column<double> &xs,
+                                 const Column<double> &ys,
+                                 const Column<double> &radii,
+                                 const Column<Color> &colors, size_t n,
+                                 Action act) override;
+  MONET_VIRTUAL void rectanglearray(const Column<double> &xs,
+                                    const Column<double> &ys,
+                                    const Column<double> &widths,
+                                    const Column<double> &heights,
+                                    const Column<Color> &colors, size_t n,
+                                    Action act) override;
+  MONET_VIRTUAL void textarray(const Column<double> &xs,
+                               const Column<double> &ys,
+                               const Column<std::string> &strings, size_t n,
+                               HorizontalAlignment halign,
+                               VerticalAlignment valign) override;
+#ifdef MONET_WITH_SVGFILLS
+  MONET_VIRTUAL void gradientcirclexy(double x, double y, double radius,
+                                      const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientrectanglexy(double x1, double y1, double x2,
+                                         double y2,
+                                         const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientpathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        const Gradient &gradient) override;
+  MONET_VIRTUAL void patterncirclexy(double x, double y, double radius,
+                                     const Pattern &pattern) override;
+  MONET_VIRTUAL void patternrectanglexy(double x1, double y1, double x2,
+                                        double y2,
+                                        const Pattern &pattern) override;
+  MONET_VIRTUAL void patternpathobject(const Path &path,
+                                       const TransformSequence &transforms,
+                                       const Pattern &pattern) override;
+  MONET_VIRTUAL void imagexy(double x1, double y1, double x2, double y2,
+                             size_t cols, size_t rows,
+                             const Color8 *pixels) override;
+#endif // MONET_WITH_SVGFILLS
+  MONET_VIRTUAL ClipRegion cliprectanglexy(double x1, double y1, double x2,
+                                           double y2) override;
+
+public:
+  /// Create a new SVG file with the specified width and height (in points)
+  SVGCanvas(const std::string &filename, double awidth, double aheight,
+            SVGLayout layout = SVGLayout::Indented);
+
+  /// Write a new SVG document with the specified width and height (in
+  /// points) into `out`, which can be any output stream (e.g., the one
+  /// returned by `mmapstream`)
+  SVGCanvas(std::unique_ptr<std::ostream> out, double awidth, double aheight,
+            SVGLayout layout = SVGLayout::Indented);
+  void operator=(const SVGCanvas &canvas) = delete;
+  MONET_VIRTUAL virtual ~SVGCanvas();
+
+  /// Returns true if the SVG file was created successfully
+  bool isok() const { return stream->good(); }
+
+  /// Terminate a path that was started by a call to Transform::moveto or
+  /// Transform::lineto
+  void closepath() override { pathspec += " z"; }
+
+  /// Draw the profile of the current path
+  MONET_VIRTUAL void strokepath() override;
+
+  /// Fill the interior of the current path
+  MONET_VIRTUAL void fillpath() override;
+
+  /// Draw the profile of the current path and fill its interior
+  MONET_VIRTUAL void fillandstrokepath() override;
+
+  /// Remove the path that has been drawn so far from memory
+  void clearpath() override { pathspec = ""; }
+
+  /// Start a new group of paint operations, possibly associated with a
+  /// transformation
+  MONET_VIRTUAL void begingroup(const TransformSequence &transforms = identity,
+                                const std::string &name = "") override;
+
+  /// Close the group that was started by the last call to Transform::begingroup
+  MONET_VIRTUAL void endgroup() override;
+
+  /// Return the group nest level, i.e., the number of unclosed calls to
+  /// Transform::begingroup
+  int grouplevel() const override { return m_grouplevel; }
+
+  /// Use `acache` to store the content of cached groups (see
+  /// `cachedgroup`). Pass null to stop caching
+  void setcache(std::shared_ptr<RenderCache> acache) {
+    cache = std::move(acache);
+  }
+  const std::shared_ptr<RenderCache> &getcache() const { return cache; }
+
+  /** Merge consecutive strokes with the same style into one element
+   *
+   * If `merge` is true, calls to `line`, and calls to `circle` and
+   * `rectangle` with Action::Stroke, are collected as subpaths of a
+   * single `<path>` element, as long as the stroke color and style do
+   * not change. Any other element (including groups and clipping)
+   * writes the pending strokes first, so the drawing order is kept.
+   * Translucent strokes are never merged, as overlapping subpaths of
+   * the same path would not be blended with each other.
+   */
+  void setmergestrokes(bool merge) {
+    if (!merge)
+      flushbatch();
+    merging = merge;
+  }
+  bool getmergestrokes() const { return merging; }
+
+  /** Draw a group whose content is kept in the cache set with `setcache`
+   *
+   * `draw` must paint the content of the group on the canvas it
+   * receives. If the cache already contains the content associated
+   * with `key` and with the current drawing parameters, it is copied
+   * without calling `draw`; otherwise `draw` is called with this
+   * canvas, and what it writes is saved in the cache. The key must
+   * therefore identify everything `draw` paints, including the
+   * choices it makes according to the effective scale.
+   *
+   * Changes to the drawing parameters made by `draw` are undone at the
+   * end of the group, so that the state of the canvas does not depend
+   * on whether the content was in the cache. Groups and clipping
+   * regions that `draw` leaves open are closed, and such content is
+   * not cached.
+   */
+  void cachedgroup(uint64_t key, const TransformSequence &transforms,
+                   const std::function<void(BaseCanvas &)> &draw,
+                   const std::string &name = "");
+
+  /// Like the other `cachedgroup`, but the key is computed by
+  /// recording what `draw` paints, so that the cache is used only if
+  /// the content has not changed. Recording is cheaper than formatting,
+  /// but it is not free: use an explicit key if one is available.
+  void cachedgroup(const TransformSequence &transforms,
+                   const std::function<void(BaseCanvas &)> &draw,
+                   const std::string &name = "");
+
+#ifdef MONET_WITH_SVGREADER
+  /** Draw the content of a SVG file written by SVGCanvas as a group
+   *
+   * The elements are copied as they are, path data included, and only
+   * their indentation and their ids are changed, so that they do not
+   * clash with the ones of this file. The content uses the
+   * coordinates of the canvas that wrote it, and `transforms` places
+   * it as in any other group. Return false, without writing anything,
+   * if the file cannot be read or it was not written by SVGCanvas.
+   */
+  bool includesvg(const std::string &filename,
+                  const TransformSequence &transforms = identity,
+                  const std::string &name = "");
+
+  /// Like the other `includesvg`, but the document is made by the
+  /// `size` bytes starting from `data`
+  bool includesvg(const char *data, size_t size,
+                  const TransformSequence &transforms = identity,
+                  const std::string &name = "");
+#endif // MONET_WITH_SVGREADER
+
+  /// Return the width of the SVG picture (in points)
+  double getwidth() const override { return width; }
+
+  /// Return the height of the SVG picture (in points)
+  double getheight() const override { return height; }
+
+  /// Start recording painting commands and use them to clip
+  MONET_VIRTUAL ClipRegion defineclip() override;
+
+  /// Terminate recording painting commands for clipping
+  MONET_VIRTUAL void endclip() override;
+
+  /// Apply the last clipping region that was defined
+  void useclip() override {
+    assert(numofclipregions > 0);
+    useclip(ClipRegion{numofclipregions - 1});
+  }
+
+  /// Apply the clipping region `region`
+  MONET_VIRTUAL void useclip(ClipRegion region) override;
+
+  /// Stop clipping
+  MONET_VIRTUAL void removeclip() override;
+
+  /** Clip the geometry to rectangular regions before writing it
+   *
+   * If `clip` is true, when the innermost clipping region in use was
+   * defined with `cliprectangle`, primitives that fall outside it are
+   * not written at all, and lines are shortened. The region is
+   * written in the file only if a primitive crosses its border and
+   * cannot be clipped exactly; filled rectangles always can. Groups
+   * started within the region are clipped by the viewer as usual.
+   */
+  void setclipgeometry(bool clip) {
+    if (!clip && !clips.empty() && !definingclip)
+      openclip();
+    clipgeometry = clip;
+  }
+  bool getclipgeometry() const { return clipgeometry; }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE const char *SVGCanvas::fontfamilyname() const {
+  switch (getfontfamily()) {
+  case FontFamily::SansSerif:
+    return "sans-serif";
+  case FontFamily::Serif:
+    return "serif";
+  case FontFamily::Monospaced:
+    return "monospace";
+  default:
+    abort();
+  }
+}
+
+MONET_INLINE void SVGCanvas::appendverb(std::string &d, PathVerb verb,
+                                        const double *pt) {
+  if (verb == PathVerb::Close) {
+    d += " z";
+    return;
+  }
+
+  if (!d.empty())
+    d += ' ';
+
+  if (verb == PathVerb::MoveTo)
+    d += "M ";
+  else if (verb == PathVerb::QuadraticTo)
+    d += "Q ";
+  else if (verb == PathVerb::CubicTo)
+    d += "C ";
+
+  char num[32];
+  for (size_t i{}; i < numofcoords(verb); i += 2) {
+    if (i > 0)
+      d += ' ';
+
+    d.append(num, formatnumber(num, sizeof(num), pt[i]));
+    d += ',';
+    d.append(num, formatnumber(num, sizeof(num), pt[i + 1]));
+  }
+}
+
+MONET_INLINE void SVGCanvas::formatpath(const Path &path, std::string &d) {
+  const double *pt{path.getcoords().data()};
+  for (PathVerb verb : path.getverbs()) {
+    appendverb(d, verb, pt);
+    pt += numofcoords(verb);
+  }
+}
+
+MONET_INLINE void SVGCanvas::movetoxy(double x, double y) {
+  const double pt[]{x, y};
+  appendverb(pathspec, PathVerb::MoveTo, pt);
+}
+
+MONET_INLINE void SVGCanvas::linetoxy(double x, double y) {
+  const double pt[]{x, y};
+  appendverb(pathspec, PathVerb::LineTo, pt);
+}
+
+MONET_INLINE void SVGCanvas::quadratictoxy(double xdir, double ydir,
+                                           double xend, double yend) {
+  const double pt[]{xdir, ydir, xend, yend};
+  appendverb(pathspec, PathVerb::QuadraticTo, pt);
+}
+
+MONET_INLINE void SVGCanvas::cubictoxy(double xc1, double yc1, double xc2,
+                                       double yc2, double xend, double yend) {
+  const double pt[]{xc1, yc1, xc2, yc2, xend, yend};
+  appendverb(pathspec, PathVerb::CubicTo, pt);
+}
+
+MONET_INLINE void SVGCanvas::linexy(double x1, double y1, double x2,
+                                    double y2) {
+  assert(stream);
+  if (const ClipShape *shape = cullingshape()) {
+    const double margin{strokemargin(Action::Stroke, 1.5)};
+    switch (cliptest(*shape, x1, y1, x2, y2, margin)) {
+    case ClipTest::Outside:
+      return;
+    case ClipTest::Partial:
+      // Shortening a dashed line would shift its dashes
+      if (getstrokestyle().dashes.empty() &&
+          !clipsegment(x1, y1, x2, y2, shape->xmin - margin,
+                       shape->ymin - margin, shape->xmax + margin,
+                       shape->ymax + margin))
+        return;
+      openclip();
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (canmerge()) {
+    const double pt[]{x1, y1, x2, y2};
+    batchpolyline(pt, 2, false);
+    return;
+  }
+
+  indent();
+
+  writelit("<line x1=\"");
+  writenum(x1);
+  writelit("\" y1=\"");
+  writenum(y1);
+  writelit("\" x2=\"");
+  writenum(x2);
+  writelit("\" y2=\"");
+  writenum(y2);
+  writelit("\" stroke-width=\"");
+  writenum(getstrokewidth());
+  writelit("\" stroke=\"");
+  writecolor(getstrokecolor());
+  writelit("\"");
+  writestrokestyle();
+  writealpha(Action::Stroke);
+  writeopacity();
+  writelit("/>\n");
+  endelement();
+}
+
+template <Action act>
+MONET_INLINE void SVGCanvas::emitcircle(double x, double y, double radius) {
+  assert(stream);
+  flushbatch();
+
+  indent();
+  writelit("<circle cx=\"");
+  writenum(x);
+  writelit("\" cy=\"");
+  writenum(y);
+  writelit("\" r=\"");
+  writenum(radius);
+
+  if (act == Action::Stroke) {
+    writelit("\" stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\"");
+  } else if (act == Action::Fill) {
+    writelit("\" fill=\"");
+    writefill();
+    writelit("\" stroke=\"none\"");
+  } else {
+    writelit("\" fill=\"");
+    writecolor(getfillcolor());
+    writelit("\" stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\"");
+  }
+
+  if (act != Action::Fill)
+    writestrokestyle();
+
+  writealpha(act);
+  writeopacity();
+  writelit("/>\n");
+  endelement();
+}
+
+MONET_INLINE void SVGCanvas::circlexy(double x, double y, double radius,
+                                      Action act) {
+  if (!clipbox(x - radius, y - radius, x + radius, y + radius,
+               strokemargin(act, 1)))
+    return;
+
+  if (act == Action::Stroke && canmerge()) {
+    // Two half circles
+    char text[256], r[32], cy[32];
+    const size_t rlen{formatnumber(r, sizeof(r), radius)};
+    const size_t cylen{formatnumber(cy, sizeof(cy), y)};
+    size_t len{};
+    auto add = [&](const char *str, size_t n) {
+      std::memcpy(text + len, str, n);
+      len += n;
+    };
+
+    add(batch.empty() ? "M " : " M ", batch.empty() ? 2 : 3);
+    len += formatnumber(text + len, 32, x - radius);
+    add(",", 1);
+    add(cy, cylen);
+    for (double endx : {x + radius, x - radius}) {
+      add(" A ", 3);
+      add(r, rlen);
+      add(",", 1);
+      add(r, rlen);
+      add(" 0 1 0 ", 7);
+      len += formatnumber(text + len, 32, endx);
+      add(",", 1);
+      add(cy, cylen);
+    }
+    add(" z", 2);
+    batch.append(text, len);
+    return;
+  }
+
+  switch (act) {
+  case Action::Stroke:
+    emitcircle<Action::Stroke>(x, y, radius);
+    break;
+  case Action::Fill:
+    emitcircle<Action::Fill>(x, y, radius);
+    break;
+  case Action::FillAndStroke:
+    emitcircle<Action::FillAndStroke>(x, y, radius);
+    break;
+  default:
+    abort();
+  }
+}
+
+template <Action act>
+MONET_INLINE void SVGCanvas::emitrectangle(double x1, double y1, double x2,
+                                           double y2) {
+  assert(stream);
+  flushbatch();
+
+  indent();
+  writelit("<rect");
+  nextattribute();
+  writelit("x=\"");
+  writenum(std::min(x1, x2));
+  writelit("\" y=\"");
+  writenum(std::min(y1, y2));
+  writelit("\"");
+  nextattribute();
+  writelit("width=\"");
+  writenum(std::fabs(x2 - x1));
+  writelit("\" height=\"");
+  writenum(std::fabs(y2 - y1));
+  writelit("\"");
+  nextattribute();
+
+  if (act == Action::Stroke) {
+    writelit("stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\" fill=\"none\"");
+  } else if (act == Action::Fill) {
+    writelit("stroke=\"none\" fill=\"");
+    writefill();
+    writelit("\"");
+  } else {
+    writelit("stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\" fill=\"");
+    writecolor(getfillcolor());
+    writelit("\"");
+  }
+
+  if (act != Action::Fill)
+    writestrokestyle();
+
+  writealpha(act);
+  writeopacity();
+  writelit("/>\n");
+  endelement();
+}
+
+MONET_INLINE bool SVGCanvas::cutrectangle(double &x1, double &y1, double &x2,
+                                          double &y2) {
+  const ClipShape *shape{cullingshape()};
+  if (!shape)
+    return true;
+
+  // The intersection of two rectangles is a rectangle
+  switch (cliptest(*shape, x1, y1, x2, y2, 0)) {
+  case ClipTest::Outside:
+    return false;
+  case ClipTest::Partial:
+    if (x1 > x2)
+      std::swap(x1, x2);
+    if (y1 > y2)
+      std::swap(y1, y2);
+    x1 = std::max(x1, shape->xmin);
+    y1 = std::max(y1, shape->ymin);
+    x2 = std::min(x2, shape->xmax);
+    y2 = std::min(y2, shape->ymax);
+    return true;
+  default:
+    return true;
+  }
+}
+
+MONET_INLINE void SVGCanvas::rectanglexy(double x1, double y1, double x2,
+                                         double y2, Action act) {
+  if (act == Action::Fill) {
+    if (!cutrectangle(x1, y1, x2, y2))
+      return;
+  } else if (!clipbox(x1, y1, x2, y2, strokemargin(act, 1.5)))
+    return;
+
+  if (act == Action::Stroke && canmerge()) {
+    const double pt[]{x1, y1, x2, y1, x2, y2, x1, y2};
+    batchpolyline(pt, 4, true);
+    return;
+  }
+
+  switch (act) {
+  case Action::Stroke:
+    emitrectangle<Action::Stroke>(x1, y1, x2, y2);
+    break;
+  case Action::Fill:
+    emitrectangle<Action::Fill>(x1, y1, x2, y2);
+    break;
+  case Action::FillAndStroke:
+    emitrectangle<Action::FillAndStroke>(x1, y1, x2, y2);
+    break;
+  default:
+    abort();
+  }
+}
+
+MONET_INLINE void SVGCanvas::textxy(double x, double y, const char *text,
+                                    HorizontalAlignment halign,
+                                    VerticalAlignment valign) {
+  assert(stream != nullptr);
+  flushbatch();
+
+  // The extent of the text is not known
+  if (cullingshape())
+    openclip();
+
+  // We place the text to (0, 0) and then translate it after reversing the
+  // Y axis; otherwise, the text would be flipped vertically (remember that
+  // we are using a different coordinate system than SVG's default).
+  indent();
+  writelit("<text");
+  nextattribute();
+  writelit("x=\"0\" y=\"0\"");
+  nextattribute();
+  write(textanchor(halign));
+  nextattribute();
+  write(textbaseline(valign));
+  nextattribute();
+  writelit("font-family=\"");
+  write(fontfamilyname());
+  writelit("\" font-size=\"");
+  writenum(getfontsize());
+  writelit("\"");
+  nextattribute();
+  writelit("transform=\"translate(");
+  writenum(x);
+  writelit(" ");
+  writenum(y);
+  writelit(") scale(1 -1)\"");
+
+  if (gettransparency() > 0) {
+    nextattribute();
+    writelit("opacity=\"");
+    writenum(1 - gettransparency());
+    writelit("\"");
+  }
+
+  nextattribute();
+  writelit("fill=\"");
+  writecolor(getfillcolor());
+  writelit("\"");
+  writealpha(Action::Fill);
+  writelit(">");
+  if (compact) {
+    write(text);
+  } else {
+    writelit("\n");
+    write(text);
+    writelit("\n");
+    indent();
+  }
+  writelit("</text>\n");
+  endelement();
+}
+
+// The style and the flip of the Y axis are written once, in a <g>
+// element, so each label only needs its position and its text
+MONET_INLINE void SVGCanvas::textarray(const Column<double> &xs,
+                                       const Column<double> &ys,
+                                       const Column<std::string> &strings,
+                                       size_t n, HorizontalAlignment halign,
+                                       VerticalAlignment valign) {
+  if (n <= 1) {
+    if (n == 1)
+      textxy(xs[0], ys[0], strings[0].c_str(), halign, valign);
+    return;
+  }
+
+  assert(stream != nullptr);
+  flushbatch();
+  if (cullingshape())
+    openclip();
+
+  indent();
+  writelit("<g ");
+  write(textanchor(halign));
+  writelit(" ");
+  write(textbaseline(valign));
+  writelit(" font-family=\"");
+  write(fontfamilyname());
+  writelit("\" font-size=\"");
+  writenum(getfontsize());
+  writelit("\" fill=\"");
+  writecolor(getfillcolor());
+  writelit("\"");
+  writealpha(Action::Fill);
+  writelit(" transform=\"scale(1 -1)\">\n");
+  endelement();
+  indentlevel++;
+
+  for (size_t i{}; i < n; ++i) {
+    const std::string &str{strings[i]};
+    indent();
+    writelit("<text x=\"");
+    writenum(xs[i]);
+    writelit("\" y=\"");
+    writenum(0 - ys[i]); // Not -0 if ys[i] is 0
+    writelit("\"");
+    writeopacity();
+    writelit(">");
+    write(str.data(), str.size());
+    writelit("</text>\n");
+    endelement();
+  }
+
+  indentlevel--;
+  indent();
+  writelit("</g>\n");
+  endelement();
+}
+
+MONET_INLINE SVGCanvas::SVGCanvas(const std::string &filename, double awidth,
+                                  double aheight, SVGLayout layout)
+    : SVGCanvas{std::unique_ptr<std::ostream>{
+                    new std::ofstream(filename.c_str())},
+                awidth, aheight, layout} {}
+
+MONET_INLINE SVGCanvas::SVGCanvas(std::unique_ptr<std::ostream> out,
+                                  double awidth, double aheight,
+                                  SVGLayout layout)
+    : BaseCanvas{}, stream{std::move(out)},
+      compact{layout == SVGLayout::Compact}, indentlevel{0}, width{awidth},
+      height{aheight}, pathspec{""}, m_grouplevel{0}, numofclipregions{0},
+      clipshapes{}, clips{},
+      definingclip{false}, clipgeometry{false}, clipcalls{0},
+      numofimports{0}, cache{},
+      captured{},
+      capturing{0}, merging{false}, batch{}, batchcolor{}, batchstyle{},
+      colorgroups{}, keptitems{}, keptcolors{}, gradients{},
+      patterns{}, gradientstops{}, fillpaint{nullptr}, fillkey{0}, arena{},
+      buf{nullptr}, buflen{0}, bufsize{0} {
+  if (!stream) {
+    std::perror("Unable to create file");
+    std::abort();
+  }
+
+  // Don't let the locale of the stream change the numbers
+  char w[32], h[32];
+  w[formatnumber(w, sizeof(w), width)] = '\0';
+  h[formatnumber(h, sizeof(h), height)] = '\0';
+
+  const char *sep{compact ? " " : "\n    "};
+  *stream << "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+             "<!-- Created with Monet "
+          << version << " (https://github.com/ziotom78/monet)-->\n"
+          << (compact ? "" : "\n") << "<svg" << sep << "width=\"" << w
+          << "mm\"" << sep << "height=\"" << h << "mm\"" << sep
+          << "viewBox=\"0 0 " << w << ' ' << h << '"' << sep
+          << "version=\"1.1\"" << sep
+          << "xmlns=\"http://www.w3.org/2000/svg\">\n";
+
+  indentlevel++;
+  begingroup(scaley(-1) | translate(Point(0, height)), "canvas");
+}
+
+MONET_INLINE SVGCanvas::~SVGCanvas() {
+  if (!stream) {
+    return;
+  }
+
+  while (!clips.empty()) {
+    removeclip();
+  }
+
+  // Close any group that was not closed yet
+  for (int i{m_grouplevel}; i > 0; i--) {
+    endgroup();
+  }
+
+  flushbatch();
+  *stream << "</svg>\n";
+}
+
+template <Action act>
+MONET_INLINE void SVGCanvas::emitpath(const std::string &d,
+                                      const TransformSequence &transforms) {
+  assert(stream);
+  flushbatch();
+
+  indent();
+  writelit("<path");
+  nextattribute();
+  writelit("d=\"");
+  if (d.size() > 4096) {
+    // Send long paths to the stream without copying them into `buf`
+    endelement();
+    output(d.data(), d.size());
+  } else
+    write(d.data(), d.size());
+  writelit("\"");
+  nextattribute();
+
+  if (!isidentity(transforms)) {
+    writelit("transform=\"");
+    writetransforms(transforms);
+    writelit("\"");
+    nextattribute();
+  }
+
+  if (act == Action::Stroke) {
+    writelit("fill=\"none\" stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\"");
+  } else if (act == Action::Fill) {
+    writelit("fill=\"");
+    writefill();
+    writelit("\" stroke=\"none\"");
+  } else {
+    writelit("fill=\"");
+    writecolor(getfillcolor());
+    writelit("\" stroke=\"");
+    writecolor(getstrokecolor());
+    writelit("\" stroke-width=\"");
+    writenum(getstrokewidth());
+    writelit("\"");
+  }
+
+  if (act != Action::Fill)
+    writestrokestyle();
+
+  writealpha(act);
+  writelit("/>\n");
+  endelement();
+}
+
+// The points of the current path are not kept, so it is always
+// clipped by the viewer
+MONET_INLINE void SVGCanvas::strokepath() {
+  if (cullingshape())
+    openclip();
+  emitpath<Action::Stroke>(pathspec, identity);
+}
+
+MONET_INLINE void SVGCanvas::fillpath() {
+  if (cullingshape())
+    openclip();
+  emitpath<Action::Fill>(pathspec, identity);
+}
+
+MONET_INLINE void SVGCanvas::fillandstrokepath() {
+  if (cullingshape())
+    openclip();
+  emitpath<Action::FillAndStroke>(pathspec, identity);
+}
+
+MONET_INLINE void SVGCanvas::pathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        Action act) {
+  // As in BaseCanvas, a path that has not been drawn yet is discarded
+  pathspec.clear();
+
+  if (cullingshape()) {
+    // Control points enclose the curves
+    const std::vector<double> &coords{path.getcoords()};
+    if (!isidentity(transforms) || coords.empty())
+      openclip();
+    else {
+      double xmin{coords[0]}, ymin{coords[1]}, xmax{xmin}, ymax{ymin};
+      for (size_t i{2}; i + 1 < coords.size(); i += 2) {
+        xmin = std::min(xmin, coords[i]);
+        xmax = std::max(xmax, coords[i]);
+        ymin = std::min(ymin, coords[i + 1]);
+        ymax = std::max(ymax, coords[i + 1]);
+      }
+      const double miter{std::max(getstrokestyle().miterlimit, 1.5)};
+      if (!clipbox(xmin, ymin, xmax, ymax, strokemargin(act, miter)))
+        return;
+    }
+  }
+
+  // The text of the path is built only the first time the path is drawn
+  const std::string &d{path.serialized(PathFormat::SVG, formatpath)};
+
+  switch (act) {
+  case Action::Stroke:
+    emitpath<Action::Stroke>(d, transforms);
+    break;
+  case Action::Fill:
+    emitpath<Action::Fill>(d, transforms);
+    break;
+  case Action::FillAndStroke:
+    emitpath<Action::FillAndStroke>(d, transforms);
+    break;
+  default:
+    abort();
+  }
+}
+
+#ifdef MONET_WITH_SVGFILLS
+MONET_INLINE void SVGCanvas::begingradient(const Gradient &gradient) {
+  assert(!gradient.stops.empty());
+  flushbatch();
+  fillkey = hashgradient(gradient);
+  fillpaint = "monet_gradient_";
+
+  // A cached group must include the gradients it uses, as it might be
+  // copied into another document
+  if (!gradients.insert(fillkey).second && capturing == 0)
+    return;
+
+  const bool linear{gradient.type == GradientType::Linear};
+  indent();
+  writelit("<defs>\n");
+  indentlevel++;
+
+  indent();
+  if (linear) {
+    writelit("<linearGradient id=\"");
+    writepaintid(fillpaint, fillkey);
+    writelit("\" x1=\"");
+    writenum(gradient.start.x);
+    writelit("\" y1=\"");
+    writenum(gradient.start.y);
+    writelit("\" x2=\"");
+    writenum(gradient.end.x);
+    writelit("\" y2=\"");
+    writenum(gradient.end.y);
+  } else {
+    writelit("<radialGradient id=\"");
+    writepaintid(fillpaint, fillkey);
+    writelit("\" cx=\"");
+    writenum(gradient.start.x);
+    writelit("\" cy=\"");
+    writenum(gradient.start.y);
+    writelit("\" r=\"");
+    writenum(gradient.radius);
+  }
+  writelit("\">\n");
+  indentlevel++;
+
+  gradient.rgbstops(gradientstops);
+  for (const GradientStop &stop : gradientstops) {
+    indent();
+    writelit("<stop offset=\"");
+    writenum(stop.offset);
+    writelit("\" stop-color=\"");
+    writecolor(stop.color);
+    writelit("\"/>\n");
+  }
+
+  indentlevel--;
+  indent();
+  if (linear)
+    writelit("</linearGradient>\n");
+  else
+    writelit("</radialGradient>\n");
+
+  indentlevel--;
+  indent();
+  writelit("</defs>\n");
+  endelement();
+}
+
+MONET_INLINE void SVGCanvas::gradientcirclexy(double x, double y, double radius,
+                                              const Gradient &gradient) {
+  if (!clipbox(x - radius, y - radius, x + radius, y + radius, 0))
+    return;
+
+  begingradient(gradient);
+  emitcircle<Action::Fill>(x, y, radius);
+  endgradient();
+}
+
+MONET_INLINE void SVGCanvas::gradientrectanglexy(double x1, double y1,
+                                                 double x2, double y2,
+                                                 const Gradient &gradient) {
+  // Cutting the rectangle would change the gradient
+  if (!clipbox(x1, y1, x2, y2, 0))
+    return;
+
+  begingradient(gradient);
+  emitrectangle<Action::Fill>(x1, y1, x2, y2);
+  endgradient();
+}
+
+MONET_INLINE void
+SVGCanvas::gradientpathobject(const Path &path,
+                              const TransformSequence &transforms,
+                              const Gradient &gradient) {
+  pathspec.clear();
+  if (cullingshape()) {
+    Point min, max;
+    if (!isidentity(transforms) || path.empty())
+      openclip();
+    else {
+      path.boundingbox(min, max);
+      if (!clipbox(min.x, min.y, max.x, max.y, 0))
+        return;
+    }
+  }
+
+  begingradient(gradient);
+  emitpath<Action::Fill>(path.serialized(PathFormat::SVG, formatpath),
+                         transforms);
+  endgradient();
+}
+
+// The pixels are embedded in the document as a PNG file
+MONET_INLINE void SVGCanvas::imagexy(double x1, double y1, double x2, double y2,
+                                     size_t cols, size_t rows,
+                                     const Color8 *pixels) {
+  assert(stream);
+  if (cols == 0 || rows == 0 || !clipbox(x1, y1, x2, y2, 0))
+    return;
+
+  flushbatch();
+  std::string png, data;
+  encodepng(png, cols, rows, pixels);
+  encodebase64(data, png.data(), png.size());
+
+  indent();
+  writelit("<image");
+  nextattribute();
+  writelit("x=\"");
+  writenum(std::min(x1, x2));
+  writelit("\" y=\"");
+  writenum(std::min(y1, y2));
+  writelit("\" width=\"");
+  writenum(std::fabs(x2 - x1));
+  writelit("\" height=\"");
+  writenum(std::fabs(y2 - y1));
+  writelit("\"");
+
+  // An image is always drawn from its upper-left corner, so mirror it
+  // if the first pixel is in another corner
+  if (x2 < x1 || y2 < y1) {
+    nextattribute();
+    writelit("transform=\"matrix(");
+    writenum(x2 < x1 ? -1 : 1);
+    writelit(" 0 0 ");
+    writenum(y2 < y1 ? -1 : 1);
+    writelit(" ");
+    writenum(x2 < x1 ? x1 + x2 : 0);
+    writelit(" ");
+    writenum(y2 < y1 ? y1 + y2 : 0);
+    writelit(")\"");
+  }
+
+  nextattribute();
+  writelit("preserveAspectRatio=\"none\" image-rendering=\"optimizeSpeed\"");
+  writeopacity();
+  nextattribute();
+  writelit("href=\"data:image/png;base64,");
+  write(data.data(), data.size());
+  writelit("\"/>\n");
+  endelement();
+}
+#endif // MONET_WITH_SVGFILLS
+
+MONET_INLINE void
+SVGCanvas::writetransforms(const TransformSequence &transforms) {
+  for (const auto &transf : transforms) {
+    switch (transf.type) {
+    case TransformType::Identity:
+      break;
+
+    case TransformType::Translation:
+      writelit("translate(");
+      writenum(transf.translation.x);
+      writelit(" ");
+      writenum(transf.translation.y);
+      writelit(") ");
+      break;
+
+    case TransformType::Rotation:
+      writelit("rotate(");
+      writenum(transf.rotation.angle);
+      writelit(" ");
+      writenum(transf.rotation.pivot.x);
+      writelit(" ");
+      writenum(transf.rotation.pivot.y);
+      writelit(") ");
+      break;
+
+    case TransformType::Scale:
+      writelit("scale(");
+      writenum(transf.scale_factor.x);
+      writelit(" ");
+      writenum(transf.scale_factor.y);
+      writelit(") ");
+      break;
+
+    default:
+      abort();
+    }
+  }
+}
+
+MONET_INLINE void SVGCanvas::begingroup(const TransformSequence &transforms,
+                                        const std::string &name) {
+  assert(stream);
+  flushbatch();
+
+  // The geometry of the group is not clipped by the canvas
+  if (!clips.empty() && !definingclip)
+    openclip();
+
+  indent();
+
+  writelit("<g");
+
+  if (!name.empty()) {
+    writelit(" name=\"");
+    write(name.data(), name.size());
+    writelit("\"");
+  }
+
+  if (!isidentity(transforms)) {
+    writelit(" transform=\"");
+    writetransforms(transforms);
+    writelit("\"");
+  }
+
+  writelit(">\n");
+  endelement();
+  indentlevel++;
+  m_grouplevel++;
+  pushtransform(transforms);
+}
+
+MONET_INLINE void SVGCanvas::endgroup() {
+  assert(stream);
+  flushbatch();
+
+  if (m_grouplevel <= 0)
+    abort();
+
+  if (indentlevel <= 0)
+    abort();
+
+  indentlevel--;
+  indent();
+  writelit("</g>\n");
+  endelement();
+
+  m_grouplevel--;
+  poptransform();
+}
+
+MONET_INLINE void SVGCanvas::beginclipdefs(int id) {
+  indent();
+  writelit("<defs>\n");
+  indentlevel++;
+
+  indent();
+  writelit("<clipPath id=\"");
+  writeclipid(id);
+  writelit("\">\n");
+  endelement();
+  indentlevel++;
+}
+
+MONET_INLINE void SVGCanvas::endclipdefs() {
+  indentlevel--;
+  indent();
+  writelit("</clipPath>\n");
+
+  --indentlevel;
+  indent();
+  writelit("</defs>\n");
+  endelement();
+}
+
+MONET_INLINE ClipRegion SVGCanvas::defineclip() {
+  assert(stream);
+  flushbatch();
+  assert(!definingclip);
+
+  const ClipRegion region{numofclipregions++};
+  ++clipcalls;
+  beginclipdefs(region.id);
+  definingclip = true;
+  return region;
+}
+
+MONET_INLINE void SVGCanvas::endclip() {
+  assert(stream);
+  flushbatch();
+  assert(definingclip);
+
+  endclipdefs();
+  definingclip = false;
+}
+
+MONET_INLINE ClipRegion SVGCanvas::cliprectanglexy(double x1, double y1,
+                                                   double x2, double y2) {
+  assert(!definingclip);
+
+  // The region is written by `openclip`, if it is ever needed
+  ++clipcalls;
+  const ClipRegion region{numofclipregions++};
+  clipshapes.push_back(ClipShape{region.id, false, std::min(x1, x2),
+                                 std::min(y1, y2), std::max(x1, x2),
+                                 std::max(y1, y2)});
+  return region;
+}
+
+MONET_INLINE void SVGCanvas::openclip() {
+  assert(!clips.empty());
+  ActiveClip &clip{clips.back()};
+  if (clip.open)
+    return;
+
+  flushbatch();
+  if (clip.shape >= 0 && !clipshapes[size_t(clip.shape)].written) {
+    ClipShape &shape{clipshapes[size_t(clip.shape)]};
+    beginclipdefs(clip.id);
+    indent();
+    writelit("<rect x=\"");
+    writenum(shape.xmin);
+    writelit("\" y=\"");
+    writenum(shape.ymin);
+    writelit("\" width=\"");
+    writenum(shape.xmax - shape.xmin);
+    writelit("\" height=\"");
+    writenum(shape.ymax - shape.ymin);
+    writelit("\"/>\n");
+    endclipdefs();
+    shape.written = true;
+  }
+
+  indent();
+  writelit("<g clip-path=\"url(#");
+  writeclipid(clip.id);
+  writelit(")\">\n");
+  endelement();
+  indentlevel++;
+
+  clip.open = true;
+}
+
+MONET_INLINE void SVGCanvas::useclip(ClipRegion region) {
+  assert(stream);
+  flushbatch();
+  assert(!definingclip);
+  assert(region.id >= 0 && region.id < numofclipregions);
+
+  // The canvas can only clip the geometry to the innermost region
+  if (!clips.empty())
+    openclip();
+
+  auto shape = std::lower_bound(
+      clipshapes.begin(), clipshapes.end(), region.id,
+      [](const ClipShape &item, int id) { return item.id < id; });
+  const bool rectangular{shape != clipshapes.end() && shape->id == region.id};
+
+  clips.push_back(ActiveClip{
+      region.id, rectangular ? int(shape - clipshapes.begin()) : -1, false,
+      getctm()});
+  ++clipcalls;
+  if (!clipgeometry || !rectangular)
+    openclip();
+}
+
+MONET_INLINE void SVGCanvas::removeclip() {
+  assert(stream);
+  flushbatch();
+  assert(!clips.empty());
+
+  if (clips.back().open) {
+    indentlevel--;
+    indent();
+    writelit("</g>\n");
+    endelement();
+  }
+
+  clips.pop_back();
+}
+
+MONET_INLINE bool SVGCanvas::clipsegment(double &x1, double &y1, double &x2,
+                                         double &y2, double xmin, double ymin,
+                                         double xmax, double ymax) {
+  const double dx{x2 - x1}, dy{y2 - y1};
+  const double p[]{-dx, dx, -dy, dy};
+  const double q[]{x1 - xmin, xmax - x1, y1 - ymin, ymax - y1};
+  double t0{0}, t1{1};
+  for (int i{}; i < 4; ++i) {
+    if (p[i] == 0) {
+      if (q[i] < 0)
+        return false;
+    } else if (p[i] < 0)
+      t0 = std::max(t0, q[i] / p[i]);
+    else
+      t1 = std::min(t1, q[i] / p[i]);
+  }
+
+  if (t0 > t1)
+    return false;
+
+  const double startx{x1}, starty{y1};
+  if (t0 > 0) {
+    x1 = startx + t0 * dx;
+    y1 = starty + t0 * dy;
+  }
+  if (t1 < 1) {
+    x2 = startx + t1 * dx;
+    y2 = starty + t1 * dy;
+  }
+  return true;
+}
+#endif // MONET_DEFINITIONS
+
+template <typename ItemBox>
+inline bool SVGCanvas::cullitems(const Column<Color> &colors, size_t n,
+                                 double margin, ItemBox box) {
+  if (!cullingshape())
+    return false;
+
+  keptitems.clear();
+  keptcolors.clear();
+  for (size_t i{}; i < n; ++i) {
+    double x1, y1, x2, y2;
+    box(i, x1, y1, x2, y2);
+    if (clipbox(x1, y1, x2, y2, margin)) {
+      keptitems.push_back(i);
+      keptcolors.push_back(colors[i]);
+    }
+  }
+  return true;
+}
+
+template <typename WriteItem>
+inline void SVGCanvas::writearray(const Column<Color> &colors, size_t n,
+                                  Action act, WriteItem item) {
+  assert(stream);
+  flushbatch();
+
+  const Color oldstroke{getstrokecolor()}, oldfill{getfillcolor()};
+  colorgroups.build(colors, n);
+  for (size_t g{}; g < colorgroups.numofgroups(); ++g) {
+    const size_t first{colorgroups.start[g]}, last{colorgroups.start[g + 1]};
+    setitemcolor(colors, colorgroups.order[first], act);
+
+    if (last - first == 1) {
+      // A group would be longer than the style of a single item
+      indent();
+      item(colorgroups.order[first]);
+      writepaint(act);
+      writeopacity();
+      writelit("/>\n");
+      endelement();
+      continue;
+    }
+
+    indent();
+    writelit("<g");
+    writepaint(act);
+    writelit(">\n");
+    endelement();
+    indentlevel++;
+
+    for (size_t i{first}; i < last; ++i) {
+      indent();
+      item(colorgroups.order[i]);
+      writeopacity();
+      writelit("/>\n");
+      endelement();
+    }
+
+    indentlevel--;
+    indent();
+    writelit("</g>\n");
+    endelement();
+  }
+  setstrokecolor(oldstroke);
+  setfillcolor(oldfill);
+}
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void SVGCanvas::circlearray(const Column<double> &xs,
+                                         const Column<double> &ys,
+                                         const Column<double> &radii,
+                                         const Column<Color> &colors, size_t n,
+                                         Action act) {
+  const bool culled{cullitems(
+      colors, n, strokemargin(act, 1),
+      [&](size_t idx, double &x1, double &y1, double &x2, double &y2) {
+        x1 = xs[idx] - radii[idx];
+        y1 = ys[idx] - radii[idx];
+        x2 = xs[idx] + radii[idx];
+        y2 = ys[idx] + radii[idx];
+      })};
+
+  writearray(culled ? Column<Color>{keptcolors} : colors,
+             culled ? keptitems.size() : n, act, [&](size_t item) {
+    const size_t idx{culled ? keptitems[item] : item};
+    writelit("<circle cx=\"");
+    writenum(xs[idx]);
+    writelit("\" cy=\"");
+    writenum(ys[idx]);
+    writelit("\" r=\"");
+    writenum(radii[idx]);
+    writelit("\"");
+  });
+}
+
+MONET_INLINE void SVGCanvas::rectanglearray(const Column<double> &xs,
+                                            const Column<double> &ys,
+                                            const Column<double> &widths,
+                                            const Column<double> &heights,
+                                            const Column<Color> &colors,
+                                            size_t n, Action act) {
+  const bool culled{cullitems(
+      colors, n, strokemargin(act, 1.5),
+      [&](size_t idx, double &x1, double &y1, double &x2, double &y2) {
+        x1 = xs[idx];
+        y1 = ys[idx];
+        x2 = x1 + widths[idx];
+        y2 = y1 + heights[idx];
+      })};
+
+  writearray(culled ? Column<Color>{keptcolors} : colors,
+             culled ? keptitems.size() : n, act, [&](size_t item) {
+    const size_t idx{culled ? keptitems[item] : item};
+    const double x1{xs[idx]}, y1{ys[idx]};
+    const double x2{x1 + widths[idx]}, y2{y1 + heights[idx]};
+    writelit("<rect x=\"");
+    writenum(std::min(x1, x2));
+    writelit("\" y=\"");
+    writenum(std::min(y1, y2));
+    writelit("\" width=\"");
+    writenum(std::fabs(x2 - x1));
+    writelit("\" height=\"");
+    writenum(std::fabs(y2 - y1));
+    writelit("\"");
+  });
+}
+
+MONET_INLINE bool SVGCanvas::canmerge() {
+  const StrokeStyle &style{getstrokestyle()};
+  if (!merging || gettransparency() > 0 || getstrokealpha() < 1) {
+    flushbatch();
+    return false;
+  }
+
+  const Color col{getstrokecolor()};
+  if (!batch.empty() &&
+      (col.r != batchcolor.r || col.g != batchcolor.g ||
+       col.b != batchcolor.b || style.width != batchstyle.width ||
+       style.join != batchstyle.join || style.cap != batchstyle.cap ||
+       style.miterlimit != batchstyle.miterlimit ||
+       style.dashes != batchstyle.dashes ||
+       style.dashoffset != batchstyle.dashoffset))
+    flushbatch();
+
+  if (batch.empty()) {
+    batchcolor = col;
+    batchstyle = style;
+  }
+  return true;
+}
+
+MONET_INLINE void SVGCanvas::flushbatch() {
+  if (batch.empty())
+    return;
+
+  // The style of the batch might not be the current one anymore
+  std::string d;
+  d.swap(batch);
+  const DrawingState current{getstate()};
+  DrawingState state{current};
+  state.strokecolor = batchcolor;
+  state.strokestyle = batchstyle;
+  state.strokealpha = 1;
+  setstate(state);
+  emitpath<Action::Stroke>(d, identity);
+  setstate(current);
+
+  // Keep the memory for the next batch
+  d.clear();
+  batch.swap(d);
+}
+
+MONET_INLINE void SVGCanvas::splice(const std::string &bytes, int level) {
+  flushbatch();
+  if (level == indentlevel) {
+    output(bytes.data(), bytes.size());
+    return;
+  }
+
+  // Lines that are not indented belong to the text of a <text>
+  // element, and they must be copied unchanged
+  const size_t oldindent{size_t(tabwidth * level)};
+  for (size_t pos{}; pos < bytes.size();) {
+    size_t eol{bytes.find('\n', pos)};
+    eol = (eol == std::string::npos) ? bytes.size() : eol + 1;
+
+    size_t spaces{};
+    while (spaces < oldindent && pos + spaces < eol &&
+           bytes[pos + spaces] == ' ')
+      ++spaces;
+
+    if (spaces == oldindent) {
+      indent();
+      pos += oldindent;
+    }
+    write(bytes.data() + pos, eol - pos);
+    pos = eol;
+  }
+  endelement();
+}
+
+MONET_INLINE void SVGCanvas::drawcached(uint64_t key,
+                                        const std::function<void()> &draw) {
+  if (compact) {
+    // Compact entries cannot be re-indented
+    XXHash64 hash{key};
+    hash.update("compact", 7);
+    key = hash.digest();
+  }
+  if (merging) {
+    XXHash64 hash{key};
+    hash.update("merge", 5);
+    key = hash.digest();
+  }
+
+  int level;
+  if (const std::string *bytes = cache->find(key, level)) {
+    splice(*bytes, level);
+    return;
+  }
+
+  // Nested cached groups share `captured`
+  const size_t start{captured.size()};
+  const int groups{m_grouplevel};
+  const size_t numofclips{clips.size()}, oldclipcalls{clipcalls};
+  ++capturing;
+  draw();
+
+  // Only self-contained content can be cached: close what `draw` left
+  // open, and draw it again next time
+  const bool balanced{m_grouplevel == groups && clips.size() == numofclips};
+  while (clips.size() > numofclips)
+    removeclip();
+  while (m_grouplevel > groups)
+    endgroup();
+  flushbatch();
+  --capturing;
+
+  // Clipping regions are referenced by ids, which depend on what was
+  // drawn before the group
+  if (balanced && clipcalls == oldclipcalls)
+    cache->insert(key, indentlevel, captured.substr(start));
+  if (capturing == 0)
+    captured.clear();
+}
+
+#ifdef MONET_WITH_SVGREADER
+MONET_INLINE bool SVGCanvas::includesvg(const std::string &filename,
+                                        const TransformSequence &transforms,
+                                        const std::string &name) {
+  MappedFile file;
+  return file.open(filename) &&
+         includesvg(file.data(), file.size(), transforms, name);
+}
+
+MONET_INLINE bool SVGCanvas::includesvg(const char *data, size_t size,
+                                        const TransformSequence &transforms,
+                                        const std::string &name) {
+  assert(stream);
+  assert(!definingclip);
+
+  // Find the content of the <g name="canvas"> element that SVGCanvas
+  // writes within <svg>, and where the ids it uses start
+  class Scanner : public SVGReader {
+  public:
+    int depth;
+    const char *begin, *end;
+    std::vector<const char *> ids;
+    bool valid;
+
+    Scanner() : depth{0}, begin{nullptr}, end{nullptr}, ids{}, valid{true} {}
+
+  protected:
+    void startelement(const Slice &name, const std::vector<Attribute> &attrs,
+                      const Slice &tag) override {
+      ++depth;
+      Slice value;
+      if (depth == 1) {
+        valid = valid && name == "svg";
+      } else if (depth == 2 && !begin) {
+        valid = valid && name == "g" &&
+                findattribute(attrs, "name", value) && value == "canvas";
+        begin = tag.end;
+      } else if (depth > 2 && begin && !end) {
+        // Definitions are named `monet_...`, and they are referenced
+        // as `url(#monet_...)` or `#monet_...`
+        for (const Attribute &attr : attrs) {
+          const Slice &val{attr.value};
+          if (attr.name == "id") {
+            if (val.size() > 6 && std::memcmp(val.begin, "monet_", 6) == 0)
+              ids.push_back(val.begin + 6);
+            continue;
+          }
+
+          const char *hash{val.begin};
+          while ((hash = static_cast<const char *>(std::memchr(
+                      hash, '#', size_t(val.end - hash)))) != nullptr) {
+            ++hash;
+            if (size_t(val.end - hash) > 6 &&
+                std::memcmp(hash, "monet_", 6) == 0)
+              ids.push_back(hash + 6);
+          }
+        }
+      }
+    }
+
+    void endelement(const Slice &, const Slice &tag) override {
+      if (depth == 2 && begin && !end)
+        end = tag.begin;
+      --depth;
+    }
+  };
+
+  Scanner scanner;
+  if (!scanner.parse(data, size) || !scanner.valid || !scanner.end)
+    return false;
+
+  // Ids are prefixed with a number that is different for each file,
+  // so that even files that include other files can be included
+  ++numofimports;
+  ++clipcalls;
+  char prefix[32];
+  const size_t prefixlen{size_t(
+      std::snprintf(prefix, sizeof(prefix), "import%d_", numofimports))};
+
+  begingroup(transforms, name);
+
+  // The indentation of the content, which is the one of the first
+  // element, is replaced by the one of this file
+  const char *cur{scanner.begin}, *end{scanner.end};
+  while (cur < end && *cur == '\n')
+    ++cur;
+  const char *const firstline{cur};
+  while (cur < end && *cur == ' ')
+    ++cur;
+  const size_t oldindent{size_t(cur - firstline)};
+  const char *const start{cur};
+  while (end > cur && end[-1] == ' ')
+    --end;
+
+  const std::vector<const char *> &ids{scanner.ids};
+  size_t nextid{};
+  bool linestart{true};
+  while (cur < end) {
+    // Lines that are not indented belong to the text of a <text>
+    // element, and they must be copied unchanged
+    if (linestart) {
+      size_t spaces{};
+      while (spaces < oldindent && cur + spaces < end && cur[spaces] == ' ')
+        ++spaces;
+      if (spaces == oldindent || cur == start) {
+        cur += spaces;
+        indent();
+        endelement();
+      }
+    }
+
+    const char *eol{
+        static_cast<const char *>(std::memchr(cur, '\n', size_t(end - cur)))};
+    const char *next{eol ? eol + 1 : end};
+    for (; nextid < ids.size() && ids[nextid] < next; ++nextid) {
+      output(cur, size_t(ids[nextid] - cur));
+      output(prefix, prefixlen);
+      cur = ids[nextid];
+    }
+    output(cur, size_t(next - cur));
+    cur = next;
+    linestart = (eol != nullptr);
+  }
+  if (end > start && end[-1] != '\n')
+    output("\n", 1);
+
+  endgroup();
+  return true;
+}
+#endif // MONET_WITH_SVGREADER
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef MONET_WITH_PDF
+
+/// Append the UTF-8 string `text` to `result`, encoded in WinAnsi (the
+/// encoding of the standard PDF fonts). Characters in Latin-1 keep
+/// their code; the others, and invalid sequences, become '?'
+inline void encodewinansi(std::string &result, const char *text) {
+  static const uint32_t mincode[]{0, 0, 0x80, 0x800, 0x10000};
+  const unsigned char *ch{reinterpret_cast<const unsigned char *>(text)};
+  while (*ch) {
+    // Length of the sequence, from the bits of its first byte
+    size_t len{};
+    uint32_t code{*ch};
+    if (code < 0x80)
+      len = 1;
+    else if ((code & 0xE0) == 0xC0) {
+      len = 2;
+      code &= 0x1F;
+    } else if ((code & 0xF0) == 0xE0) {
+      len = 3;
+      code &= 0x0F;
+    } else if ((code & 0xF8) == 0xF0) {
+      len = 4;
+      code &= 0x07;
+    }
+
+    // The terminator is not a continuation byte, so this stops there
+    size_t i{1};
+    for (; i < len && (ch[i] & 0xC0) == 0x80; ++i)
+      code = (code << 6) | (ch[i] & 0x3F);
+
+    if (len == 0 || i < len || code < mincode[len]) {
+      result += '?';
+      ++ch;
+      continue;
+    }
+
+    // WinAnsi uses 0x80–0x9F for other characters than Latin-1
+    result += code < 0x80 || (code >= 0xA0 && code <= 0xFF) ? char(code) : '?';
+    ch += len;
+  }
+}
+
+/** A PDF canvas
+ *
+ * This object writes a one-page PDF file. As in SVGCanvas, sizes are
+ * measured in millimeters. Content streams are compressed (see
+ * ZlibWriter) and written while drawing, and the cross-reference table
+ * is built from the offsets recorded along the way, so the whole file
+ * is produced in one streaming pass.
+ *
+ * A few details:
+ *
+ * - Groups are written as `q … cm … Q` blocks. Groups whose content is
+ *   repeated are turned into Form XObjects the second time they are
+ *   met, and from then on they are drawn with a single `Do` operator.
+ *   The content of every open group is kept in memory until the group
+ *   is closed.
+ * - Transparency values are mapped to shared ExtGState resources.
+ * - Text uses the standard Helvetica, Times, and Courier fonts with
+ *   WinAnsi encoding. Strings are in UTF-8, and the characters that
+ *   are not in Latin-1 are replaced by '?'. The width of a string is
+ *   estimated from the average width of the characters, so horizontal
+ *   alignment is only approximate for proportional fonts.
+ */
+class PDFCanvas : public BaseCanvas {
+private:
+  // What has been set in the PDF graphics state so far, so that
+  // operators are emitted only when something changes
+  struct GraphicsState {
+    bool strokeknown, fillknown, opacityknown;
+    Color strokecolor, fillcolor;
+    std::pair<double, double> opacity; // Strokes and fills
+    StrokeStyle strokestyle;
+
+    GraphicsState()
+        : strokeknown{false}, fillknown{false}, opacityknown{false},
+          strokecolor{}, fillcolor{}, opacity{1, 1} {}
+  };
+
+  std::unique_ptr<std::ostream> stream;
+  size_t offset;
+  double width, height;
+  int m_grouplevel;
+  int clipdepth;
+  bool recordingclip;
+
+  // Objects 1-4 are the catalog, the page tree, the page, and the
+  // resource dictionary; `offsets[i]` is the position of object i
+  std::vector<size_t> offsets;
+  std::vector<int> contentobjs;
+  bool contentopen;
+  int contentlengthobj;
+  size_t contentstart;
+  std::unique_ptr<ZlibWriter> zlib;
+
+  // Content of the groups that are still open, from the outermost
+  std::vector<std::string> groupbuffers;
+  std::vector<Matrix> groupmatrices;
+  std::vector<GraphicsState> states;
+
+  // Reuse of groups: content → XObject (-1 = seen once)
+  std::unordered_map<std::string, int> groups;
+  std::vector<int> xobjects;
+
+  std::vector<std::pair<double, double>> opacities;
+  bool usedfonts[3];
+
+  struct GradientHash {
+    size_t operator()(const Gradient &gradient) const {
+      return size_t(hashgradient(gradient));
+    }
+  };
+
+  // Dictionaries of the shadings used by gradients, and their indexes
+  // by gradient
+  std::vector<std::string> shadings;
+  std::unordered_map<Gradient, size_t, GradientHash> shadingids;
+
+  // Index in `xobjects` of the tile of each pattern, by `patternkey`
+  std::unordered_map<std::string, size_t> patternids;
+  ColorGroups colorgroups;
+
+  // Operators that build each clipping region, indexed by its id
+  std::vector<std::string> clipregions;
+  std::string pathops;
+  Point current;
+
+  static const int resourcesobj{4};
+
+  void out(const char *data, size_t len) {
+    stream->write(data, std::streamsize(len));
+    offset += len;
+  }
+
+  void out(const std::string &str) { out(str.data(), str.size()); }
+
+  int newobject() {
+    offsets.push_back(0);
+    return int(offsets.size()) - 1;
+  }
+
+  void beginobject(int num) {
+    offsets[size_t(num)] = offset;
+    out(std::to_string(num) + " 0 obj\n");
+  }
+
+  void opencontent() {
+    int num{newobject()};
+    contentlengthobj = newobject();
+    contentobjs.push_back(num);
+
+    beginobject(num);
+    out("<< /Length " + std::to_string(contentlengthobj) +
+        " 0 R /Filter /FlateDecode >>\nstream\n");
+    contentstart = offset;
+    zlib.reset(new ZlibWriter{[this](const char *data, size_t len) {
+      out(data, len);
+    }});
+    contentopen = true;
+  }
+
+  void closecontent() {
+    if (!contentopen)
+      return;
+
+    zlib->finish();
+    zlib.reset();
+    size_t len{offset - contentstart};
+    out("\nendstream\nendobj\n");
+
+    beginobject(contentlengthobj);
+    out(std::to_string(len) + "\nendobj\n");
+    contentopen = false;
+  }
+
+  // Write content, either to the innermost open group or to the page
+  void put(const char *data, size_t len) {
+    if (!groupbuffers.empty()) {
+      groupbuffers.back().append(data, len);
+      return;
+    }
+
+    if (!contentopen)
+      opencontent();
+    zlib->write(data, len);
+  }
+
+  void put(const char *str) { put(str, std::strlen(str)); }
+  void put(const std::string &str) { put(str.data(), str.size()); }
+
+  static size_t formatnumber(char *dest, size_t size, double value) {
+    // PDF does not support the exponential notation. Numbers within the
+    // page are written as fixed-point integers, which is much faster
+    // than snprintf
+    int len;
+    if (std::fabs(value) < 1e12) {
+      long long fixed{std::llround(std::fabs(value) * 10000)};
+      char digits[24];
+      int numofdigits{};
+      do {
+        digits[numofdigits++] = char('0' + fixed % 10);
+        fixed /= 10;
+      } while (fixed > 0 || numofdigits < 5);
+
+      len = 0;
+      if (value < 0)
+        dest[len++] = '-';
+      while (numofdigits > 4)
+        dest[len++] = digits[--numofdigits];
+      dest[len++] = '.';
+      while (numofdigits > 0)
+        dest[len++] = digits[--numofdigits];
+    } else {
+      // No decimal point, so the locale does not matter
+      len = std::snprintf(dest, size, "%.0f", value);
+      if (len <= 0 || size_t(len) >= size)
+        return 0;
+    }
+
+    while (len > 1 && dest[len - 1] == '0')
+      --len;
+    if (dest[len - 1] == '.')
+      --len;
+    if (len == 2 && dest[0] == '-' && dest[1] == '0')
+      dest[0] = '0', len = 1;
+    dest[len] = '\0';
+
+    return size_t(len);
+  }
+
+  static void appendnum(std::string &str, double value) {
+    char num[32];
+    str.append(num, formatnumber(num, sizeof(num), value));
+    str += ' ';
+  }
+
+  void putnum(double value) {
+    char num[32];
+    size_t len{formatnumber(num, sizeof(num), value)};
+    num[len++] = ' ';
+    put(num, len);
+  }
+
+  void putmatrix(const Matrix &m) {
+    for (double value : {m.a, m.b, m.c, m.d, m.e, m.f})
+      putnum(value);
+    put("cm\n");
+  }
+
+  static void appendverb(std::string &ops, PathVerb verb, const double *pt,
+                         Point &current, Point &start);
+  static void formatpath(const Path &path, std::string &ops);
+
+  void syncstate(Action act);
+  void paint(const std::string &geometry, Action act);
+
+  // Return the index of the shading that draws `gradient`
+  size_t shading(const Gradient &gradient);
+
+  // Fill `geometry`, whose bounding box goes from `min` to `max`, with
+  // a gradient
+  void paintgradient(const std::string &geometry, Point min, Point max,
+                     const Gradient &gradient);
+
+  // Write a stream object with the entries in `dict` and the data in
+  // `content`, which is compressed, and return its number
+  int writestream(const std::string &dict, const std::string &content);
+
+  // Write `content` as a Form XObject whose bounding box is `bbox`,
+  // and return its index in `xobjects`
+  size_t writeform(const std::string &content, const std::string &bbox) {
+    xobjects.push_back(writestream("/Type /XObject /Subtype /Form /BBox [" +
+                                       bbox + "] /Resources 4 0 R",
+                                   content));
+    return xobjects.size() - 1;
+  }
+
+  // Return the bytes that identify the tile of `pattern`: its size and
+  // its commands
+  static std::string patternkey(const Pattern &pattern);
+
+  // Return the index in `xobjects` of the tile of `pattern`
+  size_t tile(const Pattern &pattern);
+
+  // Fill `geometry` by repeating the tile of `pattern` over its
+  // bounding box
+  void paintpattern(const std::string &geometry, Point min, Point max,
+                    const Pattern &pattern);
+
+  static void appendcircle(std::string &ops, double x, double y, double r);
+  void pushstate() { states.push_back(states.back()); }
+  void popstate() { states.pop_back(); }
+
+  size_t fontindex() const;
+
+protected:
+  MONET_VIRTUAL void movetoxy(double x, double y) override;
+  MONET_VIRTUAL void linetoxy(double x, double y) override;
+  MONET_VIRTUAL void quadratictoxy(double xdir, double ydir, double xend,
+                                   double yend) override;
+  MONET_VIRTUAL void cubictoxy(double xc1, double yc1, double xc2, double yc2,
+                               double xend, double yend) override;
+  MONET_VIRTUAL void linexy(double x1, double y1, double x2,
+                            double y2) override;
+  MONET_VIRTUAL void circlexy(double x, double y, double radius,
+                              Action act = Action::Stroke) override;
+  MONET_VIRTUAL void rectanglexy(double x1, double y1, double x2, double y2,
+                                 Action act = Action::Stroke) override;
+  MONET_VIRTUAL void textxy(double x, double y, const char *text,
+                            HorizontalAlignment halign,
+                            VerticalAlignment valign) override;
+  MONET_VIRTUAL void pathobject(const Path &path,
+                                const TransformSequence &transforms,
+                                Action act) override;
+  MONET_VIRTUAL void circlearray(const Column<double> &xs,
+                                 const Column<double> &ys,
+                                 const Column<double> &radii,
+                                 const Column<Color> &colors, size_t n,
+                                 Action act) override;
+  MONET_VIRTUAL void rectanglearray(const Column<double> &xs,
+                                    const Column<double> &ys,
+                                    const Column<double> &widths,
+                                    const Column<double> &heights,
+                                    const Column<Color> &colors, size_t n,
+                                    Action act) override;
+  MONET_VIRTUAL void gradientcirclexy(double x, double y, double radius,
+                                      const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientrectanglexy(double x1, double y1, double x2,
+                                         double y2,
+                                         const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientpathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        const Gradient &gradient) override;
+  MONET_VIRTUAL void patterncirclexy(double x, double y, double radius,
+                                     const Pattern &pattern) override;
+  MONET_VIRTUAL void patternrectanglexy(double x1, double y1, double x2,
+                                        double y2,
+                                        const Pattern &pattern) override;
+  MONET_VIRTUAL void patternpathobject(const Path &path,
+                                       const TransformSequence &transforms,
+                                       const Pattern &pattern) override;
+  MONET_VIRTUAL void imagexy(double x1, double y1, double x2, double y2,
+                             size_t cols, size_t rows,
+                             const Color8 *pixels) override;
+
+public:
+  /// Create a new PDF file with the specified width and height (in mm)
+  PDFCanvas(const std::string &filename, double awidth, double aheight);
+
+  /// Write a new PDF document with the specified width and height (in
+  /// mm) into `out`
+  PDFCanvas(std::unique_ptr<std::ostream> out, double awidth, double aheight);
+  void operator=(const PDFCanvas &canvas) = delete;
+  MONET_VIRTUAL ~PDFCanvas();
+
+  /// Returns true if the PDF file was created successfully
+  bool isok() const { return stream->good(); }
+
+  void closepath() override { pathops += "h "; }
+  void strokepath() override { paint(pathops, Action::Stroke); }
+  void fillpath() override { paint(pathops, Action::Fill); }
+  void fillandstrokepath() override {
+    paint(pathops, Action::FillAndStroke);
+  }
+  void clearpath() override { pathops.clear(); }
+
+  MONET_VIRTUAL void begingroup(const TransformSequence &transforms = identity,
+                                const std::string &name = "") override;
+  MONET_VIRTUAL void endgroup() override;
+  int grouplevel() const override { return m_grouplevel; }
+
+  double getwidth() const override { return width; }
+  double getheight() const override { return height; }
+
+  MONET_VIRTUAL ClipRegion defineclip() override;
+  MONET_VIRTUAL void endclip() override;
+  void useclip() override {
+    assert(!clipregions.empty());
+    useclip(ClipRegion{int(clipregions.size()) - 1});
+  }
+  MONET_VIRTUAL void useclip(ClipRegion region) override;
+  MONET_VIRTUAL void removeclip() override;
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE PDFCanvas::PDFCanvas(const std::string &filename, double awidth,
+                                  double aheight)
+    : PDFCanvas{std::unique_ptr<std::ostream>{new std::ofstream(
+                    filename.c_str(), std::ios::out | std::ios::binary)},
+                awidth, aheight} {}
+
+MONET_INLINE PDFCanvas::PDFCanvas(std::unique_ptr<std::ostream> out,
+                                  double awidth, double aheight)
+    : BaseCanvas{}, stream{std::move(out)}, offset{0}, width{awidth},
+      height{aheight}, m_grouplevel{0}, clipdepth{0}, recordingclip{false},
+      offsets{}, contentobjs{}, contentopen{false}, contentlengthobj{0},
+      contentstart{0}, zlib{}, groupbuffers{}, groupmatrices{}, states(1),
+      groups{}, xobjects{}, opacities{}, usedfonts{}, shadings{},
+      shadingids{}, patternids{}, colorgroups{}, clipregions{}, pathops{},
+      current{} {
+  if (!stream) {
+    std::perror("Unable to create file");
+    std::abort();
+  }
+
+  // Object 0 is the head of the free list, 1-4 are written at the end
+  for (int i{}; i <= resourcesobj; ++i)
+    newobject();
+
+  this->out(std::string{"%PDF-1.4\n%\xe2\xe3\xcf\xd3\n% Created with Monet "} +
+            version + " (https://github.com/ziotom78/monet)\n");
+
+  // Monet's units are millimeters, while PDF uses points. In both, the
+  // origin is in the lower-left corner and the Y axis points upwards
+  put("2.834645669 0 0 2.834645669 0 0 cm\n");
+}
+
+MONET_INLINE PDFCanvas::~PDFCanvas() {
+  if (!stream)
+    return;
+
+  while (clipdepth > 0)
+    removeclip();
+
+  for (int i{m_grouplevel}; i > 0; i--)
+    endgroup();
+
+  closecontent();
+
+  const double mm{72.0 / 25.4};
+  char num[32];
+
+  beginobject(1);
+  out("<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+
+  beginobject(2);
+  out("<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+
+  beginobject(3);
+  out("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 ");
+  out(num, formatnumber(num, sizeof(num), width * mm));
+  out(" ", 1);
+  out(num, formatnumber(num, sizeof(num), height * mm));
+  out("] /Resources 4 0 R /Contents [");
+  for (int obj : contentobjs)
+    out(std::to_string(obj) + " 0 R ");
+  out("] >>\nendobj\n");
+
+  beginobject(resourcesobj);
+  out("<< /ProcSet [/PDF /Text]\n/ExtGState <<");
+  for (size_t i{}; i < opacities.size(); ++i) {
+    out("\n/GS" + std::to_string(i) + " << /Type /ExtGState /CA ");
+    out(num, formatnumber(num, sizeof(num), opacities[i].first));
+    out(" /ca ");
+    out(num, formatnumber(num, sizeof(num), opacities[i].second));
+    out(" >>");
+  }
+  out(" >>\n/Shading <<");
+  for (size_t i{}; i < shadings.size(); ++i)
+    out("\n/Sh" + std::to_string(i) + " " + shadings[i]);
+  out(" >>\n/XObject <<");
+  for (size_t i{}; i < xobjects.size(); ++i)
+    out(" /X" + std::to_string(i) + " " + std::to_string(xobjects[i]) +
+        " 0 R");
+  out(" >>\n/Font <<");
+  static const char *fontnames[]{"Times-Roman", "Helvetica", "Courier"};
+  for (size_t i{}; i < 3; ++i) {
+    if (usedfonts[i])
+      out(std::string{" /F"} + std::to_string(i) +
+          " << /Type /Font /Subtype /Type1 /BaseFont /" + fontnames[i] +
+          " /Encoding /WinAnsiEncoding >>");
+  }
+  out(" >> >>\nendobj\n");
+
+  // The cross-reference table: every entry must be exactly 20 bytes long
+  size_t xref{offset};
+  out("xref\n0 " + std::to_string(offsets.size()) +
+      "\n0000000000 65535 f\r\n");
+  for (size_t i{1}; i < offsets.size(); ++i) {
+    char entry[32];
+    std::snprintf(entry, sizeof(entry), "%010lu 00000 n\r\n",
+                  static_cast<unsigned long>(offsets[i]));
+    out(entry, 20);
+  }
+
+  out("trailer\n<< /Size " + std::to_string(offsets.size()) +
+      " /Root 1 0 R >>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n");
+  stream->flush();
+}
+
+MONET_INLINE void PDFCanvas::syncstate(Action act) {
+  GraphicsState &state{states.back()};
+  const bool stroke{act != Action::Fill}, fill{act != Action::Stroke};
+
+  if (stroke) {
+    const StrokeStyle &style{getstrokestyle()};
+    Color col{getstrokecolor()};
+    if (!state.strokeknown || col.r != state.strokecolor.r ||
+        col.g != state.strokecolor.g || col.b != state.strokecolor.b) {
+      putnum(col.r);
+      putnum(col.g);
+      putnum(col.b);
+      put("RG\n");
+      state.strokecolor = col;
+    }
+
+    if (!state.strokeknown || style.width != state.strokestyle.width) {
+      putnum(style.width);
+      put("w\n");
+    }
+    if (!state.strokeknown || style.join != state.strokestyle.join) {
+      putnum(style.join == LineJoin::Miter ? 0
+                                           : style.join == LineJoin::Round ? 1
+                                                                           : 2);
+      put("j\n");
+    }
+    if (!state.strokeknown || style.cap != state.strokestyle.cap) {
+      putnum(style.cap == LineCap::Butt ? 0 : style.cap == LineCap::Round ? 1
+                                                                          : 2);
+      put("J\n");
+    }
+    if (!state.strokeknown ||
+        style.miterlimit != state.strokestyle.miterlimit) {
+      putnum(style.miterlimit);
+      put("M\n");
+    }
+    if (!state.strokeknown || style.dashes != state.strokestyle.dashes ||
+        style.dashoffset != state.strokestyle.dashoffset) {
+      put("[");
+      for (double len : style.dashes)
+        putnum(len);
+      put("] ");
+      putnum(style.dashoffset);
+      put("d\n");
+    }
+    state.strokestyle = style;
+    state.strokeknown = true;
+  }
+
+  if (fill) {
+    Color col{getfillcolor()};
+    if (!state.fillknown || col.r != state.fillcolor.r ||
+        col.g != state.fillcolor.g || col.b != state.fillcolor.b) {
+      putnum(col.r);
+      putnum(col.g);
+      putnum(col.b);
+      put("rg\n");
+      state.fillcolor = col;
+      state.fillknown = true;
+    }
+  }
+
+  const double global{1 - gettransparency()};
+  const std::pair<double, double> opacity{global * getstrokealpha(),
+                                          global * getfillalpha()};
+  if (!state.opacityknown || opacity != state.opacity) {
+    // Opacities are shared: each value gets one ExtGState resource
+    size_t idx{};
+    while (idx < opacities.size() && opacities[idx] != opacity)
+      ++idx;
+    if (idx == opacities.size())
+      opacities.push_back(opacity);
+
+    put("/GS" + std::to_string(idx) + " gs\n");
+    state.opacity = opacity;
+    state.opacityknown = true;
+  }
+}
+
+MONET_INLINE void PDFCanvas::paint(const std::string &geometry, Action act) {
+  if (recordingclip) {
+    clipregions.back() += geometry;
+    return;
+  }
+
+  if (geometry.empty())
+    return;
+
+  syncstate(act);
+  put(geometry);
+  switch (act) {
+  case Action::Stroke:
+    put("S\n");
+    break;
+  case Action::Fill:
+    put("f\n");
+    break;
+  case Action::FillAndStroke:
+    put("B\n");
+    break;
+  default:
+    abort();
+  }
+}
+
+MONET_INLINE size_t PDFCanvas::shading(const Gradient &gradient) {
+  auto it = shadingids.find(gradient);
+  if (it != shadingids.end())
+    return it->second;
+
+  // Functions are defined over [0, 1], so the colors before the first
+  // stop and after the last one need stops of their own
+  std::vector<GradientStop> stops;
+  gradient.rgbstops(stops);
+  assert(!stops.empty());
+  if (stops.front().offset > 0)
+    stops.insert(stops.begin(), GradientStop{0, stops.front().color});
+  if (stops.back().offset < 1)
+    stops.push_back(GradientStop{1, stops.back().color});
+
+  std::string dict{"<< /ShadingType "};
+  if (gradient.type == GradientType::Linear) {
+    dict += "2 /Coords [";
+    for (double value : {gradient.start.x, gradient.start.y, gradient.end.x,
+                         gradient.end.y})
+      appendnum(dict, value);
+  } else {
+    dict += "3 /Coords [";
+    for (double value : {gradient.start.x, gradient.start.y, 0.0,
+                         gradient.start.x, gradient.start.y, gradient.radius})
+      appendnum(dict, value);
+  }
+  dict += "] /ColorSpace /DeviceRGB /Extend [true true]\n"
+          "/Function << /FunctionType 3 /Domain [0 1] /Functions [";
+
+  // Stitch a linear function for each interval that is not empty
+  std::string bounds, encode;
+  for (size_t i{1}; i < stops.size(); ++i) {
+    if (stops[i].offset <= stops[i - 1].offset)
+      continue;
+
+    if (!encode.empty())
+      appendnum(bounds, stops[i - 1].offset);
+    encode += "0 1 ";
+
+    const Color &c0{stops[i - 1].color}, &c1{stops[i].color};
+    dict += "\n<< /FunctionType 2 /Domain [0 1] /C0 [";
+    for (double value : {c0.r, c0.g, c0.b})
+      appendnum(dict, value);
+    dict += "] /C1 [";
+    for (double value : {c1.r, c1.g, c1.b})
+      appendnum(dict, value);
+    dict += "] /N 1 >>";
+  }
+  dict += "] /Bounds [" + bounds + "] /Encode [" + encode + "] >> >>";
+
+  shadings.push_back(dict);
+  shadingids[gradient] = shadings.size() - 1;
+  return shadings.size() - 1;
+}
+
+MONET_INLINE void PDFCanvas::paintgradient(const std::string &geometry,
+                                           Point min, Point max,
+                                           const Gradient &gradient) {
+  if (recordingclip) {
+    clipregions.back() += geometry;
+    return;
+  }
+
+  // Shapes with no area are invisible
+  if (geometry.empty() || max.x <= min.x || max.y <= min.y)
+    return;
+
+  // The opacity is set outside the q/Q pair, which would discard it
+  syncstate(Action::Fill);
+  const size_t idx{shading(gradient)};
+
+  // Map the unit square to the bounding box, as the coordinates of
+  // the gradient are relative to it
+  put("q\n");
+  put(geometry);
+  put("W n\n");
+  putmatrix(Matrix{max.x - min.x, 0, 0, max.y - min.y, min.x, min.y});
+  put("/Sh" + std::to_string(idx) + " sh\nQ\n");
+}
+
+MONET_INLINE void PDFCanvas::gradientcirclexy(double x, double y, double radius,
+                                              const Gradient &gradient) {
+  std::string ops;
+  appendcircle(ops, x, y, radius);
+  paintgradient(ops, Point{x - radius, y - radius},
+                Point{x + radius, y + radius}, gradient);
+}
+
+MONET_INLINE void PDFCanvas::gradientrectanglexy(double x1, double y1,
+                                                 double x2, double y2,
+                                                 const Gradient &gradient) {
+  const Point min{std::min(x1, x2), std::min(y1, y2)};
+  const Point max{std::max(x1, x2), std::max(y1, y2)};
+  std::string ops;
+  for (double value : {min.x, min.y, max.x - min.x, max.y - min.y})
+    appendnum(ops, value);
+  ops += "re ";
+  paintgradient(ops, min, max, gradient);
+}
+
+MONET_INLINE void
+PDFCanvas::gradientpathobject(const Path &path,
+                              const TransformSequence &transforms,
+                              const Gradient &gradient) {
+  pathops.clear();
+  if (path.empty())
+    return;
+
+  if (recordingclip) {
+    pathobject(path, transforms, Action::Fill);
+    return;
+  }
+
+  Point min, max;
+  path.boundingbox(min, max);
+  const std::string &ops{path.serialized(PathFormat::PDF, formatpath)};
+  if (isidentity(transforms)) {
+    paintgradient(ops, min, max, gradient);
+    return;
+  }
+
+  // As in `pathobject`, transform the coordinate system
+  put("q ");
+  putmatrix(tomatrix(transforms));
+  pushstate();
+  paintgradient(ops, min, max, gradient);
+  popstate();
+  put("Q\n");
+}
+
+// The alpha channel, if any, becomes a soft mask
+MONET_INLINE void PDFCanvas::imagexy(double x1, double y1, double x2, double y2,
+                                     size_t cols, size_t rows,
+                                     const Color8 *pixels) {
+  if (recordingclip) {
+    std::string ops;
+    for (double value : {x1, y1, x2 - x1, y2 - y1})
+      appendnum(ops, value);
+    clipregions.back() += ops + "re ";
+    return;
+  }
+
+  if (cols == 0 || rows == 0)
+    return;
+
+  std::string rgb, alpha;
+  rgb.reserve(3 * cols * rows);
+  alpha.reserve(cols * rows);
+  bool opaque{true};
+  for (size_t i{}; i < cols * rows; ++i) {
+    rgb += char(pixels[i].r);
+    rgb += char(pixels[i].g);
+    rgb += char(pixels[i].b);
+    alpha += char(pixels[i].a);
+    opaque = opaque && pixels[i].a == 255;
+  }
+
+  const std::string image{"/Type /XObject /Subtype /Image /Width " +
+                          std::to_string(cols) + " /Height " +
+                          std::to_string(rows) + " /BitsPerComponent 8"};
+  std::string dict{image + " /ColorSpace /DeviceRGB"};
+  if (!opaque)
+    dict += " /SMask " +
+            std::to_string(writestream(image + " /ColorSpace /DeviceGray",
+                                       alpha)) +
+            " 0 R";
+  xobjects.push_back(writestream(dict, rgb));
+
+  // The opacity of fills applies to images too. The first row of an
+  // image is at the top of the unit square
+  syncstate(Action::Fill);
+  put("q\n");
+  putmatrix(Matrix{x2 - x1, 0, 0, y1 - y2, x1, y2});
+  put("/X" + std::to_string(xobjects.size() - 1) + " Do\nQ\n");
+}
+
+MONET_INLINE void PDFCanvas::appendverb(std::string &ops, PathVerb verb,
+                                        const double *pt, Point &current,
+                                        Point &start) {
+  switch (verb) {
+  case PathVerb::MoveTo:
+    appendnum(ops, pt[0]);
+    appendnum(ops, pt[1]);
+    ops += "m ";
+    current = start = Point{pt[0], pt[1]};
+    break;
+
+  case PathVerb::LineTo:
+    appendnum(ops, pt[0]);
+    appendnum(ops, pt[1]);
+    ops += "l ";
+    current = Point{pt[0], pt[1]};
+    break;
+
+  case PathVerb::QuadraticTo: {
+    // PDF has no quadratic curves, but they can be turned into cubics
+    Point ctrl{pt[0], pt[1]}, end{pt[2], pt[3]};
+    Point c1{current + 2.0 / 3.0 * (ctrl - current)};
+    Point c2{end + 2.0 / 3.0 * (ctrl - end)};
+    for (double value : {c1.x, c1.y, c2.x, c2.y, end.x, end.y})
+      appendnum(ops, value);
+    ops += "c ";
+    current = end;
+    break;
+  }
+
+  case PathVerb::CubicTo:
+    for (size_t i{}; i < 6; ++i)
+      appendnum(ops, pt[i]);
+    ops += "c ";
+    current = Point{pt[4], pt[5]};
+    break;
+
+  case PathVerb::Close:
+    ops += "h ";
+    current = start;
+    break;
+
+  default:
+    abort();
+  }
+}
+
+MONET_INLINE void PDFCanvas::formatpath(const Path &path, std::string &ops) {
+  const double *pt{path.getcoords().data()};
+  Point current, start;
+  for (PathVerb verb : path.getverbs()) {
+    appendverb(ops, verb, pt, current, start);
+    pt += numofcoords(verb);
+  }
+}
+
+MONET_INLINE void PDFCanvas::movetoxy(double x, double y) {
+  const double pt[]{x, y};
+  Point start;
+  appendverb(pathops, PathVerb::MoveTo, pt, current, start);
+}
+
+MONET_INLINE void PDFCanvas::linetoxy(double x, double y) {
+  const double pt[]{x, y};
+  Point start;
+  appendverb(pathops, PathVerb::LineTo, pt, current, start);
+}
+
+MONET_INLINE void PDFCanvas::quadratictoxy(double xdir, double ydir,
+                                           double xend, double yend) {
+  const double pt[]{xdir, ydir, xend, yend};
+  Point start;
+  appendverb(pathops, PathVerb::QuadraticTo, pt, current, start);
+}
+
+MONET_INLINE void PDFCanvas::cubictoxy(double xc1, double yc1, double xc2,
+                                       double yc2, double xend, double yend) {
+  const double pt[]{xc1, yc1, xc2, yc2, xend, yend};
+  Point start;
+  appendverb(pathops, PathVerb::CubicTo, pt, current, start);
+}
+
+MONET_INLINE void PDFCanvas::linexy(double x1, double y1, double x2,
+                                    double y2) {
+  // A line has no area, so it cannot contribute to a clipping path
+  if (recordingclip)
+    return;
+
+  std::string ops;
+  for (double value : {x1, y1})
+    appendnum(ops, value);
+  ops += "m ";
+  for (double value : {x2, y2})
+    appendnum(ops, value);
+  ops += "l ";
+  paint(ops, Action::Stroke);
+}
+
+MONET_INLINE void PDFCanvas::circlearray(const Column<double> &xs,
+                                         const Column<double> &ys,
+                                         const Column<double> &radii,
+                                         const Column<Color> &colors, size_t n,
+                                         Action act) {
+  // Colors are set only when they change, so it is enough to draw the
+  // items of each color together
+  const Color oldstroke{getstrokecolor()}, oldfill{getfillcolor()};
+  colorgroups.build(colors, n);
+  for (size_t idx : colorgroups.order) {
+    setitemcolor(colors, idx, act);
+    circlexy(xs[idx], ys[idx], radii[idx], act);
+  }
+  setstrokecolor(oldstroke);
+  setfillcolor(oldfill);
+}
+
+MONET_INLINE void PDFCanvas::rectanglearray(const Column<double> &xs,
+                                            const Column<double> &ys,
+                                            const Column<double> &widths,
+                                            const Column<double> &heights,
+                                            const Column<Color> &colors,
+                                            size_t n, Action act) {
+  const Color oldstroke{getstrokecolor()}, oldfill{getfillcolor()};
+  colorgroups.build(colors, n);
+  for (size_t idx : colorgroups.order) {
+    setitemcolor(colors, idx, act);
+    rectanglexy(xs[idx], ys[idx], xs[idx] + widths[idx], ys[idx] + heights[idx],
+                act);
+  }
+  setstrokecolor(oldstroke);
+  setfillcolor(oldfill);
+}
+
+MONET_INLINE void PDFCanvas::appendcircle(std::string &ops, double x, double y,
+                                          double r) {
+  // Four cubic arcs approximate a circle within 0.03% of the radius
+  const double k{0.5522847498 * r};
+  const double pts[][6]{{x + r, y + k, x + k, y + r, x, y + r},
+                        {x - k, y + r, x - r, y + k, x - r, y},
+                        {x - r, y - k, x - k, y - r, x, y - r},
+                        {x + k, y - r, x + r, y - k, x + r, y}};
+
+  appendnum(ops, x + r);
+  appendnum(ops, y);
+  ops += "m ";
+  for (const auto &arc : pts) {
+    for (double value : arc)
+      appendnum(ops, value);
+    ops += "c ";
+  }
+  ops += "h ";
+}
+
+MONET_INLINE void PDFCanvas::circlexy(double x, double y, double r,
+                                      Action act) {
+  std::string ops;
+  appendcircle(ops, x, y, r);
+  paint(ops, act);
+}
+
+MONET_INLINE void PDFCanvas::rectanglexy(double x1, double y1, double x2,
+                                         double y2, Action act) {
+  std::string ops;
+  for (double value : {std::min(x1, x2), std::min(y1, y2), std::fabs(x2 - x1),
+                       std::fabs(y2 - y1)})
+    appendnum(ops, value);
+  ops += "re ";
+  paint(ops, act);
+}
+
+MONET_INLINE size_t PDFCanvas::fontindex() const {
   switch (getfontfamily()) {
-  case FontFamily::SansSerif:
-    return "sans-serif";
   case FontFamily::Serif:
-    return "serif";
+    return 0;
+  case FontFamily::SansSerif:
+    return 1;
   case FontFamily::Monospaced:
-    return "monospace";
+    return 2;
+  default:
+    abort();
+  }
+}
+
+MONET_INLINE void PDFCanvas::textxy(double x, double y, const char *text,
+                                    HorizontalAlignment halign,
+                                    VerticalAlignment valign) {
+  if (recordingclip)
+    return;
+
+  size_t font{fontindex()};
+  usedfonts[font] = true;
+  const double size{getfontsize()};
+
+  std::string encoded;
+  encodewinansi(encoded, text);
+
+  // Courier is monospaced, the others have an average width of ~0.5 em
+  const double textwidth{encoded.size() * size * (font == 2 ? 0.6 : 0.5)};
+  switch (halign) {
+  case HorizontalAlignment::Left:
+    x -= textwidth;
+    break;
+  case HorizontalAlignment::Center:
+    x -= textwidth / 2;
+    break;
+  case HorizontalAlignment::Right:
+    break;
+  default:
+    abort();
+  }
+
+  // Approximate ascent and descent of the standard fonts
+  switch (valign) {
+  case VerticalAlignment::Top:
+    y -= 0.75 * size;
+    break;
+  case VerticalAlignment::Center:
+  case VerticalAlignment::Middle:
+    y -= 0.25 * size;
+    break;
+  case VerticalAlignment::Bottom:
+    y += 0.25 * size;
+    break;
   default:
     abort();
   }
+
+  syncstate(Action::Fill);
+  put("BT /F" + std::to_string(font) + " ");
+  putnum(size);
+  put("Tf ");
+  putnum(x);
+  putnum(y);
+  put("Td (");
+  for (const char &ch : encoded) {
+    if (ch == '(' || ch == ')' || ch == '\\')
+      put("\\", 1);
+    put(&ch, 1);
+  }
+  put(") Tj ET\n");
+}
+
+MONET_INLINE void PDFCanvas::pathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        Action act) {
+  // As in BaseCanvas, a path that has not been drawn yet is discarded
+  pathops.clear();
+
+  const std::string &ops{path.serialized(PathFormat::PDF, formatpath)};
+
+  if (isidentity(transforms)) {
+    paint(ops, act);
+    return;
+  }
+
+  if (recordingclip) {
+    // The clipping path is made of plain coordinates
+    std::string clip;
+    formatpath(Path{path}.transform(transforms), clip);
+    paint(clip, act);
+    return;
+  }
+
+  // Transform the coordinate system, not the path, so that the cached
+  // text can be reused
+  put("q ");
+  putmatrix(tomatrix(transforms));
+  pushstate();
+  paint(ops, act);
+  popstate();
+  put("Q\n");
+}
+
+MONET_INLINE void PDFCanvas::begingroup(const TransformSequence &transforms,
+                                        const std::string &) {
+  groupbuffers.emplace_back();
+  groupmatrices.push_back(tomatrix(transforms));
+
+  // The content of a group must not depend on the state set outside,
+  // as it could be reused elsewhere
+  states.push_back(GraphicsState{});
+  m_grouplevel++;
+  pushtransform(transforms);
+}
+
+MONET_INLINE void PDFCanvas::endgroup() {
+  if (m_grouplevel <= 0)
+    abort();
+
+  std::string content{std::move(groupbuffers.back())};
+  Matrix matrix{groupmatrices.back()};
+  groupbuffers.pop_back();
+  groupmatrices.pop_back();
+  states.pop_back();
+  m_grouplevel--;
+  poptransform();
+
+  // Small groups are cheaper to repeat than to reference
+  const size_t mingroupsize{256};
+  int xobject{-1};
+  if (content.size() >= mingroupsize) {
+    auto entry = groups.emplace(content, -1);
+    if (!entry.second) {
+      // Second time we see this group: turn it into a Form XObject. Its
+      // extent is not measured, so the box encloses any reasonable
+      // drawing (PDF has no exponential notation)
+      int &form{entry.first->second};
+      if (form < 0)
+        form = int(writeform(content, "-100000 -100000 100000 100000"));
+      xobject = form;
+    }
+  }
+
+  put("q\n");
+  putmatrix(matrix);
+  if (xobject >= 0)
+    put("/X" + std::to_string(xobject) + " Do\n");
+  else
+    put(content);
+  put("Q\n");
+}
+
+// Objects must be written outside of the page's content stream
+MONET_INLINE int PDFCanvas::writestream(const std::string &dict,
+                                        const std::string &content) {
+  std::string compressed;
+  ZlibWriter writer{[&compressed](const char *data, size_t len) {
+    compressed.append(data, len);
+  }};
+  writer.write(content.data(), content.size());
+  writer.finish();
+
+  closecontent();
+  int num{newobject()};
+  beginobject(num);
+  out("<< " + dict + " /Filter /FlateDecode /Length " +
+      std::to_string(compressed.size()) + " >>\nstream\n");
+  out(compressed);
+  out("\nendstream\nendobj\n");
+  return num;
+}
+
+MONET_INLINE ClipRegion PDFCanvas::defineclip() {
+  assert(!recordingclip);
+
+  clipregions.emplace_back();
+  recordingclip = true;
+  return ClipRegion{int(clipregions.size()) - 1};
+}
+
+MONET_INLINE void PDFCanvas::endclip() {
+  assert(recordingclip);
+
+  recordingclip = false;
+}
+
+// The clipping path is intersected with the one of the enclosing q/Q
+// pair, so regions can be nested
+MONET_INLINE void PDFCanvas::useclip(ClipRegion region) {
+  assert(!recordingclip);
+  assert(region.id >= 0 && size_t(region.id) < clipregions.size());
+
+  put("q\n");
+  put(clipregions[size_t(region.id)]);
+  put("W n\n");
+  pushstate();
+
+  ++clipdepth;
+}
+
+MONET_INLINE void PDFCanvas::removeclip() {
+  assert(clipdepth > 0);
+
+  popstate();
+  put("Q\n");
+
+  --clipdepth;
+}
+#endif // MONET_DEFINITIONS
+#endif // MONET_WITH_PDF
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** A R-tree over rectangles, for point and region queries
+ *
+ * Rectangles are added with `add`, each with a numeric id; once they
+ * are all known, `build` packs them into a static R-tree using the
+ * Sort-Tile-Recursive algorithm, and `query` returns the ids of the
+ * rectangles that contain a point or intersect a region, visiting
+ * O(log n) nodes for small regions.
+ *
+ * Coordinates are stored as `float`, rounded outwards. The index can
+ * be saved into a compact binary file with `save` and loaded back with
+ * `load`, without rebuilding it; the file contains the same arrays used
+ * in memory, in the byte order of the machine.
+ */
+class SpatialIndex {
+public:
+  struct Box {
+    float minx, miny, maxx, maxy;
+  };
+
+  struct Entry {
+    Box box;
+    uint32_t id;
+  };
+
+  /// A node of the tree: its children are `count` elements starting
+  /// from `first`, either nodes or entries (for the nodes of the first
+  /// `numofleaves`)
+  struct Node {
+    Box box;
+    uint32_t first, count;
+  };
+
+private:
+  // A tree built from 2^32 entries has 8 levels, and `load` accepts
+  // at most `maxlevels`, so that `visit` can use a fixed stack
+  enum { fanout = 16, maxlevels = 16, version = 1 };
+
+  std::vector<Entry> entries;
+  std::vector<Node> nodes;
+  uint32_t numofleaves;
+  bool built;
+
+  static bool intersects(const Box &a, const Box &b) {
+    return a.minx <= b.maxx && b.minx <= a.maxx && a.miny <= b.maxy &&
+           b.miny <= a.maxy;
+  }
+
+  static void extend(Box &box, const Box &other) {
+    box.minx = std::min(box.minx, other.minx);
+    box.miny = std::min(box.miny, other.miny);
+    box.maxx = std::max(box.maxx, other.maxx);
+    box.maxy = std::max(box.maxy, other.maxy);
+  }
+
+  // Sort elements so that each run of `fanout` of them is compact: first
+  // cut vertical slices, then sort each slice along Y
+  template <typename T> static void sorttiles(std::vector<T> &elems) {
+    auto centerx = [](const T &elem) { return elem.box.minx + elem.box.maxx; };
+    auto centery = [](const T &elem) { return elem.box.miny + elem.box.maxy; };
+
+    const size_t numofpages{(elems.size() + fanout - 1) / fanout};
+    const size_t numofslices{
+        size_t(std::ceil(std::sqrt(double(numofpages))))};
+    const size_t slicesize{
+        ((numofpages + numofslices - 1) / numofslices) * fanout};
+
+    std::sort(elems.begin(), elems.end(), [&](const T &a, const T &b) {
+      return centerx(a) < centerx(b);
+    });
+    for (size_t start{}; start < elems.size(); start += slicesize) {
+      auto end = elems.begin() + std::min(elems.size(), start + slicesize);
+      std::sort(elems.begin() + start, end, [&](const T &a, const T &b) {
+        return centery(a) < centery(b);
+      });
+    }
+  }
+
+  // Group runs of `fanout` elements into new nodes
+  template <typename T>
+  static void pack(const std::vector<T> &elems, size_t offset,
+                   std::vector<Node> &result) {
+    for (size_t start{}; start < elems.size(); start += fanout) {
+      Node node{elems[start].box, uint32_t(offset + start),
+                uint32_t(std::min(size_t(fanout), elems.size() - start))};
+      for (size_t i{1}; i < node.count; ++i)
+        extend(node.box, elems[start + i].box);
+      result.push_back(node);
+    }
+  }
+
+  template <typename Fn> void visit(const Box &region, Fn fn) const;
+
+  // Read `count` elements, growing the vector only while the stream
+  // has data, so that a damaged count cannot exhaust the memory
+  template <typename T>
+  static bool readarray(std::istream &in, std::vector<T> &elems,
+                        size_t count) {
+    const size_t chunk{size_t(1) << 16};
+    elems.clear();
+    while (elems.size() < count) {
+      const size_t start{elems.size()};
+      elems.resize(start + std::min(chunk, count - start));
+      if (!in.read(reinterpret_cast<char *>(&elems[start]),
+                   std::streamsize((elems.size() - start) * sizeof(T))))
+        return false;
+    }
+    return true;
+  }
+
+public:
+  SpatialIndex() : entries{}, nodes{}, numofleaves{0}, built{true} {}
+
+  /// Add a rectangle; the index must be built again before querying it
+  void add(Point min, Point max, uint32_t id);
+
+  /// Build the tree
+  void build();
+
+  /// Return the number of rectangles
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+
+  /// Append to `result` the ids of the rectangles that contain `pt`
+  void query(Point pt, std::vector<uint32_t> &result) const {
+    query(pt, pt, result);
+  }
+
+  /// Append to `result` the ids of the rectangles that intersect the
+  /// region between `min` and `max`
+  void query(Point min, Point max, std::vector<uint32_t> &result) const;
+
+  /// Write the index in binary form; return false in case of errors
+  bool save(std::ostream &out) const;
+
+  /// Replace the content of the index with the one saved by `save`;
+  /// return false if the data is not valid
+  bool load(std::istream &in);
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void SpatialIndex::add(Point min, Point max, uint32_t id) {
+  // Round outwards, so that the float box contains the double one
+  const float inf{std::numeric_limits<float>::infinity()};
+  Box box{float(std::min(min.x, max.x)), float(std::min(min.y, max.y)),
+          float(std::max(min.x, max.x)), float(std::max(min.y, max.y))};
+  if (box.minx > std::min(min.x, max.x))
+    box.minx = std::nextafter(box.minx, -inf);
+  if (box.miny > std::min(min.y, max.y))
+    box.miny = std::nextafter(box.miny, -inf);
+  if (box.maxx < std::max(min.x, max.x))
+    box.maxx = std::nextafter(box.maxx, inf);
+  if (box.maxy < std::max(min.y, max.y))
+    box.maxy = std::nextafter(box.maxy, inf);
+
+  entries.push_back(Entry{box, id});
+  built = false;
+}
+
+MONET_INLINE void SpatialIndex::build() {
+  nodes.clear();
+  if (!entries.empty()) {
+    sorttiles(entries);
+    pack(entries, 0, nodes);
+    numofleaves = uint32_t(nodes.size());
+
+    // Each level is packed into the next one, until only the root is left
+    size_t levelstart{};
+    std::vector<Node> level;
+    while (nodes.size() - levelstart > 1) {
+      level.assign(nodes.begin() + levelstart, nodes.end());
+      sorttiles(level);
+      std::copy(level.begin(), level.end(), nodes.begin() + levelstart);
+
+      const size_t nextstart{nodes.size()};
+      pack(level, levelstart, nodes);
+      levelstart = nextstart;
+    }
+  } else {
+    numofleaves = 0;
+  }
+
+  built = true;
+}
+#endif // MONET_DEFINITIONS
+
+template <typename Fn>
+void SpatialIndex::visit(const Box &region, Fn fn) const {
+  assert(built);
+  if (nodes.empty())
+    return;
+
+  // The root is the last node. Each level adds at most `fanout` - 1
+  // nodes to the stack, and there are at most `maxlevels` of them
+  uint32_t stack[maxlevels * fanout];
+  size_t depth{};
+  stack[depth++] = uint32_t(nodes.size() - 1);
+
+  while (depth > 0) {
+    const Node &node{nodes[stack[--depth]]};
+    if (!intersects(node.box, region))
+      continue;
+
+    const bool leaf{size_t(&node - nodes.data()) < numofleaves};
+    for (uint32_t i{node.first}; i < node.first + node.count; ++i) {
+      if (leaf) {
+        if (intersects(entries[i].box, region))
+          fn(entries[i]);
+      } else {
+        assert(depth < sizeof(stack) / sizeof(stack[0]));
+        stack[depth++] = i;
+      }
+    }
+  }
+}
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void SpatialIndex::query(Point min, Point max,
+                                      std::vector<uint32_t> &result) const {
+  Box region{float(std::min(min.x, max.x)), float(std::min(min.y, max.y)),
+             float(std::max(min.x, max.x)), float(std::max(min.y, max.y))};
+  visit(region, [&result](const Entry &entry) { result.push_back(entry.id); });
+}
+
+MONET_INLINE bool SpatialIndex::save(std::ostream &out) const {
+  assert(built);
+
+  const uint32_t header[]{uint32_t(version), uint32_t(entries.size()),
+                          uint32_t(nodes.size()), numofleaves};
+  out.write("MONETIDX", 8);
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            std::streamsize(entries.size() * sizeof(Entry)));
+  out.write(reinterpret_cast<const char *>(nodes.data()),
+            std::streamsize(nodes.size() * sizeof(Node)));
+
+  return out.good();
+}
+
+MONET_INLINE bool SpatialIndex::load(std::istream &in) {
+  char magic[8];
+  uint32_t header[4];
+  if (!in.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, "MONETIDX", sizeof(magic)) != 0 ||
+      !in.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+      header[0] != version || header[3] > header[2])
+    return false;
+
+  std::vector<Entry> newentries;
+  std::vector<Node> newnodes;
+  if (!readarray(in, newentries, header[1]) ||
+      !readarray(in, newnodes, header[2]))
+    return false;
+
+  // Children must be within the arrays, and nodes can only point to
+  // nodes that come before them. The number of levels below each node
+  // bounds the depth of the tree
+  std::vector<unsigned char> levels(newnodes.size());
+  for (size_t i{}; i < newnodes.size(); ++i) {
+    const Node &node{newnodes[i]};
+    const bool leaf{i < header[3]};
+    size_t limit{leaf ? newentries.size() : i};
+    if (node.count > fanout || node.first > limit ||
+        node.count > limit - node.first)
+      return false;
+
+    levels[i] = 1;
+    for (uint32_t child{node.first}; !leaf && child < node.first + node.count;
+         ++child)
+      levels[i] = std::max(levels[i], (unsigned char)(levels[child] + 1));
+    if (levels[i] > maxlevels)
+      return false;
+  }
+
+  entries = std::move(newentries);
+  nodes = std::move(newnodes);
+  numofleaves = header[3];
+  built = true;
+  return true;
+}
+#endif // MONET_DEFINITIONS
+
+////////////////
+
+/// The commands that can be stored in a CommandBuffer: one for each
+/// method of BaseCanvas, plus one for each drawing parameter
+enum class CommandType : uint32_t {
+  SetStrokeColor,
+  SetFillColor,
+  SetStrokeColor8,
+  SetFillColor8,
+  SetStrokeWidth,
+  SetLineJoin,
+  SetLineCap,
+  SetMiterLimit,
+  SetDash,
+  SetFontFamily,
+  SetFontSize,
+  SetTransparency,
+  MoveTo,
+  LineTo,
+  QuadraticTo,
+  CubicTo,
+  ClosePath,
+  StrokePath,
+  FillPath,
+  FillAndStrokePath,
+  ClearPath,
+  Line,
+  Circle,
+  Rectangle,
+  Text,
+  PathObject,
+  BeginGroup,
+  EndGroup,
+  DefineClip,
+  EndClip,
+  UseClip,
+  RemoveClip,
+  ClipRectangle,
+  SetGradient,
+  GradientCircle,
+  GradientRectangle,
+  GradientPath,
+  SetPattern,
+  PatternCircle,
+  PatternRectangle,
+  PatternPath,
+  Image,
+  NumOfCommands,
+};
+
+/// The header that precedes the arguments of every command
+struct CommandHeader {
+  uint32_t type;
+  uint32_t size; // Size of the arguments, including the padding
+};
+
+/** A sequence of drawing commands in a compact binary form
+ *
+ * Each command is made by a CommandHeader followed by its arguments,
+ * padded to a multiple of 8 bytes, so that every command starts on an
+ * 8-byte boundary. The buffer is a contiguous block of memory that can
+ * be replayed into any canvas (see CommandPlayer), handed to another
+ * thread, or saved to disk as it is.
+ */
+class CommandBuffer {
+private:
+  std::vector<uint64_t> words;
+  size_t used;
+
+public:
+  CommandBuffer() : words{}, used{0} {}
+
+  /// Add a command and return a pointer to the memory where its
+  /// `argsize` bytes of arguments must be written
+  char *append(CommandType type, size_t argsize) {
+    size_t padded{(argsize + 7) & ~size_t(7)};
+    size_t total{used + sizeof(CommandHeader) + padded};
+    if (total > words.size() * sizeof(uint64_t))
+      words.resize(std::max(total / sizeof(uint64_t), 2 * words.size()));
+
+    char *dest{reinterpret_cast<char *>(words.data()) + used};
+    CommandHeader header{uint32_t(type), uint32_t(padded)};
+    std::memcpy(dest, &header, sizeof(header));
+    dest += sizeof(header);
+    if (padded > 0)
+      std::memset(dest + padded - sizeof(uint64_t), 0, sizeof(uint64_t));
+
+    used = total;
+    return dest;
+  }
+
+  /// Reserve memory for at least `size` bytes
+  void reserve(size_t size) {
+    if (size > words.size() * sizeof(uint64_t))
+      words.resize((size + 7) / sizeof(uint64_t));
+  }
+
+  /// Remove all the commands, keeping the memory
+  void clear() { used = 0; }
+
+  /// Replace the commands with a copy of the `size` bytes at `data`,
+  /// which must be a sequence of whole commands
+  void assign(const char *data, size_t size) {
+    assert(size % sizeof(uint64_t) == 0);
+    used = 0;
+    reserve(size);
+    if (size > 0)
+      std::memcpy(words.data(), data, size);
+    used = size;
+  }
+
+  bool empty() const { return used == 0; }
+  const char *data() const {
+    return reinterpret_cast<const char *>(words.data());
+  }
+
+  /// Return the number of bytes used by the commands
+  size_t size() const { return used; }
+};
+
+class RecordingCanvas;
+
+/** A tile that is repeated to fill shapes
+ *
+ * The tile is drawn into a RecordingCanvas with the usual calls, and
+ * it covers the rectangle from (0, 0) to the size of that canvas: what
+ * is drawn outside is not shown. Unlike the ones of gradients, tiles
+ * are aligned to the origin of the coordinate system, not to the
+ * shape, so that adjacent shapes filled with the same pattern join
+ * seamlessly. Canvases define each pattern once, so filling a large
+ * region costs the same as filling a small one:
+ *
+ *     RecordingCanvas tile{2, 2};
+ *     tile.line(Point{0, 2}, Point{2, 0});
+ *     const Pattern hatch{tile};
+ *     canv.rectangle(Point{10, 10}, Point{90, 40}, hatch);
+ */
+class Pattern {
+private:
+  double width, height;
+  CommandBuffer commands;
+  uint64_t key;
+
+public:
+  Pattern() : width{0}, height{0}, commands{}, key{0} {}
+
+  /// Copy the commands recorded so far by `tile`, and its size
+  explicit Pattern(const RecordingCanvas &tile);
+
+  /// Replace the tile with one of the given size, drawn by the `size`
+  /// bytes of commands at `data`
+  void assign(double awidth, double aheight, const char *data, size_t size) {
+    width = awidth;
+    height = aheight;
+    commands.assign(data, size);
+
+    XXHash64 hash;
+    hash.update(&width, sizeof(width));
+    hash.update(&height, sizeof(height));
+    hash.update(commands.data(), commands.size());
+    key = hash.digest();
+  }
+
+  double getwidth() const { return width; }
+  double getheight() const { return height; }
+  const CommandBuffer &getcommands() const { return commands; }
+
+  /// Return a hash of the size and of the commands of the tile, so
+  /// that canvases can define equal patterns only once
+  uint64_t getkey() const { return key; }
+};
+
+/** Replay the commands in a CommandBuffer into a canvas
+ *
+ * The player keeps the memory used for paths and transformations
+ * between calls to `play`, so that replaying does not allocate memory
+ * once it has warmed up. It also keeps the clipping regions defined on
+ * the canvas, so a player must always replay into the same canvas.
+ */
+class CommandPlayer {
+private:
+  Path path;
+  TransformSequence transforms;
+  std::vector<double> dashes;
+  std::string groupname;
+
+  // The regions defined on the canvas, indexed by the recorded ids
+  std::vector<ClipRegion> clips;
+
+  // Set by the last SetGradient and SetPattern commands
+  Gradient gradient;
+  Pattern pattern;
+
+  template <typename T> static T get(const char *&src) {
+    T value;
+    std::memcpy(&value, src, sizeof(T));
+    src += sizeof(T);
+    return value;
+  }
+
+  static Point getpoint(const char *&src) {
+    double x{get<double>(src)};
+    return Point{x, get<double>(src)};
+  }
+
+  void gettransforms(const char *&src, size_t count) {
+    transforms.resize(count);
+    if (count > 0)
+      std::memcpy(transforms.data(), src, count * sizeof(Transform));
+    src += count * sizeof(Transform);
+  }
+
+  // Read the arguments of a PathObject command into `path` and
+  // `transforms`, and return the action
+  Action getpath(const char *&src) {
+    auto act = Action(get<uint32_t>(src));
+    uint32_t numoftransforms{get<uint32_t>(src)};
+    uint32_t numofverbs{get<uint32_t>(src)};
+    uint32_t numofcoords{get<uint32_t>(src)};
+    gettransforms(src, numoftransforms);
+    const char *coords{src};
+    src += numofcoords * sizeof(double);
+
+    // `coords` is aligned, as it follows four 32-bit integers and a
+    // number of 32-byte transforms
+    path.assign(reinterpret_cast<const PathVerb *>(src), numofverbs,
+                reinterpret_cast<const double *>(coords), numofcoords);
+    return act;
+  }
+
+public:
+  CommandPlayer()
+      : path{}, transforms{}, dashes{}, groupname{}, clips{}, gradient{},
+        pattern{} {}
+
+  /// Replay `size` bytes of commands, starting from `data`, which must
+  /// be aligned to 8 bytes
+  void play(const char *data, size_t size, BaseCanvas &canvas);
+
+  void play(const CommandBuffer &buffer, BaseCanvas &canvas) {
+    play(buffer.data(), buffer.size(), canvas);
+  }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void CommandPlayer::play(const char *data, size_t size,
+                                      BaseCanvas &canvas) {
+  const char *end{data + size};
+  while (data < end) {
+    CommandHeader header{get<CommandHeader>(data)};
+    const char *src{data};
+    data += header.size;
+    assert(data <= end);
+
+    switch (CommandType(header.type)) {
+    case CommandType::SetStrokeColor: {
+      Color col;
+      col.r = get<double>(src);
+      col.g = get<double>(src);
+      col.b = get<double>(src);
+      canvas.setstrokecolor(col);
+      canvas.setstrokealpha(get<double>(src));
+      break;
+    }
+    case CommandType::SetFillColor: {
+      Color col;
+      col.r = get<double>(src);
+      col.g = get<double>(src);
+      col.b = get<double>(src);
+      canvas.setfillcolor(col);
+      canvas.setfillalpha(get<double>(src));
+      break;
+    }
+    case CommandType::SetStrokeColor8:
+      canvas.setstrokecolor(Color8::frompacked(get<uint32_t>(src)));
+      break;
+    case CommandType::SetFillColor8:
+      canvas.setfillcolor(Color8::frompacked(get<uint32_t>(src)));
+      break;
+    case CommandType::SetStrokeWidth:
+      canvas.setstrokewidth(get<double>(src));
+      break;
+    case CommandType::SetLineJoin:
+      canvas.setlinejoin(LineJoin(get<uint32_t>(src)));
+      break;
+    case CommandType::SetLineCap:
+      canvas.setlinecap(LineCap(get<uint32_t>(src)));
+      break;
+    case CommandType::SetMiterLimit:
+      canvas.setmiterlimit(get<double>(src));
+      break;
+    case CommandType::SetDash: {
+      double offset{get<double>(src)};
+      dashes.resize(header.size / sizeof(double) - 1);
+      for (double &len : dashes)
+        len = get<double>(src);
+      canvas.setdash(dashes, offset);
+      break;
+    }
+    case CommandType::SetFontFamily:
+      canvas.setfontfamily(FontFamily(get<uint32_t>(src)));
+      break;
+    case CommandType::SetFontSize:
+      canvas.setfontsize(get<double>(src));
+      break;
+    case CommandType::SetTransparency:
+      canvas.settransparency(get<double>(src));
+      break;
+
+    case CommandType::MoveTo: {
+      Point p{getpoint(src)};
+      canvas.movetoxy(p.x, p.y);
+      break;
+    }
+    case CommandType::LineTo: {
+      Point p{getpoint(src)};
+      canvas.linetoxy(p.x, p.y);
+      break;
+    }
+    case CommandType::QuadraticTo: {
+      Point dir{getpoint(src)}, end{getpoint(src)};
+      canvas.quadratictoxy(dir.x, dir.y, end.x, end.y);
+      break;
+    }
+    case CommandType::CubicTo: {
+      Point c1{getpoint(src)}, c2{getpoint(src)}, end{getpoint(src)};
+      canvas.cubictoxy(c1.x, c1.y, c2.x, c2.y, end.x, end.y);
+      break;
+    }
+    case CommandType::ClosePath:
+      canvas.closepath();
+      break;
+    case CommandType::StrokePath:
+      canvas.strokepath();
+      break;
+    case CommandType::FillPath:
+      canvas.fillpath();
+      break;
+    case CommandType::FillAndStrokePath:
+      canvas.fillandstrokepath();
+      break;
+    case CommandType::ClearPath:
+      canvas.clearpath();
+      break;
+
+    case CommandType::Line: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      canvas.linexy(p1.x, p1.y, p2.x, p2.y);
+      break;
+    }
+    case CommandType::Circle: {
+      Point center{getpoint(src)};
+      double radius{get<double>(src)};
+      canvas.circlexy(center.x, center.y, radius, Action(get<uint32_t>(src)));
+      break;
+    }
+    case CommandType::Rectangle: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      canvas.rectanglexy(p1.x, p1.y, p2.x, p2.y, Action(get<uint32_t>(src)));
+      break;
+    }
+    case CommandType::Text: {
+      Point p{getpoint(src)};
+      auto halign = HorizontalAlignment(get<uint32_t>(src));
+      auto valign = VerticalAlignment(get<uint32_t>(src));
+      canvas.textxy(p.x, p.y, src, halign, valign);
+      break;
+    }
+    case CommandType::PathObject: {
+      const Action act{getpath(src)};
+      canvas.pathobject(path, transforms, act);
+      break;
+    }
+
+    case CommandType::SetGradient: {
+      gradient.type = GradientType(get<uint32_t>(src));
+      gradient.space = ColorSpace(get<uint32_t>(src));
+      const uint32_t numofstops{get<uint32_t>(src)};
+      src += sizeof(uint32_t);
+      gradient.start = getpoint(src);
+      gradient.end = getpoint(src);
+      gradient.radius = get<double>(src);
+      gradient.stops.resize(numofstops);
+      for (GradientStop &stop : gradient.stops) {
+        stop.offset = get<double>(src);
+        stop.color.r = get<double>(src);
+        stop.color.g = get<double>(src);
+        stop.color.b = get<double>(src);
+      }
+      break;
+    }
+    case CommandType::GradientCircle: {
+      Point p{getpoint(src)};
+      canvas.gradientcirclexy(p.x, p.y, get<double>(src), gradient);
+      break;
+    }
+    case CommandType::GradientRectangle: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      canvas.gradientrectanglexy(p1.x, p1.y, p2.x, p2.y, gradient);
+      break;
+    }
+    case CommandType::GradientPath:
+      getpath(src);
+      canvas.gradientpathobject(path, transforms, gradient);
+      break;
+
+    case CommandType::SetPattern: {
+      Point size{getpoint(src)};
+      pattern.assign(size.x, size.y, src, header.size - 2 * sizeof(double));
+      break;
+    }
+    case CommandType::PatternCircle: {
+      Point p{getpoint(src)};
+      canvas.patterncirclexy(p.x, p.y, get<double>(src), pattern);
+      break;
+    }
+    case CommandType::PatternRectangle: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      canvas.patternrectanglexy(p1.x, p1.y, p2.x, p2.y, pattern);
+      break;
+    }
+    case CommandType::PatternPath:
+      getpath(src);
+      canvas.patternpathobject(path, transforms, pattern);
+      break;
+    case CommandType::Image: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      const uint32_t cols{get<uint32_t>(src)};
+      const uint32_t rows{get<uint32_t>(src)};
+      canvas.imagexy(p1.x, p1.y, p2.x, p2.y, cols, rows,
+                     reinterpret_cast<const Color8 *>(src));
+      break;
+    }
+
+    case CommandType::BeginGroup: {
+      uint32_t numoftransforms{get<uint32_t>(src)};
+      uint32_t namelen{get<uint32_t>(src)};
+      gettransforms(src, numoftransforms);
+      groupname.assign(src, namelen);
+      canvas.begingroup(transforms, groupname);
+      break;
+    }
+    case CommandType::EndGroup:
+      canvas.endgroup();
+      break;
+    case CommandType::DefineClip:
+      clips.push_back(canvas.defineclip());
+      break;
+    case CommandType::EndClip:
+      canvas.endclip();
+      break;
+    case CommandType::UseClip: {
+      const uint32_t id{get<uint32_t>(src)};
+      assert(id < clips.size());
+      canvas.useclip(clips[id]);
+      break;
+    }
+    case CommandType::RemoveClip:
+      canvas.removeclip();
+      break;
+    case CommandType::ClipRectangle: {
+      Point p1{getpoint(src)}, p2{getpoint(src)};
+      clips.push_back(canvas.cliprectanglexy(p1.x, p1.y, p2.x, p2.y));
+      break;
+    }
+
+    default:
+      abort();
+    }
+  }
+}
+#endif // MONET_DEFINITIONS
+
+/** A canvas that records every call into a CommandBuffer
+ *
+ * The drawing parameters (colors, stroke style, font, transparency)
+ * are recorded only when they change, just before the first primitive
+ * that uses them. Once the buffer contains more than `batchsize`
+ * bytes, the virtual method `submit` is called; derived classes can
+ * override it to consume the commands and clear the buffer.
+ */
+class RecordingCanvas : public BaseCanvas {
+private:
+  struct RecordedState {
+    Color strokecolor, fillcolor;
+    double strokealpha, fillalpha;
+    StrokeStyle strokestyle;
+    FontFamily fontfamily;
+    double fontsize, transparency;
+  };
+
+  double width, height;
+  int m_grouplevel;
+  size_t batchsize;
+
+  bool statevalid;
+  RecordedState recorded;
+
+  // The gradient used by the last Gradient* command, and the key of the
+  // pattern used by the last Pattern* one
+  bool gradientvalid;
+  Gradient recordedgradient;
+  bool patternvalid;
+  uint64_t recordedpattern;
+
+  int numofclips;
+
+  SpatialIndex *index;
+  uint32_t numofindexed;
+  Point pathmin, pathmax;
+  bool pathempty;
+
+  template <typename T> static char *put(char *dest, const T &value) {
+    std::memcpy(dest, &value, sizeof(T));
+    return dest + sizeof(T);
+  }
+
+  static char *putpoint(char *dest, double x, double y) {
+    return put(put(dest, x), y);
+  }
+
+  // Copy only the members that are used, so that the padding and the
+  // rest of the union are zero and equal drawings produce equal bytes
+  static char *puttransforms(char *dest, const TransformSequence &transforms) {
+    for (const Transform &transf : transforms) {
+      std::memset(dest, 0, sizeof(Transform));
+      put(dest + offsetof(Transform, type), transf.type);
+      if (transf.type == TransformType::Rotation)
+        put(dest + offsetof(Transform, rotation), transf.rotation);
+      else
+        put(dest + offsetof(Transform, translation), transf.translation);
+      dest += sizeof(Transform);
+    }
+    return dest;
+  }
+
+  static bool samecolor(Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+  }
+
+  // Colors that fit in a Color8 use a command that is half as long
+  void recordcolor(CommandType type, CommandType type8, Color col,
+                   double alpha) {
+    if (isexactcolor8(col, alpha)) {
+      put(commands.append(type8, sizeof(uint32_t)),
+          Color8{col, alpha}.packed());
+      return;
+    }
+
+    char *dest{commands.append(type, 4 * sizeof(double))};
+    put(put(putpoint(dest, col.r, col.g), col.b), alpha);
+  }
+
+  void recordstate();
+  void recordgradient(const Gradient &gradient);
+  void recordpattern(const Pattern &pattern);
+
+  // Record the arguments of a PathObject command
+  void recordpath(CommandType type, const Path &path,
+                  const TransformSequence &transforms, Action act);
+
+  void record(CommandType type) {
+    commands.append(type, 0);
+    endcommand();
+  }
+
+  void endcommand() {
+    if (commands.size() >= batchsize)
+      submit();
+  }
+
+  void extendpath(double x, double y) {
+    if (!index)
+      return;
+
+    if (pathempty) {
+      pathmin = pathmax = Point{x, y};
+      pathempty = false;
+    } else
+      extendbox(Point{x, y}, pathmin, pathmax);
+  }
+
+  void indexbox(Point min, Point max, bool stroked,
+                const Matrix &transform = Matrix{});
+
+  void indexpath(bool stroked) {
+    if (!pathempty)
+      indexbox(pathmin, pathmax, stroked);
+  }
+
+protected:
+  CommandBuffer commands;
+
+  /// Called when the buffer is full: consume the commands and clear it
+  virtual void submit() {}
+
+  /// Record all the drawing parameters again before the next primitive
+  void invalidatestate() {
+    statevalid = gradientvalid = patternvalid = false;
+  }
+
+  MONET_VIRTUAL void movetoxy(double x, double y) override;
+  MONET_VIRTUAL void linetoxy(double x, double y) override;
+  MONET_VIRTUAL void quadratictoxy(double xdir, double ydir, double xend,
+                                   double yend) override;
+  MONET_VIRTUAL void cubictoxy(double xc1, double yc1, double xc2, double yc2,
+                               double xend, double yend) override;
+  MONET_VIRTUAL void linexy(double x1, double y1, double x2,
+                            double y2) override;
+  MONET_VIRTUAL void circlexy(double x, double y, double radius,
+                              Action act = Action::Stroke) override;
+  MONET_VIRTUAL void rectanglexy(double x1, double y1, double x2, double y2,
+                                 Action act = Action::Stroke) override;
+  MONET_VIRTUAL void textxy(double x, double y, const char *text,
+                            HorizontalAlignment halign,
+                            VerticalAlignment valign) override;
+  MONET_VIRTUAL void pathobject(const Path &path,
+                                const TransformSequence &transforms,
+                                Action act) override;
+  MONET_VIRTUAL void gradientcirclexy(double x, double y, double radius,
+                                      const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientrectanglexy(double x1, double y1, double x2,
+                                         double y2,
+                                         const Gradient &gradient) override;
+  MONET_VIRTUAL void gradientpathobject(const Path &path,
+                                        const TransformSequence &transforms,
+                                        const Gradient &gradient) override;
+  MONET_VIRTUAL void patterncirclexy(double x, double y, double radius,
+                                     const Pattern &pattern) override;
+  MONET_VIRTUAL void patternrectanglexy(double x1, double y1, double x2,
+                                        double y2,
+                                        const Pattern &pattern) override;
+  MONET_VIRTUAL void patternpathobject(const Path &path,
+                                       const TransformSequence &transforms,
+                                       const Pattern &pattern) override;
+  MONET_VIRTUAL void imagexy(double x1, double y1, double x2, double y2,
+                             size_t cols, size_t rows,
+                             const Color8 *pixels) override;
+  ClipRegion cliprectanglexy(double x1, double y1, double x2,
+                             double y2) override {
+    putpoint(putpoint(commands.append(CommandType::ClipRectangle,
+                                      4 * sizeof(double)),
+                      x1, y1),
+             x2, y2);
+    endcommand();
+    return ClipRegion{numofclips++};
+  }
+
+public:
+  /// Create a canvas with the given size. If `abatchsize` is not
+  /// specified, `submit` is never called
+  RecordingCanvas(double awidth, double aheight,
+                  size_t abatchsize = size_t(-1))
+      : BaseCanvas{}, width{awidth}, height{aheight}, m_grouplevel{0},
+        batchsize{abatchsize}, statevalid{false}, recorded{},
+        gradientvalid{false}, recordedgradient{}, patternvalid{false},
+        recordedpattern{0}, numofclips{0}, index{nullptr}, numofindexed{0},
+        pathmin{}, pathmax{}, pathempty{true}, commands{} {}
+
+  /// Return the commands recorded so far
+  const CommandBuffer &getcommands() const { return commands; }
+
+  /** Add the bounding box of every primitive drawn from now on to
+   * `aindex` (pass `nullptr` to stop)
+   *
+   * Boxes are in device coordinates, i.e., canvas coordinates times
+   * the device scale, and include the width of strokes; the box of
+   * a text is estimated from its length. The id of each box is the
+   * number of primitives indexed before it, so later primitives, which
+   * are drawn over the others, have larger ids. Call
+   * `SpatialIndex::build` once the drawing is complete.
+   */
+  void setindex(SpatialIndex *aindex) { index = aindex; }
+
+  void closepath() override { record(CommandType::ClosePath); }
+  void strokepath() override {
+    indexpath(true);
+    recordstate();
+    record(CommandType::StrokePath);
+  }
+  void fillpath() override {
+    indexpath(false);
+    recordstate();
+    record(CommandType::FillPath);
+  }
+  void fillandstrokepath() override {
+    indexpath(true);
+    recordstate();
+    record(CommandType::FillAndStrokePath);
+  }
+  void clearpath() override {
+    pathempty = true;
+    record(CommandType::ClearPath);
+  }
+
+  MONET_VIRTUAL void begingroup(const TransformSequence &transforms = identity,
+                                const std::string &name = "") override;
+  MONET_VIRTUAL void endgroup() override;
+  int grouplevel() const override { return m_grouplevel; }
+
+  double getwidth() const override { return width; }
+  double getheight() const override { return height; }
+
+  ClipRegion defineclip() override {
+    record(CommandType::DefineClip);
+    return ClipRegion{numofclips++};
+  }
+  void endclip() override { record(CommandType::EndClip); }
+  void useclip() override {
+    assert(numofclips > 0);
+    useclip(ClipRegion{numofclips - 1});
+  }
+  void useclip(ClipRegion region) override {
+    assert(region.id >= 0 && region.id < numofclips);
+    put(commands.append(CommandType::UseClip, sizeof(uint32_t)),
+        uint32_t(region.id));
+    endcommand();
+  }
+  void removeclip() override { record(CommandType::RemoveClip); }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE void RecordingCanvas::recordstate() {
+  Color strokecolor{getstrokecolor()}, fillcolor{getfillcolor()};
+  const StrokeStyle &style{getstrokestyle()};
+
+  if (!statevalid || !samecolor(strokecolor, recorded.strokecolor) ||
+      getstrokealpha() != recorded.strokealpha)
+    recordcolor(CommandType::SetStrokeColor, CommandType::SetStrokeColor8,
+                strokecolor, getstrokealpha());
+  if (!statevalid || !samecolor(fillcolor, recorded.fillcolor) ||
+      getfillalpha() != recorded.fillalpha)
+    recordcolor(CommandType::SetFillColor, CommandType::SetFillColor8,
+                fillcolor, getfillalpha());
+
+  if (!statevalid || style.width != recorded.strokestyle.width)
+    put(commands.append(CommandType::SetStrokeWidth, sizeof(double)),
+        style.width);
+  if (!statevalid || style.join != recorded.strokestyle.join)
+    put(commands.append(CommandType::SetLineJoin, sizeof(uint32_t)),
+        uint32_t(style.join));
+  if (!statevalid || style.cap != recorded.strokestyle.cap)
+    put(commands.append(CommandType::SetLineCap, sizeof(uint32_t)),
+        uint32_t(style.cap));
+  if (!statevalid || style.miterlimit != recorded.strokestyle.miterlimit)
+    put(commands.append(CommandType::SetMiterLimit, sizeof(double)),
+        style.miterlimit);
+  if (!statevalid || style.dashes != recorded.strokestyle.dashes ||
+      style.dashoffset != recorded.strokestyle.dashoffset) {
+    char *dest{commands.append(CommandType::SetDash,
+                               (style.dashes.size() + 1) * sizeof(double))};
+    dest = put(dest, style.dashoffset);
+    for (double len : style.dashes)
+      dest = put(dest, len);
+  }
+
+  if (!statevalid || getfontfamily() != recorded.fontfamily)
+    put(commands.append(CommandType::SetFontFamily, sizeof(uint32_t)),
+        uint32_t(getfontfamily()));
+  if (!statevalid || getfontsize() != recorded.fontsize)
+    put(commands.append(CommandType::SetFontSize, sizeof(double)),
+        getfontsize());
+  if (!statevalid || gettransparency() != recorded.transparency)
+    put(commands.append(CommandType::SetTransparency, sizeof(double)),
+        gettransparency());
+
+  recorded.strokecolor = strokecolor;
+  recorded.fillcolor = fillcolor;
+  recorded.strokealpha = getstrokealpha();
+  recorded.fillalpha = getfillalpha();
+  if (!statevalid || style.dashes != recorded.strokestyle.dashes)
+    recorded.strokestyle = style;
+  else {
+    recorded.strokestyle.width = style.width;
+    recorded.strokestyle.join = style.join;
+    recorded.strokestyle.cap = style.cap;
+    recorded.strokestyle.miterlimit = style.miterlimit;
+    recorded.strokestyle.dashoffset = style.dashoffset;
+  }
+  recorded.fontfamily = getfontfamily();
+  recorded.fontsize = getfontsize();
+  recorded.transparency = gettransparency();
+  statevalid = true;
+}
+
+MONET_INLINE void RecordingCanvas::indexbox(Point min, Point max, bool stroked,
+                                            const Matrix &transform) {
+  if (!index)
+    return;
+
+  if (stroked) {
+    // Miter joins can stick out by `miterlimit` half-widths
+    const StrokeStyle &style{getstrokestyle()};
+    double margin{style.width / 2};
+    if (style.join == LineJoin::Miter)
+      margin *= std::max(style.miterlimit, std::sqrt(2.0));
+    else if (style.cap == LineCap::Square)
+      margin *= std::sqrt(2.0);
+
+    min -= Point{margin, margin};
+    max += Point{margin, margin};
+  }
+
+  const Matrix matrix{getctm() * transform};
+  const double scale{getdevicescale()};
+  const Point corners[]{min, Point{max.x, min.y}, max, Point{min.x, max.y}};
+  Point devmin{matrix.apply(min)}, devmax{devmin};
+  for (const auto &corner : corners)
+    extendbox(matrix.apply(corner), devmin, devmax);
+
+  index->add(devmin * scale, devmax * scale, numofindexed++);
+}
+
+MONET_INLINE void RecordingCanvas::movetoxy(double x, double y) {
+  extendpath(x, y);
+  putpoint(commands.append(CommandType::MoveTo, 2 * sizeof(double)), x, y);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::linetoxy(double x, double y) {
+  extendpath(x, y);
+  putpoint(commands.append(CommandType::LineTo, 2 * sizeof(double)), x, y);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::quadratictoxy(double xdir, double ydir,
+                                                 double xend, double yend) {
+  // Control points enclose the curve
+  extendpath(xdir, ydir);
+  extendpath(xend, yend);
+  char *dest{commands.append(CommandType::QuadraticTo, 4 * sizeof(double))};
+  putpoint(putpoint(dest, xdir, ydir), xend, yend);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::cubictoxy(double xc1, double yc1, double xc2,
+                                             double yc2, double xend,
+                                             double yend) {
+  extendpath(xc1, yc1);
+  extendpath(xc2, yc2);
+  extendpath(xend, yend);
+  char *dest{commands.append(CommandType::CubicTo, 6 * sizeof(double))};
+  putpoint(putpoint(putpoint(dest, xc1, yc1), xc2, yc2), xend, yend);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::linexy(double x1, double y1, double x2,
+                                          double y2) {
+  indexbox(Point{std::min(x1, x2), std::min(y1, y2)},
+           Point{std::max(x1, x2), std::max(y1, y2)}, true);
+  recordstate();
+  char *dest{commands.append(CommandType::Line, 4 * sizeof(double))};
+  putpoint(putpoint(dest, x1, y1), x2, y2);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::circlexy(double x, double y, double radius,
+                                            Action act) {
+  indexbox(Point{x - radius, y - radius}, Point{x + radius, y + radius},
+           act != Action::Fill);
+  recordstate();
+  char *dest{commands.append(CommandType::Circle,
+                             3 * sizeof(double) + sizeof(uint32_t))};
+  put(put(putpoint(dest, x, y), radius), uint32_t(act));
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::rectanglexy(double x1, double y1, double x2,
+                                               double y2, Action act) {
+  indexbox(Point{std::min(x1, x2), std::min(y1, y2)},
+           Point{std::max(x1, x2), std::max(y1, y2)}, act != Action::Fill);
+  recordstate();
+  char *dest{commands.append(CommandType::Rectangle,
+                             4 * sizeof(double) + sizeof(uint32_t))};
+  put(putpoint(putpoint(dest, x1, y1), x2, y2), uint32_t(act));
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::textxy(double x, double y, const char *text,
+                                          HorizontalAlignment halign,
+                                          VerticalAlignment valign) {
+  size_t len{std::strlen(text) + 1};
+  if (index) {
+    // Assume that characters are 0.6 em wide at most, as in Courier
+    const double size{getfontsize()};
+    const double textwidth{0.6 * size * double(len - 1)};
+    double left{x - textwidth}, top{y - size};
+    if (halign == HorizontalAlignment::Center)
+      left = x - textwidth / 2;
+    else if (halign == HorizontalAlignment::Right)
+      left = x;
+    if (valign == VerticalAlignment::Top)
+      top = y;
+    else if (valign != VerticalAlignment::Bottom)
+      top = y - size / 2;
+
+    indexbox(Point{left, top}, Point{left + textwidth, top + size}, false);
+  }
+
+  recordstate();
+  char *dest{commands.append(CommandType::Text,
+                             2 * sizeof(double) + 2 * sizeof(uint32_t) + len)};
+  dest = put(putpoint(dest, x, y), uint32_t(halign));
+  std::memcpy(put(dest, uint32_t(valign)), text, len);
+  endcommand();
+}
+
+MONET_INLINE void
+RecordingCanvas::pathobject(const Path &path,
+                            const TransformSequence &transforms, Action act) {
+  static_assert(sizeof(Transform) % sizeof(double) == 0,
+                "Coordinates in a PathObject command would be misaligned");
+
+  // The canvas that replays the command discards its path in the same way
+  pathempty = true;
+
+  if (index && !path.empty()) {
+    Point min, max;
+    path.boundingbox(min, max);
+    indexbox(min, max, act != Action::Fill, tomatrix(transforms));
+  }
+
+  recordstate();
+  recordpath(CommandType::PathObject, path, transforms, act);
+}
+
+MONET_INLINE void
+RecordingCanvas::recordpath(CommandType type, const Path &path,
+                            const TransformSequence &transforms, Action act) {
+  const auto &verbs = path.getverbs();
+  const auto &coords = path.getcoords();
+  char *dest{commands.append(type, 4 * sizeof(uint32_t) +
+                                       transforms.size() * sizeof(Transform) +
+                                       coords.size() * sizeof(double) +
+                                       verbs.size() * sizeof(PathVerb))};
+  dest = put(dest, uint32_t(act));
+  dest = put(dest, uint32_t(transforms.size()));
+  dest = put(dest, uint32_t(verbs.size()));
+  dest = put(dest, uint32_t(coords.size()));
+  dest = puttransforms(dest, transforms);
+  if (!coords.empty()) {
+    std::memcpy(dest, coords.data(), coords.size() * sizeof(double));
+    dest += coords.size() * sizeof(double);
+  }
+  if (!verbs.empty())
+    std::memcpy(dest, verbs.data(), verbs.size() * sizeof(PathVerb));
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::recordgradient(const Gradient &gradient) {
+  if (gradientvalid && gradient == recordedgradient)
+    return;
+
+  const size_t numofstops{gradient.stops.size()};
+  char *dest{commands.append(CommandType::SetGradient,
+                             4 * sizeof(uint32_t) + 5 * sizeof(double) +
+                                 numofstops * 4 * sizeof(double))};
+  dest = put(dest, uint32_t(gradient.type));
+  dest = put(dest, uint32_t(gradient.space));
+  dest = put(dest, uint32_t(numofstops));
+  dest = put(dest, uint32_t(0));
+  dest = putpoint(dest, gradient.start.x, gradient.start.y);
+  dest = putpoint(dest, gradient.end.x, gradient.end.y);
+  dest = put(dest, gradient.radius);
+  for (const GradientStop &stop : gradient.stops) {
+    dest = putpoint(dest, stop.offset, stop.color.r);
+    dest = putpoint(dest, stop.color.g, stop.color.b);
+  }
+  endcommand();
+
+  recordedgradient = gradient;
+  gradientvalid = true;
+}
+
+MONET_INLINE void RecordingCanvas::gradientcirclexy(double x, double y,
+                                                    double radius,
+                                                    const Gradient &gradient) {
+  indexbox(Point{x - radius, y - radius}, Point{x + radius, y + radius},
+           false);
+  recordstate();
+  recordgradient(gradient);
+  char *dest{commands.append(CommandType::GradientCircle, 3 * sizeof(double))};
+  put(putpoint(dest, x, y), radius);
+  endcommand();
+}
+
+MONET_INLINE void
+RecordingCanvas::gradientrectanglexy(double x1, double y1, double x2, double y2,
+                                     const Gradient &gradient) {
+  indexbox(Point{std::min(x1, x2), std::min(y1, y2)},
+           Point{std::max(x1, x2), std::max(y1, y2)}, false);
+  recordstate();
+  recordgradient(gradient);
+  char *dest{
+      commands.append(CommandType::GradientRectangle, 4 * sizeof(double))};
+  putpoint(putpoint(dest, x1, y1), x2, y2);
+  endcommand();
+}
+
+MONET_INLINE void
+RecordingCanvas::gradientpathobject(const Path &path,
+                                    const TransformSequence &transforms,
+                                    const Gradient &gradient) {
+  pathempty = true;
+  if (index && !path.empty()) {
+    Point min, max;
+    path.boundingbox(min, max);
+    indexbox(min, max, false, tomatrix(transforms));
+  }
+
+  recordstate();
+  recordgradient(gradient);
+  recordpath(CommandType::GradientPath, path, transforms, Action::Fill);
+}
+
+// The commands of the tile are copied as they are: they are a
+// sequence of whole commands, so they keep the alignment
+MONET_INLINE void RecordingCanvas::recordpattern(const Pattern &pattern) {
+  if (patternvalid && pattern.getkey() == recordedpattern)
+    return;
+
+  const CommandBuffer &tile{pattern.getcommands()};
+  char *dest{commands.append(CommandType::SetPattern,
+                             2 * sizeof(double) + tile.size())};
+  dest = putpoint(dest, pattern.getwidth(), pattern.getheight());
+  if (!tile.empty())
+    std::memcpy(dest, tile.data(), tile.size());
+  endcommand();
+
+  recordedpattern = pattern.getkey();
+  patternvalid = true;
+}
+
+MONET_INLINE void RecordingCanvas::patterncirclexy(double x, double y,
+                                                   double radius,
+                                                   const Pattern &pattern) {
+  indexbox(Point{x - radius, y - radius}, Point{x + radius, y + radius},
+           false);
+  recordstate();
+  recordpattern(pattern);
+  char *dest{commands.append(CommandType::PatternCircle, 3 * sizeof(double))};
+  put(putpoint(dest, x, y), radius);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::patternrectanglexy(double x1, double y1,
+                                                      double x2, double y2,
+                                                      const Pattern &pattern) {
+  indexbox(Point{std::min(x1, x2), std::min(y1, y2)},
+           Point{std::max(x1, x2), std::max(y1, y2)}, false);
+  recordstate();
+  recordpattern(pattern);
+  char *dest{
+      commands.append(CommandType::PatternRectangle, 4 * sizeof(double))};
+  putpoint(putpoint(dest, x1, y1), x2, y2);
+  endcommand();
+}
+
+MONET_INLINE void
+RecordingCanvas::patternpathobject(const Path &path,
+                                   const TransformSequence &transforms,
+                                   const Pattern &pattern) {
+  pathempty = true;
+  if (index && !path.empty()) {
+    Point min, max;
+    path.boundingbox(min, max);
+    indexbox(min, max, false, tomatrix(transforms));
+  }
+
+  recordstate();
+  recordpattern(pattern);
+  recordpath(CommandType::PatternPath, path, transforms, Action::Fill);
+}
+
+MONET_INLINE void RecordingCanvas::imagexy(double x1, double y1, double x2,
+                                           double y2, size_t cols, size_t rows,
+                                           const Color8 *pixels) {
+  indexbox(Point{std::min(x1, x2), std::min(y1, y2)},
+           Point{std::max(x1, x2), std::max(y1, y2)}, false);
+  recordstate();
+
+  const size_t numofpixels{cols * rows};
+  char *dest{commands.append(CommandType::Image,
+                             4 * sizeof(double) + 2 * sizeof(uint32_t) +
+                                 numofpixels * sizeof(Color8))};
+  dest = putpoint(putpoint(dest, x1, y1), x2, y2);
+  dest = put(dest, uint32_t(cols));
+  dest = put(dest, uint32_t(rows));
+  if (numofpixels > 0)
+    std::memcpy(dest, pixels, numofpixels * sizeof(Color8));
+  endcommand();
+}
+
+MONET_INLINE void
+RecordingCanvas::begingroup(const TransformSequence &transforms,
+                            const std::string &name) {
+  char *dest{commands.append(CommandType::BeginGroup,
+                             2 * sizeof(uint32_t) +
+                                 transforms.size() * sizeof(Transform) +
+                                 name.size())};
+  dest = put(dest, uint32_t(transforms.size()));
+  dest = put(dest, uint32_t(name.size()));
+  dest = puttransforms(dest, transforms);
+  if (!name.empty())
+    std::memcpy(dest, name.data(), name.size());
+
+  m_grouplevel++;
+  pushtransform(transforms);
+  endcommand();
+}
+
+MONET_INLINE void RecordingCanvas::endgroup() {
+  if (m_grouplevel <= 0)
+    abort();
+
+  m_grouplevel--;
+  poptransform();
+  record(CommandType::EndGroup);
+}
+
+// These are defined here because they need RecordingCanvas
+
+MONET_INLINE Pattern::Pattern(const RecordingCanvas &tile)
+    : width{0}, height{0}, commands{}, key{0} {
+  const CommandBuffer &recorded{tile.getcommands()};
+  assign(tile.getwidth(), tile.getheight(), recorded.data(), recorded.size());
+}
+
+#ifdef MONET_WITH_SVGFILLS
+MONET_INLINE void SVGCanvas::beginpattern(const Pattern &pattern) {
+  flushbatch();
+
+  // As for gradients, cached groups include the patterns they use
+  const uint64_t key{pattern.getkey()};
+  if (patterns.insert(key).second || capturing > 0) {
+    indent();
+    writelit("<defs>\n");
+    indentlevel++;
+
+    indent();
+    writelit("<pattern id=\"");
+    writepaintid("monet_pattern_", key);
+    writelit("\" patternUnits=\"userSpaceOnUse\" width=\"");
+    writenum(pattern.getwidth());
+    writelit("\" height=\"");
+    writenum(pattern.getheight());
+    writelit("\">\n");
+    endelement();
+    indentlevel++;
+
+    // The tile uses its own drawing parameters, and it is not clipped
+    // by the regions in use
+    const DrawingState state{getstate()};
+    std::vector<ActiveClip> outerclips;
+    std::string outerpath;
+    outerclips.swap(clips);
+    outerpath.swap(pathspec);
+
+    CommandPlayer player;
+    player.play(pattern.getcommands(), *this);
+    flushbatch();
+
+    clips.swap(outerclips);
+    pathspec.swap(outerpath);
+    setstate(state);
+
+    indentlevel--;
+    indent();
+    writelit("</pattern>\n");
+    indentlevel--;
+    indent();
+    writelit("</defs>\n");
+    endelement();
+  }
+
+  fillpaint = "monet_pattern_";
+  fillkey = key;
+}
+
+MONET_INLINE void SVGCanvas::patterncirclexy(double x, double y, double radius,
+                                             const Pattern &pattern) {
+  if (!clipbox(x - radius, y - radius, x + radius, y + radius, 0))
+    return;
+
+  beginpattern(pattern);
+  emitcircle<Action::Fill>(x, y, radius);
+  endpattern();
+}
+
+// Tiles do not depend on the shape, so rectangles can be cut
+MONET_INLINE void SVGCanvas::patternrectanglexy(double x1, double y1, double x2,
+                                                double y2,
+                                                const Pattern &pattern) {
+  if (!cutrectangle(x1, y1, x2, y2))
+    return;
+
+  beginpattern(pattern);
+  emitrectangle<Action::Fill>(x1, y1, x2, y2);
+  endpattern();
+}
+
+MONET_INLINE void
+SVGCanvas::patternpathobject(const Path &path,
+                             const TransformSequence &transforms,
+                             const Pattern &pattern) {
+  pathspec.clear();
+  if (cullingshape()) {
+    Point min, max;
+    if (!isidentity(transforms) || path.empty())
+      openclip();
+    else {
+      path.boundingbox(min, max);
+      if (!clipbox(min.x, min.y, max.x, max.y, 0))
+        return;
+    }
+  }
+
+  beginpattern(pattern);
+  emitpath<Action::Fill>(path.serialized(PathFormat::SVG, formatpath),
+                         transforms);
+  endpattern();
+}
+#endif // MONET_WITH_SVGFILLS
+
+#ifdef MONET_WITH_PDF
+MONET_INLINE std::string PDFCanvas::patternkey(const Pattern &pattern) {
+  const double size[]{pattern.getwidth(), pattern.getheight()};
+  std::string key{reinterpret_cast<const char *>(size), sizeof(size)};
+  key.append(pattern.getcommands().data(), pattern.getcommands().size());
+  return key;
+}
+
+MONET_INLINE size_t PDFCanvas::tile(const Pattern &pattern) {
+  std::string key{patternkey(pattern)};
+  auto it = patternids.find(key);
+  if (it != patternids.end())
+    return it->second;
+
+  // The tile is drawn like a group, with its own drawing parameters
+  const DrawingState state{getstate()};
+  const Point outercurrent{current};
+  std::string outerpath;
+  outerpath.swap(pathops);
+  groupbuffers.emplace_back();
+  states.push_back(GraphicsState{});
+
+  CommandPlayer player;
+  player.play(pattern.getcommands(), *this);
+
+  std::string content{std::move(groupbuffers.back())};
+  groupbuffers.pop_back();
+  states.pop_back();
+  pathops.swap(outerpath);
+  current = outercurrent;
+  setstate(state);
+
+  // The bounding box of the form clips the tile
+  std::string bbox{"0 0 "};
+  appendnum(bbox, pattern.getwidth());
+  appendnum(bbox, pattern.getheight());
+  bbox.pop_back();
+
+  const size_t idx{writeform(content, bbox)};
+  patternids.emplace(std::move(key), idx);
+  return idx;
+}
+
+// The pattern space of PDF tiling patterns is the one of the page or
+// of the form that uses them, which is not the one of the shape when
+// groups are turned into forms. Thus, the tile is a form which is
+// painted once for every cell of the grid that covers the shape
+MONET_INLINE void PDFCanvas::paintpattern(const std::string &geometry,
+                                          Point min, Point max,
+                                          const Pattern &pattern) {
+  if (recordingclip) {
+    clipregions.back() += geometry;
+    return;
+  }
+
+  const double tilewidth{pattern.getwidth()};
+  const double tileheight{pattern.getheight()};
+  if (geometry.empty() || max.x <= min.x || max.y <= min.y ||
+      tilewidth <= 0 || tileheight <= 0)
+    return;
+
+  const std::string drawtile{"/X" + std::to_string(tile(pattern)) +
+                             " Do Q\n"};
+  syncstate(Action::Fill);
+
+  put("q\n");
+  put(geometry);
+  put("W n\n");
+  const long long firstcol{(long long)std::floor(min.x / tilewidth)};
+  const long long lastcol{(long long)std::ceil(max.x / tilewidth)};
+  const long long firstrow{(long long)std::floor(min.y / tileheight)};
+  const long long lastrow{(long long)std::ceil(max.y / tileheight)};
+  for (long long row{firstrow}; row < lastrow; ++row) {
+    for (long long col{firstcol}; col < lastcol; ++col) {
+      put("q 1 0 0 1 ");
+      putnum(double(col) * tilewidth);
+      putnum(double(row) * tileheight);
+      put("cm ");
+      put(drawtile);
+    }
+  }
+  put("Q\n");
 }
 
-inline void SVGCanvas::movetoxy(double x, double y) {
-  if (!pathspec.empty())
-    pathspec += ' ';
+MONET_INLINE void PDFCanvas::patterncirclexy(double x, double y, double radius,
+                                             const Pattern &pattern) {
+  std::string ops;
+  appendcircle(ops, x, y, radius);
+  paintpattern(ops, Point{x - radius, y - radius},
+               Point{x + radius, y + radius}, pattern);
+}
 
-  std::stringstream buf{};
-  buf << "M " << x << ',' << y;
-  pathspec += buf.str();
+MONET_INLINE void PDFCanvas::patternrectanglexy(double x1, double y1, double x2,
+                                                double y2,
+                                                const Pattern &pattern) {
+  const Point min{std::min(x1, x2), std::min(y1, y2)};
+  const Point max{std::max(x1, x2), std::max(y1, y2)};
+  std::string ops;
+  for (double value : {min.x, min.y, max.x - min.x, max.y - min.y})
+    appendnum(ops, value);
+  ops += "re ";
+  paintpattern(ops, min, max, pattern);
 }
 
-inline void SVGCanvas::linetoxy(double x, double y) {
-  if (!pathspec.empty())
-    pathspec += ' ';
+MONET_INLINE void
+PDFCanvas::patternpathobject(const Path &path,
+                             const TransformSequence &transforms,
+                             const Pattern &pattern) {
+  pathops.clear();
+  if (path.empty())
+    return;
+
+  if (recordingclip) {
+    pathobject(path, transforms, Action::Fill);
+    return;
+  }
+
+  Point min, max;
+  path.boundingbox(min, max);
+  const std::string &ops{path.serialized(PathFormat::PDF, formatpath)};
+  if (isidentity(transforms)) {
+    paintpattern(ops, min, max, pattern);
+    return;
+  }
+
+  put("q ");
+  putmatrix(tomatrix(transforms));
+  pushstate();
+  paintpattern(ops, min, max, pattern);
+  popstate();
+  put("Q\n");
+}
+#endif // MONET_WITH_PDF
+
+MONET_INLINE void
+SVGCanvas::cachedgroup(uint64_t key, const TransformSequence &transforms,
+                       const std::function<void(BaseCanvas &)> &draw,
+                       const std::string &name) {
+  const DrawingState state{getstate()};
+  begingroup(transforms, name);
+
+  if (cache) {
+    // The drawing parameters are part of the key, as `draw` might not
+    // set all of them
+    XXHash64 hash{key};
+    auto add = [&hash](double value) { hash.update(&value, sizeof(value)); };
+    for (Color col : {state.strokecolor, state.fillcolor}) {
+      add(col.r);
+      add(col.g);
+      add(col.b);
+    }
+    const StrokeStyle &style{state.strokestyle};
+    add(style.width);
+    add(double(style.join));
+    add(double(style.cap));
+    add(style.miterlimit);
+    add(style.dashoffset);
+    for (double dash : style.dashes)
+      add(dash);
+    add(double(style.dashes.size()));
+    add(double(state.fontfamily));
+    add(state.fontsize);
+    add(state.transparency);
+    add(state.strokealpha);
+    add(state.fillalpha);
+
+    drawcached(hash.digest(), [&] { draw(*this); });
+  } else
+    draw(*this);
+
+  setstate(state);
+  endgroup();
+}
 
-  std::stringstream buf{};
-  buf << x << ',' << y;
-  pathspec += buf.str();
+MONET_INLINE void
+SVGCanvas::cachedgroup(const TransformSequence &transforms,
+                       const std::function<void(BaseCanvas &)> &draw,
+                       const std::string &name) {
+  const DrawingState state{getstate()};
+  begingroup(transforms, name);
+
+  if (cache) {
+    // Before every primitive, the recorder saves the drawing parameters
+    // that apply to it, so the commands fully describe the output
+    RecordingCanvas recorder{getwidth(), getheight()};
+    recorder.setstate(state);
+    recorder.setdevicescale(geteffectivescale());
+    draw(recorder);
+
+    const CommandBuffer &commands{recorder.getcommands()};
+    XXHash64 hash;
+    hash.update(commands.data(), commands.size());
+    drawcached(hash.digest(), [&] {
+      CommandPlayer player;
+      player.play(commands, *this);
+    });
+  } else
+    draw(*this);
+
+  setstate(state);
+  endgroup();
 }
+#endif // MONET_DEFINITIONS
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef MONET_WITH_THREADS
+
+/** Replay batches of commands into a canvas on a separate thread
+ *
+ * Batches are passed from the producer to the worker through a
+ * lock-free single-producer/single-consumer ring of `queuedepth`
+ * slots; `push` waits only if the ring is full. An idle worker spins
+ * for a short while, then sleeps until `push` wakes it up. The worker
+ * never modifies a batch, and it keeps it in its slot after having replayed
+ * it, so that the producer can get it back and reuse its memory. The
+ * canvas must not be used by anybody else while the worker is alive.
+ */
+class CanvasWorker {
+public:
+  typedef std::shared_ptr<CommandBuffer> Batch;
+
+private:
+  BaseCanvas &canvas;
+  std::vector<Batch> slots;
+  size_t mask;
+
+  // `head` is only written by the worker, `tail` by the producer
+  std::atomic<size_t> head, tail;
+  std::atomic<bool> stopping;
+  CommandPlayer player;
+  std::thread thread;
+
+  // Set by the worker before it sleeps on `wakeup`, so that the
+  // producer takes the lock only when somebody has to be woken up
+  std::atomic<bool> sleeping;
+  std::mutex lock;
+  std::condition_variable wakeup;
+
+  // Wake up the worker if it is sleeping; call it after having changed
+  // `tail` or `stopping`
+  void notify() {
+    if (sleeping.load()) {
+      std::lock_guard<std::mutex> guard{lock};
+      wakeup.notify_one();
+    }
+  }
+
+  static void backoff(unsigned &count) {
+    if (++count < 64)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  void run();
+
+public:
+  /// Start a worker that draws on `acanvas`; `queuedepth` is rounded
+  /// up to a power of two
+  explicit CanvasWorker(BaseCanvas &acanvas, size_t queuedepth = 16);
+  CanvasWorker(const CanvasWorker &) = delete;
+  void operator=(const CanvasWorker &) = delete;
+
+  /// Wait until every batch has been replayed, then stop the thread
+  ~CanvasWorker();
+
+  /// Return true if `push` would have to wait
+  bool full() const {
+    return tail.load(std::memory_order_relaxed) -
+               head.load(std::memory_order_acquire) ==
+           slots.size();
+  }
+
+  /// Queue a batch of commands, waiting if the queue is full. Return
+  /// the batch that was in the slot before, which has already been
+  /// replayed (it can be null)
+  Batch push(Batch batch);
+
+  /// Return the number of batches that have not been replayed yet
+  size_t pending() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
 
-inline void SVGCanvas::quadratictoxy(double xdir, double ydir, double xend,
-                                     double yend) {
-  if (!pathspec.empty())
-    pathspec += ' ';
+  /// Wait until every batch pushed so far has been replayed
+  void wait() const {
+    unsigned count{};
+    while (pending() > 0)
+      backoff(count);
+  }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE CanvasWorker::CanvasWorker(BaseCanvas &acanvas, size_t queuedepth)
+    : canvas(acanvas), slots{}, mask{}, head{0}, tail{0}, stopping{false},
+      player{}, thread{}, sleeping{false}, lock{}, wakeup{} {
+  size_t depth{1};
+  while (depth < queuedepth)
+    depth *= 2;
+  slots.resize(depth);
+  mask = depth - 1;
+
+  thread = std::thread{&CanvasWorker::run, this};
+}
 
-  std::stringstream buf{};
-  buf << "Q " << xdir << ',' << ydir << ' ' << xend << ',' << yend;
-  pathspec += buf.str();
+MONET_INLINE CanvasWorker::~CanvasWorker() {
+  wait();
+  stopping.store(true);
+  notify();
+  thread.join();
 }
 
-inline void SVGCanvas::cubictoxy(double xc1, double yc1, double xc2, double yc2,
-                                 double xend, double yend) {
-  if (!pathspec.empty())
-    pathspec += ' ';
+MONET_INLINE CanvasWorker::Batch CanvasWorker::push(Batch batch) {
+  size_t t{tail.load(std::memory_order_relaxed)};
+  unsigned count{};
+  while (t - head.load(std::memory_order_acquire) == slots.size())
+    backoff(count);
 
-  std::stringstream buf{};
-  buf << "C " << xc1 << ',' << yc1 << ' ' << xc2 << ',' << yc2 << ' ' << xend
-      << ',' << yend;
-  pathspec += buf.str();
+  std::swap(slots[t & mask], batch);
+  tail.store(t + 1);
+  notify();
+  return batch;
 }
 
-inline void SVGCanvas::linexy(double x1, double y1, double x2, double y2) {
-  assert(stream);
-  indent();
+MONET_INLINE void CanvasWorker::run() {
+  unsigned count{};
+  for (;;) {
+    size_t h{head.load(std::memory_order_relaxed)};
+    if (h == tail.load(std::memory_order_acquire)) {
+      if (stopping.load(std::memory_order_acquire))
+        return;
+
+      if (++count < 64) {
+        std::this_thread::yield();
+        continue;
+      }
 
-  *stream << "<line x1=\"" << x1 << "\" y1=\"" << y1 << "\" x2=\"" << x2
-          << "\" y2=\"" << y2 << "\" stroke-width=\"" << getstrokewidth()
-          << "\" stroke=\"" << getstrokecolor().toHTML() << '\"';
+      // Both `sleeping` and `tail` are sequentially consistent: either
+      // the producer sees that the worker sleeps, or the worker sees
+      // the new batch before waiting
+      std::unique_lock<std::mutex> guard{lock};
+      sleeping.store(true);
+      wakeup.wait(guard, [this, h] {
+        return h != tail.load() || stopping.load();
+      });
+      sleeping.store(false);
+      continue;
+    }
 
-  if (gettransparency() > 0)
-    *stream << " opacity=\"" << 1 - gettransparency() << '\"';
+    count = 0;
+    player.play(*slots[h & mask], canvas);
 
-  *stream << "/>\n";
+    // Release the slot only once the batch is no longer needed
+    head.store(h + 1, std::memory_order_release);
+  }
 }
+#endif // MONET_DEFINITIONS
 
-inline void SVGCanvas::circlexy(double x, double y, double radius, Action act) {
-  assert(stream);
+#else
+class CanvasWorker;
+#endif // MONET_WITH_THREADS
 
-  indent();
-  *stream << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << radius;
+////////////////////////////////////////////////////////////////////////////////
 
-  std::stringstream buf{};
-  switch (act) {
-  case Action::Stroke:
-    buf << "\" stroke=\"" << getstrokecolor().toHTML() << "\" stroke-width=\""
-        << getstrokewidth() << '\"';
-    break;
-  case Action::Fill:
-    buf << "\" fill=\"" << getfillcolor().toHTML() << "\" stroke=\"none\"";
-    break;
-  case Action::FillAndStroke:
-    buf << "\" fill=\"" << getfillcolor().toHTML() << "\" stroke=\""
-        << getstrokecolor().toHTML() << "\" stroke-width=\"" << getstrokewidth()
-        << '\"';
-    break;
-  default:
-    abort();
+/** A canvas that forwards every call to several canvases
+ *
+ * Calls are recorded into a CommandBuffer and sent to the children in
+ * batches of about `batchsize` bytes, so that the same drawing code
+ * produces several files at once (e.g., a SVG and a PDF). If
+ * MONET_WITH_THREADS is defined, a child added with `usethread = true`
+ * replays its batches on its own thread (see CanvasWorker), so that a
+ * slow backend does not block the caller; the others replay them
+ * immediately.
+ *
+ * Drawing parameters are not sent to the children until a primitive
+ * uses them, so `getstrokecolor` etc. should be called on the
+ * TeeCanvas, not on the children.
+ */
+class TeeCanvas : public RecordingCanvas {
+private:
+  // The worker is a shared_ptr, which does not need the definition of
+  // CanvasWorker, so the layout does not depend on MONET_WITH_THREADS
+  struct Child {
+    std::unique_ptr<BaseCanvas> canvas;
+    std::shared_ptr<CanvasWorker> worker;
+    CommandPlayer player;
+  };
+
+  std::vector<Child> children;
+  size_t batchsize;
+  size_t queuedepth;
+  bool threaded;
+
+protected:
+  MONET_VIRTUAL void submit() override;
+
+public:
+  /// Create a canvas that forwards commands in batches of `abatchsize`
+  /// bytes; threaded children can queue up to `aqueuedepth` batches
+  explicit TeeCanvas(size_t abatchsize = 65536, size_t aqueuedepth = 16)
+      : RecordingCanvas{0, 0, abatchsize}, children{}, batchsize{abatchsize},
+        queuedepth{aqueuedepth}, threaded{false} {
+    commands.reserve(batchsize);
   }
 
-  *stream << buf.rdbuf();
+  TeeCanvas(const TeeCanvas &) = delete;
+  void operator=(const TeeCanvas &) = delete;
 
-  if (gettransparency() > 0)
-    *stream << " opacity=\"" << 1 - gettransparency() << '\"';
+  /// Send the last commands to the children and wait for them; the
+  /// children are destroyed afterwards
+  ~TeeCanvas() {
+    flush();
+    children.clear();
+  }
 
-  *stream << "/>\n";
-}
+  /// Add a new child, which will be destroyed together with this
+  /// object. Children should be added before drawing anything.
+  /// Without MONET_WITH_THREADS, `usethread` is ignored
+  BaseCanvas &addcanvas(std::unique_ptr<BaseCanvas> canvas,
+                        bool usethread = false);
 
-inline void SVGCanvas::rectanglexy(double x1, double y1, double x2, double y2,
-                                   Action act) {
-  assert(stream);
-  std::string spaces{indentstr(indentlevel + 1)};
+  /// Send the commands recorded so far to the children
+  void flush() {
+    if (!commands.empty())
+      submit();
+  }
 
-  indent();
-  *stream << "<rect\n"
-          << spaces << "x=\"" << std::min(x1, x2) << "\" y=\""
-          << std::min(y1, y2) << "\"\n"
-          << spaces << "width=\"" << std::fabs(x2 - x1) << "\" height=\""
-          << std::fabs(y2 - y1) << "\"\n"
-          << spaces;
-
-  std::stringstream buf{};
-  switch (act) {
-  case Action::Stroke:
-    buf << "stroke=\"" << getstrokecolor().toHTML() << "\" stroke-width=\""
-        << getstrokewidth() << "\" fill=\"none\"";
-    break;
-  case Action::Fill:
-    buf << "stroke=\"none\" fill=\"" << getfillcolor().toHTML() << '\"';
-    break;
-  case Action::FillAndStroke:
-    buf << "stroke=\"" << getstrokecolor().toHTML() << "\" stroke-width=\""
-        << getstrokewidth() << "\" fill=\"" << getfillcolor().toHTML() << '\"';
-    break;
-  default:
-    abort();
+  /// Send the commands recorded so far to the children, and wait until
+  /// they have been drawn
+  void wait();
+
+  size_t numofchildren() const { return children.size(); }
+
+  double getwidth() const override {
+    return children.empty() ? 0.0 : children.front().canvas->getwidth();
+  }
+  double getheight() const override {
+    return children.empty() ? 0.0 : children.front().canvas->getheight();
   }
+};
 
-  *stream << buf.rdbuf();
+#ifdef MONET_DEFINITIONS
+MONET_INLINE BaseCanvas
+&TeeCanvas::addcanvas(std::unique_ptr<BaseCanvas> canvas, bool usethread) {
+  assert(canvas);
+
+  // Commands recorded so far must reach only the old children, and the
+  // new one needs all the drawing parameters
+  flush();
+  invalidatestate();
+
+  Child child{std::move(canvas), nullptr, CommandPlayer{}};
+#ifdef MONET_WITH_THREADS
+  if (usethread) {
+    child.worker.reset(new CanvasWorker{*child.canvas, queuedepth});
+    threaded = true;
+  }
+#else
+  (void)usethread;
+#endif
 
-  if (gettransparency() > 0)
-    *stream << " opacity=\"" << 1 - gettransparency() << '\"';
+  children.push_back(std::move(child));
+  return *children.back().canvas;
+}
 
-  *stream << "/>\n";
+MONET_INLINE void TeeCanvas::wait() {
+  flush();
+#ifdef MONET_WITH_THREADS
+  for (auto &child : children) {
+    if (child.worker)
+      child.worker->wait();
+  }
+#endif
 }
 
-inline void SVGCanvas::textxy(double x, double y, const char *text,
-                              HorizontalAlignment halign,
-                              VerticalAlignment valign) {
-  assert(stream != nullptr);
+MONET_INLINE void TeeCanvas::submit() {
+  if (!threaded) {
+    // Replay the commands and reuse the buffer
+    for (auto &child : children)
+      child.player.play(commands, *child.canvas);
 
-  std::string halign_def;
-  switch (halign) {
-  case HorizontalAlignment::Left:
-    halign_def = "text-anchor=\"end\"";
-    break;
-  case HorizontalAlignment::Center:
-    halign_def = "text-anchor=\"middle\"";
-    break;
-  case HorizontalAlignment::Right:
-    halign_def = "text-anchor=\"start\"";
-    break;
-  default:
-    abort();
+    commands.clear();
+    return;
   }
 
-  std::string valign_def;
-  switch (valign) {
-  case VerticalAlignment::Top:
-    valign_def = "dominant-baseline=\"text-top\"";
-    break;
-  case VerticalAlignment::Center:
-    valign_def = "dominant-baseline=\"central\"";
-    break;
-  case VerticalAlignment::Middle:
-    valign_def = "dominant-baseline=\"middle\"";
-    break;
-  case VerticalAlignment::Bottom:
-    valign_def = "dominant-baseline=\"text-bottom\"";
-    break;
-  default:
-    abort();
+#ifdef MONET_WITH_THREADS
+  // Threaded children share the batch, which cannot be reused until
+  // all of them are done with it
+  std::shared_ptr<CommandBuffer> batch{new CommandBuffer{}};
+  std::swap(*batch, commands);
+  commands.reserve(batchsize);
+
+  for (auto &child : children) {
+    if (child.worker)
+      child.worker->push(batch);
   }
 
-  indent();
-  const std::string spaces = indentstr(indentlevel + 1);
+  for (auto &child : children) {
+    if (!child.worker)
+      child.player.play(*batch, *child.canvas);
+  }
+#endif // MONET_WITH_THREADS
+}
+#endif // MONET_DEFINITIONS
 
-  // We place the text to (0, 0) and then translate it after reversing the
-  // Y axis; otherwise, the text would be flipped vertically (remember that
-  // we are using a different coordinate system than SVG's default).
-  *stream << "<text\n"
-          << spaces << "x=\"0\" y=\"0\"\n"
-          << spaces << halign_def << "\n"
-          << spaces << valign_def << "\n"
-          << spaces << "font-family=\"" << fontfamilyname() << "\" font-size=\""
-          << getfontsize() << "\"\n"
-          << spaces << "transform=\"translate(" << x << " " << y
-          << ") scale(1 -1)\"\n";
+////////////////////////////////////////////////////////////////////////////////
 
-  if (gettransparency() > 0)
-    *stream << spaces << "opacity=\"" << 1 - gettransparency() << "\"\n";
+#ifdef MONET_WITH_THREADS
 
-  *stream << spaces << "fill=\"" << getfillcolor().toHTML() << "\">\n"
-          << text << "\n";
+/// What AsyncCanvas does when the queue of its worker is full
+enum class Backpressure {
+  Block, ///< Wait until the worker has replayed a batch
+  Grow,  ///< Keep recording into a larger batch
+};
 
-  indent();
-  *stream << "</text>\n";
-}
+/** A canvas that draws into another canvas on a separate thread
+ *
+ * Every call is recorded into a CommandBuffer, and batches of about
+ * `batchsize` bytes are drawn by a CanvasWorker, so that formatting
+ * and I/O do not run on the caller's thread:
+ *
+ * \code{cpp}
+ * AsyncCanvas canv{std::unique_ptr<BaseCanvas>{
+ *     new SVGCanvas{"plot.svg", 100, 100}}};
+ * \endcode
+ *
+ * At most `queuedepth` batches wait to be drawn; once the queue is
+ * full, the `backpressure` policy decides whether the caller waits or
+ * keeps recording into a larger buffer. The buffers of batches that
+ * have been drawn are reused, so no memory is allocated in the steady
+ * state.
+ */
+class AsyncCanvas : public RecordingCanvas {
+private:
+  std::unique_ptr<BaseCanvas> canvas;
+  std::unique_ptr<CanvasWorker> worker;
+  CanvasWorker::Batch spare;
+  size_t batchsize;
+  Backpressure backpressure;
+
+  void send() {
+    if (!spare)
+      spare.reset(new CommandBuffer{});
+
+    spare->clear();
+    spare->reserve(batchsize);
+    std::swap(*spare, commands);
+    spare = worker->push(std::move(spare));
+  }
 
-inline SVGCanvas::SVGCanvas(const std::string &filename, double awidth,
-                            double aheight)
-    : BaseCanvas{}, stream{new std::ofstream(filename.c_str())},
-      indentlevel{0}, width{awidth}, height{aheight}, pathspec{""},
-      m_grouplevel{0}, clipping{false} {
-  if (!stream) {
-    std::perror("Unable to create file");
-    std::abort();
+protected:
+  void submit() override {
+    if (backpressure == Backpressure::Block || !worker->full())
+      send();
   }
 
-  *stream << "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
-             "<!-- Created with Monet "
-          << version
-          << " (https://github.com/ziotom78/monet)-->\n"
-             "\n"
-             "<svg\n"
-             "    width=\""
-          << width
-          << "mm\"\n"
-             "    height=\""
-          << height
-          << "mm\"\n"
-             "    viewBox=\"0 0 "
-          << width << ' ' << height
-          << "\"\n"
-             "    version=\"1.1\"\n"
-             "    xmlns=\"http://www.w3.org/2000/svg\">\n";
+public:
+  /// Draw on `acanvas`, which will be destroyed together with this
+  /// object
+  explicit AsyncCanvas(std::unique_ptr<BaseCanvas> acanvas,
+                       size_t abatchsize = 65536, size_t queuedepth = 16,
+                       Backpressure abackpressure = Backpressure::Block)
+      : RecordingCanvas{0, 0, abatchsize}, canvas{std::move(acanvas)},
+        worker{}, spare{}, batchsize{abatchsize},
+        backpressure{abackpressure} {
+    assert(canvas);
+    commands.reserve(batchsize);
+    worker.reset(new CanvasWorker{*canvas, queuedepth});
+  }
 
-  indentlevel++;
-  begingroup(scaley(-1) | translate(Point(0, height)), "canvas");
-}
+  AsyncCanvas(const AsyncCanvas &) = delete;
+  void operator=(const AsyncCanvas &) = delete;
 
-inline SVGCanvas::~SVGCanvas() {
-  if (!stream) {
-    return;
+  /// Draw the last commands, then destroy the canvas
+  ~AsyncCanvas() {
+    flush();
+    worker.reset();
   }
 
-  if (clipping) {
-    removeclip();
+  /// Send the commands recorded so far to the worker, waiting if the
+  /// queue is full
+  void flush() {
+    if (!commands.empty())
+      send();
   }
 
-  // Close any group that was not closed yet
-  for (int i{m_grouplevel}; i > 0; i--) {
-    endgroup();
+  /// Send the commands recorded so far to the worker, and wait until
+  /// they have been drawn; only then the canvas can be used directly
+  void wait() {
+    flush();
+    worker->wait();
   }
 
-  *stream << "</svg>\n";
-}
+  /// Return the number of batches that have not been drawn yet
+  size_t pending() const { return worker->pending(); }
 
-inline void SVGCanvas::strokepath() {
-  assert(stream);
-  std::string spaces{indentstr(indentlevel + 1)};
+  double getwidth() const override { return canvas->getwidth(); }
+  double getheight() const override { return canvas->getheight(); }
+};
 
-  indent();
-  *stream << "<path\n"
-          << spaces << "d=\"" << pathspec << "\"\n"
-          << spaces << "fill=\"none\" stroke=\"" << getstrokecolor().toHTML()
-          << "\" stroke-width=\"" << getstrokewidth() << "\"/>\n";
-}
+#endif // MONET_WITH_THREADS
 
-inline void SVGCanvas::fillpath() {
-  assert(stream);
-  std::string spaces{indentstr(indentlevel + 1)};
+////////////////////////////////////////////////////////////////////////////////
 
-  indent();
-  *stream << "<path\n"
-          << spaces << "d=\"" << pathspec << "\"\n"
-          << spaces << "fill=\"" << getfillcolor().toHTML()
-          << "\" stroke=\"none\"/>\n";
-}
+#ifdef MONET_WITH_SCENES
 
-inline void SVGCanvas::fillandstrokepath() {
-  assert(stream);
-  std::string spaces{indentstr(indentlevel + 1)};
+/** The first bytes of a scene file
+ *
+ * A scene file contains this header, the commands recorded by a
+ * RecordingCanvas as they are in a CommandBuffer, and a SceneFooter.
+ * The header is 32 bytes long, so that the commands are aligned to 8
+ * bytes when the file is mapped in memory. Numbers are stored in the
+ * byte order of the machine that wrote the file.
+ */
+struct SceneHeader {
+  char magic[8]; // "MONETSCN"
+  uint32_t version;
+  uint32_t byteorder;
+  double width, height;
 
-  indent();
-  *stream << "<path\n"
-          << spaces << "d=\"" << pathspec << "\"\n"
-          << spaces << "fill=\"" << getfillcolor().toHTML() << "\" stroke=\""
-          << getstrokecolor().toHTML() << "\" stroke-width=\""
-          << getstrokewidth() << "\"/>\n";
-}
+  // The version changes whenever the layout of the commands does
+  enum : uint32_t { currentversion = 1, nativeorder = 0x01020304 };
+};
 
-inline void SVGCanvas::begingroup(const TransformSequence &transforms,
-                                  const std::string &name) {
-  assert(stream);
+/// The last bytes of a scene file, which are written only when the
+/// file is complete
+struct SceneFooter {
+  char magic[8]; // "MONETEND"
+  uint64_t size; // Number of bytes between the header and the footer
+};
 
-  indent();
+/** A canvas that saves what is drawn on it into a scene file
+ *
+ * The commands are written every time `batchsize` bytes have been
+ * recorded, so the scene does not need to fit in memory. Use SceneFile
+ * to draw the scene later on any canvas, even in another process:
+ *
+ * \code{cpp}
+ * {
+ *   SceneWriter scene{"plot.scene", 100, 100};
+ *   scene.circle(Point{50, 50}, 10);
+ * }
+ *
+ * SceneFile scene;
+ * if (scene.open("plot.scene")) {
+ *   SVGCanvas canv{"plot.svg", scene.getwidth(), scene.getheight()};
+ *   scene.play(canv);
+ * }
+ * \endcode
+ */
+class SceneWriter : public RecordingCanvas {
+private:
+  std::unique_ptr<std::ostream> stream;
+  uint64_t written;
 
-  *stream << "<g";
+  void write() {
+    assert(stream);
+    stream->write(commands.data(), std::streamsize(commands.size()));
+    written += commands.size();
+    commands.clear();
+  }
 
-  if (!name.empty()) {
-    *stream << " name=\"" << name << '\"';
+protected:
+  void submit() override { write(); }
+
+public:
+  /// Write the scene into `astream`, which is destroyed by `close`
+  SceneWriter(std::unique_ptr<std::ostream> astream, double awidth,
+              double aheight, size_t abatchsize = size_t(1) << 20)
+      : RecordingCanvas{awidth, aheight, abatchsize},
+        stream{std::move(astream)}, written{0} {
+    assert(stream);
+    SceneHeader header{};
+    std::memcpy(header.magic, "MONETSCN", sizeof(header.magic));
+    header.version = SceneHeader::currentversion;
+    header.byteorder = SceneHeader::nativeorder;
+    header.width = awidth;
+    header.height = aheight;
+    stream->write(reinterpret_cast<const char *>(&header), sizeof(header));
   }
 
-  if (transforms.size() > 1 ||
-      (transforms.size() == 1 &&
-       transforms[0].type != TransformType::Identity)) {
-    *stream << " transform=\"";
-    for (const auto &transf : transforms) {
-      switch (transf.type) {
-      case TransformType::Identity:
-        break;
+  SceneWriter(const std::string &filename, double awidth, double aheight,
+              size_t abatchsize = size_t(1) << 20)
+      : SceneWriter{mmapstream(filename), awidth, aheight, abatchsize} {}
 
-      case TransformType::Translation:
-        *stream << "translate(" << transf.translation.x << ' '
-                << transf.translation.y << ") ";
-        break;
+  SceneWriter(const SceneWriter &) = delete;
+  void operator=(const SceneWriter &) = delete;
 
-      case TransformType::Rotation:
-        *stream << "rotate(" << transf.rotation.angle << ' '
-                << transf.rotation.pivot.x << ' ' << transf.rotation.pivot.y
-                << ") ";
-        break;
+  ~SceneWriter() { close(); }
 
-      case TransformType::Scale:
-        *stream << "scale(" << transf.scale_factor.x << ' '
-                << transf.scale_factor.y << ") ";
-        break;
+  /// Write the last commands and the footer, and close the stream;
+  /// nothing can be drawn afterwards. Return false in case of errors
+  bool close() {
+    if (!stream)
+      return true;
 
-      default:
-        abort();
-      }
-    }
-    *stream << '\"';
+    write();
+    SceneFooter footer{};
+    std::memcpy(footer.magic, "MONETEND", sizeof(footer.magic));
+    footer.size = written;
+    stream->write(reinterpret_cast<const char *>(&footer), sizeof(footer));
+
+    const bool ok{stream->good()};
+    stream.reset();
+    return ok;
   }
+};
 
-  *stream << ">\n";
-  indentlevel++;
-  m_grouplevel++;
-}
+/** A scene file saved by SceneWriter, ready to be drawn
+ *
+ * On POSIX systems the file is mapped in memory, and the commands are
+ * played directly from the mapping: nothing is copied or allocated for
+ * each command. Elsewhere the file is read in memory at once.
+ */
+class SceneFile {
+private:
+  const char *commands;
+  size_t size;
+  double width, height;
+  MappedFile file;
 
-inline void SVGCanvas::endgroup() {
-  assert(stream);
+  // Patterns can contain patterns, but `check` stops at this depth
+  enum { maxpatterndepth = 64 };
 
-  if (m_grouplevel <= 0)
-    abort();
+  static uint32_t getuint32(const char *src) {
+    uint32_t value;
+    std::memcpy(&value, src, sizeof(value));
+    return value;
+  }
 
-  if (indentlevel <= 0)
-    abort();
+  // Check the type of `count` transforms saved from `src` on
+  static bool checktransforms(const char *src, uint64_t count);
 
-  indentlevel--;
-  indent();
-  *stream << "</g>\n";
+  // Check the arguments of a PathObject, GradientPath or PatternPath
+  // command
+  static bool checkpath(const char *args, size_t size);
 
-  m_grouplevel--;
-}
+  // Check that the commands from `cur` to `end` can be replayed by
+  // CommandPlayer, which trusts their sizes, counts, and order
+  static bool check(const char *cur, const char *end, int depth);
 
-inline void SVGCanvas::defineclip() {
-  assert(stream);
-  assert(!clipping);
+  // Check the header, the footer, and the commands
+  bool parse(const char *data, size_t datasize);
 
-  indent();
-  *stream << "<defs>\n";
-  indentlevel++;
+public:
+  SceneFile()
+      : commands{nullptr}, size{0}, width{0}, height{0}, file{} {}
 
-  indent();
-  *stream << "<clipPath id=\"monet_clip_path\">\n";
-  indentlevel++;
-}
+  SceneFile(const SceneFile &) = delete;
+  void operator=(const SceneFile &) = delete;
 
-inline void SVGCanvas::endclip() {
-  assert(stream);
-  assert(!clipping);
+  ~SceneFile() { close(); }
 
-  indentlevel--;
-  indent();
-  *stream << "</clipPath>\n";
+  /// Open a scene file; return false if it cannot be read, if it is
+  /// incomplete, or if it was written by an incompatible version
+  bool open(const std::string &filename);
 
-  --indentlevel;
-  indent();
-  *stream << "</defs>\n";
+  /// Release the file; `play` draws nothing afterwards
+  void close();
+
+  /// Draw the whole scene on `canvas`
+  void play(BaseCanvas &canvas) const {
+    CommandPlayer player;
+    player.play(commands, size, canvas);
+  }
+
+  /// Return the commands, which can be passed to CommandPlayer::play
+  const char *data() const { return commands; }
+
+  /// Return the number of bytes used by the commands
+  size_t getsize() const { return size; }
+
+  double getwidth() const { return width; }
+  double getheight() const { return height; }
+};
+
+#ifdef MONET_DEFINITIONS
+MONET_INLINE bool SceneFile::checktransforms(const char *src,
+                                             uint64_t count) {
+  for (uint64_t i{}; i < count; ++i) {
+    // The type is the first member of a Transform
+    TransformType type;
+    std::memcpy(&type, src + i * sizeof(Transform), sizeof(type));
+    if (type < TransformType::Identity || type > TransformType::Scale)
+      return false;
+  }
+
+  return true;
 }
 
-inline void SVGCanvas::useclip() {
-  assert(stream);
-  assert(!clipping);
+MONET_INLINE bool SceneFile::checkpath(const char *args, size_t size) {
+  // The action and the number of transforms, verbs, and coordinates,
+  // followed by the three arrays (see CommandPlayer::getpath)
+  const size_t countsize{4 * sizeof(uint32_t)};
+  if (size < countsize || getuint32(args) > uint32_t(Action::FillAndStroke))
+    return false;
+
+  const uint64_t transforms{getuint32(args + sizeof(uint32_t))},
+      verbs{getuint32(args + 2 * sizeof(uint32_t))},
+      coords{getuint32(args + 3 * sizeof(uint32_t))};
+  const uint64_t verbstart{countsize + transforms * sizeof(Transform) +
+                           coords * sizeof(double)};
+  if (verbstart + verbs * sizeof(PathVerb) > size ||
+      !checktransforms(args + countsize, transforms))
+    return false;
+
+  // Every verb must find its coordinates
+  uint64_t used{};
+  for (uint64_t i{}; i < verbs; ++i) {
+    const auto verb = PathVerb(args[verbstart + i]);
+    if (verb > PathVerb::Close)
+      return false;
+    used += numofcoords(verb);
+  }
 
-  indent();
-  *stream << "<g clip-path=\"url(#monet_clip_path)\">\n";
-  indentlevel++;
+  return used == coords;
+}
+
+MONET_INLINE bool SceneFile::check(const char *cur, const char *end,
+                                   int depth) {
+  if (depth > maxpatterndepth)
+    return false;
+
+  // The state of the player and of the canvas that the commands expect
+  uint64_t numofclips{}, groups{}, usedclips{};
+  bool definingclip{false}, gradientset{false}, patternset{false};
+
+  while (cur < end) {
+    CommandHeader command;
+    if (size_t(end - cur) < sizeof(command))
+      return false;
+
+    std::memcpy(&command, cur, sizeof(command));
+    cur += sizeof(command);
+    if (command.type >= uint32_t(CommandType::NumOfCommands) ||
+        command.size % sizeof(uint64_t) != 0 ||
+        command.size > size_t(end - cur))
+      return false;
+
+    const char *args{cur};
+    const size_t size{command.size};
+    cur += size;
+
+    bool valid{};
+    switch (CommandType(command.type)) {
+    case CommandType::SetStrokeColor:
+    case CommandType::SetFillColor:
+      valid = size >= 4 * sizeof(double);
+      break;
+    case CommandType::SetStrokeColor8:
+    case CommandType::SetFillColor8:
+      valid = size >= sizeof(uint32_t);
+      break;
+    case CommandType::SetStrokeWidth:
+    case CommandType::SetMiterLimit:
+    case CommandType::SetFontSize:
+    case CommandType::SetTransparency:
+      valid = size >= sizeof(double);
+      break;
+    case CommandType::SetLineJoin:
+      valid = size >= sizeof(uint32_t) &&
+              getuint32(args) <= uint32_t(LineJoin::Bevel);
+      break;
+    case CommandType::SetLineCap:
+      valid = size >= sizeof(uint32_t) &&
+              getuint32(args) <= uint32_t(LineCap::Square);
+      break;
+    case CommandType::SetDash:
+      // The offset, followed by the lengths of the dashes
+      valid = size >= sizeof(double);
+      break;
+    case CommandType::SetFontFamily:
+      valid = size >= sizeof(uint32_t) &&
+              getuint32(args) <= uint32_t(FontFamily::Monospaced);
+      break;
+
+    case CommandType::MoveTo:
+    case CommandType::LineTo:
+      valid = size >= 2 * sizeof(double);
+      break;
+    case CommandType::QuadraticTo:
+      valid = size >= 4 * sizeof(double);
+      break;
+    case CommandType::CubicTo:
+      valid = size >= 6 * sizeof(double);
+      break;
+    case CommandType::ClosePath:
+    case CommandType::StrokePath:
+    case CommandType::FillPath:
+    case CommandType::FillAndStrokePath:
+    case CommandType::ClearPath:
+      valid = true;
+      break;
+
+    case CommandType::Line:
+      valid = size >= 4 * sizeof(double);
+      break;
+    case CommandType::Circle:
+      valid = size >= 3 * sizeof(double) + sizeof(uint32_t) &&
+              getuint32(args + 3 * sizeof(double)) <=
+                  uint32_t(Action::FillAndStroke);
+      break;
+    case CommandType::Rectangle:
+      valid = size >= 4 * sizeof(double) + sizeof(uint32_t) &&
+              getuint32(args + 4 * sizeof(double)) <=
+                  uint32_t(Action::FillAndStroke);
+      break;
+    case CommandType::Text: {
+      // The alignments, and a string terminated by a NUL character
+      const size_t start{2 * sizeof(double) + 2 * sizeof(uint32_t)};
+      valid = size > start &&
+              getuint32(args + 2 * sizeof(double)) <=
+                  uint32_t(HorizontalAlignment::Right) &&
+              getuint32(args + 2 * sizeof(double) + sizeof(uint32_t)) <=
+                  uint32_t(VerticalAlignment::Bottom) &&
+              std::memchr(args + start, '\0', size - start) != nullptr;
+      break;
+    }
+    case CommandType::PathObject:
+      valid = checkpath(args, size);
+      break;
+
+    case CommandType::BeginGroup: {
+      if (size < 2 * sizeof(uint32_t))
+        break;
+      const uint64_t transforms{getuint32(args)},
+          namelen{getuint32(args + sizeof(uint32_t))};
+      const uint64_t needed{2 * sizeof(uint32_t) +
+                            transforms * sizeof(Transform) + namelen};
+      valid = needed <= size &&
+              checktransforms(args + 2 * sizeof(uint32_t), transforms);
+      ++groups;
+      break;
+    }
+    case CommandType::EndGroup:
+      valid = groups > 0;
+      --groups;
+      break;
+    case CommandType::DefineClip:
+      valid = !definingclip;
+      definingclip = true;
+      ++numofclips;
+      break;
+    case CommandType::EndClip:
+      valid = definingclip;
+      definingclip = false;
+      break;
+    case CommandType::UseClip:
+      valid = size >= sizeof(uint32_t) && !definingclip &&
+              getuint32(args) < numofclips;
+      ++usedclips;
+      break;
+    case CommandType::RemoveClip:
+      valid = usedclips > 0;
+      --usedclips;
+      break;
+    case CommandType::ClipRectangle:
+      valid = size >= 4 * sizeof(double) && !definingclip;
+      ++numofclips;
+      break;
+
+    case CommandType::SetGradient: {
+      // Type, color space, number of stops, padding, start, end, radius,
+      // and four numbers for each stop
+      const size_t start{4 * sizeof(uint32_t) + 5 * sizeof(double)};
+      if (size < start)
+        break;
+      const uint64_t numofstops{getuint32(args + 2 * sizeof(uint32_t))};
+      valid = getuint32(args) <= uint32_t(GradientType::Radial) &&
+              getuint32(args + sizeof(uint32_t)) <=
+                  uint32_t(ColorSpace::HSL) &&
+              numofstops > 0 &&
+              start + numofstops * 4 * sizeof(double) <= size;
+      gradientset = true;
+      break;
+    }
+    case CommandType::GradientCircle:
+      valid = gradientset && size >= 3 * sizeof(double);
+      break;
+    case CommandType::GradientRectangle:
+      valid = gradientset && size >= 4 * sizeof(double);
+      break;
+    case CommandType::GradientPath:
+      valid = gradientset && checkpath(args, size);
+      break;
+
+    case CommandType::SetPattern:
+      // The size of the tile, and the commands that draw it, which are
+      // replayed by another player
+      valid = size >= 2 * sizeof(double) &&
+              check(args + 2 * sizeof(double), args + size, depth + 1);
+      patternset = true;
+      break;
+    case CommandType::PatternCircle:
+      valid = patternset && size >= 3 * sizeof(double);
+      break;
+    case CommandType::PatternRectangle:
+      valid = patternset && size >= 4 * sizeof(double);
+      break;
+    case CommandType::PatternPath:
+      valid = patternset && checkpath(args, size);
+      break;
+    case CommandType::Image: {
+      const size_t start{4 * sizeof(double) + 2 * sizeof(uint32_t)};
+      if (size < start)
+        break;
+      const uint64_t cols{getuint32(args + 4 * sizeof(double))},
+          rows{getuint32(args + 4 * sizeof(double) + sizeof(uint32_t))};
+      // The product of the two counts can overflow
+      valid = rows == 0 || cols <= (size - start) / sizeof(Color8) / rows;
+      break;
+    }
+
+    default:
+      break;
+    }
+
+    if (!valid)
+      return false;
+  }
 
-  clipping = true;
+  return true;
 }
 
-inline void SVGCanvas::removeclip() {
-  assert(stream);
-  assert(clipping);
+MONET_INLINE bool SceneFile::parse(const char *data, size_t datasize) {
+  SceneHeader header;
+  SceneFooter footer;
+  if (datasize < sizeof(header) + sizeof(footer))
+    return false;
+
+  std::memcpy(&header, data, sizeof(header));
+  std::memcpy(&footer, data + datasize - sizeof(footer), sizeof(footer));
+  if (std::memcmp(header.magic, "MONETSCN", sizeof(header.magic)) != 0 ||
+      header.version != SceneHeader::currentversion ||
+      header.byteorder != SceneHeader::nativeorder ||
+      std::memcmp(footer.magic, "MONETEND", sizeof(footer.magic)) != 0 ||
+      footer.size != datasize - sizeof(header) - sizeof(footer))
+    return false;
+
+  // CommandPlayer trusts the arguments of each command, so a damaged
+  // file must be caught here
+  const char *start{data + sizeof(header)};
+  if (!check(start, start + footer.size, 0))
+    return false;
+
+  commands = data + sizeof(header);
+  size = size_t(footer.size);
+  width = header.width;
+  height = header.height;
+  return true;
+}
 
-  indentlevel--;
-  indent();
-  *stream << "</g>\n";
+MONET_INLINE bool SceneFile::open(const std::string &filename) {
+  close();
+  if (!file.open(filename) || !parse(file.data(), file.size())) {
+    close();
+    return false;
+  }
+
+  return true;
+}
 
-  clipping = false;
+MONET_INLINE void SceneFile::close() {
+  file.close();
+  commands = nullptr;
+  size = 0;
+  width = height = 0;
 }
+#endif // MONET_DEFINITIONS
+#endif // MONET_WITH_SCENES
 
 }; // namespace monet
@@ -0,0 +1,3 @@
+// Compile the canvases of Monet once, for the MONET_CompiledLibrary build
+#define MONET_IMPLEMENTATION
+#include <monet.h>
@@ -0,0 +1,75 @@
+#include <cassert>
+#include <cstdlib>
+#include <monet.h>
+#include <new>
+
+using namespace monet;
+
+// Count every call to the global operator new, so that we can check
+// that SVGCanvas does not touch the heap once it has warmed up
+
+static size_t num_allocations{};
+
+void *operator new(size_t size) {
+  ++num_allocations;
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void draw(SVGCanvas &canv, const TransformSequence &transforms,
+          const std::string &label) {
+  canv.setstrokecolor(hsl(0.3, 0.5, 0.5));
+  canv.setfillcolor(gray(0.5));
+  canv.settransparency(0.25);
+
+  canv.line(Point{1, 2}, Point{3, 4});
+  canv.circle(Point{10, 20}, 5, Action::Stroke);
+  canv.circle(Point{10, 20}, 5, Action::Fill);
+  canv.circle(Point{10, 20}, 5, Action::FillAndStroke);
+  canv.rectangle(Point{10, 20}, Point{30, 40}, Action::Stroke);
+  canv.rectangle(Point{10, 20}, Point{30, 40}, Action::Fill);
+  canv.rectangle(Point{10, 20}, Point{30, 40}, Action::FillAndStroke);
+  canv.text(Point{50, 60}, label, HorizontalAlignment::Center,
+            VerticalAlignment::Middle);
+
+  canv.begingroup(transforms, label);
+  canv.moveto(Point{0, 0});
+  canv.lineto(Point{100, 0});
+  canv.quadraticto(Point{150, 50}, Point{100, 100});
+  canv.cubicto(Point{80, 120}, Point{20, 120}, Point{0, 100});
+  canv.closepath();
+  canv.strokepath();
+  canv.fillpath();
+  canv.fillandstrokepath();
+  canv.clearpath();
+  canv.endgroup();
+
+  canv.defineclip();
+  canv.rectangle(Point{0, 0}, Point{100, 100}, Action::Fill);
+  canv.endclip();
+  canv.useclip();
+  canv.circle(Point{50, 50}, 75, Action::Fill);
+  canv.removeclip();
+}
+
+int main() {
+  SVGCanvas canv{"allocations.svg", 500, 500};
+  const TransformSequence transforms{rotate(Point{1.0, 2.0}, 30.0) |
+                                     translate(Point{4.0, 5.0})};
+  const std::string label{"A label long enough to defeat the SSO"};
+
+  // Warm up: let the arena and the path buffer reach their final size
+  for (int i{}; i < 10; ++i)
+    draw(canv, transforms, label);
+
+  size_t before{num_allocations};
+  assert(before > 0); // Make sure that the counter is working
+  for (int i{}; i < 1000; ++i)
+    draw(canv, transforms, label);
+
+  assert(num_allocations == before);
+}
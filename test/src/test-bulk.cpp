@@ -0,0 +1,83 @@
+#include <cassert>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+const double xs[]{1, 2, 3, 4, 5};
+const double ys[]{5, 4, 3, 2, 1};
+const Color colors[]{red, blue, red, Color{1, 0.001, 0}, green};
+const std::vector<std::string> labels{"0", "0.5", "1"};
+
+void draw(BaseCanvas &canv) {
+  canv.circles(xs, ys, 0.5, colors, 5);
+  canv.rectangles(xs, ys, 1.0, std::vector<double>{1, 2, 3, 4, 5}, blue, 5,
+                  Action::Stroke);
+  canv.texts(xs, 0.0, labels, 3, HorizontalAlignment::Center);
+}
+
+int main() {
+  ColorGroups groups;
+  groups.build(colors, 5);
+  assert(groups.numofgroups() == 3);
+  const size_t order[]{0, 2, 3, 1, 4};
+  assert(std::equal(order, order + 5, groups.order.begin()));
+
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   10, 10};
+    draw(canv);
+
+    // The colors of the canvas do not change
+    assert(canv.getfillcolor().r == white.r);
+    assert(canv.getstrokecolor().b == black.b);
+  }
+
+  // The three reds (all of them are #ff0000 once quantized) share a group,
+  // the other circles are written alone
+  const std::string svg{output.str()};
+  assert(count(svg, "<circle") == 5);
+  assert(count(svg, "<rect") == 5);
+  assert(count(svg, "#ff0000") == 1);
+  assert(count(svg, "<g fill=") == 2);
+  assert(svg.find("<circle cx=\"2\" cy=\"4\" r=\"0.5\" fill=\"#0000ff\"") !=
+         std::string::npos);
+  assert(svg.find("<rect x=\"5\" y=\"1\" width=\"1\" height=\"5\"/>") !=
+         std::string::npos);
+
+  // Labels share their style and the flip of the Y axis
+  assert(count(svg, "<text") == 3);
+  assert(count(svg, "font-family") == 1);
+  assert(count(svg, "scale(1 -1)") == 2);
+  assert(svg.find("<text x=\"2\" y=\"0\">0.5</text>") != std::string::npos);
+
+  // Other canvases draw one item at a time, in order
+  RecordingCanvas recorder{10, 10};
+  draw(recorder);
+  RecordingCanvas reference{10, 10};
+  for (size_t i{}; i < 5; ++i) {
+    reference.setfillcolor(colors[i]);
+    reference.circle(Point{xs[i], ys[i]}, 0.5, Action::Fill);
+  }
+  reference.setfillcolor(white);
+  reference.setstrokecolor(blue);
+  for (size_t i{}; i < 5; ++i)
+    reference.rectangle(Point{xs[i], ys[i]},
+                        Point{xs[i] + 1, ys[i] + double(i + 1)});
+  reference.setstrokecolor(black);
+  for (size_t i{}; i < 3; ++i)
+    reference.text(Point{xs[i], 0}, labels[i], HorizontalAlignment::Center);
+  const CommandBuffer &a{recorder.getcommands()}, &b{reference.getcommands()};
+  assert(a.size() == b.size() &&
+         std::equal(a.data(), a.data() + a.size(), b.data()));
+}
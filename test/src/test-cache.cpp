@@ -0,0 +1,126 @@
+#include <cassert>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+#include <sys/stat.h>
+
+using namespace monet;
+
+int panelcalls{};
+
+void panel(BaseCanvas &canv) {
+  ++panelcalls;
+  canv.setstrokecolor(Color{0.5, 0.5, 0.5});
+  for (int i{}; i < 10; ++i)
+    canv.line(Point{0, double(i)}, Point{100, double(i)});
+  canv.rectangle(Point{1, 2}, Point{3, 4});
+  canv.text(Point{3, 4}, "label");
+}
+
+// Draw the same panel at different nesting levels
+std::string dashboard(std::shared_ptr<RenderCache> cache, double width) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   100, 100};
+    canv.setcache(cache);
+    canv.setstrokewidth(width);
+
+    canv.cachedgroup(1, TransformSequence{translate(Point{1, 1})}, panel,
+                     "first");
+    canv.begingroup();
+    canv.cachedgroup(1, identity, panel);
+    canv.cachedgroup(identity, panel);
+    canv.endgroup();
+    canv.cachedgroup(identity, panel);
+
+    // Changes made within the group are undone
+    assert(canv.getstrokecolor().r == 0);
+    assert(canv.getstrokewidth() == width);
+  }
+  return output.str();
+}
+
+int main() {
+  const std::string reference{dashboard(nullptr, 1.0)};
+  assert(panelcalls == 4);
+
+  auto cache = std::make_shared<RenderCache>();
+  panelcalls = 0;
+  assert(dashboard(cache, 1.0) == reference);
+  assert(dashboard(cache, 1.0) == reference);
+  assert(cache->hits() == 6 && cache->misses() == 2);
+  assert(cache->bytessaved() > 0);
+
+  // Recorded groups call `panel` every time, groups with a key only once
+  assert(panelcalls == 2 * 2 + 1);
+
+  // The drawing parameters are part of the key
+  assert(dashboard(cache, 2.0) == dashboard(nullptr, 2.0));
+  assert(cache->misses() == 4);
+
+  // Entries larger than the budget are dropped
+  cache->setbudget(10);
+  assert(cache->size() == 0 && cache->memoryused() == 0);
+
+  // Entries saved in a directory survive the cache
+  const char *dir{"test-cache-entries"};
+  mkdir(dir, 0755);
+  {
+    auto first = std::make_shared<RenderCache>(1 << 20, dir);
+    assert(dashboard(first, 3.0) == dashboard(nullptr, 3.0));
+  }
+  auto second = std::make_shared<RenderCache>(1 << 20, dir);
+  assert(dashboard(second, 3.0) == dashboard(nullptr, 3.0));
+  assert(second->misses() == 0 && second->hitrate() == 1.0);
+
+  // A damaged length in a saved entry is a miss, not a huge allocation
+  DIR *entries{opendir(dir)};
+  assert(entries);
+  while (const dirent *entry = readdir(entries)) {
+    if (entry->d_name[0] == '.')
+      continue;
+    const std::string name{std::string{dir} + "/" + entry->d_name};
+    std::fstream file{name, std::ios::in | std::ios::out | std::ios::binary};
+    const uint64_t length{uint64_t(1) << 39};
+    file.seekp(8 + sizeof(uint64_t) + sizeof(int32_t));
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+  }
+  closedir(entries);
+  auto third = std::make_shared<RenderCache>(1 << 20, dir);
+  assert(dashboard(third, 3.0) == dashboard(nullptr, 3.0));
+  assert(third->misses() == 2);
+
+  // Groups left open by `draw` are closed, and they are not cached
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   100, 100};
+    canv.setcache(std::make_shared<RenderCache>());
+    const ClipRegion region{canv.cliprectangle(Point{0, 0}, Point{5, 5})};
+    const int level{canv.grouplevel()};
+    panelcalls = 0;
+    for (int i{}; i < 2; ++i)
+      canv.cachedgroup(7, identity, [&region](BaseCanvas &inner) {
+        panel(inner);
+        inner.begingroup();
+        inner.useclip(region);
+        inner.line(Point{0, 0}, Point{1, 1});
+      });
+    assert(panelcalls == 2);
+    assert(canv.grouplevel() == level);
+  }
+  const std::string svg{output.str()};
+  size_t opened{}, closed{};
+  for (size_t pos{svg.find("<g")}; pos != std::string::npos;
+       pos = svg.find("<g", pos + 1))
+    ++opened;
+  for (size_t pos{svg.find("</g>")}; pos != std::string::npos;
+       pos = svg.find("</g>", pos + 1))
+    ++closed;
+  assert(opened > 0 && opened == closed);
+}
@@ -0,0 +1,133 @@
+#include <cassert>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+// Two panels share the same region, and the second one nests another
+void panels(BaseCanvas &canv) {
+  const ClipRegion panel{canv.defineclip()};
+  canv.rectangle(Point{0, 0}, Point{50, 50}, Action::Fill);
+  canv.endclip();
+
+  const ClipRegion disc{canv.defineclip()};
+  canv.circle(Point{25, 25}, 20, Action::Fill);
+  canv.endclip();
+
+  for (int i{}; i < 2; ++i) {
+    canv.begingroup(TransformSequence{translate(Point{50.0 * i, 0})});
+    canv.useclip(panel);
+    canv.circle(Point{50, 50}, 30, Action::Fill);
+    if (i == 1) {
+      canv.useclip(disc);
+      canv.rectangle(Point{0, 0}, Point{50, 50}, Action::Fill);
+      canv.removeclip();
+    }
+    canv.removeclip();
+    canv.endgroup();
+  }
+}
+
+// Most of these primitives are outside the region, or cross its border
+void scatter(BaseCanvas &canv) {
+  const ClipRegion frame{canv.cliprectangle(Point{10, 10}, Point{20, 20})};
+  canv.useclip(frame);
+  canv.rectangle(Point{0, 0}, Point{15, 15}, Action::Fill);
+  for (int i{}; i < 30; ++i)
+    canv.line(Point{double(i), 12}, Point{double(i) + 0.5, 12});
+  canv.circle(Point{40, 40}, 1, Action::Fill);
+  canv.circle(Point{15, 15}, 1, Action::Fill);
+  canv.line(Point{0, 15}, Point{30, 15});
+  canv.removeclip();
+}
+
+int main() {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 100, 50};
+    panels(canv);
+  }
+  const std::string svg{output.str()};
+  assert(count(svg, "<clipPath id=\"monet_clip_path\">") == 1);
+  assert(count(svg, "<clipPath id=\"monet_clip_path_1\">") == 1);
+  assert(count(svg, "clip-path=\"url(#monet_clip_path)\"") == 2);
+  assert(count(svg, "clip-path=\"url(#monet_clip_path_1)\"") == 1);
+  assert(svg.rfind("clip-path=\"url(#monet_clip_path)\"") <
+         svg.find("clip-path=\"url(#monet_clip_path_1)\""));
+
+  // Replaying the commands produces the same file
+  RecordingCanvas recorder{100, 50};
+  panels(recorder);
+  scatter(recorder);
+  std::ostringstream direct, replayed;
+  {
+    SVGCanvas canv{newstream(direct), 100, 50};
+    canv.setclipgeometry(true);
+    panels(canv);
+    scatter(canv);
+  }
+  {
+    SVGCanvas canv{newstream(replayed), 100, 50};
+    canv.setclipgeometry(true);
+    CommandPlayer player;
+    player.play(recorder.getcommands(), canv);
+  }
+  assert(direct.str() == replayed.str());
+
+  // Without `setclipgeometry`, the region is used as any other
+  std::ostringstream plain;
+  {
+    SVGCanvas canv{newstream(plain), 50, 50};
+    scatter(canv);
+  }
+  assert(count(plain.str(), "<g clip-path") == 1);
+  assert(count(plain.str(), "<line") == 31);
+  assert(count(plain.str(), "<circle") == 2);
+
+  std::ostringstream clipped;
+  {
+    SVGCanvas canv{newstream(clipped), 50, 50};
+    canv.setclipgeometry(true);
+    scatter(canv);
+  }
+  const std::string result{clipped.str()};
+  assert(count(result, "<g clip-path") == 1);
+  assert(count(result, "<line") == 12 + 1);
+  assert(count(result, "<circle") == 1);
+
+  // The filled rectangle was cut, so it does not need the region
+  assert(result.find("x=\"10\" y=\"10\"") < result.find("<clipPath"));
+  assert(result.find("width=\"5\" height=\"5\"") < result.find("<clipPath"));
+
+  // Nothing crosses the border: the region is never written
+  std::ostringstream inside;
+  {
+    SVGCanvas canv{newstream(inside), 50, 50};
+    canv.setclipgeometry(true);
+    canv.useclip(canv.cliprectangle(Point{0, 0}, Point{50, 50}));
+    canv.rectangle(Point{-10, -10}, Point{60, 60}, Action::Fill);
+    canv.line(Point{10, 10}, Point{20, 20});
+    canv.circle(Point{25, 25}, 5);
+    canv.removeclip();
+  }
+  assert(inside.str().find("clip") == std::string::npos);
+
+  // Regions can be nested in PDF files as well
+  {
+    PDFCanvas canv{"test-clip.pdf", 100, 50};
+    panels(canv);
+    scatter(canv);
+  }
+}
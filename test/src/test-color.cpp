@@ -0,0 +1,59 @@
+#include <cassert>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+void draw(BaseCanvas &canv) {
+  canv.setfillcolor(Color8{255, 128, 0, 51});
+  canv.setstrokecolor(Color8{0, 0, 255});
+  canv.circle(Point{10, 10}, 5, Action::FillAndStroke);
+
+  // Colors of type Color keep the opacity
+  canv.setfillcolor(Color{0.3, 0.2, 0.1});
+  canv.rectangle(Point{0, 0}, Point{5, 5}, Action::Fill);
+  canv.setfillalpha(1.0);
+  canv.setstrokealpha(0.25);
+  canv.line(Point{0, 0}, Point{5, 5});
+}
+
+std::string render(const std::function<void(BaseCanvas &)> &fn) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   100, 100};
+    fn(canv);
+  }
+  return output.str();
+}
+
+int main() {
+  for (double level : {0.0, 0.1, 0.5, 1.0})
+    assert(gray(level).r == hsl(0.7, 0.0, level).r);
+  assert(hsl(1.0 / 3, 1.0, 0.5).g == 1.0);
+  assert(gray(0.5).toHTML() == "#7f7f7f");
+  assert((Color{1.2, -0.1, 1.0 / 255}.toHTML() == "#ff0001"));
+
+  // Conversions from Color8 are lossless, the opposite only sometimes
+  const Color8 orange{255, 128, 0, 51};
+  assert(Color8(orange.tocolor(), orange.alpha()) == orange);
+  assert(Color8::frompacked(0xff800033) == orange);
+  assert(orange.packed() == 0xff800033);
+  assert(isexactcolor8(orange.tocolor(), orange.alpha()));
+  assert(!isexactcolor8(gray(0.5)));
+  assert(Color8(gray(0.5)) == Color8(128, 128, 128));
+
+  const std::string direct{render(draw)};
+  assert(direct.find("fill-opacity=\"0.2\"") != std::string::npos);
+  assert(direct.find("stroke-opacity=\"0.25\"") != std::string::npos);
+  assert(direct.find("stroke-opacity=\"1\"") == std::string::npos);
+
+  // The opacity survives recording
+  RecordingCanvas recorder{100, 100};
+  draw(recorder);
+  assert(render([&](BaseCanvas &canv) {
+           CommandPlayer player;
+           player.play(recorder.getcommands(), canv);
+         }) == direct);
+}
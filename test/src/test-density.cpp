@@ -0,0 +1,117 @@
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+// A spiral of points, denser towards the center
+void spiral(std::vector<double> &xs, std::vector<double> &ys, size_t n) {
+  xs.resize(n);
+  ys.resize(n);
+  for (size_t i{}; i < n; ++i) {
+    const double t{double(i) / double(n)};
+    xs[i] = t * std::cos(40 * t);
+    ys[i] = t * std::sin(40 * t);
+  }
+}
+
+const Gradient colormap{lineargradient(Point{0, 0}, Point{1, 0})
+                            .addstop(0, lightblue)
+                            .addstop(1, darkblue)};
+
+std::string render(const DensityGrid &grid) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 100, 100};
+    grid.draw(canv, colormap);
+  }
+  return output.str();
+}
+
+int main() {
+  // The Base64 encoding of "Man" and of shorter strings (RFC 4648)
+  for (const char *text : {"", "M", "Ma", "Man", "Many"}) {
+    std::string encoded;
+    encodebase64(encoded, text, std::strlen(text));
+    static const char *expected[]{"", "TQ==", "TWE=", "TWFu", "TWFueQ=="};
+    assert(encoded == expected[std::strlen(text)]);
+  }
+
+  const unsigned char check[]{'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  assert(crc32(check, sizeof(check)) == 0xCBF43926U);
+
+  // Points are counted in the bins that contain them
+  DensityGrid grid{4, 2, Point{0, 0}, Point{4, 2}};
+  const double xs[]{0.5, 3.5, 3.5, 9, -1, NAN, 3.99};
+  const double ys[]{0.5, 1.5, 1.2, 1, 1, 1, 0};
+  grid.add(xs, ys, 7);
+  assert(grid.at(0, 0) == 1);
+  assert(grid.at(3, 1) == 2);
+  assert(grid.at(3, 0) == 1);
+  grid.add(xs, ys, 1, 2.5);
+  assert(grid.at(0, 0) == 3.5);
+
+  // Transfer functions
+  std::vector<Color8> pixels;
+  grid.shade(pixels, colormap, TransferFunction::Linear);
+  assert(pixels[1] == Color8(0, 0, 0, 0));
+  assert(pixels[3] == Color8{lightblue});
+  assert(pixels[0] == Color8{darkblue});
+  grid.shade(pixels, colormap, TransferFunction::Equalize);
+  assert(pixels[3] == Color8{lightblue});
+  assert(pixels[7] == Color8{colormap.colorat(0.5)});
+
+  // Many threads give the same result as one
+  std::vector<double> px, py;
+  spiral(px, py, 1000000);
+  DensityGrid serial{100, 100, Point{-1, -1}, Point{1, 1}};
+  DensityGrid parallel{100, 100, Point{-1, -1}, Point{1, 1}};
+  serial.add(px, py, px.size(), 1.0, 1);
+  parallel.add(px, py, px.size(), 1.0, 4);
+  assert(serial.getbins() == parallel.getbins());
+
+  // The size of the image does not depend on the number of points
+  const std::string svg{render(serial)};
+  assert(count(svg, "<image") == 1);
+  assert(count(svg, "href=\"data:image/png;base64,iVBORw0KGgo") == 1);
+  DensityGrid sparse{100, 100, Point{-1, -1}, Point{1, 1}};
+  sparse.add(px, py, 1000);
+  assert(render(sparse).size() < svg.size());
+
+  // Replaying the commands produces the same file
+  std::ostringstream replayed;
+  {
+    RecordingCanvas recorder{100, 100};
+    serial.draw(recorder, colormap);
+
+    SVGCanvas canv{newstream(replayed), 100, 100};
+    CommandPlayer player;
+    player.play(recorder.getcommands(), canv);
+  }
+  assert(replayed.str() == svg);
+
+  // Empty bins are transparent, so PDF images have a soft mask
+  {
+    PDFCanvas canv{"test-density.pdf", 100, 100};
+    serial.draw(canv, colormap, TransferFunction::Log);
+  }
+  std::ifstream pdf{"test-density.pdf", std::ios::binary};
+  const std::string content{std::istreambuf_iterator<char>{pdf},
+                            std::istreambuf_iterator<char>{}};
+  assert(count(content, "/Subtype /Image") == 2);
+  assert(count(content, "/SMask") == 1);
+}
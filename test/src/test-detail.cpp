@@ -0,0 +1,53 @@
+#include <cassert>
+#include <cmath>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+// Draw a marker in a group scaled by `factor`, and return which of the
+// alternatives has been chosen (0 = none)
+int drawmarker(BaseCanvas &canv, double factor) {
+  int chosen{};
+  canv.detailgroup(TransformSequence{scale(factor)},
+                   {{1.0, [&] {
+                       chosen = 1;
+                       canv.circle(Point{0, 0}, 1);
+                     }},
+                    {4.0, [&] {
+                       chosen = 2;
+                       canv.circle(Point{0, 0}, 1, Action::Fill);
+                     }}});
+  return chosen;
+}
+
+int main() {
+  std::ostringstream output;
+  SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                     output.rdbuf()}},
+                 100, 100};
+
+  assert(canv.geteffectivescale() == 1.0);
+
+  canv.begingroup(TransformSequence{scale(2.0, 8.0) | rotate(30)});
+  assert(std::fabs(canv.geteffectivescale() - 4.0) < 1e-12);
+  assert(std::fabs(canv.getctm().apply(Point{1, 0}).x -
+                   2 * std::cos(M_PI / 6)) < 1e-12);
+
+  canv.begingroup(TransformSequence{translate(Point{10, 10})});
+  assert(std::fabs(canv.geteffectivescale() - 4.0) < 1e-12);
+  canv.endgroup();
+
+  canv.setdevicescale(0.5);
+  assert(std::fabs(canv.geteffectivescale() - 2.0) < 1e-12);
+  canv.endgroup();
+
+  assert(canv.geteffectivescale() == 0.5);
+  assert(canv.getctm().a == 1.0 && canv.getctm().e == 0.0);
+
+  // Scales 0.5·1, 0.5·2, 0.5·8, and 0.5·16
+  assert(drawmarker(canv, 1.0) == 0);
+  assert(drawmarker(canv, 2.0) == 1);
+  assert(drawmarker(canv, 8.0) == 2);
+  assert(drawmarker(canv, 16.0) == 2);
+}
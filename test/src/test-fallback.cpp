@@ -0,0 +1,103 @@
+#include <cassert>
+#include <cmath>
+#include <monet.h>
+#include <vector>
+
+using namespace monet;
+
+// A canvas that implements only the methods that every canvas must
+// have, and records the color and the opacity of the filled shapes
+class MinimalCanvas : public BaseCanvas {
+public:
+  struct Fill {
+    Color color;
+    double alpha;
+  };
+
+  std::vector<Fill> fills;
+  int level{};
+
+protected:
+  void movetoxy(double, double) override {}
+  void linetoxy(double, double) override {}
+  void quadratictoxy(double, double, double, double) override {}
+  void cubictoxy(double, double, double, double, double, double) override {}
+  void linexy(double, double, double, double) override {}
+  void circlexy(double, double, double, Action act) override { record(act); }
+  void rectanglexy(double, double, double, double, Action act) override {
+    record(act);
+  }
+  void textxy(double, double, const char *, HorizontalAlignment,
+              VerticalAlignment) override {}
+
+  void record(Action act) {
+    if (act != Action::Stroke)
+      fills.push_back(Fill{getfillcolor(), getfillalpha()});
+  }
+
+public:
+  double getwidth() const override { return 10; }
+  double getheight() const override { return 10; }
+
+  void closepath() override {}
+  void strokepath() override {}
+  void fillpath() override { record(Action::Fill); }
+  void clearpath() override {}
+
+  void begingroup(const TransformSequence &, const std::string &) override {
+    ++level;
+  }
+  void endgroup() override { --level; }
+  int grouplevel() const override { return level; }
+
+  ClipRegion defineclip() override { return ClipRegion{}; }
+  void endclip() override {}
+  void useclip() override {}
+  void useclip(ClipRegion) override {}
+  void removeclip() override {}
+};
+
+bool same(Color a, Color b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+
+int main() {
+  MinimalCanvas canv;
+  canv.setfillcolor(green);
+
+  // Gradients are filled with the color of their first stop
+  const Gradient gradient{lineargradient(Point{0, 0}, Point{1, 0})
+                              .addstop(0, red)
+                              .addstop(1, blue)};
+  Path triangle;
+  triangle.moveto(Point{0, 0}).lineto(Point{1, 0}).lineto(Point{0, 1});
+  triangle.closepath();
+  canv.circle(Point{5, 5}, 1, gradient);
+  canv.rectangle(Point{0, 0}, Point{1, 1}, gradient);
+  canv.draw(triangle, gradient);
+  assert(canv.fills.size() == 3);
+  for (const MinimalCanvas::Fill &fill : canv.fills)
+    assert(same(fill.color, red));
+  assert(same(canv.getfillcolor(), green));
+
+  // Patterns are filled with the fill color
+  canv.fills.clear();
+  RecordingCanvas tile{2, 2};
+  tile.line(Point{0, 2}, Point{2, 0});
+  const Pattern hatch{tile};
+  canv.circle(Point{5, 5}, 1, hatch);
+  canv.rectangle(Point{0, 0}, Point{1, 1}, hatch);
+  canv.draw(triangle, hatch);
+  assert(canv.fills.size() == 3);
+  for (const MinimalCanvas::Fill &fill : canv.fills)
+    assert(same(fill.color, green));
+
+  // Images are drawn as a rectangle for each pixel that is visible
+  canv.fills.clear();
+  const Color8 pixels[]{Color8{255, 0, 0}, Color8{0, 0, 255, 0},
+                        Color8{0, 0, 255, 51}, Color8{0, 255, 0}};
+  canv.image(Point{0, 0}, Point{2, 2}, 2, 2, pixels);
+  assert(canv.fills.size() == 3);
+  assert(same(canv.fills[0].color, red) && canv.fills[0].alpha == 1);
+  assert(same(canv.fills[1].color, blue));
+  assert(std::fabs(canv.fills[1].alpha - 0.2) < 1e-12);
+  assert(same(canv.getfillcolor(), green) && canv.getfillalpha() == 1);
+}
@@ -0,0 +1,162 @@
+#include <cassert>
+#include <cmath>
+#include <monet.h>
+
+using namespace monet;
+
+const int num_of_samples{20000};
+
+// Distance between point `p` and the segment joining `a` and `b`
+double distance(Point p, Point a, Point b) {
+  Point ab{b - a};
+  double len2{ab.x * ab.x + ab.y * ab.y};
+  double t{len2 > 0 ? ((p.x - a.x) * ab.x + (p.y - a.y) * ab.y) / len2 : 0};
+  t = std::max(0.0, std::min(1.0, t));
+  return norm(p - (a + t * ab));
+}
+
+void check_curve(const Path &path, Point p0, Point p1, Point p2, Point p3,
+                 bool cubic) {
+  auto eval = [&](double t) {
+    return cubic ? cubicpoint(p0, p1, p2, p3, t)
+                 : quadraticpoint(p0, p1, p2, t);
+  };
+
+  // Reference values, computed by dense sampling
+  Point refmin{p0}, refmax{p0};
+  double reflength{};
+  Point prev{p0};
+  for (int i{1}; i <= num_of_samples; ++i) {
+    Point cur{eval(double(i) / num_of_samples)};
+    extendbox(cur, refmin, refmax);
+    reflength += norm(cur - prev);
+    prev = cur;
+  }
+
+  // The bounding box must enclose all the samples, and it must be tight
+  Point min, max;
+  path.boundingbox(min, max);
+  const double eps{1e-6};
+  assert(min.x <= refmin.x + 1e-12 && min.x >= refmin.x - eps);
+  assert(min.y <= refmin.y + 1e-12 && min.y >= refmin.y - eps);
+  assert(max.x >= refmax.x - 1e-12 && max.x <= refmax.x + eps);
+  assert(max.y >= refmax.y - 1e-12 && max.y <= refmax.y + eps);
+
+  // The length must match the one of the dense polyline
+  assert(std::fabs(length(path, 1e-8) - reflength) < 1e-5);
+
+  // Every point on the curve must be within the tolerance from the
+  // flattened polyline
+  for (double tolerance : {1.0, 0.1, 0.01, 0.001}) {
+    Path flat{flatten(path, tolerance)};
+    const auto &verbs = flat.getverbs();
+    const auto &coords = flat.getcoords();
+    for (PathVerb verb : verbs)
+      assert(verb == PathVerb::MoveTo || verb == PathVerb::LineTo);
+
+    size_t numofpoints{coords.size() / 2};
+    for (int i{}; i <= num_of_samples; i += 10) {
+      Point pt{eval(double(i) / num_of_samples)};
+      double mindist{1e100};
+      for (size_t k{}; k + 1 < numofpoints; ++k) {
+        Point a{coords[2 * k], coords[2 * k + 1]};
+        Point b{coords[2 * k + 2], coords[2 * k + 3]};
+        mindist = std::min(mindist, distance(pt, a, b));
+      }
+      assert(mindist <= tolerance);
+    }
+  }
+}
+
+int main() {
+  {
+    Point p0{0, 0}, p1{50, 100}, p2{100, -20};
+    Path path;
+    path.moveto(p0).quadraticto(p1, p2);
+    check_curve(path, p0, p1, p2, p2, false);
+  }
+
+  {
+    Point p0{0, 0}, p1{-30, 80}, p2{130, 90}, p3{100, -10};
+    Path path;
+    path.moveto(p0).cubicto(p1, p2, p3);
+    check_curve(path, p0, p1, p2, p3, true);
+  }
+
+  {
+    // A cubic with an inflection point
+    Point p0{10, 10}, p1{90, 120}, p2{-40, -60}, p3{70, 30};
+    Path path;
+    path.moveto(p0).cubicto(p1, p2, p3);
+    check_curve(path, p0, p1, p2, p3, true);
+  }
+
+  // Straight lines and closed subpaths
+  Path square;
+  square.moveto(Point{0, 0}).lineto(Point{2, 0}).lineto(Point{2, 2});
+  square.lineto(Point{0, 2}).closepath();
+  assert(length(square) == 8.0);
+  assert(flatten(square, 0.1).size() == square.size());
+
+  // A curve after `closepath` starts from the beginning of the subpath,
+  // and one before any `moveto` starts from the origin
+  {
+    Path path;
+    path.moveto(Point{10, 10}).lineto(Point{20, 10}).lineto(Point{20, 20});
+    path.closepath().quadraticto(Point{0, 15}, Point{10, 20});
+    Point min, max;
+    path.boundingbox(min, max);
+    assert(min.x == 5 && min.y == 10 && max.x == 20 && max.y == 20);
+
+    Path open;
+    open.quadraticto(Point{10, 10}, Point{20, 0});
+    open.boundingbox(min, max);
+    assert(min.x == 0 && min.y == 0 && max.x == 20 && max.y == 5);
+  }
+
+  // Zero and negative tolerances are raised to `mintolerance`, and the
+  // number of segments is bounded
+  Point q0{0, 0}, q1{50, 100}, q2{100, 0}, q3{150, 100};
+  for (double tolerance : {0.0, -1.0, std::nan("")}) {
+    const int n{quadraticsegments(q0, q1, q2, tolerance)};
+    assert(n == quadraticsegments(q0, q1, q2, mintolerance));
+    assert(n > 1 && n <= maxsegments);
+    assert(cubicsegments(q0, q1, q2, q3, tolerance) <= maxsegments);
+    assert(std::fabs(cubiclength(q0, q1, q2, q3, tolerance) -
+                     cubiclength(q0, q1, q2, q3, 1e-8)) < 1e-6);
+  }
+  assert(quadraticsegments(q0, q1, Point{1e300, 0}, 1e-3) == maxsegments);
+
+  StrokeStyle thick;
+  thick.width = 10;
+  thick.join = LineJoin::Round;
+  thick.cap = LineCap::Round;
+  Path corner;
+  corner.moveto(Point{0, 0}).lineto(Point{100, 0}).lineto(Point{100, 100});
+  const Path outline{strokeoutline(corner, thick, 0.0)};
+  assert(!outline.empty() && outline.size() < size_t(10 * maxsegments));
+
+  // Vectorized evaluation must match the scalar code
+  CubicArray curves;
+  curves.push_back(Point{0, 0}, Point{1, 2}, Point{3, 2}, Point{4, 0});
+  curves.push_back(Point{5, 5}, Point{6, 9}, Point{8, 1});
+  curves.push_back(Point{-1, 0}, Point{-2, 3}, Point{4, -3}, Point{2, 1});
+  assert(curves.size() == 3);
+
+  double x[3], y[3];
+  curves.evaluate(0.3, x, y);
+  Point expected{cubicpoint(Point{0, 0}, Point{1, 2}, Point{3, 2}, Point{4, 0},
+                            0.3)};
+  assert(std::fabs(x[0] - expected.x) < 1e-12);
+  assert(std::fabs(y[0] - expected.y) < 1e-12);
+
+  expected = quadraticpoint(Point{5, 5}, Point{6, 9}, Point{8, 1}, 0.3);
+  assert(std::fabs(x[1] - expected.x) < 1e-12);
+  assert(std::fabs(y[1] - expected.y) < 1e-12);
+
+  const double t[]{0.0, 0.5, 1.0};
+  curves.evaluate(t, x, y);
+  assert(x[0] == 0.0 && y[0] == 0.0);
+  assert(std::fabs(x[1] - 6.25) < 1e-12 && std::fabs(y[1] - 6.0) < 1e-12);
+  assert(x[2] == 2.0 && y[2] == 1.0);
+}
@@ -0,0 +1,107 @@
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+bool near(Color a, Color b) {
+  return std::fabs(a.r - b.r) < 1e-12 && std::fabs(a.g - b.g) < 1e-12 &&
+         std::fabs(a.b - b.b) < 1e-12;
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+const Gradient colorbar{
+    lineargradient(Point{0, 0}, Point{0, 1}, ColorSpace::HSL)
+        .addstop(0, red)
+        .addstop(1, blue)};
+
+void draw(BaseCanvas &canv) {
+  // Two colorbars with the same colormap share the definition
+  canv.rectangle(Point{0, 0}, Point{10, 100}, colorbar);
+  canv.rectangle(Point{20, 0}, Point{30, 50}, colorbar);
+
+  canv.settransparency(0.5);
+  canv.circle(Point{50, 50}, 20,
+              radialgradient(Point{0.5, 0.5}, 0.5)
+                  .addstop(0.2, white)
+                  .addstop(0.2, yellow)
+                  .addstop(1, darkred));
+  canv.settransparency(0);
+
+  Path triangle;
+  triangle.moveto(Point{0, 0}).lineto(Point{10, 0}).lineto(Point{0, 10});
+  triangle.closepath();
+  canv.draw(triangle, TransformSequence{translate(Point{60, 0})}, colorbar);
+}
+
+int main() {
+  // tohsl is the inverse of hsl
+  for (Color col : {red, darkgreen, lightblue, brown, Color{0.2, 0.3, 0.9}}) {
+    double h, s, l;
+    tohsl(col, h, s, l);
+    assert(near(hsl(h, s, l), col));
+  }
+
+  // RGB interpolation is linear, HSL goes along the hue circle
+  const Gradient rgbgradient{lineargradient(Point{0, 0}, Point{1, 0})
+                                 .addstop(0, red)
+                                 .addstop(1, blue)};
+  assert(near(rgbgradient.colorat(0.5), Color{0.5, 0, 0.5}));
+  assert(near(rgbgradient.colorat(-1), red));
+  assert(near(colorbar.colorat(0.5), purple));
+
+  std::vector<GradientStop> stops;
+  colorbar.rgbstops(stops, 4);
+  assert(stops.size() == 2 + 4);
+  rgbgradient.rgbstops(stops, 4);
+  assert(stops.size() == 2);
+
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 100, 100};
+    draw(canv);
+  }
+  const std::string svg{output.str()};
+  assert(count(svg, "<linearGradient") == 1);
+  assert(count(svg, "<radialGradient") == 1);
+  assert(count(svg, "<stop") == 2 + 8 + 3);
+  assert(count(svg, "fill=\"url(#monet_gradient_") == 4);
+  assert(svg.find("<linearGradient") < svg.find("<rect"));
+
+  // Replaying the commands produces the same file
+  std::ostringstream replayed;
+  {
+    RecordingCanvas recorder{100, 100};
+    draw(recorder);
+
+    SVGCanvas canv{newstream(replayed), 100, 100};
+    CommandPlayer player;
+    player.play(recorder.getcommands(), canv);
+  }
+  assert(replayed.str() == svg);
+
+  // Shadings are in the resources of the page, which are not compressed
+  {
+    PDFCanvas canv{"test-gradient.pdf", 100, 100};
+    draw(canv);
+  }
+  std::ifstream pdf{"test-gradient.pdf", std::ios::binary};
+  const std::string content{std::istreambuf_iterator<char>{pdf},
+                            std::istreambuf_iterator<char>{}};
+  assert(count(content, "/ShadingType 2") == 1);
+  assert(count(content, "/ShadingType 3") == 1);
+  assert(count(content, "/FunctionType 2") == 9 + 2);
+}
@@ -0,0 +1,75 @@
+#include <cassert>
+#include <cstring>
+#include <locale>
+#include <monet.h>
+#include <sstream>
+#include <stdexcept>
+
+using namespace monet;
+
+uint64_t hashof(const char *str, size_t piece) {
+  XXHash64 hash;
+  size_t len{std::strlen(str)};
+  for (size_t i{}; i < len; i += piece)
+    hash.update(str + i, std::min(piece, len - i));
+  assert(hash.size() == len);
+  return hash.digest();
+}
+
+uint64_t drawing(std::ostringstream &output) {
+  auto hash = std::make_shared<XXHash64>();
+  {
+    SVGCanvas canv{hashstream(std::unique_ptr<std::ostream>{new std::ostream{
+                                  output.rdbuf()}},
+                              hash),
+                   123.5, 100};
+    canv.setstrokewidth(0.25);
+    canv.circle(Point{1.5, 2.125}, 1e-5);
+    canv.rectangle(Point{1e7, -3.75}, Point{2.5e-7, 0.1});
+  }
+  return hash->digest();
+}
+
+int main() {
+  // Reference values of XXH64
+  assert(hashof("", 1) == 0xEF46DB3751D8E999ULL);
+  const char *text{"Nel mezzo del cammin di nostra vita mi ritrovai per una "
+                   "selva oscura, che' la diritta via era smarrita"};
+  for (size_t piece : {1, 3, 31, 32, 33, 1000})
+    assert(hashof(text, piece) == hashof(text, 1000));
+
+  // The hash is the same as the one of the bytes written
+  std::ostringstream first, second;
+  uint64_t hash{drawing(first)};
+  XXHash64 check;
+  check.update(first.str().data(), first.str().size());
+  assert(check.digest() == hash);
+  assert(first.str().find("123.5") != std::string::npos);
+  assert(first.str().find("1e-05") != std::string::npos);
+
+  // A null stream only computes the hash
+  auto onlyhash = std::make_shared<XXHash64>();
+  {
+    SVGCanvas canv{hashstream(nullptr, onlyhash), 123.5, 100};
+    canv.setstrokewidth(0.25);
+    canv.circle(Point{1.5, 2.125}, 1e-5);
+    canv.rectangle(Point{1e7, -3.75}, Point{2.5e-7, 0.1});
+  }
+  assert(onlyhash->digest() == hash);
+
+  // Numbers do not depend on the locale
+  try {
+    std::locale::global(std::locale{"de_DE.UTF-8"});
+  } catch (std::runtime_error &) {
+    // The locale is not installed, so this check is meaningless
+  }
+  assert(drawing(second) == hash);
+  assert(second.str() == first.str());
+  std::locale::global(std::locale::classic());
+
+  char buf[32];
+  formatgeneral(buf, sizeof(buf), -0.000123456789);
+  assert(std::strcmp(buf, "-0.000123457") == 0);
+  formatgeneral(buf, sizeof(buf), 2.5e10);
+  assert(std::strcmp(buf, "2.5e+10") == 0);
+}
@@ -0,0 +1,130 @@
+#include <cassert>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+// Count the elements and keep the text of a document
+class Counter : public SVGReader {
+public:
+  int elements, ends;
+  std::string text;
+
+  Counter() : elements{0}, ends{0}, text{} {}
+
+protected:
+  void startelement(const Slice &, const std::vector<Attribute> &,
+                    const Slice &) override {
+    ++elements;
+  }
+  void endelement(const Slice &, const Slice &) override { ++ends; }
+  void characters(const Slice &chars) override { text += chars.str(); }
+};
+
+void panel(BaseCanvas &canv) {
+  const ClipRegion frame{canv.cliprectangle(Point{0, 0}, Point{40, 40})};
+  canv.useclip(frame);
+  canv.circle(Point{20, 20}, 30,
+              radialgradient(Point{0.5, 0.5}, 0.5)
+                  .addstop(0, white)
+                  .addstop(1, darkblue));
+  canv.removeclip();
+
+  Path curve;
+  curve.moveto(Point{0, 0}).cubicto(Point{10, 40}, Point{30, 0}, Point{40, 40});
+  canv.draw(curve, identity, Action::Stroke);
+  canv.text(Point{20, 45}, "Panel", HorizontalAlignment::Center);
+}
+
+std::string render(SVGLayout layout) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 40, 50, layout};
+    panel(canv);
+  }
+  return output.str();
+}
+
+int main() {
+  Counter counter;
+  const std::string doc{"<?xml version=\"1.0\"?>\n<!-- <b> -->\n"
+                        "<svg a='1' b=\"2\"><g/><![CDATA[<x>]]>y</svg>\n"};
+  assert(counter.parse(doc.data(), doc.size()));
+  assert(counter.elements == 2 && counter.ends == 2);
+  assert(counter.text == "<x>y");
+  for (const char *bad : {"<svg>", "<svg></g>", "<svg/><svg/>", "<svg a=1/>",
+                          "<svg><!-- </svg>", "text"})
+    assert(!counter.parse(bad, std::strlen(bad)));
+
+  const std::string indented{render(SVGLayout::Indented)};
+  const std::string compact{render(SVGLayout::Compact)};
+
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 100, 50};
+    panel(canv);
+    assert(canv.includesvg(indented.data(), indented.size(),
+                           TransformSequence{translate(Point{50, 0})},
+                           "right"));
+    assert(canv.includesvg(compact.data(), compact.size()));
+
+    // Nothing is written for files that SVGCanvas did not write
+    const std::string before{output.str()};
+    const std::string other{"<svg><g><rect/></g></svg>"};
+    assert(!canv.includesvg(other.data(), other.size()));
+    assert(!canv.includesvg(indented.data(), indented.size() - 10));
+    assert(!canv.includesvg("test-import-missing.svg"));
+    assert(output.str() == before);
+  }
+
+  // Besides <svg> and the canvas group, the file contains the elements
+  // of the panel three times, two of them in a group
+  Counter inpanel, infile;
+  assert(inpanel.parse(indented.data(), indented.size()));
+  const int content{inpanel.elements - 2};
+  const std::string svg{output.str()};
+  assert(infile.parse(svg.data(), svg.size()));
+  assert(infile.elements == 2 + 3 * content + 2);
+  assert(count(svg, "<g name=\"right\" transform=\"translate(50 0) \">") == 1);
+
+  // The path data is copied as it is
+  const size_t start{indented.find(" d=\"")};
+  const size_t end{indented.find('"', start + 4)};
+  assert(count(svg, indented.substr(start, end - start)) == 3);
+
+  // Each file has its own ids
+  assert(count(svg, "id=\"monet_clip_path\"") == 1);
+  assert(count(svg, "id=\"monet_import1_clip_path\"") == 1);
+  assert(count(svg, "url(#monet_import1_clip_path)") == 1);
+  assert(count(svg, "id=\"monet_import2_gradient_") == 1);
+  assert(count(svg, "url(#monet_import2_gradient_") == 1);
+
+  // The content is indented as the rest of the file
+  assert(count(svg, "\n      <text\n") == 1);
+  assert(count(svg, "\nPanel\n      </text>") == 1);
+
+  // Files are mapped in memory
+  {
+    std::ofstream out{"test-import-panel.svg"};
+    out << indented;
+  }
+  std::ostringstream fromfile;
+  {
+    SVGCanvas canv{newstream(fromfile), 40, 50};
+    assert(canv.includesvg("test-import-panel.svg"));
+  }
+  assert(count(fromfile.str(), "id=\"monet_import1_clip_path\"") == 1);
+}
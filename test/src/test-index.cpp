@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+double randomnum(double max) { return max * std::rand() / RAND_MAX; }
+
+void sorted(std::vector<uint32_t> &ids) { std::sort(ids.begin(), ids.end()); }
+
+void test_queries() {
+  SpatialIndex index;
+  std::vector<Point> mins, maxs;
+  for (uint32_t i{}; i < 5000; ++i) {
+    Point min{randomnum(1000), randomnum(1000)};
+    Point max{min + Point{randomnum(20), randomnum(20)}};
+    index.add(min, max, i);
+    mins.push_back(min);
+    maxs.push_back(max);
+  }
+  index.build();
+  assert(index.size() == 5000);
+
+  // Compare the tree with a brute-force search
+  for (int k{}; k < 200; ++k) {
+    Point qmin{randomnum(1000), randomnum(1000)};
+    Point qmax{qmin + (k % 2 == 0 ? Point{} : Point{50, 50})};
+
+    std::vector<uint32_t> expected, result;
+    for (uint32_t i{}; i < mins.size(); ++i) {
+      if (mins[i].x <= qmax.x && qmin.x <= maxs[i].x && mins[i].y <= qmax.y &&
+          qmin.y <= maxs[i].y)
+        expected.push_back(i);
+    }
+
+    index.query(qmin, qmax, result);
+    sorted(result);
+    assert(result == expected);
+  }
+
+  // The binary form can be loaded back
+  std::stringstream buf;
+  assert(index.save(buf));
+
+  SpatialIndex loaded;
+  assert(loaded.load(buf));
+  assert(loaded.size() == 5000);
+
+  std::vector<uint32_t> a, b;
+  index.query(Point{500, 500}, Point{600, 550}, a);
+  loaded.query(Point{500, 500}, Point{600, 550}, b);
+  assert(!a.empty() && a == b);
+
+  std::istringstream garbage{"MONETIDX this is not an index"};
+  assert(!loaded.load(garbage));
+  assert(loaded.size() == 5000);
+}
+
+// Write an index file with the given arrays
+std::string indexfile(const std::vector<SpatialIndex::Entry> &entries,
+                      const std::vector<SpatialIndex::Node> &nodes,
+                      uint32_t numofleaves, uint32_t numofentries,
+                      uint32_t numofnodes) {
+  const uint32_t header[]{1, numofentries, numofnodes, numofleaves};
+  std::string result{"MONETIDX"};
+  result.append(reinterpret_cast<const char *>(header), sizeof(header));
+  result.append(reinterpret_cast<const char *>(entries.data()),
+                entries.size() * sizeof(entries[0]));
+  result.append(reinterpret_cast<const char *>(nodes.data()),
+                nodes.size() * sizeof(nodes[0]));
+  return result;
+}
+
+bool loads(const std::string &content) {
+  std::istringstream in{content};
+  SpatialIndex index;
+  if (!index.load(in))
+    return false;
+
+  std::vector<uint32_t> ids;
+  index.query(Point{-1, -1}, Point{1, 1}, ids);
+  return true;
+}
+
+// Damaged files must be refused before they are queried
+void test_damaged() {
+  const SpatialIndex::Box box{-1, -1, 1, 1};
+  std::vector<SpatialIndex::Entry> entries(1000, SpatialIndex::Entry{box, 0});
+
+  // Nodes cannot have more than 16 children
+  std::vector<SpatialIndex::Node> nodes;
+  for (uint32_t i{}; i < 1000; ++i)
+    nodes.push_back(SpatialIndex::Node{box, i, 1});
+  nodes.push_back(SpatialIndex::Node{box, 0, 16});
+  assert(loads(indexfile(entries, nodes, 1000, 1000, 1001)));
+  nodes.back().count = 1000;
+  assert(!loads(indexfile(entries, nodes, 1000, 1000, 1001)));
+
+  // A chain of nodes that is deeper than any real tree
+  nodes.assign(1, SpatialIndex::Node{box, 0, 16});
+  for (uint32_t i{1}; i < 100; ++i)
+    nodes.push_back(SpatialIndex::Node{box, i - 1, 1});
+  assert(loads(indexfile(entries, {nodes.begin(), nodes.begin() + 10}, 1,
+                         1000, 10)));
+  assert(!loads(indexfile(entries, nodes, 1, 1000, 100)));
+
+  // Counts larger than the data are not allocated
+  nodes.assign(1, SpatialIndex::Node{box, 0, 16});
+  assert(!loads(indexfile(entries, nodes, 1, 0xffffffff, 1)));
+  assert(!loads(indexfile(entries, nodes, 1, 1000, 0xffffffff)));
+}
+
+void test_canvas() {
+  SpatialIndex index;
+  RecordingCanvas canv{100, 100};
+  canv.setindex(&index);
+  canv.setdevicescale(2.0);
+
+  canv.rectangle(Point{0, 0}, Point{100, 100}, Action::Fill); // id 0
+  canv.begingroup(TransformSequence{scale(2) | translate(Point{50, 50})});
+  canv.circle(Point{0, 0}, 5, Action::Fill); // id 1, (40, 40)-(60, 60) mm
+  canv.endgroup();
+
+  canv.setstrokewidth(2);
+  canv.setlinejoin(LineJoin::Round);
+  canv.line(Point{80, 10}, Point{90, 10}); // id 2
+
+  canv.moveto(Point{10, 80});
+  canv.quadraticto(Point{20, 90}, Point{30, 80});
+  canv.fillpath(); // id 3
+  canv.clearpath();
+  index.build();
+
+  std::vector<uint32_t> ids;
+  index.query(Point{2 * 45, 2 * 55}, ids);
+  sorted(ids);
+  assert(ids == std::vector<uint32_t>({0, 1}));
+
+  ids.clear();
+  index.query(Point{2 * 25, 2 * 25}, ids);
+  assert(ids == std::vector<uint32_t>({0}));
+
+  // The stroke is 2 mm wide
+  ids.clear();
+  index.query(Point{2 * 85, 2 * 10.9}, ids);
+  sorted(ids);
+  assert(ids == std::vector<uint32_t>({0, 2}));
+
+  ids.clear();
+  index.query(Point{2 * 15, 2 * 82}, Point{2 * 16, 2 * 83}, ids);
+  sorted(ids);
+  assert(ids == std::vector<uint32_t>({0, 3}));
+}
+
+int main() {
+  test_queries();
+  test_damaged();
+  test_canvas();
+}
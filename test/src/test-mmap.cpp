@@ -0,0 +1,75 @@
+#include <cassert>
+#include <csignal>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+#include <sys/resource.h>
+
+using namespace monet;
+
+std::string readfile(const char *filename) {
+  std::ifstream input{filename, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{input},
+                     std::istreambuf_iterator<char>{}};
+}
+
+void draw(SVGCanvas &canv) {
+  for (int i{}; i < 1000; ++i)
+    canv.circle(Point{i * 0.5, i * 0.25}, 3, Action::Fill);
+}
+
+int main() {
+  // Start from one page, so that the file is mapped again several times
+  std::string expected;
+  {
+    MMapOStream out{"test-mmap.dat", 4096};
+    assert(out.good());
+    for (int i{}; i < 100000; ++i) {
+      const std::string line{"line " + std::to_string(i) + "\n"};
+      out << line;
+      expected += line;
+    }
+    out.write(expected.data(), std::streamsize(expected.size()));
+    expected += expected;
+    assert(out.good());
+  }
+  assert(expected.size() > size_t(4096) << 8);
+
+  // The file is truncated to the number of bytes that were written
+  assert(readfile("test-mmap.dat") == expected);
+
+  // The stream produces the same document as any other
+  std::ostringstream reference;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       reference.rdbuf()}},
+                   500, 500};
+    draw(canv);
+  }
+  {
+    SVGCanvas canv{mmapstream("test-mmap.svg"), 500, 500};
+    draw(canv);
+  }
+  assert(readfile("test-mmap.svg") == reference.str());
+
+#ifdef MONET_HAVE_MMAP
+  // If the file cannot be enlarged, the stream goes bad and keeps only
+  // the bytes that were written before the failure
+  std::signal(SIGXFSZ, SIG_IGN);
+  rlimit limit{};
+  getrlimit(RLIMIT_FSIZE, &limit);
+  limit.rlim_cur = 16384;
+  setrlimit(RLIMIT_FSIZE, &limit);
+  {
+    MMapOStream out{"test-mmap.dat", 4096};
+    assert(out.good());
+    for (int i{}; i < 100000 && out.good(); ++i)
+      out << "line " << i << "\n";
+    assert(out.bad());
+    out << "this is lost";
+  }
+  const std::string truncated{readfile("test-mmap.dat")};
+  assert(truncated.size() > 0 && truncated.size() <= 16384);
+  assert(expected.compare(0, truncated.size(), truncated) == 0);
+#endif
+}
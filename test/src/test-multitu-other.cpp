@@ -0,0 +1,15 @@
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+std::string drawsvg() {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   10, 10};
+    canv.circle(Point{5, 5}, 1, Action::Fill);
+  }
+  return output.str();
+}
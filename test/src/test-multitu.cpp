@@ -0,0 +1,23 @@
+#include <cassert>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+// Defined in test-multitu-other.cpp, which includes monet.h as well
+std::string drawsvg();
+
+int main() {
+  const std::string svg{drawsvg()};
+  assert(svg.find(version) != std::string::npos);
+  assert(svg.find("<circle") != std::string::npos);
+
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   10, 10};
+    canv.circle(Point{5, 5}, 1, Action::Fill);
+  }
+  assert(output.str() == svg);
+}
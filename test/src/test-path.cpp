@@ -0,0 +1,135 @@
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+bool areclose(double a, double b) { return std::fabs(a - b) < 1e-10; }
+
+std::string readfile(const char *filename) {
+  std::ifstream input{filename, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{input},
+                     std::istreambuf_iterator<char>{}};
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+// Drawing a Path object discards the path built with moveto and lineto,
+// so `strokepath` has nothing left to stroke
+void discard(BaseCanvas &canv, const Path &path, bool pending) {
+  const Gradient gradient{lineargradient(Point{0, 0}, Point{1, 0})
+                              .addstop(0, red)
+                              .addstop(1, blue)};
+  for (int i{}; i < 3; ++i) {
+    if (pending) {
+      canv.moveto(Point{10, 10});
+      canv.lineto(Point{90, 90});
+    }
+    if (i == 0)
+      canv.draw(path, Action::Fill);
+    else if (i == 1)
+      canv.draw(path, TransformSequence{translate(Point{5, 5})}, gradient);
+    else
+      canv.draw(path, TransformSequence{scale(2.0)}, Action::Stroke);
+    canv.strokepath();
+  }
+}
+
+int main() {
+  Path path;
+  assert(path.empty());
+
+  path.moveto(Point{1.0, 2.0})
+      .lineto(Point{5.0, 2.0})
+      .quadraticto(Point{7.0, 4.0}, Point{5.0, 6.0})
+      .cubicto(Point{4.0, 8.0}, Point{-1.0, 7.0}, Point{1.0, 6.0})
+      .closepath();
+
+  assert(path.size() == 5);
+  assert(path.getcoords().size() == 2 + 2 + 4 + 6);
+  assert(path.getverbs()[3] == PathVerb::CubicTo);
+
+  Point min, max;
+  path.boundingbox(min, max);
+  // The box is tight: it does not include the control points
+  assert(min.y == 2.0 && max.x == 6.0);
+  assert(min.x > -1.0 && max.y < 8.0);
+
+  // The serialized form is computed only once
+  int calls{};
+  auto serialize = [&calls](const Path &, std::string &result) {
+    ++calls;
+    result = "test";
+  };
+  assert(path.serialized(PathFormat::SVG, serialize) == "test");
+  assert(path.serialized(PathFormat::SVG, serialize) == "test");
+  assert(calls == 1);
+
+  // Paths can be moved without losing their content
+  Path moved{std::move(path)};
+  assert(moved.size() == 5);
+
+  // Transforming a path changes its bounding box and the cache
+  moved.transform(TransformSequence{translate(Point{10.0, 20.0})});
+  moved.boundingbox(min, max);
+  assert(min.y == 22.0 && max.x == 16.0);
+  assert(moved.serialized(PathFormat::SVG, serialize) == "test");
+  assert(calls == 2);
+
+  // Sequences are applied from the last to the first, like in SVG
+  Matrix m{tomatrix(scale(2.0) | translate(Point{1.0, 0.0}))};
+  Point p{m.apply(Point{1.0, 1.0})};
+  assert(areclose(p.x, 3.0) && areclose(p.y, 2.0));
+
+  Point q{tomatrix(rotate(Point{1.0, 1.0}, 90.0)).apply(Point{2.0, 1.0})};
+  assert(areclose(q.x, 1.0) && areclose(q.y, 2.0));
+
+  // Drawing a path on a SVG canvas fills the cache
+  Path triangle;
+  triangle.moveto(Point{0, 0}).lineto(Point{1, 0}).lineto(Point{0.5, 1});
+  triangle.closepath();
+
+  SVGCanvas canv{"path.svg", 100, 100};
+  for (int i{}; i < 10; ++i)
+    canv.draw(triangle, TransformSequence{translate(Point{i * 5.0, 0.0})},
+              Action::FillAndStroke);
+
+  auto fail = [](const Path &, std::string &) { assert(false); };
+  assert(triangle.serialized(PathFormat::SVG, fail) == "M 0,0 1,0 0.5,1 z");
+
+  // Every backend discards the pending path in the same way
+  std::ostringstream svg, withpending, replayed;
+  {
+    SVGCanvas canv{newstream(svg), 100, 100};
+    discard(canv, triangle, false);
+  }
+  {
+    SVGCanvas canv{newstream(withpending), 100, 100};
+    discard(canv, triangle, true);
+  }
+  assert(withpending.str() == svg.str());
+  assert(svg.str().find("90,90") == std::string::npos);
+
+  {
+    RecordingCanvas recorder{100, 100};
+    discard(recorder, triangle, true);
+    SVGCanvas canv{newstream(replayed), 100, 100};
+    CommandPlayer player;
+    player.play(recorder.getcommands(), canv);
+  }
+  assert(replayed.str() == svg.str());
+
+  {
+    PDFCanvas canv{"path-plain.pdf", 100, 100};
+    discard(canv, triangle, false);
+  }
+  {
+    PDFCanvas canv{"path-pending.pdf", 100, 100};
+    discard(canv, triangle, true);
+  }
+  assert(readfile("path-plain.pdf") == readfile("path-pending.pdf"));
+}
@@ -0,0 +1,101 @@
+#include <cassert>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+Pattern hatching() {
+  RecordingCanvas tile{2, 2};
+  tile.setstrokewidth(0.2);
+  tile.line(Point{0, 2}, Point{2, 0});
+  tile.line(Point{-1, 1}, Point{1, -1});
+  tile.line(Point{1, 3}, Point{3, 1});
+  return Pattern{tile};
+}
+
+void draw(BaseCanvas &canv, double size) {
+  const Pattern hatch{hatching()};
+
+  canv.setstrokecolor(red);
+  canv.rectangle(Point{0, 0}, Point{size, size}, hatch);
+  canv.circle(Point{size, size}, size / 4, hatch);
+
+  Path triangle;
+  triangle.moveto(Point{0, 0}).lineto(Point{size, 0}).lineto(Point{0, size});
+  triangle.closepath();
+  canv.draw(triangle, TransformSequence{translate(Point{size, 0})}, hatch);
+
+  // The tile does not change the parameters of the canvas
+  assert(canv.getstrokewidth() != 0.2);
+  assert(canv.getstrokecolor().g == red.g);
+}
+
+std::string render(double size) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 2 * size, 2 * size};
+    draw(canv, size);
+  }
+  return output.str();
+}
+
+int main() {
+  const std::string svg{render(10)};
+  assert(count(svg, "<pattern") == 1);
+  assert(count(svg, "patternUnits=\"userSpaceOnUse\" width=\"2\"") == 1);
+  assert(count(svg, "<line") == 3);
+  assert(count(svg, "fill=\"url(#monet_pattern_") == 3);
+  assert(svg.find("<pattern") < svg.find("<rect"));
+
+  // The cost of filling a region does not depend on its area
+  assert(render(1000).size() < svg.size() + 64);
+
+  // Replaying the commands produces the same file
+  std::ostringstream replayed;
+  {
+    RecordingCanvas recorder{20, 20};
+    draw(recorder, 10);
+
+    SVGCanvas canv{newstream(replayed), 20, 20};
+    CommandPlayer player;
+    player.play(recorder.getcommands(), canv);
+  }
+  assert(replayed.str() == svg);
+
+  // Rectangles are cut to the region, without clipping them
+  std::ostringstream clipped;
+  {
+    SVGCanvas canv{newstream(clipped), 20, 20};
+    canv.setclipgeometry(true);
+    canv.useclip(canv.cliprectangle(Point{5, 5}, Point{15, 15}));
+    canv.rectangle(Point{0, 0}, Point{10, 10}, hatching());
+    canv.rectangle(Point{16, 16}, Point{20, 20}, hatching());
+    canv.removeclip();
+  }
+  assert(clipped.str().find("clip") == std::string::npos);
+  assert(count(clipped.str(), "<rect") == 1);
+  assert(count(clipped.str(), "x=\"5\" y=\"5\"") == 1);
+
+  // The tile is written once in PDF files as well
+  {
+    PDFCanvas canv{"test-pattern.pdf", 20, 20};
+    draw(canv, 10);
+  }
+  std::ifstream pdf{"test-pattern.pdf", std::ios::binary};
+  const std::string content{std::istreambuf_iterator<char>{pdf},
+                            std::istreambuf_iterator<char>{}};
+  assert(count(content, "/BBox [0 0 2 2]") == 1);
+}
@@ -0,0 +1,297 @@
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+#include <vector>
+
+using namespace monet;
+
+std::string readfile(const char *filename) {
+  std::ifstream input{filename, std::ios::in | std::ios::binary};
+  std::ostringstream contents;
+  contents << input.rdbuf();
+  return contents.str();
+}
+
+size_t count(const std::string &str, const std::string &pattern) {
+  size_t result{};
+  for (size_t pos{str.find(pattern)}; pos != std::string::npos;
+       pos = str.find(pattern, pos + 1))
+    ++result;
+
+  return result;
+}
+
+// A decoder for the fixed Huffman codes, the only ones used by ZlibWriter
+class Inflater {
+private:
+  const std::string &input;
+  size_t pos;
+
+  unsigned bit() {
+    unsigned result{(static_cast<unsigned char>(input[pos / 8]) >> (pos % 8)) &
+                    1u};
+    ++pos;
+    return result;
+  }
+
+  // Extra bits start from the least significant one...
+  unsigned bits(int count) {
+    unsigned result{};
+    for (int i{}; i < count; ++i)
+      result |= bit() << i;
+    return result;
+  }
+
+  // ...while Huffman codes start from the most significant one
+  unsigned code(int count) {
+    unsigned result{};
+    for (int i{}; i < count; ++i)
+      result = (result << 1) | bit();
+    return result;
+  }
+
+  unsigned literal() {
+    unsigned c{code(7)};
+    if (c <= 0x17)
+      return 256 + c;
+    c = (c << 1) | bit();
+    if (c >= 0x30 && c <= 0xBF)
+      return c - 0x30;
+    if (c >= 0xC0 && c <= 0xC7)
+      return 280 + c - 0xC0;
+    return 144 + ((c << 1) | bit()) - 0x190;
+  }
+
+public:
+  explicit Inflater(const std::string &data) : input{data}, pos{16} {}
+
+  std::string run() {
+    static const unsigned lenbase[]{3,  4,  5,  6,  7,  8,  9,  10,
+                                    11, 13, 15, 17, 19, 23, 27, 31,
+                                    35, 43, 51, 59, 67, 83, 99, 115,
+                                    131, 163, 195, 227, 258};
+    static const int lenextra[]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                4, 4, 4, 4, 5, 5, 5, 5, 0};
+    std::string result;
+    bool final;
+    do {
+      final = bit() == 1;
+      assert(bits(2) == 1);
+      for (unsigned sym{literal()}; sym != 256; sym = literal()) {
+        if (sym < 256) {
+          result += char(sym);
+          continue;
+        }
+
+        const unsigned len{lenbase[sym - 257] + bits(lenextra[sym - 257])};
+        const unsigned distcode{code(5)};
+        const int extra{distcode < 4 ? 0 : int(distcode / 2) - 1};
+        const unsigned distbase{
+            distcode < 4 ? distcode + 1
+                         : ((2u + distcode % 2) << extra) + 1u};
+        const size_t dist{distbase + bits(extra)};
+        for (unsigned k{}; k < len; ++k)
+          result += result[result.size() - dist];
+      }
+    } while (!final);
+    return result;
+  }
+};
+
+// Return the uncompressed content of every stream in the file
+std::vector<std::string> streams(const std::string &pdf) {
+  std::vector<std::string> result;
+  for (size_t pos{pdf.find(">>\nstream\n")}; pos != std::string::npos;
+       pos = pdf.find(">>\nstream\n", pos + 1)) {
+    const size_t start{pos + 10};
+    const std::string data{
+        pdf.substr(start, pdf.find("\nendstream", start) - start)};
+    result.push_back(Inflater{data}.run());
+  }
+  return result;
+}
+
+// Return the number before the `index`-th one preceding `op`
+double operand(const std::string &content, const std::string &op,
+               int index) {
+  size_t pos{content.find(" " + op)};
+  assert(pos != std::string::npos);
+  for (int i{}; i <= index; ++i)
+    pos = content.rfind(' ', pos - 1);
+  return std::strtod(content.c_str() + pos + 1, nullptr);
+}
+
+void test_zlib() {
+  std::string compressed;
+  ZlibWriter writer{[&compressed](const char *data, size_t len) {
+    compressed.append(data, len);
+  }};
+
+  std::string text;
+  for (int i{}; i < 10000; ++i)
+    text += "All work and no play makes Jack a dull boy. ";
+  writer.write(text.data(), text.size());
+  writer.finish();
+
+  assert(compressed.size() < text.size() / 50);
+  assert(static_cast<unsigned char>(compressed[0]) == 0x78);
+
+  // The stream ends with the Adler-32 checksum of the data
+  unsigned long a{1}, b{};
+  for (char ch : text) {
+    a = (a + static_cast<unsigned char>(ch)) % 65521;
+    b = (b + a) % 65521;
+  }
+  unsigned long adler{};
+  for (size_t i{compressed.size() - 4}; i < compressed.size(); ++i)
+    adler = (adler << 8) | static_cast<unsigned char>(compressed[i]);
+  assert(adler == ((b << 16) | a));
+}
+
+void test_structure() {
+  {
+    PDFCanvas canv{"test-pdf.pdf", 100, 50};
+    assert(canv.isok());
+
+    canv.setstrokecolor(red);
+    canv.line(Point{0, 0}, Point{100, 50});
+    canv.settransparency(0.5);
+    canv.circle(Point{50, 25}, 10, Action::FillAndStroke);
+    canv.text(Point{50, 25}, "Hello (world)", HorizontalAlignment::Center,
+              VerticalAlignment::Middle);
+
+    // The same group drawn several times becomes a Form XObject
+    for (int i{}; i < 4; ++i) {
+      canv.begingroup(TransformSequence{translate(Point{i * 10.0, 0})});
+      for (int k{}; k < 20; ++k)
+        canv.rectangle(Point{1, 1.0 + k}, Point{5, 2.0 + k});
+      canv.endgroup();
+    }
+
+    // Leave a group open: the destructor must close it
+    canv.begingroup();
+    canv.rectangle(Point{0, 0}, Point{100, 50});
+  }
+
+  std::string pdf{readfile("test-pdf.pdf")};
+  assert(pdf.compare(0, 9, "%PDF-1.4\n") == 0);
+  assert(pdf.compare(pdf.size() - 6, 6, "%%EOF\n") == 0);
+  assert(pdf.find("/MediaBox [0 0 283.4646 141.7323]") != std::string::npos);
+  assert(count(pdf, "/Subtype /Form") == 1);
+  assert(count(pdf, "/Type /ExtGState") == 2);
+  assert(count(pdf, "/BaseFont /Helvetica") == 1);
+
+  // Every entry in the cross-reference table must point to its object
+  size_t startxref{pdf.rfind("startxref\n")};
+  assert(startxref != std::string::npos);
+  size_t xref{std::strtoul(pdf.c_str() + startxref + 10, nullptr, 10)};
+  assert(pdf.compare(xref, 7, "xref\n0 ") == 0);
+
+  size_t numofobjects{std::strtoul(pdf.c_str() + xref + 7, nullptr, 10)};
+  size_t table{pdf.find('\n', xref + 5) + 1};
+  assert(pdf.compare(table, 20, "0000000000 65535 f\r\n") == 0);
+  for (size_t i{1}; i < numofobjects; ++i) {
+    const char *entry{pdf.c_str() + table + 20 * i};
+    assert(entry[17] == 'n');
+    size_t offset{std::strtoul(entry, nullptr, 10)};
+    std::string header{std::to_string(i) + " 0 obj\n"};
+    assert(pdf.compare(offset, header.size(), header) == 0);
+  }
+}
+
+// As in SVG, the origin is in the lower-left corner of the page
+void test_orientation() {
+  {
+    PDFCanvas canv{"test-pdf-orientation.pdf", 100, 50};
+    canv.rectangle(Point{10, 0}, Point{20, 5}, Action::Fill);
+    canv.text(Point{50, 40}, "Up", HorizontalAlignment::Right,
+              VerticalAlignment::Bottom);
+  }
+
+  const std::string pdf{readfile("test-pdf-orientation.pdf")};
+  assert(pdf.find("/MediaBox [0 0 283.4646 141.7323]") != std::string::npos);
+
+  std::string content;
+  for (const std::string &stream : streams(pdf))
+    if (stream.find(" re ") != std::string::npos)
+      content = stream;
+  assert(content.compare(0, 15, "2.834645669 0 0") == 0);
+
+  // Map a Y coordinate through the matrix of the page
+  const double d{operand(content, "cm", 2)};
+  const double f{operand(content, "cm", 0)};
+  assert(d > 0);
+  const double bottom{d * operand(content, "re", 2) + f};
+  const double top{d * (operand(content, "re", 2) + operand(content, "re", 0)) +
+                   f};
+  assert(std::fabs(bottom) < 1e-3);
+  assert(std::fabs(top - 5 * 72 / 25.4) < 1e-3);
+
+  // Text is not mirrored, and it is in the upper half of the page
+  assert(content.find(" Tm") == std::string::npos);
+  const double baseline{d * operand(content, "Td", 0) + f};
+  assert(baseline > 141.7323 / 2 && baseline < 141.7323);
+}
+
+// Forms reused by groups have a bounding box without exponents
+void test_forms() {
+  {
+    PDFCanvas canv{"test-pdf-forms.pdf", 100, 50};
+    for (int i{}; i < 2; ++i) {
+      canv.begingroup(TransformSequence{translate(Point{i * 10.0, 0})});
+      for (int k{}; k < 20; ++k)
+        canv.rectangle(Point{1, 1.0 + k}, Point{5, 2.0 + k});
+      canv.endgroup();
+    }
+  }
+
+  const std::string pdf{readfile("test-pdf-forms.pdf")};
+  const size_t bbox{pdf.find("/BBox [")};
+  assert(bbox != std::string::npos);
+  const std::string box{pdf.substr(bbox, pdf.find(']', bbox) - bbox)};
+  assert(box.find('e') == std::string::npos);
+
+  // Groups with the same size but a different content are not merged
+  {
+    PDFCanvas canv{"test-pdf-forms.pdf", 100, 50};
+    for (int i{}; i < 4; ++i) {
+      canv.begingroup();
+      for (int k{}; k < 20; ++k)
+        canv.rectangle(Point{1.0 + i % 2, 1.0 + k}, Point{5, 2.0 + k});
+      canv.endgroup();
+    }
+  }
+  const std::string twoforms{readfile("test-pdf-forms.pdf")};
+  assert(count(twoforms, "/Subtype /Form") == 2);
+}
+
+// Text in UTF-8 is written in WinAnsi, with '?' for what is missing
+void test_text() {
+  std::string encoded;
+  encodewinansi(encoded, "Caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 "
+                         "\xc0\x80 \xe2\x82 \xff");
+  assert(encoded == "Caf\xe9 ? ? ?? ?? ?");
+
+  {
+    PDFCanvas canv{"test-pdf-text.pdf", 100, 50};
+    canv.text(Point{10, 10}, "(\xc3\xa9)", HorizontalAlignment::Right,
+              VerticalAlignment::Bottom);
+  }
+
+  bool found{false};
+  for (const std::string &stream : streams(readfile("test-pdf-text.pdf")))
+    found = found || stream.find("(\\(\xe9\\)) Tj") != std::string::npos;
+  assert(found);
+}
+
+int main() {
+  test_zlib();
+  test_structure();
+  test_orientation();
+  test_forms();
+  test_text();
+}
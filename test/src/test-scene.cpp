@@ -0,0 +1,257 @@
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+std::unique_ptr<std::ostream> newstream(std::ostringstream &output) {
+  return std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}};
+}
+
+// Use most of the commands, so that all of them go through the file
+void draw(BaseCanvas &canv) {
+  canv.setstrokewidth(0.5);
+  canv.setdash({1, 2}, 0.5);
+  canv.begingroup(TransformSequence{translate(Point{10, 0})},
+                  "a group with a name too long to fit in a short string");
+  for (int i{}; i < 1000; ++i)
+    canv.circle(Point{i * 0.1, 50}, 1, Action::FillAndStroke);
+  canv.endgroup();
+
+  const ClipRegion panel{canv.cliprectangle(Point{0, 0}, Point{50, 50})};
+  canv.useclip(panel);
+  canv.rectangle(Point{10, 10}, Point{90, 90},
+                 lineargradient(Point{0, 0}, Point{1, 0})
+                     .addstop(0, red)
+                     .addstop(1, blue));
+  canv.removeclip();
+
+  RecordingCanvas tile{2, 2};
+  tile.line(Point{0, 2}, Point{2, 0});
+  canv.circle(Point{70, 70}, 20, Pattern{tile});
+
+  const Color8 pixels[]{Color8{255, 0, 0, 255}, Color8{0, 0, 255, 128}};
+  canv.image(Point{0, 90}, Point{20, 100}, 2, 1, pixels);
+
+  canv.setfontsize(8);
+  canv.text(Point{50, 5}, "Scene", HorizontalAlignment::Center);
+}
+
+std::string readfile(const std::string &filename) {
+  std::ifstream in{filename, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{in},
+                     std::istreambuf_iterator<char>{}};
+}
+
+void writefile(const std::string &filename, const std::string &content) {
+  std::ofstream out{filename, std::ios::binary};
+  out << content;
+}
+
+// Wrap raw commands between a header and a footer
+std::string makescene(const std::string &commands) {
+  SceneHeader header{};
+  std::memcpy(header.magic, "MONETSCN", sizeof(header.magic));
+  header.version = SceneHeader::currentversion;
+  header.byteorder = SceneHeader::nativeorder;
+  header.width = header.height = 100;
+  SceneFooter footer{};
+  std::memcpy(footer.magic, "MONETEND", sizeof(footer.magic));
+  footer.size = commands.size();
+
+  return std::string{reinterpret_cast<const char *>(&header), sizeof(header)} +
+         commands +
+         std::string{reinterpret_cast<const char *>(&footer), sizeof(footer)};
+}
+
+// Append a command with the given arguments, padded to 8 bytes
+std::string &addcommand(std::string &commands, CommandType type,
+                        const std::string &args = "") {
+  const CommandHeader header{uint32_t(type),
+                             uint32_t((args.size() + 7) & ~size_t(7))};
+  commands.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  commands.append(args);
+  commands.resize(commands.size() + header.size - args.size());
+  return commands;
+}
+
+template <typename T> std::string bytes(T value) {
+  return std::string{reinterpret_cast<const char *>(&value), sizeof(value)};
+}
+
+// Return true if a scene made by a single command can be opened
+bool accepts(CommandType type, const std::string &args = "") {
+  std::string commands;
+  writefile("test-scene-crafted.scene",
+            makescene(addcommand(commands, type, args)));
+  SceneFile scene;
+  return scene.open("test-scene-crafted.scene");
+}
+
+// Open a damaged file, and play it if it is accepted: either way, the
+// program must not crash
+void tryopen(const std::string &content) {
+  writefile("test-scene-fuzzed.scene", content);
+  SceneFile scene;
+  if (!scene.open("test-scene-fuzzed.scene"))
+    return;
+
+  std::ostringstream output;
+  {
+    SVGCanvas canv{newstream(output), 100, 100};
+    scene.play(canv);
+  }
+  RecordingCanvas recorder{100, 100};
+  scene.play(recorder);
+}
+
+// Every command must have the arguments that CommandPlayer reads
+void test_crafted() {
+  const std::string xy{bytes(1.0) + bytes(2.0)};
+  const std::string fill{bytes(uint32_t(Action::Fill))};
+
+  // Fixed-size arguments that are too short
+  assert(accepts(CommandType::LineTo, xy));
+  assert(!accepts(CommandType::CubicTo, xy));
+  assert(!accepts(CommandType::SetFillColor, xy));
+  assert(!accepts(CommandType::SetDash));
+  assert(!accepts(CommandType::SetStrokeWidth));
+
+  // Values of enumerations out of range
+  assert(accepts(CommandType::Circle, xy + bytes(1.0) + fill));
+  assert(!accepts(CommandType::Circle, xy + bytes(1.0) + bytes(uint32_t(3))));
+  assert(!accepts(CommandType::SetLineJoin, bytes(uint32_t(7))));
+
+  // Text must end with a NUL character
+  const std::string align{bytes(uint32_t(0)) + bytes(uint32_t(0))};
+  assert(accepts(CommandType::Text, xy + align + std::string{"abc\0", 4}));
+  assert(!accepts(CommandType::Text, xy + align + "abcdefgh"));
+
+  // Images with more pixels than bytes
+  const std::string pixels(8, '\xff');
+  assert(accepts(CommandType::Image, xy + xy + bytes(uint32_t(1)) +
+                                        bytes(uint32_t(2)) + pixels));
+  assert(!accepts(CommandType::Image, xy + xy + bytes(uint32_t(100000)) +
+                                         bytes(uint32_t(100000)) + pixels));
+  assert(!accepts(CommandType::Image, xy + xy + bytes(uint32_t(0x80000000)) +
+                                         bytes(uint32_t(0x80000000)) + pixels));
+
+  // Paths whose counts do not match their arrays
+  const std::string line{xy + xy + char(PathVerb::MoveTo) +
+                         char(PathVerb::LineTo)};
+  const auto path = [&](uint32_t transforms, uint32_t verbs, uint32_t coords) {
+    return fill + bytes(transforms) + bytes(verbs) + bytes(coords) + line;
+  };
+  assert(accepts(CommandType::PathObject, path(0, 2, 4)));
+  assert(!accepts(CommandType::PathObject, path(0, 2, 2)));
+  assert(!accepts(CommandType::PathObject, path(1000, 2, 4)));
+  assert(!accepts(CommandType::PathObject, path(0, 0xffffffff, 4)));
+
+  // Groups with more transforms than bytes
+  assert(accepts(CommandType::BeginGroup,
+                 bytes(uint32_t(0)) + bytes(uint32_t(0))));
+  assert(!accepts(CommandType::BeginGroup,
+                  bytes(uint32_t(1000)) + bytes(uint32_t(0))));
+
+  // Commands that need another one before them
+  assert(!accepts(CommandType::EndGroup));
+  assert(!accepts(CommandType::EndClip));
+  assert(!accepts(CommandType::RemoveClip));
+  assert(!accepts(CommandType::UseClip, bytes(uint32_t(0))));
+  assert(!accepts(CommandType::GradientCircle, xy + bytes(1.0)));
+  assert(!accepts(CommandType::PatternCircle, xy + bytes(1.0)));
+}
+
+// Damage a valid file in many ways: the damage must be either caught
+// by `open`, or harmless
+void test_fuzzed(const std::string &content) {
+  const size_t start{sizeof(SceneHeader)},
+      end{content.size() - sizeof(SceneFooter)};
+
+  // Drop the last 8 bytes of the arguments of each command in turn
+  for (size_t cur{start}; cur < end;) {
+    CommandHeader header;
+    std::memcpy(&header, &content[cur], sizeof(header));
+    const size_t next{cur + sizeof(header) + header.size};
+    if (header.size >= 8) {
+      std::string commands{content.substr(start, end - start)};
+      CommandHeader shorter{header.type, header.size - 8};
+      std::memcpy(&commands[cur - start], &shorter, sizeof(shorter));
+      commands.erase(next - start - 8, 8);
+      tryopen(makescene(commands));
+    }
+    cur = next;
+  }
+
+  // Change bytes at random
+  uint64_t state{12345};
+  for (int i{}; i < 2000; ++i) {
+    std::string damaged{content};
+    for (int j{}; j < 4; ++j) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      damaged[start + (state >> 33) % (end - start)] = char(state >> 17);
+    }
+    tryopen(damaged);
+  }
+}
+
+int main() {
+  std::ostringstream direct;
+  {
+    SVGCanvas canv{newstream(direct), 100, 100};
+    draw(canv);
+  }
+
+  // A small batch size makes the commands be written in several chunks
+  {
+    SceneWriter scene{"test-scene.scene", 100, 100, 4096};
+    draw(scene);
+    assert(scene.close());
+  }
+
+  SceneFile scene;
+  assert(scene.open("test-scene.scene"));
+  assert(scene.getwidth() == 100 && scene.getheight() == 100);
+
+  std::ostringstream replayed;
+  {
+    SVGCanvas canv{newstream(replayed), scene.getwidth(), scene.getheight()};
+    scene.play(canv);
+  }
+  assert(replayed.str() == direct.str());
+
+  // The scene can be played again, and it contains the commands as
+  // they were recorded
+  RecordingCanvas recorder{100, 100}, reference{100, 100};
+  scene.play(recorder);
+  draw(reference);
+  const CommandBuffer &a{recorder.getcommands()}, &b{reference.getcommands()};
+  assert(a.size() == scene.getsize() && b.size() == scene.getsize());
+  assert(std::equal(a.data(), a.data() + a.size(), b.data()));
+  assert(std::equal(a.data(), a.data() + a.size(), scene.data()));
+  scene.close();
+
+  // Incomplete or damaged files are refused
+  const std::string content{readfile("test-scene.scene")};
+  writefile("test-scene-truncated.scene",
+            content.substr(0, content.size() - 100));
+  assert(!scene.open("test-scene-truncated.scene"));
+
+  std::string damaged{content};
+  damaged[sizeof(SceneHeader)] = char(CommandType::NumOfCommands);
+  writefile("test-scene-damaged.scene", damaged);
+  assert(!scene.open("test-scene-damaged.scene"));
+
+  std::string newer{content};
+  newer[8] = char(SceneHeader::currentversion + 1);
+  writefile("test-scene-newer.scene", newer);
+  assert(!scene.open("test-scene-newer.scene"));
+
+  assert(!scene.open("test-scene-missing.scene"));
+  assert(scene.getsize() == 0);
+
+  test_crafted();
+  test_fuzzed(content);
+}
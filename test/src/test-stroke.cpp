@@ -0,0 +1,215 @@
+#include <cassert>
+#include <cmath>
+#include <monet.h>
+#include <sstream>
+
+using namespace monet;
+
+typedef std::vector<std::vector<Point>> Polygons;
+
+Polygons expand(const Path &path, const StrokeStyle &style,
+                double tolerance = 1e-3) {
+  Polygons result;
+  strokeoutline(path, style, tolerance, [&result](const Point *pts, size_t n) {
+    result.emplace_back(pts, pts + n);
+  });
+
+  // Every polygon must be counterclockwise
+  for (const auto &poly : result) {
+    double area{};
+    for (size_t i{}; i < poly.size(); ++i) {
+      const Point &a{poly[i]}, &b{poly[(i + 1) % poly.size()]};
+      area += a.x * b.y - a.y * b.x;
+    }
+    assert(area >= 0);
+  }
+
+  return result;
+}
+
+// Non-zero winding number test on the union of the polygons
+bool inside(const Polygons &polys, Point p) {
+  for (const auto &poly : polys) {
+    int winding{};
+    for (size_t i{}; i < poly.size(); ++i) {
+      const Point &a{poly[i]}, &b{poly[(i + 1) % poly.size()]};
+      double side{(b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y)};
+      if (a.y <= p.y && b.y > p.y && side > 0)
+        ++winding;
+      else if (a.y > p.y && b.y <= p.y && side < 0)
+        --winding;
+    }
+    if (winding != 0)
+      return true;
+  }
+  return false;
+}
+
+double segment_distance(Point p, Point a, Point b) {
+  Point ab{b - a};
+  double t{((p.x - a.x) * ab.x + (p.y - a.y) * ab.y) /
+           (ab.x * ab.x + ab.y * ab.y)};
+  t = std::max(0.0, std::min(1.0, t));
+  return norm(p - (a + t * ab));
+}
+
+void test_round() {
+  // With round joins and caps, the stroke is the set of points whose
+  // distance from the polyline is not greater than half the width
+  const std::vector<Point> pts{{0, 0}, {10, 0}, {12, 8}, {4, 3}, {3, 12}};
+  Path path;
+  path.moveto(pts[0]);
+  for (size_t i{1}; i < pts.size(); ++i)
+    path.lineto(pts[i]);
+
+  StrokeStyle style;
+  style.width = 3.0;
+  style.join = LineJoin::Round;
+  style.cap = LineCap::Round;
+  const double tolerance{1e-3};
+  Polygons polys{expand(path, style, tolerance)};
+
+  for (double x{-3}; x <= 15; x += 0.11) {
+    for (double y{-3}; y <= 15; y += 0.13) {
+      Point p{x, y};
+      double dist{1e100};
+      for (size_t i{1}; i < pts.size(); ++i)
+        dist = std::min(dist, segment_distance(p, pts[i - 1], pts[i]));
+
+      if (dist < style.width / 2 - tolerance)
+        assert(inside(polys, p));
+      else if (dist > style.width / 2 + 1e-9)
+        assert(!inside(polys, p));
+    }
+  }
+}
+
+void test_caps() {
+  Path path;
+  path.moveto(Point{0, 0}).lineto(Point{10, 0});
+
+  StrokeStyle style;
+  style.width = 2.0;
+
+  style.cap = LineCap::Butt;
+  Polygons butt{expand(path, style)};
+  assert(butt.size() == 1);
+  assert(inside(butt, Point{0.01, 0.99}) && inside(butt, Point{9.99, -0.99}));
+  assert(!inside(butt, Point{-0.01, 0}) && !inside(butt, Point{10.01, 0}));
+  assert(!inside(butt, Point{5, 1.01}) && !inside(butt, Point{5, -1.01}));
+
+  style.cap = LineCap::Square;
+  Polygons square{expand(path, style)};
+  assert(inside(square, Point{-0.99, 0.99}) && inside(square, Point{10.99, 0}));
+  assert(!inside(square, Point{-1.01, 0}) && !inside(square, Point{11.01, 0}));
+
+  style.cap = LineCap::Round;
+  Polygons round{expand(path, style)};
+  assert(inside(round, Point{-0.99, 0}) && inside(round, Point{10.99, 0}));
+  assert(!inside(round, Point{-0.8, 0.8}) && !inside(round, Point{10.8, -0.8}));
+}
+
+void test_joins() {
+  // A right-angle corner at (10, 0)
+  Path path;
+  path.moveto(Point{0, 0}).lineto(Point{10, 0}).lineto(Point{10, 10});
+
+  StrokeStyle style;
+  style.width = 2.0;
+
+  style.join = LineJoin::Miter;
+  Polygons miter{expand(path, style)};
+  assert(inside(miter, Point{10.99, -0.99}));
+  assert(!inside(miter, Point{11.01, -0.5}));
+  assert(!inside(miter, Point{10.5, -1.01}));
+
+  // The miter of a right angle is √2 times the width: with a lower
+  // limit, the join becomes a bevel
+  style.miterlimit = 1.4;
+  Polygons limited{expand(path, style)};
+  assert(!inside(limited, Point{10.9, -0.9}));
+  assert(inside(limited, Point{10.4, -0.4}));
+
+  style.join = LineJoin::Bevel;
+  style.miterlimit = 4.0;
+  Polygons bevel{expand(path, style)};
+  assert(!inside(bevel, Point{10.9, -0.9}));
+  assert(inside(bevel, Point{10.45, -0.45}));
+
+  style.join = LineJoin::Round;
+  Polygons round{expand(path, style)};
+  assert(inside(round, Point{10.7, -0.7}));
+  assert(!inside(round, Point{10.75, -0.75}));
+
+  // A closed square has a join at every corner, including the first one,
+  // and no caps
+  Path square;
+  square.moveto(Point{0, 0}).lineto(Point{10, 0}).lineto(Point{10, 10});
+  square.lineto(Point{0, 10}).closepath();
+  style.join = LineJoin::Miter;
+  Polygons closed{expand(square, style)};
+  assert(closed.size() == 8);
+  for (Point corner : {Point{-0.99, -0.99}, Point{10.99, -0.99},
+                       Point{10.99, 10.99}, Point{-0.99, 10.99}})
+    assert(inside(closed, corner));
+  assert(!inside(closed, Point{5, 5}));
+}
+
+void test_dashes() {
+  Path path;
+  path.moveto(Point{0, 0}).lineto(Point{10, 0});
+
+  StrokeStyle style;
+  style.width = 2.0;
+  style.dashes = {2, 1};
+
+  Polygons dashed{expand(path, style)};
+  assert(dashed.size() == 4); // [0, 2], [3, 5], [6, 8], [9, 10]
+  for (double x : {0.1, 1.9, 3.1, 4.9, 6.5, 9.9})
+    assert(inside(dashed, Point{x, 0}));
+  for (double x : {2.1, 2.9, 5.5, 8.5})
+    assert(!inside(dashed, Point{x, 0}));
+
+  // Odd-length patterns are repeated: {1} is the same as {1, 1}
+  style.dashes = {1};
+  style.dashoffset = 0.5;
+  Polygons odd{expand(path, style)};
+  assert(inside(odd, Point{0.25, 0}) && !inside(odd, Point{0.75, 0}));
+  assert(inside(odd, Point{1.75, 0}) && !inside(odd, Point{2.75, 0}));
+
+  // Dashes continue across corners
+  Path corner;
+  corner.moveto(Point{0, 0}).lineto(Point{3, 0}).lineto(Point{3, 3});
+  style.dashes = {4, 1};
+  style.dashoffset = 0;
+  Polygons bent{expand(corner, style)};
+  assert(inside(bent, Point{3, 0.5}) && !inside(bent, Point{3, 1.5}));
+  assert(inside(bent, Point{3, 2.5}));
+}
+
+void test_svg_attributes() {
+  std::ostringstream *output{new std::ostringstream{}};
+  SVGCanvas canv{std::unique_ptr<std::ostream>{output}, 100, 100};
+
+  canv.line(Point{0, 0}, Point{10, 10});
+  assert(output->str().find("stroke-linejoin") == std::string::npos);
+
+  canv.setlinejoin(LineJoin::Round);
+  canv.setlinecap(LineCap::Square);
+  canv.setdash({3, 2}, 1);
+  canv.line(Point{0, 0}, Point{10, 10});
+
+  const std::string svg{output->str()};
+  assert(svg.find("stroke-linejoin=\"round\"") != std::string::npos);
+  assert(svg.find("stroke-linecap=\"square\"") != std::string::npos);
+  assert(svg.find("stroke-dasharray=\"3 2\"") != std::string::npos);
+  assert(svg.find("stroke-dashoffset=\"1\"") != std::string::npos);
+}
+
+int main() {
+  test_round();
+  test_caps();
+  test_joins();
+  test_dashes();
+  test_svg_attributes();
+}
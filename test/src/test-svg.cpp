@@ -1,10 +1,10 @@
+#include <cassert>
 #include <monet.h>
+#include <sstream>
 
 using namespace monet;
 
-int main() {
-  SVGCanvas canv{"output.svg", 500, 450};
-
+void draw(SVGCanvas &canv) {
   // Create a closed path
   canv.moveto(Point{0.0, 0.0});
   canv.lineto(Point{100.0, 0.0});
@@ -40,3 +40,80 @@ int main() {
   }
   canv.endgroup();
 }
+
+std::string withoutspaces(const std::string &str) {
+  std::string result;
+  for (char ch : str)
+    if (ch != ' ' && ch != '\n')
+      result += ch;
+  return result;
+}
+
+std::string render(SVGLayout layout) {
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   500, 450, layout};
+    draw(canv);
+  }
+  return output.str();
+}
+
+size_t count(const std::string &str, const std::string &what) {
+  size_t result{};
+  for (size_t pos{str.find(what)}; pos != std::string::npos;
+       pos = str.find(what, pos + 1))
+    ++result;
+  return result;
+}
+
+void grid(SVGCanvas &canv) {
+  for (int i{}; i < 10; ++i)
+    canv.line(Point{0, double(i)}, Point{10, double(i)});
+  canv.circle(Point{5, 5}, 1);
+  canv.rectangle(Point{1, 1}, Point{2, 2});
+
+  // This must be drawn after the lines, and before the next ones
+  canv.circle(Point{5, 5}, 1, Action::Fill);
+
+  canv.setstrokecolor(red);
+  for (int i{}; i < 10; ++i)
+    canv.line(Point{double(i), 0}, Point{double(i), 10});
+
+  canv.settransparency(0.5);
+  canv.line(Point{0, 0}, Point{10, 10});
+}
+
+int main() {
+  {
+    SVGCanvas canv{"output.svg", 500, 450};
+    draw(canv);
+  }
+
+  // The compact layout only removes spaces, one element per line
+  const std::string indented{render(SVGLayout::Indented)};
+  const std::string compact{render(SVGLayout::Compact)};
+  assert(compact.size() < indented.size());
+  assert(withoutspaces(compact) == withoutspaces(indented));
+  assert(compact.find("\n ") == std::string::npos);
+  assert(compact.find("<text x=\"0\" y=\"0\" text-anchor") !=
+         std::string::npos);
+
+  // Consecutive strokes with the same style are merged
+  std::ostringstream output;
+  {
+    SVGCanvas canv{std::unique_ptr<std::ostream>{new std::ostream{
+                       output.rdbuf()}},
+                   10, 10};
+    canv.setmergestrokes(true);
+    grid(canv);
+  }
+  const std::string merged{output.str()};
+  assert(count(merged, "<path") == 2);
+  assert(count(merged, "<line") == 1);
+  assert(count(merged, "<circle") == 1);
+  assert(merged.find("#000000") < merged.find("<circle"));
+  assert(merged.find("<circle") < merged.find("#ff0000"));
+  assert(count(merged, "M ") == 10 + 1 + 1 + 10);
+}
@@ -0,0 +1,137 @@
+#include <cassert>
+#include <monet.h>
+#include <sstream>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+using namespace monet;
+
+void draw(BaseCanvas &canv) {
+  canv.setstrokecolor(hsl(0.3, 0.5, 0.5));
+  canv.setfillcolor(gray(0.5));
+  canv.line(Point{1, 2}, Point{3, 4});
+
+  for (int i{}; i < 1000; ++i) {
+    canv.settransparency(i % 3 * 0.25);
+    canv.circle(Point{i * 0.1, 20}, 5, Action::FillAndStroke);
+  }
+
+  canv.setlinejoin(LineJoin::Round);
+  canv.setdash({1, 2}, 0.5);
+  canv.begingroup(TransformSequence{translate(Point{10, 10}), rotate(30)},
+                  "group");
+  // A group without transforms is recorded with no Transform at all
+  canv.begingroup(TransformSequence{});
+  canv.circle(Point{1, 1}, 1);
+  canv.endgroup();
+
+  canv.moveto(Point{0, 0});
+  canv.quadraticto(Point{5, 5}, Point{10, 0});
+  canv.cubicto(Point{5, 5}, Point{2, 3}, Point{0, 10});
+  canv.closepath();
+  canv.fillandstrokepath();
+  canv.clearpath();
+
+  Path path;
+  path.moveto(Point{0, 0}).lineto(Point{1, 0}).lineto(Point{0, 1});
+  path.closepath();
+  canv.draw(path, TransformSequence{scale(2)}, Action::Fill);
+  canv.endgroup();
+
+  canv.setfontsize(5);
+  canv.setfontfamily(FontFamily::Monospaced);
+  canv.text(Point{5, 5}, "Hello, world!", HorizontalAlignment::Center);
+
+  canv.defineclip();
+  canv.rectangle(Point{0, 0}, Point{50, 50});
+  canv.endclip();
+  canv.useclip();
+  canv.circle(Point{50, 50}, 30, Action::Fill);
+  canv.removeclip();
+}
+
+// The canvas destroys its stream, but not the buffer of `output`
+std::unique_ptr<BaseCanvas> newcanvas(std::ostringstream &output) {
+  return std::unique_ptr<BaseCanvas>{new SVGCanvas{
+      std::unique_ptr<std::ostream>{new std::ostream{output.rdbuf()}}, 100,
+      100}};
+}
+
+int main() {
+  std::ostringstream reference;
+  {
+    auto canv = newcanvas(reference);
+    draw(*canv);
+  }
+  assert(reference.str().find("</svg>") != std::string::npos);
+
+  // Small batches, so that the queues fill up. Without threads, the
+  // children draw on this thread
+  for (size_t batchsize : {size_t(256), size_t(65536)}) {
+    std::ostringstream outputs[3];
+    {
+      TeeCanvas tee{batchsize, 2};
+      for (size_t i{}; i < 3; ++i)
+        tee.addcanvas(newcanvas(outputs[i]), i > 0);
+
+      assert(tee.numofchildren() == 3);
+      assert(tee.getwidth() == 100);
+      draw(tee);
+      tee.wait();
+
+      // The children are destroyed with the TeeCanvas
+    }
+
+    for (const auto &output : outputs)
+      assert(output.str() == reference.str());
+  }
+
+#ifdef MONET_WITH_THREADS
+  // An AsyncCanvas draws on its own thread, with either policy
+  for (auto backpressure : {Backpressure::Block, Backpressure::Grow}) {
+    std::ostringstream output;
+    {
+      AsyncCanvas async{newcanvas(output), 256, 2, backpressure};
+      assert(async.getheight() == 100);
+      draw(async);
+
+      async.wait();
+      assert(async.pending() == 0);
+      assert(output.str().find("Hello, world!") != std::string::npos);
+    }
+
+    assert(output.str() == reference.str());
+  }
+
+#ifdef __linux__
+  // An idle worker sleeps instead of polling its queue, so it is not
+  // woken up thousands of times per second
+  {
+    std::ostringstream output;
+    AsyncCanvas async{newcanvas(output), 256, 2, Backpressure::Block};
+    draw(async);
+    async.wait();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    rusage before{}, after{};
+    getrusage(RUSAGE_SELF, &before);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    getrusage(RUSAGE_SELF, &after);
+    assert(after.ru_nvcsw - before.ru_nvcsw < 100);
+  }
+#endif
+#endif
+
+  // A RecordingCanvas can be replayed later
+  RecordingCanvas recorder{100, 100};
+  draw(recorder);
+
+  std::ostringstream replayed;
+  {
+    auto canv = newcanvas(replayed);
+    CommandPlayer player;
+    player.play(recorder.getcommands(), *canv);
+  }
+  assert(replayed.str() == reference.str());
+}